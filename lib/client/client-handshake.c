@@ -25,6 +25,28 @@ lws_getaddrinfo46(struct lws *wsi, const char *ads, struct addrinfo **result)
 	return getaddrinfo(ads, NULL, &hints, result);
 }
 
+/*
+ * client wsi that produce the same key are going to the same place in the
+ * same way, and can share a connection
+ */
+
+void
+lws_client_peer_key(struct lws *wsi, char *buf, int len)
+{
+	const char *ads = lws_hdr_simple_ptr(wsi,
+					     _WSI_TOKEN_CLIENT_PEER_ADDRESS),
+		   *host = lws_hdr_simple_ptr(wsi, _WSI_TOKEN_CLIENT_HOST);
+
+	lws_snprintf(buf, len, "%s:%u:%s:%d", ads ? ads : "", wsi->c_port,
+		     host ? host : "",
+#ifdef LWS_OPENSSL_SUPPORT
+		     wsi->use_ssl
+#else
+		     0
+#endif
+		     );
+}
+
 struct lws *
 lws_client_connect_2(struct lws *wsi)
 {
@@ -55,6 +77,36 @@ lws_client_connect_2(struct lws *wsi)
 		goto oom4;
 	}
 
+#if defined(LWS_H2_CLIENT)
+	/*
+	 * If there's already an h2 connection to the same place, or one on
+	 * the way, we go as a stream on it instead of making our own
+	 */
+	if (wsi->h2.client_offer && !lws_socket_is_valid(wsi->desc.sockfd)) {
+		n = lws_h2_client_join(wsi);
+		if (n < 0) {
+			cce = "h2 join failed";
+			goto oom4;
+		}
+		if (n)
+			return wsi;
+	}
+#endif
+
+	/*
+	 * If an earlier request made a connection to the same place, queue
+	 * behind it instead of making our own
+	 */
+	if (wsi->client_pipeline && !lws_socket_is_valid(wsi->desc.sockfd)) {
+		n = lws_client_pipeline_join(wsi);
+		if (n < 0) {
+			cce = "pipeline join failed";
+			goto oom4;
+		}
+		if (n)
+			return wsi;
+	}
+
 	/*
 	 * start off allowing ipv6 on connection if vhost allows it
 	 */
@@ -421,9 +473,14 @@ oom4:
 	/* take care that we might be inserted in fds already */
 	if (wsi->position_in_fds_table != -1)
 		goto failed1;
+#if defined(LWS_H2_CLIENT)
+	lws_h2_client_leave(wsi);
+#endif
+	lws_client_pipeline_leave(wsi);
 	lws_remove_from_timeout_list(wsi);
 	lws_header_table_detach(wsi, 0);
 	lws_client_stash_destroy(wsi);
+	lws_txn_release(wsi);
 	lws_free(wsi);
 
 	return NULL;
@@ -480,6 +537,9 @@ lws_client_reset(struct lws **pwsi, int ssl, const char *address, int port,
 	lwsl_info("redirect ads='%s', port=%d, path='%s', ssl = %d\n",
 		   address, port, path, ssl);
 
+	/* nobody can queue on us going somewhere else */
+	lws_client_pipeline_leave(wsi);
+
 	/* close the connection by hand */
 
 #ifdef LWS_OPENSSL_SUPPORT
@@ -683,32 +743,20 @@ html_parser_cb(const hubbub_token *token, void *pw)
 }
 #endif
 
-static char *
-lws_strdup(const char *s)
-{
-	char *d = lws_malloc(strlen(s) + 1, "strdup");
-
-	if (d)
-		strcpy(d, s);
-
-	return d;
-}
-
 void
 lws_client_stash_destroy(struct lws *wsi)
 {
 	if (!wsi || !wsi->stash)
 		return;
 
-	lws_free_set_NULL(wsi->stash->address);
-	lws_free_set_NULL(wsi->stash->path);
-	lws_free_set_NULL(wsi->stash->host);
-	lws_free_set_NULL(wsi->stash->origin);
-	lws_free_set_NULL(wsi->stash->protocol);
-	lws_free_set_NULL(wsi->stash->method);
-	lws_free_set_NULL(wsi->stash->iface);
+	/* the stash and its strings are in the wsi's txn arena */
+	wsi->stash = NULL;
 
-	lws_free_set_NULL(wsi->stash);
+	/* unless the html rewriter is in there too, that's all it holds */
+#ifdef LWS_WITH_HTTP_PROXY
+	if (!wsi->rw)
+#endif
+		lws_txn_release(wsi);
 }
 
 LWS_VISIBLE struct lws *
@@ -732,7 +780,7 @@ lws_client_connect_via_info(struct lws_client_connect_info *i)
 	if (i->local_protocol_name)
 		local = i->local_protocol_name;
 
-	wsi = lws_zalloc(sizeof(struct lws), "client wsi");
+	wsi = lws_wsi_alloc(i->context, 0, "client wsi");
 	if (wsi == NULL)
 		goto bail;
 
@@ -808,13 +856,25 @@ lws_client_connect_via_info(struct lws_client_connect_info *i)
 				goto bail;
 
 #ifdef LWS_OPENSSL_SUPPORT
-	wsi->use_ssl = i->ssl_connection;
+	wsi->use_ssl = i->ssl_connection & ~(LCCSCF_OFFER_H2 | LCCSCF_PIPELINE);
+#if defined(LWS_H2_CLIENT)
+	wsi->h2.client_offer = (i->ssl_connection & LCCSCF_OFFER_H2) &&
+			       wsi->use_ssl && i->method &&
+			       strcmp(i->method, "RAW");
+#endif
 #else
-	if (i->ssl_connection) {
+	if (i->ssl_connection & ~LCCSCF_PIPELINE) {
 		lwsl_err("libwebsockets not configured for ssl\n");
 		goto bail;
 	}
 #endif
+	/*
+	 * libuv can't have the socket change hands between wsi, it closes the
+	 * handle asynchronously along with the wsi
+	 */
+	wsi->client_pipeline = (i->ssl_connection & LCCSCF_PIPELINE) &&
+			       i->method && strcmp(i->method, "RAW") &&
+			       !LWS_LIBUV_ENABLED(i->context);
 
 	/* 2) stash the things from connect_info that we can't process without
 	 * an ah.  Because if no ah, we will go on the ah waiting list and
@@ -822,36 +882,37 @@ lws_client_connect_via_info(struct lws_client_connect_info *i)
 	 * things pointed to have gone out of scope.
 	 */
 
-	wsi->stash = lws_zalloc(sizeof(*wsi->stash), "client stash");
+	wsi->stash = lws_txn_alloc(wsi, sizeof(*wsi->stash));
 	if (!wsi->stash) {
 		lwsl_err("%s: OOM\n", __func__);
 		goto bail1;
 	}
+	memset(wsi->stash, 0, sizeof(*wsi->stash));
 
-	wsi->stash->address = lws_strdup(i->address);
-	wsi->stash->path = lws_strdup(i->path);
-	wsi->stash->host = lws_strdup(i->host);
+	wsi->stash->address = lws_txn_strdup(wsi, i->address);
+	wsi->stash->path = lws_txn_strdup(wsi, i->path);
+	wsi->stash->host = lws_txn_strdup(wsi, i->host);
 
 	if (!wsi->stash->address || !wsi->stash->path || !wsi->stash->host)
 		goto bail1;
 
 	if (i->origin) {
-		wsi->stash->origin = lws_strdup(i->origin);
+		wsi->stash->origin = lws_txn_strdup(wsi, i->origin);
 		if (!wsi->stash->origin)
 			goto bail1;
 	}
 	if (i->protocol) {
-		wsi->stash->protocol = lws_strdup(i->protocol);
+		wsi->stash->protocol = lws_txn_strdup(wsi, i->protocol);
 		if (!wsi->stash->protocol)
 			goto bail1;
 	}
 	if (i->method) {
-		wsi->stash->method = lws_strdup(i->method);
+		wsi->stash->method = lws_txn_strdup(wsi, i->method);
 		if (!wsi->stash->method)
 			goto bail1;
 	}
 	if (i->iface) {
-		wsi->stash->iface = lws_strdup(i->iface);
+		wsi->stash->iface = lws_txn_strdup(wsi, i->iface);
 		if (!wsi->stash->iface)
 			goto bail1;
 	}
@@ -890,6 +951,7 @@ bail1:
 	lws_client_stash_destroy(wsi);
 
 bail:
+	lws_txn_release(wsi);
 	lws_free(wsi);
 
 bail2:
@@ -944,11 +1006,6 @@ lws_client_connect_via_info2(struct lws *wsi)
 					  stash->iface))
 			goto bail1;
 
-#if defined(LWS_WITH_SOCKS5)
-	if (!wsi->vhost->socks_proxy_port)
-		lws_client_stash_destroy(wsi);
-#endif
-
 	/*
 	 * Check with each extension if it is able to route and proxy this
 	 * connection for us.  For example, an extension like x-google-mux
@@ -969,6 +1026,13 @@ lws_client_connect_via_info2(struct lws *wsi)
 		wsi->mode = LWSCM_WSCL_WAITING_EXTENSION_CONNECT;
 		return wsi;
 	}
+
+	/* stash->address was needed above, we're done with it now */
+#if defined(LWS_WITH_SOCKS5)
+	if (!wsi->vhost->socks_proxy_port)
+#endif
+		lws_client_stash_destroy(wsi);
+
 	lwsl_client("lws_client_connect: direct conn\n");
 	wsi->context->count_wsi_allocated++;
 
@@ -977,7 +1041,7 @@ lws_client_connect_via_info2(struct lws *wsi)
 bail1:
 #if defined(LWS_WITH_SOCKS5)
 	if (!wsi->vhost->socks_proxy_port)
-		lws_free_set_NULL(wsi->stash);
+		lws_client_stash_destroy(wsi);
 #endif
 
 	return NULL;
@@ -296,6 +296,18 @@ start_ws_handshake:
 		} else
 			wsi->ssl = NULL;
 #endif
+#if defined(LWS_H2_CLIENT)
+		if (wsi->h2.client_offer) {
+			/* did the server choose h2 by ALPN? */
+			n = lws_h2_client_alpn(wsi);
+			if (n < 0) {
+				cce = "h2 client setup failed";
+				goto bail3;
+			}
+			if (n)
+				return 0;
+		}
+#endif
 
 		wsi->mode = LWSCM_WSCL_ISSUE_HANDSHAKE2;
 		lws_set_timeout(wsi, PENDING_TIMEOUT_AWAITING_CLIENT_HS_SEND,
@@ -481,17 +493,22 @@ lws_http_transaction_completed_client(struct lws *wsi)
 		return 1;
 	}
 
-	/* we don't support chained client connections yet */
-	return 1;
-#if 0
-	/* otherwise set ourselves up ready to go again */
+	/* it's only worth keeping if later requests can queue on it */
+	if (!wsi->http.client_peer)
+		return 1;
+
+	/* otherwise set ourselves up ready to hand the connection on */
 	wsi->state = LWSS_CLIENT_HTTP_ESTABLISHED;
-	wsi->mode = LWSCM_HTTP_CLIENT_ACCEPTED;
+	lws_union_transition(wsi, LWSCM_HTTP_CLIENT_IDLE);
 	wsi->http.rx_content_length = 0;
+	wsi->http.rx_content_remain = 0;
 	wsi->hdr_parsing_completed = 0;
+	wsi->chunked = 0;
+	wsi->client_rx_avail = 0;
 
-	/* He asked for it to stay alive indefinitely */
-	lws_set_timeout(wsi, NO_PENDING_TIMEOUT, 0);
+	/* the server may keep it open as long as it likes, we won't */
+	lws_set_timeout(wsi, PENDING_TIMEOUT_CLIENT_CONN_IDLE,
+			wsi->vhost->keepalive_timeout);
 
 	/*
 	 * As client, nothing new is going to come until we ask for it
@@ -502,13 +519,312 @@ lws_http_transaction_completed_client(struct lws *wsi)
 		lws_header_table_detach(wsi, 0);
 	}
 
-	/* If we're (re)starting on headers, need other implied init */
-	wsi->ues = URIES_IDLE;
+	/* the server only says anything now if it's closing it */
+	lws_change_pollfd(wsi, 0, LWS_POLLIN);
 
-	lwsl_info("%s: %p: keep-alive await new transaction\n", __func__, wsi);
+	/* anyone already queued on us gets it from the POLLOUT handler */
+	if (wsi->http.client_pending.next)
+		lws_callback_on_writable(wsi);
+
+	lwsl_info("%s: %p: keep-alive idle\n", __func__, wsi);
 
 	return 0;
+}
+
+/*
+ * http/1.1 client pipelining
+ *
+ * A client wsi with LCCSCF_PIPELINE looks on its vhost for a connection to
+ * the same peer made by an earlier wsi with the flag.  If there is one, the
+ * wsi queues on it instead of connecting.  Otherwise it connects as usual and
+ * becomes the one later wsi queue on.
+ *
+ * When a transaction completes on a keep-alive connection, the wsi that owns
+ * it goes idle instead of closing.  The first wsi in the queue takes over its
+ * socket (and tls connection) along with the rest of the queue, and the idle
+ * wsi closes without them.
+ *
+ * So the requests are serialized on the connection rather than truly
+ * pipelined: a request isn't sent until the response before it completed.
+ * A server may close a keep-alive connection whenever it likes, and requests
+ * already sent behind the one in flight would be lost with it.
+ */
+
+/*
+ * take the wsi that queued first on wsi off its queue, or NULL
+ */
+
+static struct lws *
+lws_client_pipeline_pop(struct lws *wsi)
+{
+	struct lws_dll_lws *d;
+	struct lws *w = NULL;
+
+	lws_vhost_lock(wsi->vhost);
+	d = wsi->http.client_pending.next;
+	/* queued wsi are added at the front */
+	while (d && d->next)
+		d = d->next;
+	if (d) {
+		lws_dll_lws_remove(d);
+		w = lws_container_of(d, struct lws, http.dll_client_pending);
+	}
+	lws_vhost_unlock(wsi->vhost);
+
+	return w;
+}
+
+/*
+ * Returns 1 if wsi queued on an existing connection, 0 if it should go on and
+ * make its own, or -1 on OOM
+ */
+
+int
+lws_client_pipeline_join(struct lws *wsi)
+{
+	struct lws_vhost *vh = wsi->vhost;
+	int ret = 0, count = 0, n, least = 0;
+	struct lws *owner = NULL;
+	struct lws_dll_lws *p;
+	char peer[256];
+
+	lws_client_peer_key(wsi, peer, sizeof(peer));
+
+	lws_vhost_lock(vh);
+
+	/*
+	 * An idle connection is best, otherwise we make another one if there
+	 * aren't enough yet, otherwise we queue on the one with the shortest
+	 * queue
+	 */
+	lws_start_foreach_dll_safe(struct lws_dll_lws *, d, d1,
+				   vh->dll_h1_client_conns.next) {
+		struct lws *w = lws_container_of(d, struct lws,
+						 http.dll_client_conns);
+
+		/* the socket can only change hands on the same pt */
+		if (w->tsi == wsi->tsi && !strcmp(w->http.client_peer, peer)) {
+			if (w->mode == LWSCM_HTTP_CLIENT_IDLE &&
+			    !w->http.client_pending.next) {
+				owner = w;
+				count = vh->client_conns_per_peer;
+				break;
+			}
+			for (n = 0, p = w->http.client_pending.next; p;
+			     p = p->next)
+				n++;
+			if (!owner || n < least) {
+				owner = w;
+				least = n;
+			}
+			count++;
+		}
+	} lws_end_foreach_dll_safe(d, d1);
+
+	if (count < vh->client_conns_per_peer)
+		owner = NULL;
+
+	if (owner) {
+		lws_dll_lws_add_front(&wsi->http.dll_client_pending,
+				      &owner->http.client_pending);
+		ret = 1;
+	} else {
+		/* nobody to queue on... we connect and others can queue on us */
+		wsi->http.client_peer = lws_malloc(strlen(peer) + 1,
+						   "client peer");
+		if (!wsi->http.client_peer)
+			ret = -1;
+		else {
+			strcpy(wsi->http.client_peer, peer);
+			lws_dll_lws_add_front(&wsi->http.dll_client_conns,
+					      &vh->dll_h1_client_conns);
+		}
+	}
+
+	lws_vhost_unlock(vh);
+
+	if (ret <= 0)
+		return ret;
+
+	lwsl_info("%s: %p: queued on %p\n", __func__, wsi, owner);
+
+	if (!wsi->protocol)
+		wsi->protocol = &vh->protocols[0];
+
+	lws_union_transition(wsi, LWSCM_WSCL_PENDING_CANDIDATE_CHILD);
+	lws_set_timeout(wsi, PENDING_TIMEOUT_AWAITING_CONNECT_RESPONSE,
+			AWAITING_TIMEOUT);
+
+	/* an idle connection can be handed over next time around */
+	if (owner->mode == LWSCM_HTTP_CLIENT_IDLE)
+		lws_callback_on_writable(owner);
+
+	return 1;
+}
+
+/*
+ * wsi is going away, or going somewhere else... nobody can queue on it any
+ * more.  Anyone already queued on it goes off to make their own connection,
+ * unless wsi never got as far as sending a request on its connection, in
+ * which case they are failed.
+ */
+
+void
+lws_client_pipeline_leave(struct lws *wsi)
+{
+	int redial = !wsi->context->being_destroyed &&
+		     (wsi->mode == LWSCM_WSCL_ISSUE_HANDSHAKE2 ||
+		      wsi->mode == LWSCM_WSCL_ISSUE_HTTP_BODY ||
+		      wsi->mode == LWSCM_WSCL_WAITING_SERVER_REPLY ||
+		      wsi->mode == LWSCM_HTTP_CLIENT_ACCEPTED ||
+		      wsi->mode == LWSCM_HTTP_CLIENT_IDLE);
+	struct lws *w;
+
+	lws_vhost_lock(wsi->vhost);
+	lws_dll_lws_remove(&wsi->http.dll_client_conns);
+	lws_dll_lws_remove(&wsi->http.dll_client_pending);
+	lws_vhost_unlock(wsi->vhost);
+
+	if (wsi->http.client_peer)
+		lws_free_set_NULL(wsi->http.client_peer);
+
+	while ((w = lws_client_pipeline_pop(wsi))) {
+		if (!redial) {
+			w->protocol->callback(w,
+					LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
+					w->user_space,
+					(void *)"pipeline conn failed", 20);
+			w->already_did_cce = 1;
+			lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS,
+					   "pipeline conn failed");
+			continue;
+		}
+
+		/*
+		 * the first one connects and the rest queue on him... on
+		 * failure, he was already closed with a CCE
+		 */
+		lws_union_transition(w, LWSCM_HTTP_CLIENT);
+		if (!lws_client_connect_2(w))
+			lwsl_info("%s: %p: connect failed\n", __func__, w);
+	}
+}
+
+/*
+ * POLLIN / POLLOUT on a keep-alive connection that has gone idle
+ *
+ * Returns nonzero if wsi should be closed now, either because the connection
+ * has died or because we handed it on to the next queued wsi.
+ */
+
+int
+lws_client_idle_service(struct lws *wsi, struct lws_pollfd *pollfd)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_pollfd pfd;
+	unsigned char c;
+	struct lws *w;
+	int n;
+
+	if (pollfd->revents & (LWS_POLLIN | LWS_POLLHUP)) {
+		/*
+		 * The server has nothing to say on an idle connection except
+		 * that it is closing it... but on tls, the POLLIN may be for
+		 * a post-handshake message with no application data in it
+		 */
+		n = lws_ssl_capable_read(wsi, &c, 1);
+		if (n != LWS_SSL_CAPABLE_MORE_SERVICE ||
+		    (pollfd->revents & LWS_POLLHUP)) {
+			lwsl_info("%s: %p: idle conn closed\n", __func__, wsi);
+
+			return 1;
+		}
+	}
+
+	if (!(pollfd->revents & LWS_POLLOUT))
+		return 0;
+
+	w = lws_client_pipeline_pop(wsi);
+	if (!w) {
+		/* whoever queued went away again */
+		if (lws_change_pollfd(wsi, LWS_POLLOUT, 0))
+			return 1;
+
+		return 0;
+	}
+
+	lwsl_info("%s: %p: handing conn to %p\n", __func__, wsi, w);
+
+	/* w becomes the one others queue on, and takes over our queue */
+
+	lws_vhost_lock(wsi->vhost);
+	lws_dll_lws_remove(&wsi->http.dll_client_conns);
+	lws_dll_lws_add_front(&w->http.dll_client_conns,
+			      &wsi->vhost->dll_h1_client_conns);
+	w->http.client_pending.next = wsi->http.client_pending.next;
+	if (w->http.client_pending.next)
+		w->http.client_pending.next->prev = &w->http.client_pending;
+	wsi->http.client_pending.next = NULL;
+	lws_vhost_unlock(wsi->vhost);
+
+	w->http.client_peer = wsi->http.client_peer;
+	wsi->http.client_peer = NULL;
+
+	/* ... and the socket, and any tls connection on it */
+
+	lws_pt_lock(pt, __func__);
+	lws_libevent_io(wsi, LWS_EV_STOP | LWS_EV_READ | LWS_EV_WRITE);
+	__remove_wsi_socket_from_fds(wsi);
+	__lws_ssl_remove_wsi_from_buffered_list(wsi);
+
+	w->desc = wsi->desc;
+	wsi->desc.sockfd = LWS_SOCK_INVALID;
+#ifdef LWS_OPENSSL_SUPPORT
+	w->ssl = wsi->ssl;
+	w->client_bio = wsi->client_bio;
+	wsi->ssl = NULL;
+	wsi->client_bio = NULL;
+	if (w->ssl)
+		lws_tls_client_reuse(w);
 #endif
+
+	lws_libev_accept(w, w->desc);
+	lws_libevent_accept(w, w->desc);
+
+	n = __insert_wsi_socket_into_fds(wsi->context, w);
+	lws_pt_unlock(pt);
+	if (n) {
+		compatible_close(w->desc.sockfd);
+		w->desc.sockfd = LWS_SOCK_INVALID;
+		w->protocol->callback(w, LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
+				      w->user_space, (void *)"insert wsi failed",
+				      17);
+		w->already_did_cce = 1;
+		lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS, "insert");
+
+		return 1;
+	}
+
+	w->protocol->callback(w, LWS_CALLBACK_WSI_CREATE, w->user_space,
+			      NULL, 0);
+
+	/* provoke service to issue w's request on it directly */
+
+	lws_set_timeout(w, PENDING_TIMEOUT_SENT_CLIENT_HANDSHAKE,
+			AWAITING_TIMEOUT);
+	lws_union_transition(w, LWSCM_WSCL_ISSUE_HANDSHAKE2);
+
+	pfd.fd = w->desc.sockfd;
+	pfd.events = LWS_POLLIN;
+	pfd.revents = LWS_POLLIN;
+
+	/* if it failed, w was closed with a CCE */
+	if (lws_service_fd_tsi(wsi->context, &pfd, w->tsi))
+		lwsl_info("%s: %p: first service failed\n", __func__, w);
+
+	/* we close now, without the socket */
+
+	return 1;
 }
 
 LWS_VISIBLE LWS_EXTERN unsigned int
@@ -595,6 +911,11 @@ lws_client_interpret_server_handshake(struct lws *wsi)
 		p = lws_hdr_simple_ptr(wsi, WSI_TOKEN_HTTP1_0);
 		wsi->http.connection_type = HTTP_CONNECTION_CLOSE;
 	}
+	/* ...or the server may tell us it won't keep the connection */
+	if (lws_hdr_total_length(wsi, WSI_TOKEN_CONNECTION) &&
+	    !strcasecmp(lws_hdr_simple_ptr(wsi, WSI_TOKEN_CONNECTION),
+			"close"))
+		wsi->http.connection_type = HTTP_CONNECTION_CLOSE;
 	if (!p) {
 		cce = "HS: URI missing";
 		lwsl_info("no URI\n");
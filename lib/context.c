@@ -293,8 +293,11 @@ next:
 
 	context->doing_protocol_init = 0;
 
-	if (!context->protocol_init_done)
+	if (!context->protocol_init_done) {
+		/* any inherited listen sockets nobody wanted can go now */
+		lws_inherited_listen_fds_close(context);
 		lws_finalize_startup(context);
+	}
 
 	context->protocol_init_done = 1;
 
@@ -599,6 +602,14 @@ lws_create_vhost(struct lws_context *context,
 	if (info->http2_settings[0])
 		for (n = 1; n < LWS_H2_SETTINGS_LEN; n++)
 			vh->set.s[n] = info->http2_settings[n];
+
+	vh->h2_rx_win_max = 16 * 1024 * 1024;
+	if (info->h2_rx_window_max)
+		vh->h2_rx_win_max = info->h2_rx_window_max < 0 ? 0 :
+					(uint32_t)info->h2_rx_window_max;
+	vh->h2_rx_win_cap = 64 * 1024 * 1024;
+	if (info->h2_rx_window_vhost_max > 0)
+		vh->h2_rx_win_cap = (uint64_t)info->h2_rx_window_vhost_max;
 #endif
 
 	vh->iface = info->iface;
@@ -627,9 +638,27 @@ lws_create_vhost(struct lws_context *context,
 	else
 		vh->timeout_secs_ah_idle = 10;
 
+	if (info->client_conns_per_peer > 0)
+		vh->client_conns_per_peer = info->client_conns_per_peer;
+	else
+		vh->client_conns_per_peer = 1;
+
 #ifdef LWS_OPENSSL_SUPPORT
 	if (info->ecdh_curve)
 		lws_strncpy(vh->ecdh_curve, info->ecdh_curve, sizeof(vh->ecdh_curve) - 1);
+
+	vh->tls_rec_small = LWS_TLS_RECORD_SMALL;
+	if (info->tls_record_size_small)
+		vh->tls_rec_small = info->tls_record_size_small < 0 ? 0 :
+						info->tls_record_size_small;
+	if (vh->tls_rec_small > LWS_TLS_RECORD_MAX)
+		vh->tls_rec_small = LWS_TLS_RECORD_MAX;
+	vh->tls_rec_boost = 64 * 1024;
+	if (info->tls_record_boost_bytes > 0)
+		vh->tls_rec_boost = info->tls_record_boost_bytes;
+	vh->tls_rec_idle_us = 1000000;
+	if (info->tls_record_idle_ms > 0)
+		vh->tls_rec_idle_us = info->tls_record_idle_ms * 1000;
 #endif
 
 	/* carefully allocate and take a copy of cert + key paths if present */
@@ -849,6 +878,10 @@ lws_create_vhost(struct lws_context *context,
 	} else
 		vh->log_fd = (int)LWS_INVALID_FILE;
 #endif
+	if (lws_vhost_compile_headers(vh) || lws_vhost_compile_ws101(vh)) {
+		lwsl_err("%s: OOM compiling headers\n", __func__);
+		goto bail1;
+	}
 	if (lws_context_init_server_ssl(info, vh)) {
 		lwsl_err("%s: lws_context_init_server_ssl failed\n", __func__);
 		goto bail1;
@@ -906,10 +939,34 @@ lws_init_vhost_client_ssl(const struct lws_context_creation_info *info,
 	return lws_context_init_client_ssl(&i, vhost);
 }
 
+/*
+ * Signal the pt's event pipe, unless it is already signalled and the service
+ * thread has not got to it yet... then that one wake covers us too.  The
+ * service thread drains the pipe, then clears wake_pending, before it
+ * broadcasts LWS_CALLBACK_EVENT_WAIT_CANCELLED, so anything published before
+ * we see wake_pending already set is visible to the handlers of that
+ * broadcast.
+ */
+
+void
+lws_pt_wake(struct lws_context_per_thread *pt)
+{
+	/* the pipe wsi goes away partway through context destroy */
+	if (!pt->pipe_wsi || pt->pipe_wsi->context->being_destroyed)
+		return;
+
+#if defined(LWS_ATOMICS)
+	if (lws_atomic_xchg(&pt->wake_pending, 1))
+		return;
+#endif
+
+	lws_plat_pipe_signal(pt->pipe_wsi);
+}
+
 LWS_VISIBLE void
 lws_cancel_service_pt(struct lws *wsi)
 {
-	lws_plat_pipe_signal(wsi);
+	lws_pt_wake(&wsi->context->pt[(int)wsi->tsi]);
 }
 
 LWS_VISIBLE void
@@ -920,11 +977,8 @@ lws_cancel_service(struct lws_context *context)
 
 	lwsl_info("%s\n", __func__);
 
-	while (m--) {
-		if (pt->pipe_wsi)
-			lws_plat_pipe_signal(pt->pipe_wsi);
-		pt++;
-	}
+	while (m--)
+		lws_pt_wake(pt++);
 }
 
 int
@@ -980,6 +1034,7 @@ lws_create_event_pipes(struct lws_context *context)
 static void
 lws_destroy_event_pipe(struct lws *wsi)
 {
+	wsi->context->pt[(int)wsi->tsi].pipe_wsi = NULL;
 	lws_plat_pipe_close(wsi);
 	__remove_wsi_socket_from_fds(wsi);
 	lws_libevent_destroy(wsi);
@@ -1095,10 +1150,36 @@ lws_create_context(struct lws_context_creation_info *info)
 		context->external_baggage_free_on_destroy =
 			info->external_baggage_free_on_destroy;
 
+	if (info->listen_fds && info->count_listen_fds > 0) {
+		context->listen_fds = lws_malloc(sizeof(int) *
+						 info->count_listen_fds,
+						 "listen fds");
+		if (!context->listen_fds) {
+			lws_free(context);
+			return NULL;
+		}
+		memcpy(context->listen_fds, info->listen_fds,
+		       sizeof(int) * info->count_listen_fds);
+		context->count_listen_fds = info->count_listen_fds;
+	}
+
 	context->time_up = time(NULL);
 
 	context->simultaneous_ssl_restriction =
 			info->simultaneous_ssl_restriction;
+	if (info->wsi_cache_per_thread < 0)
+		context->wsi_cache_max = 0;
+	else
+		if (info->wsi_cache_per_thread)
+			context->wsi_cache_max = info->wsi_cache_per_thread;
+		else
+			context->wsi_cache_max = 64;
+	context->tx_coalesce_size = info->tx_coalesce_size;
+#if defined(LWS_OPENSSL_SUPPORT)
+	context->tls_ctx_build_threads = info->tls_ctx_build_threads;
+	context->tls_session_ops = info->tls_session_ops;
+	context->tls_ticket_key_rotate_secs = info->tls_ticket_key_rotate_secs;
+#endif
 
 #ifndef LWS_NO_DAEMONIZE
 	if (pid_daemon) {
@@ -1126,6 +1207,7 @@ lws_create_context(struct lws_context_creation_info *info)
 		context->count_threads = LWS_MAX_SMP;
 
 	context->token_limits = info->token_limits;
+	lws_header_hash_init(context);
 
 	context->options = info->options;
 
@@ -1171,7 +1253,8 @@ lws_create_context(struct lws_context_creation_info *info)
 			return NULL;
 		}
 
-#ifdef LWS_WITH_LIBUV
+#if defined(LWS_WITH_LIBUV) || defined(LWS_WITH_LIBEV) || \
+    defined(LWS_WITH_LIBEVENT)
 		context->pt[n].context = context;
 #endif
 		context->pt[n].tid = n;
@@ -1276,6 +1359,11 @@ lws_create_context(struct lws_context_creation_info *info)
 				     context->fd_limit_per_thread;
 #endif
 
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	lws_tls_offload_create(context, info->tls_offload_threads);
+#endif
+	lws_fcache_init(context, info);
+
 	if (lws_plat_init(context, info))
 		goto bail;
 
@@ -1289,6 +1377,8 @@ lws_create_context(struct lws_context_creation_info *info)
 #endif
 
 	lws_context_init_ssl_library(info);
+	/* create the first session ticket key if we manage them */
+	lws_tls_ticket_keys_check(context, lws_now_secs());
 
 	context->user_space = info->user;
 
@@ -1299,6 +1389,10 @@ lws_create_context(struct lws_context_creation_info *info)
 	if (!lws_check_opt(info->options, LWS_SERVER_OPTION_EXPLICIT_VHOSTS))
 		if (!lws_create_vhost(context, info)) {
 			lwsl_err("Failed to create default vhost\n");
+#if defined(LWS_WITH_TLS_OFFLOAD)
+			lws_tls_offload_destroy(context);
+			lws_tls_offload_destroy2(context);
+#endif
 			for (n = 0; n < context->count_threads; n++)
 				lws_free_set_NULL(context->pt[n].serv_buf);
 #if defined(LWS_WITH_PEER_LIMITS)
@@ -1592,6 +1686,10 @@ lws_vhost_destroy2(struct lws_vhost *vh)
 	if (vh->protocol_vh_privs)
 		lws_free(vh->protocol_vh_privs);
 	lws_ssl_SSL_CTX_destroy(vh);
+#if defined(LWS_OPENSSL_SUPPORT)
+	if (vh->tls_conf)
+		lws_free(vh->tls_conf);
+#endif
 	lws_free(vh->same_vh_protocol_list);
 #ifdef LWS_WITH_PLUGINS
 	if (LWS_LIBUV_ENABLED(context)) {
@@ -1616,6 +1714,9 @@ lws_vhost_destroy2(struct lws_vhost *vh)
 #endif
 
 	lws_free_set_NULL(vh->alloc_cert_path);
+	lws_free_set_NULL(vh->hdr_tpl);
+	lws_free_set_NULL(vh->ws101_ofs); /* ws101_tpl is in the same alloc */
+	vh->ws101_tpl = NULL;
 
 #if LWS_MAX_SMP > 1
        pthread_mutex_destroy(&vh->lock);
@@ -1711,6 +1812,11 @@ lws_context_destroy(struct lws_context *context)
 	memset(&wsi, 0, sizeof(wsi));
 	wsi.context = context;
 
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	/* no more accept steps may complete while we close everything */
+	lws_tls_offload_destroy(context);
+#endif
+
 #ifdef LWS_LATENCY
 	if (context->worst_latency_info[0])
 		lwsl_notice("Worst latency: %s\n", context->worst_latency_info);
@@ -1742,6 +1848,7 @@ lws_context_destroy(struct lws_context *context)
 					/* no protocol close */);
 			n--;
 		}
+		lws_pt_caches_destroy(pt);
 		lws_pt_mutex_destroy(pt);
 	}
 
@@ -1841,6 +1948,12 @@ lws_context_destroy2(struct lws_context *context)
 	lws_free(context->pl_hash_table);
 #endif
 
+	lws_inherited_listen_fds_close(context);
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	lws_tls_offload_destroy2(context);
+#endif
+	lws_fcache_destroy(context);
+
 	if (context->external_baggage_free_on_destroy)
 		free(context->external_baggage_free_on_destroy);
 
@@ -58,6 +58,45 @@ lws_accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents)
 	lws_service_fd(context, &eventfd);
 }
 
+static void
+lws_ev_hrtimer_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents)
+{
+	struct lws_context_per_thread *pt = lws_container_of(watcher,
+				struct lws_context_per_thread, ev_hrtimer);
+	lws_usec_t us;
+
+	lws_pt_lock(pt, __func__);
+	us = __lws_hrtimer_service(pt);
+	if (us != LWS_HRTIMER_NOWAIT) {
+		ev_timer_set(&pt->ev_hrtimer, ((ev_tstamp)us) / 1000000.0, 0);
+		ev_timer_start(loop, &pt->ev_hrtimer);
+	}
+	lws_pt_unlock(pt);
+}
+
+static void
+lws_ev_timeout_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents)
+{
+	struct lws_context_per_thread *pt = lws_container_of(watcher,
+			struct lws_context_per_thread, ev_timeout_watcher);
+
+	if (pt->context->requested_kill)
+		return;
+
+	lws_service_fd_tsi(pt->context, NULL, pt->tid);
+}
+
+void
+lws_libev_hrtimer_set(struct lws_context_per_thread *pt, lws_usec_t us)
+{
+	if (!LWS_LIBEV_ENABLED(pt->context) || !pt->io_loop_ev)
+		return;
+
+	ev_timer_stop(pt->io_loop_ev, &pt->ev_hrtimer);
+	ev_timer_set(&pt->ev_hrtimer, ((ev_tstamp)us) / 1000000.0, 0);
+	ev_timer_start(pt->io_loop_ev, &pt->ev_hrtimer);
+}
+
 LWS_VISIBLE void
 lws_ev_sigint_cb(struct ev_loop *loop, struct ev_signal *watcher, int revents)
 {
@@ -96,6 +135,15 @@ lws_ev_initloop(struct lws_context *context, struct ev_loop *loop, int tsi)
 	if (lws_create_event_pipes(context))
 		return -1;
 
+	/*
+	 * the 1Hz timeout sweep and the hrtimer list are serviced from timers
+	 * on the loop itself, so they don't depend on there being fd activity
+	 */
+	ev_timer_init(&context->pt[tsi].ev_timeout_watcher, lws_ev_timeout_cb,
+		      0.01, 1.0);
+	ev_timer_start(loop, &context->pt[tsi].ev_timeout_watcher);
+	ev_timer_init(&context->pt[tsi].ev_hrtimer, lws_ev_hrtimer_cb, 0, 0);
+
 	/*
 	 * Initialize the accept w_accept with all the listening sockets
 	 * and register a callback for read operations
@@ -170,6 +218,8 @@ lws_libev_destroyloop(struct lws_context *context, int tsi)
 	if (context->use_ev_sigint)
 		ev_signal_stop(pt->io_loop_ev,
 		       &pt->w_sigint.ev_watcher);
+	ev_timer_stop(pt->io_loop_ev, &pt->ev_timeout_watcher);
+	ev_timer_stop(pt->io_loop_ev, &pt->ev_hrtimer);
 	if (!pt->ev_loop_foreign)
 		ev_loop_destroy(pt->io_loop_ev);
 }
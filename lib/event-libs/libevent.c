@@ -63,6 +63,49 @@ lws_event_cb(evutil_socket_t sock_fd, short revents, void *ctx)
 	lws_service_fd(context, &eventfd);
 }
 
+static void
+lws_event_hrtimer_cb(evutil_socket_t fd, short event, void *p)
+{
+	struct lws_context_per_thread *pt = (struct lws_context_per_thread *)p;
+	struct timeval tv;
+	lws_usec_t us;
+
+	lws_pt_lock(pt, __func__);
+	us = __lws_hrtimer_service(pt);
+	if (us != LWS_HRTIMER_NOWAIT) {
+		tv.tv_sec = us / 1000000;
+		tv.tv_usec = us - (tv.tv_sec * 1000000);
+		evtimer_add(pt->event_hrtimer, &tv);
+	}
+	lws_pt_unlock(pt);
+}
+
+static void
+lws_event_timeout_cb(evutil_socket_t fd, short event, void *p)
+{
+	struct lws_context_per_thread *pt = (struct lws_context_per_thread *)p;
+
+	if (pt->context->requested_kill)
+		return;
+
+	lws_service_fd_tsi(pt->context, NULL, pt->tid);
+}
+
+void
+lws_libevent_hrtimer_set(struct lws_context_per_thread *pt, lws_usec_t us)
+{
+	struct timeval tv;
+
+	if (!LWS_LIBEVENT_ENABLED(pt->context) || !pt->event_hrtimer)
+		return;
+
+	tv.tv_sec = us / 1000000;
+	tv.tv_usec = us - (tv.tv_sec * 1000000);
+
+	/* re-adding a pending timer reschedules it */
+	evtimer_add(pt->event_hrtimer, &tv);
+}
+
 LWS_VISIBLE void
 lws_event_sigint_cb(evutil_socket_t sock_fd, short revents, void *ctx)
 {
@@ -89,7 +132,9 @@ LWS_VISIBLE int
 lws_event_initloop(struct lws_context *context, struct event_base *loop,
 int tsi)
 {
+	struct lws_context_per_thread *pt = &context->pt[tsi];
 	struct lws_vhost *vh = context->vhost_list;
+	struct timeval tv = { 1, 0 };
 
 	if (!loop)
 		context->pt[tsi].io_loop_event_base = event_base_new();
@@ -101,6 +146,19 @@ int tsi)
 	if (lws_create_event_pipes(context))
 		return 1;
 
+	/*
+	 * the 1Hz timeout sweep and the hrtimer list are serviced from timers
+	 * on the loop itself, so they don't depend on there being fd activity
+	 */
+	pt->event_timeout_watcher = event_new(pt->io_loop_event_base, -1,
+					      EV_PERSIST, lws_event_timeout_cb,
+					      pt);
+	pt->event_hrtimer = evtimer_new(pt->io_loop_event_base,
+					lws_event_hrtimer_cb, pt);
+	if (!pt->event_timeout_watcher || !pt->event_hrtimer)
+		return 1;
+	event_add(pt->event_timeout_watcher, &tv);
+
 	/*
 	* Initialize all events with the listening sockets
 	* and register a callback for read operations
@@ -110,7 +168,8 @@ int tsi)
 		if (vh->lserv_wsi) {
 			vh->lserv_wsi->w_read.context = context;
 			vh->lserv_wsi->w_read.event_watcher = event_new(
-					loop, vh->lserv_wsi->desc.sockfd,
+					pt->io_loop_event_base,
+					vh->lserv_wsi->desc.sockfd,
 					(EV_READ | EV_PERSIST), lws_event_cb,
 					&vh->lserv_wsi->w_read);
 			event_add(vh->lserv_wsi->w_read.event_watcher, NULL);
@@ -122,9 +181,9 @@ int tsi)
 	if (!context->use_ev_sigint)
 		return 0;
 
-	context->pt[tsi].w_sigint.event_watcher = evsignal_new(loop, SIGINT,
-			context->lws_event_sigint_cb, &context->pt[tsi]);
-	event_add(context->pt[tsi].w_sigint.event_watcher, NULL);
+	pt->w_sigint.event_watcher = evsignal_new(pt->io_loop_event_base,
+			SIGINT, context->lws_event_sigint_cb, pt);
+	event_add(pt->w_sigint.event_watcher, NULL);
 
 	return 0;
 }
@@ -154,6 +213,14 @@ lws_libevent_destroyloop(struct lws_context *context, int tsi)
 
 	if (context->use_ev_sigint)
 		event_free(pt->w_sigint.event_watcher);
+	if (pt->event_timeout_watcher) {
+		event_free(pt->event_timeout_watcher);
+		pt->event_timeout_watcher = NULL;
+	}
+	if (pt->event_hrtimer) {
+		event_free(pt->event_hrtimer);
+		pt->event_hrtimer = NULL;
+	}
 	if (!pt->ev_loop_foreign)
 		event_base_free(pt->io_loop_event_base);
 }
@@ -153,6 +153,16 @@ lws_add_http_common_headers(struct lws *wsi, unsigned int code,
 	return 0;
 }
 
+STORE_IN_ROM static const char * const ok200[] = {
+	"OK",
+	"Created",
+	"Accepted",
+	"Non-Authoritative Information",
+	"No Content",
+	"Reset Content",
+	"Partial Content",
+};
+
 STORE_IN_ROM static const char * const err400[] = {
 	"Bad Request",
 	"Unauthorized",
@@ -183,76 +193,273 @@ STORE_IN_ROM static const char * const err500[] = {
 	"HTTP Version Not Supported"
 };
 
+static const char *
+lws_http_status_desc(unsigned int code)
+{
+	if (code >= 200 && code < (200 + ARRAY_SIZE(ok200)))
+		return ok200[code - 200];
+	if (code >= 400 && code < (400 + ARRAY_SIZE(err400)))
+		return err400[code - 400];
+	if (code >= 500 && code < (500 + ARRAY_SIZE(err500)))
+		return err500[code - 500];
+
+	switch (code) {
+	case 100:
+		return "Continue";
+	case 101:
+		return "Switching Protocols";
+	case 304:
+		return "Not Modified";
+	}
+
+	if (code >= 300 && code < 400)
+		return "Redirect";
+
+	return "";
+}
+
+static void
+lws_tpl_h1(const char *name, const char *value, int len,
+	   unsigned char **p)
+{
+	int n = (int)strlen(name);
+
+	memcpy(*p, name, n);
+	*p += n;
+	*((*p)++) = ' ';
+	memcpy(*p, value, len);
+	*p += len;
+	*((*p)++) = '\x0d';
+	*((*p)++) = '\x0a';
+}
+
+/*
+ * The headers every response from the vhost starts with, after the status,
+ * don't change for the life of the vhost: Server, anything from
+ * info->headers, and Strict-Transport-Security.  Prepare them once in
+ * http/1 text and, for h2, in HPACK, so adding them to a response is just a
+ * memcpy.  Server is first in each, so it can be skipped when the caller
+ * gives LWSAHH_FLAG_NO_SERVER_NAME.
+ */
+
+int
+lws_vhost_compile_headers(struct lws_vhost *vh)
+{
+	static const char sts[] = "max-age=15768000 ; includeSubDomains";
+	const struct lws_protocol_vhost_options *headers;
+	struct lws_context *context = vh->context;
+	unsigned char *p, *end;
+	size_t size = 0;
+
+	/* worst case for each header is a few bytes more in h2 */
+
+	if (context->server_string)
+		size += 16 + context->server_string_len;
+	for (headers = vh->headers; headers; headers = headers->next)
+		size += 16 + strlen(headers->name) + strlen(headers->value);
+	if (vh->options & LWS_SERVER_OPTION_STS)
+		size += 48 + sizeof(sts);
+
+	lws_free_set_NULL(vh->hdr_tpl);
+	vh->hdr_tpl_h1_len = vh->hdr_tpl_h1_server = 0;
+	vh->hdr_tpl_h2_len = vh->hdr_tpl_h2_server = 0;
+	if (!size)
+		return 0;
+
+#if defined(LWS_WITH_HTTP2)
+	size *= 2;
+#endif
+	vh->hdr_tpl = lws_malloc(size, "vhost hdr tpl");
+	if (!vh->hdr_tpl)
+		return 1;
+
+	p = vh->hdr_tpl;
+	end = p + size;
+
+	if (context->server_string) {
+		lws_tpl_h1("server:", context->server_string,
+			   context->server_string_len, &p);
+		vh->hdr_tpl_h1_server = lws_ptr_diff(p, vh->hdr_tpl);
+	}
+	for (headers = vh->headers; headers; headers = headers->next)
+		lws_tpl_h1(headers->name, headers->value,
+			   (int)strlen(headers->value), &p);
+	if (vh->options & LWS_SERVER_OPTION_STS)
+		lws_tpl_h1("Strict-Transport-Security:", sts,
+			   sizeof(sts) - 1, &p);
+	vh->hdr_tpl_h1_len = lws_ptr_diff(p, vh->hdr_tpl);
+
+#if defined(LWS_WITH_HTTP2)
+	if (context->server_string) {
+		if (lws_hpack_encode_literal((unsigned char *)"server", 6,
+				(unsigned char *)context->server_string,
+				context->server_string_len, &p, end))
+			return 1;
+		vh->hdr_tpl_h2_server = lws_ptr_diff(p, vh->hdr_tpl) -
+					vh->hdr_tpl_h1_len;
+	}
+	for (headers = vh->headers; headers; headers = headers->next)
+		if (lws_hpack_encode_literal(
+				(const unsigned char *)headers->name,
+				(int)strlen(headers->name),
+				(const unsigned char *)headers->value,
+				(int)strlen(headers->value), &p, end))
+			return 1;
+	if (vh->options & LWS_SERVER_OPTION_STS)
+		if (lws_hpack_encode_literal((const unsigned char *)
+				"strict-transport-security", 25,
+				(const unsigned char *)sts, sizeof(sts) - 1,
+				&p, end))
+			return 1;
+	vh->hdr_tpl_h2_len = lws_ptr_diff(p, vh->hdr_tpl) - vh->hdr_tpl_h1_len;
+#else
+	(void)end;
+#endif
+
+	return 0;
+}
+
+/*
+ * The Date header value is formatted at most once a second per service
+ * thread.  This does its own conversion from unix time rather than use
+ * gmtime(), which isn't threadsafe, nor strftime(), which follows the
+ * locale.
+ */
+
+static const char *
+lws_http_date(struct lws_context_per_thread *pt)
+{
+	static const char wday[] = "ThuFriSatSunMonTueWed",
+			  mon[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	time_t t = time(NULL);
+	long days, z, era, doe, yoe, doy, mp, d, m, y, secs;
+	char *q = pt->http_date;
+
+	if (t == pt->http_date_secs)
+		return pt->http_date;
+
+	/* no sense sending a date if we don't know what it is */
+	if (t < 1500000000)
+		return NULL;
+
+	days = (long)(t / 86400);
+	secs = (long)(t % 86400);
+
+	/* days since 1970-01-01 to civil date */
+	z = days + 719468;
+	era = z / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = yoe + era * 400 + (m <= 2);
+
+	/* eg, "Sun, 06 Nov 1994 08:49:37 GMT" */
+
+	memcpy(q, &wday[(days % 7) * 3], 3);
+	q[3] = ',';
+	q[4] = ' ';
+	q[5] = '0' + (char)(d / 10);
+	q[6] = '0' + (char)(d % 10);
+	q[7] = ' ';
+	memcpy(q + 8, &mon[(m - 1) * 3], 3);
+	q[11] = ' ';
+	q[12] = '0' + (char)(y / 1000);
+	q[13] = '0' + (char)((y / 100) % 10);
+	q[14] = '0' + (char)((y / 10) % 10);
+	q[15] = '0' + (char)(y % 10);
+	q[16] = ' ';
+	q[17] = '0' + (char)(secs / 36000);
+	q[18] = '0' + (char)((secs / 3600) % 10);
+	q[19] = ':';
+	q[20] = '0' + (char)((secs % 3600) / 600);
+	q[21] = '0' + (char)((secs % 600) / 60);
+	q[22] = ':';
+	q[23] = '0' + (char)((secs % 60) / 10);
+	q[24] = '0' + (char)(secs % 10);
+	memcpy(q + 25, " GMT", 5);
+
+	pt->http_date_secs = t;
+
+	return pt->http_date;
+}
+
 int
 lws_add_http_header_status(struct lws *wsi, unsigned int _code,
 			   unsigned char **p, unsigned char *end)
 {
 	STORE_IN_ROM static const char * const hver[] = {
-		"HTTP/1.0", "HTTP/1.1", "HTTP/2"
+		"HTTP/1.0 ", "HTTP/1.1 ", "HTTP/2 "
 	};
-	const struct lws_protocol_vhost_options *headers;
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
 	unsigned int code = _code & LWSAHH_CODE_MASK;
-	const char *description = "", *p1;
-	unsigned char code_and_desc[60];
-	int n;
+	const unsigned char *tpl = wsi->vhost->hdr_tpl;
+	const char *description, *p1, *date;
+	int n, m, len = wsi->vhost->hdr_tpl_h1_len,
+	       skip = wsi->vhost->hdr_tpl_h1_server;
 
 #ifdef LWS_WITH_ACCESS_LOG
 	wsi->access_log.response = code;
 #endif
 
 #ifdef LWS_WITH_HTTP2
-	if (wsi->mode == LWSCM_HTTP2_SERVING)
-		return lws_add_http2_header_status(wsi, code, p, end);
+	if (wsi->mode == LWSCM_HTTP2_SERVING) {
+		if (lws_add_http2_header_status(wsi, code, p, end))
+			return 1;
+		tpl += len;
+		len = wsi->vhost->hdr_tpl_h2_len;
+		skip = wsi->vhost->hdr_tpl_h2_server;
+	} else
 #endif
-	if (code >= 400 && code < (400 + ARRAY_SIZE(err400)))
-		description = err400[code - 400];
-	if (code >= 500 && code < (500 + ARRAY_SIZE(err500)))
-		description = err500[code - 500];
-
-	if (code == 100)
-		description = "Continue";
-	if (code == 200)
-		description = "OK";
-	if (code == 304)
-		description = "Not Modified";
-	else
-		if (code >= 300 && code < 400)
-			description = "Redirect";
-
-	if (wsi->http.request_version < ARRAY_SIZE(hver))
-		p1 = hver[wsi->http.request_version];
-	else
-		p1 = hver[0];
-
-	n = sprintf((char *)code_and_desc, "%s %u %s", p1, code, description);
-
-	if (lws_add_http_header_by_name(wsi, NULL, code_and_desc, n, p, end))
-		return 1;
+	{
+		if (code < 100 || code > 999)
+			return 1;
 
-	headers = wsi->vhost->headers;
-	while (headers) {
-		if (lws_add_http_header_by_name(wsi,
-				(const unsigned char *)headers->name,
-				(unsigned char *)headers->value,
-				(int)strlen(headers->value), p, end))
+		description = lws_http_status_desc(code);
+
+		if (wsi->http.request_version < ARRAY_SIZE(hver))
+			p1 = hver[wsi->http.request_version];
+		else
+			p1 = hver[0];
+
+		m = (int)strlen(p1);
+		n = (int)strlen(description);
+		if (end - *p < m + 4 + n + 2)
 			return 1;
 
-		headers = headers->next;
+		memcpy(*p, p1, m);
+		*p += m;
+		*((*p)++) = '0' + (code / 100);
+		*((*p)++) = '0' + ((code / 10) % 10);
+		*((*p)++) = '0' + (code % 10);
+		*((*p)++) = ' ';
+		memcpy(*p, description, n);
+		*p += n;
+		*((*p)++) = '\x0d';
+		*((*p)++) = '\x0a';
 	}
 
-	if (wsi->context->server_string &&
-	    !(_code & LWSAHH_FLAG_NO_SERVER_NAME))
-		if (lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_SERVER,
-				(unsigned char *)wsi->context->server_string,
-				wsi->context->server_string_len, p, end))
-			return 1;
+	if (_code & LWSAHH_FLAG_NO_SERVER_NAME) {
+		tpl += skip;
+		len -= skip;
+	}
 
-	if (wsi->vhost->options & LWS_SERVER_OPTION_STS)
-		if (lws_add_http_header_by_name(wsi, (unsigned char *)
-				"Strict-Transport-Security:",
-				(unsigned char *)"max-age=15768000 ; "
-				"includeSubDomains", 36, p, end))
+	if (len) {
+		if (end - *p <= len)
 			return 1;
+		memcpy(*p, tpl, len);
+		*p += len;
+	}
+
+	if (_code & LWSAHH_FLAG_NO_DATE)
+		return 0;
+
+	date = lws_http_date(pt);
+	if (date && lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_DATE,
+				(const unsigned char *)date, 29, p, end))
+		return 1;
 
 	return 0;
 }
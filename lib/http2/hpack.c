@@ -1323,25 +1323,22 @@ lws_h2_num(int starting_bits, unsigned long num,
 	return 0;
 }
 
-int lws_add_http2_header_by_name(struct lws *wsi, const unsigned char *name,
-				 const unsigned char *value, int length,
-				 unsigned char **p, unsigned char *end)
-{
-	int len;
-
-	lwsl_header("%s: %p  %s:%s\n", __func__, *p, name, value);
-
-	len = (int)strlen((char *)name);
-	if (len)
-		if (name[len - 1] == ':')
-			len--;
+/*
+ * Literal header field without indexing, with a literal name.  h2 needs
+ * header names in lower case, and without the ':' lws keeps on the end of
+ * them for http/1.  Since this leaves the dynamic table alone, the encoding
+ * is the same on any connection, and may be prepared in advance.
+ */
 
-	if (wsi->http2_substream && !strncmp((const char *)name,
-					     "transfer-encoding", len)) {
-		lwsl_header("rejecting %s\n", name);
+int
+lws_hpack_encode_literal(const unsigned char *name, int len,
+			 const unsigned char *value, int length,
+			 unsigned char **p, unsigned char *end)
+{
+	int n;
 
-		return 0;
-	}
+	if (len && name[len - 1] == ':')
+		len--;
 
 	if (end - *p < len + length + 8)
 		return 1;
@@ -1351,8 +1348,9 @@ int lws_add_http2_header_by_name(struct lws *wsi, const unsigned char *name,
 	*((*p)++) = 0 | lws_h2_num_start(7, len); /* non-HUF */
 	if (lws_h2_num(7, len, p, end))
 		return 1;
-	memcpy(*p, name, len);
-	*p += len;
+	for (n = 0; n < len; n++)
+		*((*p)++) = (name[n] >= 'A' && name[n] <= 'Z') ?
+				name[n] + ('a' - 'A') : name[n];
 
 	*((*p)++) = 0 | lws_h2_num_start(7, length); /* non-HUF */
 	if (lws_h2_num(7, length, p, end))
@@ -1361,11 +1359,32 @@ int lws_add_http2_header_by_name(struct lws *wsi, const unsigned char *name,
 	memcpy(*p, value, length);
 	*p += length;
 
-	//lwsl_hexdump(op, *p -op);
-
 	return 0;
 }
 
+int lws_add_http2_header_by_name(struct lws *wsi, const unsigned char *name,
+				 const unsigned char *value, int length,
+				 unsigned char **p, unsigned char *end)
+{
+	int len;
+
+	lwsl_header("%s: %p  %s:%s\n", __func__, *p, name, value);
+
+	len = (int)strlen((char *)name);
+	if (len)
+		if (name[len - 1] == ':')
+			len--;
+
+	if (wsi->http2_substream && !strncmp((const char *)name,
+					     "transfer-encoding", len)) {
+		lwsl_header("rejecting %s\n", name);
+
+		return 0;
+	}
+
+	return lws_hpack_encode_literal(name, len, value, length, p, end);
+}
+
 int lws_add_http2_header_by_token(struct lws *wsi, enum lws_token_indexes token,
 				  const unsigned char *value, int length,
 				  unsigned char **p, unsigned char *end)
@@ -1382,16 +1401,34 @@ int lws_add_http2_header_by_token(struct lws *wsi, enum lws_token_indexes token,
 int lws_add_http2_header_status(struct lws *wsi, unsigned int code,
 				unsigned char **p, unsigned char *end)
 {
-	unsigned char status[10];
-	int n;
+	/* the :status values that have their own HPACK static table entry */
+	static const unsigned short indexed[] = {
+		200, 204, 206, 304, 400, 404, 500
+	};
+	unsigned int n;
 
 	wsi->h2.send_END_STREAM = 0; // !!(code >= 400);
 
-	n = sprintf((char *)status, "%u", code);
-	if (lws_add_http2_header_by_token(wsi, WSI_TOKEN_HTTP_COLON_STATUS,
-					  status, n, p, end))
+	if (end - *p < 5)
+		return 1;
+
+	for (n = 0; n < ARRAY_SIZE(indexed); n++)
+		if (code == indexed[n]) {
+			/* indexed header field, static idx 8 .. 14 */
+			*((*p)++) = 0x80 | (8 + n);
 
+			return 0;
+		}
+
+	if (code < 100 || code > 999)
 		return 1;
 
+	/* literal without indexing, indexed name :status (8) */
+	*((*p)++) = 0x08;
+	*((*p)++) = 3;
+	*((*p)++) = '0' + (code / 100);
+	*((*p)++) = '0' + ((code / 10) % 10);
+	*((*p)++) = '0' + (code % 10);
+
 	return 0;
 }
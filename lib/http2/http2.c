@@ -184,6 +184,8 @@ lws_wsi_server_new(struct lws_vhost *vh, struct lws *parent_wsi,
 	wsi->h2.my_priority = 16;
 	wsi->h2.tx_cr = nwsi->h2.h2n->set.s[H2SET_INITIAL_WINDOW_SIZE];
 	wsi->h2.peer_tx_cr_est = nwsi->vhost->set.s[H2SET_INITIAL_WINDOW_SIZE];
+	wsi->h2.rx_win = wsi->h2.peer_tx_cr_est;
+	wsi->h2.rx_win_us = time_in_microseconds();
 
 	wsi->state = LWSS_HTTP2_ESTABLISHED;
 	wsi->mode = parent_wsi->mode;
@@ -264,6 +266,164 @@ lws_h2_new_pps(enum lws_h2_protocol_send_type type)
 	return pps;
 }
 
+/*
+ * If a WINDOW_UPDATE for the same sid is still waiting to go out, add the
+ * credit to that rather than queueing another
+ */
+
+static int
+lws_h2_update_window(struct lws *nwsi, uint32_t sid, uint32_t credit)
+{
+	struct lws_h2_protocol_send *pps;
+
+	lws_start_foreach_ll(struct lws_h2_protocol_send *, p,
+			     nwsi->h2.h2n->pps) {
+		if (p->type == LWS_H2_PPS_UPDATE_WINDOW &&
+		    p->u.update_window.sid == sid &&
+		    p->u.update_window.credit <= 0x7fffffff - credit) {
+			p->u.update_window.credit += credit;
+
+			return 0;
+		}
+	} lws_end_foreach_ll(p, next);
+
+	pps = lws_h2_new_pps(LWS_H2_PPS_UPDATE_WINDOW);
+	if (!pps)
+		return 1;
+	pps->u.update_window.sid = sid;
+	pps->u.update_window.credit = credit;
+	lws_pps_schedule(nwsi, pps);
+
+	return 0;
+}
+
+/* a PING not ACKed after this long is taken as lost, and may be resent */
+#define LWS_H2_PING_LOST_US (5 * 1000000ll)
+
+static void
+lws_h2_ping(struct lws *nwsi)
+{
+	struct lws_h2_netconn *h2n = nwsi->h2.h2n;
+	struct lws_h2_protocol_send *pps;
+
+	if (h2n->ping_sent_us &&
+	    time_in_microseconds() - h2n->ping_sent_us < LWS_H2_PING_LOST_US)
+		return;
+
+	/* forget any lost one, so a late ACK for it can't be taken as the RTT */
+	h2n->ping_sent_us = 0;
+	memset(h2n->my_ping_payload, 0, sizeof(h2n->my_ping_payload));
+
+	pps = lws_h2_new_pps(LWS_H2_PPS_PING);
+	if (!pps)
+		return;
+
+	/* so we don't queue another before this one is sent */
+	h2n->ping_sent_us = time_in_microseconds();
+	lws_pps_schedule(nwsi, pps);
+}
+
+/*
+ * Receive window auto-tuning
+ *
+ * Each stream, and the connection as a whole, has a receive window rx_win
+ * that we keep open for the peer.  Instead of one WINDOW_UPDATE per DATA
+ * frame, the peer's credit is topped back up to rx_win in one go when it
+ * falls to half of it.
+ *
+ * If the half window was used in less than two round trips since the last
+ * top up, the window rather than the link is limiting the peer, so rx_win
+ * is doubled, up to the vhost's per-wsi max and while the growth of all the
+ * windows on the vhost stays inside its cap.  The RTT comes from our PINGs,
+ * sent at connection start and again when the sample gets old.
+ */
+
+#define LWS_H2_RTT_STALE_US (10 * 1000000ll)
+
+static void
+lws_h2_rx_win_grow(struct lws *nwsi, struct lws *wsi, lws_usec_t now)
+{
+	struct lws_h2_netconn *h2n = nwsi->h2.h2n;
+	struct lws_vhost *vh = nwsi->vhost;
+	uint32_t grow;
+
+	if (!h2n->rtt_us || now - h2n->rtt_taken_us > LWS_H2_RTT_STALE_US)
+		lws_h2_ping(nwsi);
+
+	if (!h2n->rtt_us || wsi->h2.rx_win >= vh->h2_rx_win_max ||
+	    now - wsi->h2.rx_win_us >= 2 * h2n->rtt_us)
+		return;
+
+	grow = wsi->h2.rx_win;
+	if (grow > vh->h2_rx_win_max - wsi->h2.rx_win)
+		grow = vh->h2_rx_win_max - wsi->h2.rx_win;
+
+	lws_vhost_lock(vh);
+	if (vh->h2_rx_win_grown + grow > vh->h2_rx_win_cap)
+		grow = vh->h2_rx_win_cap > vh->h2_rx_win_grown ?
+			(uint32_t)(vh->h2_rx_win_cap - vh->h2_rx_win_grown) : 0;
+	vh->h2_rx_win_grown += grow;
+	lws_vhost_unlock(vh);
+
+	if (!grow)
+		return;
+
+	lwsl_info("%s: %p: rx window %u -> %u (rtt %dus)\n", __func__, wsi,
+		  wsi->h2.rx_win, wsi->h2.rx_win + grow, (int)h2n->rtt_us);
+
+	wsi->h2.rx_win += grow;
+	wsi->h2.rx_win_grown += grow;
+}
+
+/*
+ * wsi (the stream, or nwsi itself for the connection window) just had len
+ * bytes of DATA consumed, in a frame of frame_len
+ */
+
+static int
+lws_h2_rx_win_consumed(struct lws *nwsi, struct lws *wsi, uint32_t sid,
+		       int len, uint32_t frame_len)
+{
+	int need = (int)(2 * frame_len) + 65536;
+	lws_usec_t now;
+	int credit;
+
+	wsi->h2.peer_tx_cr_est -= len;
+
+	if (wsi->h2.peer_tx_cr_est > (int)(wsi->h2.rx_win / 2) &&
+	    wsi->h2.peer_tx_cr_est >= need)
+		return 0;
+
+	now = time_in_microseconds();
+	lws_h2_rx_win_grow(nwsi, wsi, now);
+	wsi->h2.rx_win_us = now;
+
+	credit = (int)wsi->h2.rx_win - wsi->h2.peer_tx_cr_est;
+	if (wsi->h2.peer_tx_cr_est + credit < need)
+		credit = need - wsi->h2.peer_tx_cr_est;
+	if (credit <= 0)
+		return 0;
+
+	wsi->h2.peer_tx_cr_est += credit;
+
+	return lws_h2_update_window(nwsi, sid, (uint32_t)credit);
+}
+
+void
+lws_h2_rx_win_release(struct lws *wsi)
+{
+	struct lws_vhost *vh = wsi->vhost;
+
+	if (!wsi->h2.rx_win_grown || !vh)
+		return;
+
+	lws_vhost_lock(vh);
+	vh->h2_rx_win_grown -= wsi->h2.rx_win_grown;
+	lws_vhost_unlock(vh);
+
+	wsi->h2.rx_win_grown = 0;
+}
+
 int
 lws_h2_goaway(struct lws *wsi, uint32_t err, const char *reason)
 {
@@ -662,6 +822,21 @@ int lws_h2_do_pps_send(struct lws *wsi)
 			lws_close_free_wsi(cwsi, 0, "reset stream");
 		break;
 
+	case LWS_H2_PPS_PING:
+		h2n->ping_sent_us = time_in_microseconds();
+		for (n = 0; n < 8; n++)
+			h2n->my_ping_payload[n] =
+				(uint8_t)(h2n->ping_sent_us >> (8 * n));
+		memcpy(&set[LWS_PRE], h2n->my_ping_payload, 8);
+		n = lws_h2_frame_write(wsi, LWS_H2_FRAME_TYPE_PING, 0,
+				       LWS_H2_STREAM_ID_MASTER, 8,
+				       &set[LWS_PRE]);
+		if (n != 8) {
+			lwsl_info("send %d %d\n", n, m);
+			goto bail;
+		}
+		break;
+
 	case LWS_H2_PPS_UPDATE_WINDOW:
 		lwsl_debug("Issuing LWS_H2_PPS_UPDATE_WINDOW: sid %d: add %d\n",
 			    pps->u.update_window.sid,
@@ -693,6 +868,564 @@ bail:
 	return 1;
 }
 
+#if defined(LWS_H2_CLIENT)
+
+/*
+ * http/2 client
+ *
+ * A client wsi that was given LCCSCF_OFFER_H2 looks on its vhost for a client
+ * network connection to the same peer before making its own.  If one already
+ * speaks h2 and has a stream free, the wsi just becomes a stream on it and
+ * never gets a socket.  If one is still negotiating, the wsi waits on it until
+ * ALPN has decided.  Otherwise the wsi connects as usual and becomes the one
+ * others wait on.
+ *
+ * If the server picks h2, the network wsi hands its own request to a new
+ * stream wsi with the same protocol and user pointer, and the waiting wsi
+ * join as more streams.  If it picks http/1.1, the waiting wsi go off and
+ * make their own connections.
+ */
+
+/*
+ * Make wsi, which has no socket of its own, a new stream on client nwsi.  It
+ * sends its request headers from the nwsi POLLOUT handler.
+ */
+
+static void
+lws_h2_client_adopt(struct lws *nwsi, struct lws *wsi)
+{
+	wsi->h2.parent_wsi = nwsi;
+	wsi->h2.sibling_list = nwsi->h2.child_list;
+	nwsi->h2.child_list = wsi;
+	nwsi->h2.child_count++;
+
+	wsi->http2_substream = 1;
+	wsi->h2.client_stream = 1;
+	wsi->h2.client_offer = 0;
+	wsi->h2.my_priority = 16;
+	wsi->h2.tx_cr = nwsi->h2.h2n->set.s[H2SET_INITIAL_WINDOW_SIZE];
+	wsi->h2.peer_tx_cr_est = nwsi->vhost->set.s[H2SET_INITIAL_WINDOW_SIZE];
+	wsi->h2.rx_win = wsi->h2.peer_tx_cr_est;
+	wsi->h2.rx_win_us = time_in_microseconds();
+	wsi->h2.initialized = 1;
+	wsi->h2.h2_state = LWS_H2_STATE_IDLE;
+	wsi->tsi = nwsi->tsi;
+
+	lws_union_transition(wsi, LWSCM_HTTP2_SERVING);
+	wsi->state = LWSS_HTTP2_CLIENT_SEND_HEADERS;
+
+	nwsi->vhost->conn_stats.h2_subs++;
+
+	wsi->protocol->callback(wsi, LWS_CALLBACK_WSI_CREATE,
+				wsi->user_space, NULL, 0);
+
+	lws_set_timeout(wsi, PENDING_TIMEOUT_AWAITING_SERVER_RESPONSE,
+			wsi->context->timeout_secs);
+	lws_callback_on_writable(wsi);
+}
+
+int
+lws_h2_client_join(struct lws *wsi)
+{
+	struct lws_vhost *vh = wsi->vhost;
+	struct lws *nwsi = NULL;
+	char peer[256];
+	int n, ret = 0;
+
+	lws_client_peer_key(wsi, peer, sizeof(peer));
+
+	lws_vhost_lock(vh);
+
+	lws_start_foreach_dll_safe(struct lws_dll_lws *, d, d1,
+				   vh->dll_h2_client_conns.next) {
+		struct lws *w = lws_container_of(d, struct lws,
+						 h2.dll_client_conns);
+
+		if (!strcmp(w->h2.client_peer, peer) && !w->h2.GOING_AWAY) {
+			if (w->h2.client_alpn) {
+				if (w->h2.child_count < w->h2.h2n->set.s[
+					      H2SET_MAX_CONCURRENT_STREAMS]) {
+					nwsi = w;
+					ret = 1;
+					break;
+				}
+			} else {
+				/* still negotiating... is there room? */
+				struct lws_dll_lws *p =
+						w->h2.client_pending.next;
+
+				for (n = 1; p; p = p->next)
+					n++;
+
+				if ((uint32_t)n < vh->set.s[
+					      H2SET_MAX_CONCURRENT_STREAMS]) {
+					nwsi = w;
+					ret = 2;
+					break;
+				}
+			}
+		}
+	} lws_end_foreach_dll_safe(d, d1);
+
+	if (ret == 2)
+		lws_dll_lws_add_front(&wsi->h2.dll_client_pending,
+				      &nwsi->h2.client_pending);
+
+	if (!nwsi) {
+		/* nobody to share with... we connect and others can join us */
+		wsi->h2.client_peer = lws_malloc(strlen(peer) + 1, "h2 peer");
+		if (!wsi->h2.client_peer)
+			ret = -1;
+		else {
+			strcpy(wsi->h2.client_peer, peer);
+			lws_dll_lws_add_front(&wsi->h2.dll_client_conns,
+					      &vh->dll_h2_client_conns);
+		}
+	}
+
+	lws_vhost_unlock(vh);
+
+	if (ret <= 0)
+		return ret;
+
+	lwsl_info("%s: %p: %s %p\n", __func__, wsi,
+		  ret == 1 ? "stream on" : "waiting for", nwsi);
+
+	if (!wsi->protocol)
+		wsi->protocol = &vh->protocols[0];
+
+	if (ret == 1) {
+		lws_h2_client_adopt(nwsi, wsi);
+
+		return 1;
+	}
+
+	lws_union_transition(wsi, LWSCM_WSCL_PENDING_CANDIDATE_CHILD);
+	lws_set_timeout(wsi, PENDING_TIMEOUT_AWAITING_CONNECT_RESPONSE,
+			AWAITING_TIMEOUT);
+
+	return 1;
+}
+
+/*
+ * take the first wsi waiting on nwsi off its list, or NULL
+ */
+
+static struct lws *
+lws_h2_client_pending_pop(struct lws *nwsi)
+{
+	struct lws_dll_lws *d;
+	struct lws *w = NULL;
+
+	lws_vhost_lock(nwsi->vhost);
+	d = nwsi->h2.client_pending.next;
+	if (d) {
+		lws_dll_lws_remove(d);
+		w = lws_container_of(d, struct lws, h2.dll_client_pending);
+	}
+	lws_vhost_unlock(nwsi->vhost);
+
+	return w;
+}
+
+/*
+ * wsi is going away (or was http/1.1 after all)... nobody can join it any
+ * more, and anyone still waiting on it is failed
+ */
+
+void
+lws_h2_client_leave(struct lws *wsi)
+{
+	struct lws_h2_protocol_send *pps;
+	struct lws *w, *nwsi;
+
+	lws_vhost_lock(wsi->vhost);
+	lws_dll_lws_remove(&wsi->h2.dll_client_conns);
+	lws_dll_lws_remove(&wsi->h2.dll_client_pending);
+	lws_vhost_unlock(wsi->vhost);
+
+	if (wsi->h2.client_peer)
+		lws_free_set_NULL(wsi->h2.client_peer);
+
+	while ((w = lws_h2_client_pending_pop(wsi))) {
+		w->protocol->callback(w, LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
+				      w->user_space, (void *)"h2 leader failed",
+				      16);
+		w->already_did_cce = 1;
+		__lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS,
+				     "h2 leader failed");
+	}
+
+	/*
+	 * A stream going away before both sides ended it tells the server to
+	 * stop, unless the whole connection is going down anyway
+	 */
+	if (!wsi->h2.client_stream || !wsi->h2.my_sid || !wsi->h2.parent_wsi ||
+	    wsi->h2.h2_state == LWS_H2_STATE_CLOSED ||
+	    (wsi->h2.h2_state == LWS_H2_STATE_HALF_CLOSED_REMOTE &&
+	     wsi->h2.send_END_STREAM))
+		return;
+
+	nwsi = lws_get_network_wsi(wsi);
+	if (wsi->socket_is_permanently_unusable ||
+	    nwsi->socket_is_permanently_unusable || nwsi->h2.GOING_AWAY)
+		return;
+
+	pps = lws_h2_new_pps(LWS_H2_PPS_RST_STREAM);
+	if (!pps)
+		return;
+	pps->u.rs.sid = wsi->h2.my_sid;
+	pps->u.rs.err = H2_ERR_CANCEL;
+	lws_pps_schedule(nwsi, pps);
+	lws_h2_state(wsi, LWS_H2_STATE_CLOSED);
+}
+
+/*
+ * The leader didn't get h2... the waiting wsi make their own connections
+ */
+
+static void
+lws_h2_client_release(struct lws *wsi)
+{
+	struct lws *w;
+
+	lws_vhost_lock(wsi->vhost);
+	lws_dll_lws_remove(&wsi->h2.dll_client_conns);
+	lws_vhost_unlock(wsi->vhost);
+
+	lws_free_set_NULL(wsi->h2.client_peer);
+	wsi->h2.client_offer = 0;
+
+	while ((w = lws_h2_client_pending_pop(wsi))) {
+		w->h2.client_offer = 0;
+		lws_union_transition(w, LWSCM_HTTP_CLIENT);
+		/* on failure, he was already closed with a CCE */
+		if (!lws_client_connect_2(w))
+			lwsl_info("%s: %p: connect failed\n", __func__, w);
+	}
+}
+
+/*
+ * The server may still send HEADERS for a stream we already closed or RST.
+ * The header block has to go through hpack anyway to keep the dynamic table
+ * in step, so it's decoded into this anonymous stream and thrown away when
+ * END_HEADERS comes.
+ */
+
+static struct lws *
+lws_h2_client_discard_new(struct lws *nwsi, unsigned int sid)
+{
+	struct lws *wsi;
+
+	wsi = lws_wsi_alloc(nwsi->context, nwsi->tsi, "h2 discard stream");
+	if (!wsi)
+		return NULL;
+
+	wsi->context = nwsi->context;
+	wsi->vhost = nwsi->vhost;
+	wsi->tsi = nwsi->tsi;
+	wsi->desc.sockfd = LWS_SOCK_INVALID;
+	wsi->position_in_fds_table = -1;
+	wsi->pending_timeout = NO_PENDING_TIMEOUT;
+	wsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
+	wsi->protocol = &nwsi->vhost->protocols[0];
+	/* nobody was ever told about it */
+	wsi->told_user_closed = 1;
+	nwsi->context->count_wsi_allocated++;
+
+	wsi->http2_substream = 1;
+	wsi->h2.discard_headers = 1;
+	wsi->h2.my_sid = sid;
+	wsi->h2.h2_state = LWS_H2_STATE_CLOSED;
+	wsi->h2.parent_wsi = nwsi;
+	wsi->h2.sibling_list = nwsi->h2.child_list;
+	nwsi->h2.child_list = wsi;
+	nwsi->h2.child_count++;
+
+	lws_union_transition(wsi, LWSCM_HTTP2_SERVING);
+	wsi->state = LWSS_HTTP2_ESTABLISHED;
+
+	return wsi;
+}
+
+/*
+ * The TLS handshake on client wsi that offered h2 just completed.
+ *
+ * Returns 0 if it's going on as http/1.1, 1 if it became an h2 network
+ * connection, or -1 if it failed.
+ */
+
+int
+lws_h2_client_alpn(struct lws *wsi)
+{
+	const unsigned char *name = NULL;
+	struct lws_h2_protocol_send *pps;
+	struct lws_h2_netconn *h2n;
+	unsigned int len = 0;
+	struct lws *cwsi, *w;
+	int n = (int)strlen(preface);
+
+	SSL_get0_alpn_selected(wsi->ssl, &name, &len);
+	if (len != 2 || strncmp((const char *)name, "h2", 2)) {
+		lwsl_info("%s: %p: server chose http/1.1\n", __func__, wsi);
+		lws_h2_client_release(wsi);
+
+		return 0;
+	}
+
+	h2n = lws_zalloc(sizeof(*h2n), "h2n");
+	if (!h2n)
+		return -1;
+
+	/* the request this wsi was made for goes on as stream 1 */
+
+	cwsi = lws_wsi_alloc(wsi->context, wsi->tsi, "h2 client stream");
+	if (!cwsi)
+		goto bail1;
+
+	/* our SETTINGS must follow the preface */
+	pps = lws_h2_new_pps(LWS_H2_PPS_MY_SETTINGS);
+	if (!pps)
+		goto bail2;
+
+	if (lws_issue_raw(wsi, (unsigned char *)preface, n) != n)
+		goto bail3;
+
+	cwsi->context = wsi->context;
+	cwsi->vhost = wsi->vhost;
+	cwsi->desc.sockfd = LWS_SOCK_INVALID;
+	cwsi->position_in_fds_table = -1;
+	cwsi->pending_timeout = NO_PENDING_TIMEOUT;
+	cwsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
+	cwsi->c_port = wsi->c_port;
+	cwsi->use_ssl = wsi->use_ssl;
+	wsi->context->count_wsi_allocated++;
+
+	cwsi->protocol = wsi->protocol;
+	cwsi->user_space = wsi->user_space;
+	cwsi->user_space_externally_allocated =
+					wsi->user_space_externally_allocated;
+	cwsi->user_space_len = wsi->user_space_len;
+	cwsi->ah = wsi->ah;
+	if (cwsi->ah)
+		cwsi->ah->wsi = cwsi;
+
+	wsi->protocol = &wsi->vhost->protocols[0];
+	wsi->user_space = NULL;
+	wsi->user_space_externally_allocated = 0;
+	wsi->user_space_len = 0;
+	wsi->ah = NULL;
+	/* nothing user-facing is left on the network wsi */
+	wsi->told_user_closed = 1;
+
+	/* the network wsi becomes a pure h2 connection */
+
+	wsi->h2.h2n = h2n;
+	wsi->upgraded_to_http2 = 1;
+	wsi->h2.client_alpn = 1;
+	wsi->h2.client_offer = 0;
+	wsi->hdr_parsing_completed = 1;
+	wsi->vhost->conn_stats.h2_alpn++;
+
+	lws_union_transition(wsi, LWSCM_HTTP2_SERVING);
+	wsi->state = LWSS_HTTP2_ESTABLISHED_PRE_SETTINGS;
+
+	lws_h2_init(wsi);
+	/* we don't want server push */
+	h2n->set.s[H2SET_ENABLE_PUSH] = 0;
+	lws_hpack_dynamic_size(wsi, h2n->set.s[H2SET_HEADER_TABLE_SIZE]);
+
+	wsi->h2.tx_cr = 65535;
+	wsi->h2.peer_tx_cr_est = 65535;
+	wsi->h2.rx_win = 65535 + 4 * 65536;
+	wsi->h2.rx_win_us = time_in_microseconds();
+	wsi->h2.initialized = 1;
+
+	lwsl_info("%s: %p: negotiated h2\n", __func__, wsi);
+
+	lws_pps_schedule(wsi, pps);
+	lws_h2_ping(wsi);
+
+	lws_set_timeout(wsi, PENDING_TIMEOUT_HTTP_KEEPALIVE_IDLE, 31);
+
+	lws_h2_client_adopt(wsi, cwsi);
+	while ((w = lws_h2_client_pending_pop(wsi)))
+		lws_h2_client_adopt(wsi, w);
+
+	return 1;
+
+bail3:
+	lws_free(pps);
+bail2:
+	lws_free(cwsi);
+bail1:
+	lws_free(h2n);
+
+	return -1;
+}
+
+/*
+ * Called from the nwsi POLLOUT handler for a client stream that is ready to
+ * send its request headers
+ */
+
+int
+lws_h2_client_handshake(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	uint8_t *buf = pt->serv_buf + LWS_PRE, *p = buf,
+		*end = &pt->serv_buf[wsi->context->pt_serv_buf_size - 1];
+	struct lws *nwsi = lws_get_network_wsi(wsi);
+	struct lws_h2_netconn *h2n = nwsi->h2.h2n;
+	const char *meth = lws_hdr_simple_ptr(wsi, _WSI_TOKEN_CLIENT_METHOD),
+		   *uri = lws_hdr_simple_ptr(wsi, _WSI_TOKEN_CLIENT_URI),
+		   *host = lws_hdr_simple_ptr(wsi, _WSI_TOKEN_CLIENT_HOST);
+	int n;
+
+	if (!meth || !uri)
+		return -1;
+
+	wsi->h2.my_sid = h2n->highest_sid_opened ?
+			 h2n->highest_sid_opened + 2 : 1;
+	h2n->highest_sid_opened = wsi->h2.my_sid;
+
+	if (lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_COLON_METHOD,
+					 (unsigned char *)meth,
+					 (int)strlen(meth), &p, end) ||
+	    lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_COLON_SCHEME,
+					 (unsigned char *)"https", 5,
+					 &p, end) ||
+	    lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_COLON_PATH,
+					 (unsigned char *)uri,
+					 (int)strlen(uri), &p, end))
+		return -1;
+
+	if (host && lws_add_http_header_by_token(wsi,
+					 WSI_TOKEN_HTTP_COLON_AUTHORITY,
+					 (unsigned char *)host,
+					 (int)strlen(host), &p, end))
+		return -1;
+
+	if (wsi->protocol->callback(wsi,
+				LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER,
+				wsi->user_space, &p, end - p - 12))
+		return -1;
+
+	n = lws_ptr_diff(p, buf);
+	if (lws_write(wsi, buf, n, LWS_WRITE_HTTP_HEADERS |
+		      (wsi->client_http_body_pending ? 0 :
+					LWS_WRITE_H2_STREAM_END)) != n)
+		return -1;
+
+	lws_h2_state(wsi, wsi->h2.send_END_STREAM ?
+			  LWS_H2_STATE_HALF_CLOSED_LOCAL : LWS_H2_STATE_OPEN);
+	wsi->state = LWSS_HTTP2_CLIENT_ESTABLISHED;
+	nwsi->vhost->conn_stats.h2_trans++;
+
+	/* open the receive windows up as we would for a server stream */
+
+	wsi->h2.rx_win += 4 * 65536;
+	wsi->h2.peer_tx_cr_est += 4 * 65536;
+	if (lws_h2_update_window(nwsi, wsi->h2.my_sid, 4 * 65536))
+		return -1;
+
+	if (nwsi->h2.peer_tx_cr_est < (int)nwsi->h2.rx_win) {
+		n = (int)nwsi->h2.rx_win - nwsi->h2.peer_tx_cr_est;
+		nwsi->h2.peer_tx_cr_est += n;
+		if (lws_h2_update_window(nwsi, 0, (uint32_t)n))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Our side of the client stream is finished, the response may still be coming
+ */
+
+void
+lws_h2_client_sent_end_stream(struct lws *wsi)
+{
+	wsi->h2.send_END_STREAM = 1;
+	if (wsi->h2.h2_state == LWS_H2_STATE_OPEN)
+		lws_h2_state(wsi, LWS_H2_STATE_HALF_CLOSED_LOCAL);
+}
+
+/*
+ * The client stream got to the end of the response.  Returns nonzero, the
+ * caller should close the stream.
+ */
+
+static int
+lws_h2_client_completed(struct lws *wsi)
+{
+	wsi->protocol->callback(wsi, LWS_CALLBACK_COMPLETED_CLIENT_HTTP,
+				wsi->user_space, NULL, 0);
+
+	return 1;
+}
+
+/*
+ * A complete HEADERS block arrived on a client stream.  Returns nonzero if
+ * the caller should close the stream.
+ */
+
+static int
+lws_h2_client_rx_headers(struct lws *wsi)
+{
+	const char *p, *cce = "HS: :status missing";
+
+	if (wsi->state != LWSS_HTTP2_CLIENT_ESTABLISHED)
+		/* trailers after the response */
+		goto done;
+
+	p = lws_hdr_simple_ptr(wsi, WSI_TOKEN_HTTP_COLON_STATUS);
+	if (!p)
+		goto bail;
+
+	wsi->ah->http_response = atoi(p);
+	if (wsi->ah->http_response < 200 && !wsi->h2.END_STREAM) {
+		/* informational, the real response is still to come */
+		wsi->seen_nonpseudoheader = 0;
+
+		return 0;
+	}
+
+	wsi->state = LWSS_CLIENT_HTTP_ESTABLISHED;
+	lws_set_timeout(wsi, NO_PENDING_TIMEOUT, 0);
+
+	if (wsi->protocol->callback(wsi,
+				    LWS_CALLBACK_CLIENT_FILTER_PRE_ESTABLISH,
+				    wsi->user_space, NULL, 0)) {
+		cce = "HS: disallowed by client filter";
+		goto bail;
+	}
+
+	if (wsi->protocol->callback(wsi, LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP,
+				    wsi->user_space, NULL, 0)) {
+		cce = "HS: disallowed at ESTABLISHED";
+		goto bail;
+	}
+
+	/* free up his parsing allocations */
+	lws_header_table_detach(wsi, 0);
+
+done:
+	if (wsi->h2.END_STREAM)
+		return lws_h2_client_completed(wsi);
+
+	return 0;
+
+bail:
+	wsi->protocol->callback(wsi, LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
+				wsi->user_space, (void *)cce, strlen(cce));
+	wsi->already_did_cce = 1;
+
+	return 1;
+}
+
+#endif
+
 /*
  * The frame header part has just completely arrived.
  * Perform actions for header completion.
@@ -827,6 +1560,19 @@ lws_h2_parse_frame_header(struct lws *wsi)
 			lws_h2_goaway(wsi, H2_ERR_STREAM_CLOSED, "conn closed");
 			break;
 		}
+#if defined(LWS_H2_CLIENT)
+		/* an empty DATA ending the response never gets to end of frame */
+		if (!h2n->length && h2n->swsi->h2.client_stream &&
+		    (h2n->flags & LWS_H2_FLAG_END_STREAM)) {
+			lws_h2_state(h2n->swsi, h2n->swsi->h2.h2_state ==
+				     LWS_H2_STATE_OPEN ?
+					LWS_H2_STATE_HALF_CLOSED_REMOTE :
+					LWS_H2_STATE_CLOSED);
+			lws_h2_client_completed(h2n->swsi);
+			lws_close_free_wsi(h2n->swsi, 0, "h2 client done");
+			h2n->swsi = NULL;
+		}
+#endif
 		break;
 	case LWS_H2_FRAME_TYPE_PRIORITY:
 		lwsl_info("LWS_H2_FRAME_TYPE_PRIORITY complete frame\n");
@@ -943,6 +1689,29 @@ lws_h2_parse_frame_header(struct lws *wsi)
 			return 1;
 		}
 
+#if defined(LWS_H2_CLIENT)
+		if (!h2n->swsi && wsi->h2.client_alpn) {
+			/*
+			 * We don't accept streams from the server, so only
+			 * one of ours we already closed is legal here
+			 */
+			if (!(h2n->sid & 1) ||
+			    h2n->sid > h2n->highest_sid_opened) {
+				lws_h2_goaway(wsi, H2_ERR_PROTOCOL_ERROR,
+					      "HEADERS for unknown client sid");
+
+				return 1;
+			}
+
+			h2n->swsi = lws_h2_client_discard_new(wsi, h2n->sid);
+			if (!h2n->swsi) {
+				lws_h2_goaway(wsi, H2_ERR_PROTOCOL_ERROR, "OOM");
+
+				return 1;
+			}
+		}
+#endif
+
 		if (!h2n->swsi) {
 			/* no more children allowed by parent */
 			if (wsi->h2.child_count + 1 >
@@ -961,21 +1730,19 @@ lws_h2_parse_frame_header(struct lws *wsi)
 				return 1;
 			}
 
-			pps = lws_h2_new_pps(LWS_H2_PPS_UPDATE_WINDOW);
-			if (!pps)
+			h2n->swsi->h2.rx_win += 4 * 65536;
+			h2n->swsi->h2.peer_tx_cr_est += 4 * 65536;
+			if (lws_h2_update_window(wsi, h2n->sid, 4 * 65536))
 				return 1;
-			pps->u.update_window.sid = h2n->sid;
-			pps->u.update_window.credit = 4 * 65536;
-			h2n->swsi->h2.peer_tx_cr_est += pps->u.update_window.credit; 
-			lws_pps_schedule(wsi, pps);
 
-			pps = lws_h2_new_pps(LWS_H2_PPS_UPDATE_WINDOW);
-			if (!pps)
-				return 1;
-			pps->u.update_window.sid = 0;
-			pps->u.update_window.credit = 4 * 65536;
-			wsi->h2.peer_tx_cr_est += pps->u.update_window.credit;
-			lws_pps_schedule(wsi, pps);
+			/* top the connection window back up if it's low */
+
+			if (wsi->h2.peer_tx_cr_est < (int)wsi->h2.rx_win) {
+				n = (int)wsi->h2.rx_win - wsi->h2.peer_tx_cr_est;
+				wsi->h2.peer_tx_cr_est += n;
+				if (lws_h2_update_window(wsi, 0, (uint32_t)n))
+					return 1;
+			}
 		}
 
 		/*
@@ -999,7 +1766,7 @@ lws_h2_parse_frame_header(struct lws *wsi)
 		 * stream 7 is sent or received.
 		 */
 		lws_start_foreach_ll(struct lws *, w, wsi->h2.child_list) {
-			if (w->h2.my_sid < h2n->sid &&
+			if (w->h2.my_sid < h2n->sid && !w->h2.client_stream &&
 			    w->h2.h2_state == LWS_H2_STATE_IDLE)
 				lws_close_free_wsi(w, 0, "h2 sid close");
 		} lws_end_foreach_ll(w, h2.sibling_list);
@@ -1117,6 +1884,18 @@ lws_h2_parse_end_of_frame(struct lws *wsi)
 			break;
 		}
 
+#if defined(LWS_H2_CLIENT)
+		if (h2n->swsi->h2.discard_headers) {
+			/* the dynamic table is up to date, that's all we need */
+			lwsl_info("%s: discarded HEADERS for closed sid %d\n",
+				  __func__, h2n->sid);
+			h2n->swsi->socket_is_permanently_unusable = 1;
+			lws_close_free_wsi(h2n->swsi, 0, "h2 discard headers");
+			h2n->swsi = NULL;
+			break;
+		}
+#endif
+
 		/* this is the last part of HEADERS */
 		switch (h2n->swsi->h2.h2_state) {
 		case LWS_H2_STATE_IDLE:
@@ -1185,6 +1964,17 @@ lws_h2_parse_end_of_frame(struct lws *wsi)
 			break;
 		}
 
+#if defined(LWS_H2_CLIENT)
+		if (h2n->swsi->h2.client_stream) {
+			if (lws_h2_client_rx_headers(h2n->swsi)) {
+				lws_close_free_wsi(h2n->swsi, 0,
+						   "h2 client headers");
+				h2n->swsi = NULL;
+			}
+			break;
+		}
+#endif
+
 		if (!lws_hdr_total_length(h2n->swsi, WSI_TOKEN_HTTP_COLON_PATH) ||
 		    !lws_hdr_total_length(h2n->swsi, WSI_TOKEN_HTTP_COLON_METHOD) ||
 		    !lws_hdr_total_length(h2n->swsi, WSI_TOKEN_HTTP_COLON_SCHEME) ||
@@ -1222,6 +2012,23 @@ lws_h2_parse_end_of_frame(struct lws *wsi)
 		if (!h2n->swsi)
 			break;
 
+#if defined(LWS_H2_CLIENT)
+		if (h2n->swsi->h2.client_stream) {
+			/* END_STREAM for a response can come on any DATA */
+			if (!(h2n->flags & LWS_H2_FLAG_END_STREAM))
+				break;
+
+			lws_h2_state(h2n->swsi, h2n->swsi->h2.h2_state ==
+				     LWS_H2_STATE_OPEN ?
+					LWS_H2_STATE_HALF_CLOSED_REMOTE :
+					LWS_H2_STATE_CLOSED);
+			lws_h2_client_completed(h2n->swsi);
+			lws_close_free_wsi(h2n->swsi, 0, "h2 client done");
+			h2n->swsi = NULL;
+			break;
+		}
+#endif
+
 		if (lws_hdr_total_length(h2n->swsi, WSI_TOKEN_HTTP_CONTENT_LENGTH) &&
 		    h2n->swsi->h2.END_STREAM &&
 		    h2n->swsi->http.rx_content_length &&
@@ -1242,6 +2049,17 @@ lws_h2_parse_end_of_frame(struct lws *wsi)
 
 	case LWS_H2_FRAME_TYPE_PING:
 		if (h2n->flags & LWS_H2_FLAG_SETTINGS_ACK) { // ack
+			if (h2n->ping_sent_us &&
+			    !memcmp(h2n->ping_payload, h2n->my_ping_payload, 8)) {
+				h2n->rtt_taken_us = time_in_microseconds();
+				h2n->rtt_us = h2n->rtt_taken_us -
+					      h2n->ping_sent_us;
+				if (h2n->rtt_us <= 0)
+					h2n->rtt_us = 1;
+				h2n->ping_sent_us = 0;
+				lwsl_info("%s: %p: rtt %dus\n", __func__, wsi,
+					  (int)h2n->rtt_us);
+			}
 		} else {/* they're sending us a ping request */
 			lwsl_info("rx ping, preparing pong\n");
 			pps = lws_h2_new_pps(LWS_H2_PPS_PONG);
@@ -1318,6 +2136,13 @@ lws_h2_parse_end_of_frame(struct lws *wsi)
 	case LWS_H2_FRAME_TYPE_RST_STREAM:
 		lwsl_info("LWS_H2_FRAME_TYPE_RST_STREAM: sid %d: reason 0x%x\n",
 			    h2n->sid, h2n->hpack_e_dep);
+#if defined(LWS_H2_CLIENT)
+		/* the server gave up on our request */
+		if (h2n->swsi && h2n->swsi->h2.client_stream) {
+			lws_close_free_wsi(h2n->swsi, 0, "h2 client rst");
+			h2n->swsi = NULL;
+		}
+#endif
 		break;
 
 	case LWS_H2_FRAME_TYPE_COUNT: /* IGNORING FRAME */
@@ -1372,6 +2197,14 @@ lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 			h2n->count = 0;
 			wsi->h2.tx_cr = 65535;
 
+			/*
+			 * the connection window starts at 65535 whatever
+			 * SETTINGS say, the first stream tops it up to rx_win
+			 */
+			wsi->h2.peer_tx_cr_est = 65535;
+			wsi->h2.rx_win = 65535 + 4 * 65536;
+			wsi->h2.rx_win_us = time_in_microseconds();
+
 			/*
 			 * we must send a settings frame -- empty one is OK...
 			 * that must be the first thing sent by server
@@ -1381,6 +2214,9 @@ lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 			if (!pps)
 				goto fail;
 			lws_pps_schedule(wsi, pps);
+
+			/* get an RTT sample for sizing the receive windows */
+			lws_h2_ping(wsi);
 			break;
 
 		case LWSS_HTTP2_ESTABLISHED_PRE_SETTINGS:
@@ -1520,6 +2356,17 @@ lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 					n = h2n->length - h2n->count + 1;
 					lwsl_debug("---- restricting len to %d vs %ld\n", n, (long)inlen + 1);
 				}
+#if defined(LWS_H2_CLIENT)
+				if (h2n->swsi->h2.client_stream) {
+					/* response body goes straight to the user */
+					if (user_callback_handle_rxflow(
+					    h2n->swsi->protocol->callback,
+					    h2n->swsi,
+					    LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ,
+					    h2n->swsi->user_space, in - 1, n))
+						n = 0;
+				} else
+#endif
 				n = lws_read(h2n->swsi, in - 1, n);
 				h2n->swsi->outer_will_close = 0;
 				/*
@@ -1541,30 +2388,12 @@ lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 
 				/* account for both network and stream wsi windows */
 
-				wsi->h2.peer_tx_cr_est -= n;
-				h2n->swsi->h2.peer_tx_cr_est -= n;
-
-	//			lwsl_notice("   peer_tx_cr_est %d, parent %d\n",
-	//				   h2n->swsi->h2.peer_tx_cr_est, wsi->h2.peer_tx_cr_est);
-
-				if (h2n->swsi->h2.peer_tx_cr_est < (int)(2 * h2n->length) + 65536) {
-					pps = lws_h2_new_pps(LWS_H2_PPS_UPDATE_WINDOW);
-					if (!pps)
-						return 1;
-					pps->u.update_window.sid = h2n->sid;
-					pps->u.update_window.credit = (2 * h2n->length + 65536);
-					h2n->swsi->h2.peer_tx_cr_est += pps->u.update_window.credit; 
-					lws_pps_schedule(wsi, pps);
-				}
-				if (wsi->h2.peer_tx_cr_est < (int)(2 * h2n->length) + 65536) {
-					pps = lws_h2_new_pps(LWS_H2_PPS_UPDATE_WINDOW);
-					if (!pps)
-						return 1;
-					pps->u.update_window.sid = 0;
-					pps->u.update_window.credit = (2 * h2n->length + 65536);
-					wsi->h2.peer_tx_cr_est += pps->u.update_window.credit;
-					lws_pps_schedule(wsi, pps);
-				}
+				if (lws_h2_rx_win_consumed(wsi, h2n->swsi,
+							   h2n->sid, n,
+							   h2n->length) ||
+				    lws_h2_rx_win_consumed(wsi, wsi, 0, n,
+							   h2n->length))
+					return 1;
 
 				// lwsl_notice("%s: count %d len %d\n", __func__, (int)h2n->count, (int)h2n->length);
 
@@ -1596,12 +2425,10 @@ lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 				break;
 
 			case LWS_H2_FRAME_TYPE_PING:
-				if (h2n->flags & LWS_H2_FLAG_SETTINGS_ACK) { // ack
-				} else { /* they're sending us a ping request */
-					if (h2n->count > 8)
-						return 1;
-					h2n->ping_payload[h2n->count - 1] = c;
-				}
+				/* request, or the ack echoing our payload */
+				if (h2n->count > 8)
+					return 1;
+				h2n->ping_payload[h2n->count - 1] = c;
 				break;
 
 			case LWS_H2_FRAME_TYPE_WINDOW_UPDATE:
@@ -0,0 +1,704 @@
+/*
+ * libwebsockets - JSON Web Signature verification cache
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * Bearer tokens are typically presented over and over until they expire, and
+ * every lws_jws_confirm_sig() on them repeats the header parse and the full
+ * RSA or HMAC verification.
+ *
+ * The cache remembers tokens that verified OK, keyed by the SHA-256 of the
+ * key identity and the whole compact JWS, until the sooner of the cache ttl
+ * and the token's own "exp" claim.  Only successes are cached, a token that
+ * fails is checked again in full the next time it is seen.
+ *
+ * It also keeps a small MRU list of RSA key handles created from lws_jwk
+ * keys it was given, so the bignum setup for the key isn't done per call.
+ * Key handles are identified by the SHA-256 of the key type and public key
+ * material, not the lws_jwk pointer, so a freed and reused lws_jwk can't pick
+ * up a stale handle.
+ *
+ * Where there are pthreads, lws_jws_confirm_sig_batch() queues a batch of
+ * tokens to a worker thread owned by the cache.
+ */
+
+#if defined(LWS_HAVE_PTHREAD_H) && !defined(LWS_WITH_ESP32)
+#define LWS_JWS_CACHE_THREADS
+#include <pthread.h>
+#endif
+
+#define LWS_JWS_CACHE_DEF_TOKENS	256
+#define LWS_JWS_CACHE_DEF_KEYS		8
+#define LWS_JWS_CACHE_DEF_TTL		60
+
+struct lws_jws_cache_key {
+	struct lws_jws_cache_key *next;	/* MRU first */
+	struct lws_genrsa_ctx rsactx;
+	uint8_t id[32];
+	int refcount;
+	char orphaned;			/* evicted while in use */
+};
+
+struct lws_jws_cache_token {
+	struct lws_jws_cache_token *hash_next;
+	struct lws_jws_cache_token *lru_prev; /* toward most recent */
+	struct lws_jws_cache_token *lru_next; /* toward least recent */
+	time_t expiry;
+	uint8_t digest[32];
+};
+
+struct lws_jws_batch_job {
+	struct lws_jws_batch_job *next;
+	struct lws_jws_batch *items;
+	lws_jws_batch_cb cb;
+	void *opaque;
+	int count;
+};
+
+struct lws_jws_cache {
+	struct lws_jws_cache_token *tokens;
+	struct lws_jws_cache_token **hash_table;
+	struct lws_jws_cache_token *lru_head;
+	struct lws_jws_cache_token *lru_tail;
+	struct lws_jws_cache_token *free_list;
+	struct lws_jws_cache_key *keys;
+	unsigned int hash_mask;
+	int count_keys;
+	int max_keys;
+	int ttl_secs;
+#if defined(LWS_JWS_CACHE_THREADS)
+	pthread_mutex_t lock;
+	pthread_cond_t cond_job;
+	pthread_t worker;
+	struct lws_jws_batch_job *job_head;
+	struct lws_jws_batch_job *job_tail;
+	char worker_running;
+	char stopping;
+#endif
+};
+
+static void
+lws_jws_cache_lock(struct lws_jws_cache *c)
+{
+#if defined(LWS_JWS_CACHE_THREADS)
+	pthread_mutex_lock(&c->lock);
+#endif
+}
+
+static void
+lws_jws_cache_unlock(struct lws_jws_cache *c)
+{
+#if defined(LWS_JWS_CACHE_THREADS)
+	pthread_mutex_unlock(&c->lock);
+#endif
+}
+
+LWS_VISIBLE struct lws_jws_cache *
+lws_jws_cache_create(int max_tokens, int max_keys, int ttl_secs)
+{
+	struct lws_jws_cache *c;
+	unsigned int buckets = 16;
+	int n;
+
+	if (max_tokens <= 0)
+		max_tokens = LWS_JWS_CACHE_DEF_TOKENS;
+	if (max_keys <= 0)
+		max_keys = LWS_JWS_CACHE_DEF_KEYS;
+	if (ttl_secs <= 0)
+		ttl_secs = LWS_JWS_CACHE_DEF_TTL;
+
+	while (buckets < (unsigned int)max_tokens / 2)
+		buckets <<= 1;
+
+	c = lws_zalloc(sizeof(*c), "jws cache");
+	if (!c)
+		return NULL;
+
+	c->tokens = lws_zalloc(sizeof(*c->tokens) * max_tokens,
+			       "jws cache tokens");
+	c->hash_table = lws_zalloc(sizeof(*c->hash_table) * buckets,
+				   "jws cache hash");
+	if (!c->tokens || !c->hash_table) {
+		lws_free(c->tokens);
+		lws_free(c->hash_table);
+		lws_free(c);
+
+		return NULL;
+	}
+
+	for (n = 0; n < max_tokens; n++) {
+		c->tokens[n].hash_next = c->free_list;
+		c->free_list = &c->tokens[n];
+	}
+
+	c->hash_mask = buckets - 1;
+	c->max_keys = max_keys;
+	c->ttl_secs = ttl_secs;
+
+#if defined(LWS_JWS_CACHE_THREADS)
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->cond_job, NULL);
+#endif
+
+	return c;
+}
+
+static void
+lws_jws_cache_key_free(struct lws_jws_cache_key *k)
+{
+	lws_genrsa_destroy(&k->rsactx);
+	lws_free(k);
+}
+
+LWS_VISIBLE void
+lws_jws_cache_flush(struct lws_jws_cache *c)
+{
+	struct lws_jws_cache_key *k, *k1;
+	unsigned int n;
+
+	lws_jws_cache_lock(c);
+
+	while (c->lru_head) {
+		struct lws_jws_cache_token *t = c->lru_head;
+
+		c->lru_head = t->lru_next;
+		t->hash_next = c->free_list;
+		c->free_list = t;
+	}
+	c->lru_tail = NULL;
+	for (n = 0; n <= c->hash_mask; n++)
+		c->hash_table[n] = NULL;
+
+	/* key handles in use on another thread are freed when released */
+
+	k = c->keys;
+	c->keys = NULL;
+	c->count_keys = 0;
+	while (k) {
+		k1 = k->next;
+		if (k->refcount)
+			k->orphaned = 1;
+		else
+			lws_jws_cache_key_free(k);
+		k = k1;
+	}
+
+	lws_jws_cache_unlock(c);
+}
+
+LWS_VISIBLE void
+lws_jws_cache_destroy(struct lws_jws_cache **pc)
+{
+	struct lws_jws_cache *c = *pc;
+
+	if (!c)
+		return;
+
+#if defined(LWS_JWS_CACHE_THREADS)
+	/* the worker completes any batches still queued before it exits */
+	pthread_mutex_lock(&c->lock);
+	c->stopping = 1;
+	pthread_cond_broadcast(&c->cond_job);
+	pthread_mutex_unlock(&c->lock);
+
+	if (c->worker_running)
+		pthread_join(c->worker, NULL);
+#endif
+
+	lws_jws_cache_flush(c);
+
+#if defined(LWS_JWS_CACHE_THREADS)
+	pthread_cond_destroy(&c->cond_job);
+	pthread_mutex_destroy(&c->lock);
+#endif
+
+	lws_free(c->hash_table);
+	lws_free(c->tokens);
+	lws_free(c);
+
+	*pc = NULL;
+}
+
+/*
+ * SHA-256 over the key type and the public part of the key... for "oct" keys
+ * that is the whole secret, held in el.e
+ */
+
+static int
+lws_jws_cache_key_id(struct lws_jwk *jwk, uint8_t *id)
+{
+	struct lws_genhash_ctx ctx;
+	int n, m = JWK_KEY_E;
+
+	if (!strcmp(jwk->keytype, "RSA"))
+		m = JWK_KEY_N;
+
+	if (lws_genhash_init(&ctx, LWS_GENHASH_TYPE_SHA256))
+		return -1;
+
+	if (lws_genhash_update(&ctx, jwk->keytype, strlen(jwk->keytype) + 1))
+		goto bail;
+
+	for (n = JWK_KEY_E; n <= m; n++) {
+		uint8_t be[2] = { (uint8_t)(jwk->el.e[n].len >> 8),
+				  (uint8_t)jwk->el.e[n].len };
+
+		if (lws_genhash_update(&ctx, be, 2) ||
+		    (jwk->el.e[n].len &&
+		     lws_genhash_update(&ctx, jwk->el.e[n].buf,
+					jwk->el.e[n].len)))
+			goto bail;
+	}
+
+	return lws_genhash_destroy(&ctx, id);
+
+bail:
+	lws_genhash_destroy(&ctx, NULL);
+
+	return -1;
+}
+
+/* called with the cache lock held */
+
+static struct lws_jws_cache_key *
+lws_jws_cache_key_get(struct lws_jws_cache *c, struct lws_jwk *jwk,
+		      const uint8_t *id)
+{
+	struct lws_jws_cache_key *k, **pk, **victim = NULL;
+
+	pk = &c->keys;
+	while (*pk) {
+		k = *pk;
+		if (!memcmp(k->id, id, sizeof(k->id))) {
+#if defined(LWS_WITH_MBEDTLS)
+			/*
+			 * mbedtls caches things in the rsa context during
+			 * public ops, so it can't be used by two threads at
+			 * once... the caller makes a one-off ctx instead
+			 */
+			if (k->refcount)
+				return NULL;
+#endif
+			/* move to MRU */
+			*pk = k->next;
+			k->next = c->keys;
+			c->keys = k;
+			k->refcount++;
+
+			return k;
+		}
+		if (!k->refcount)
+			victim = pk;
+		pk = &k->next;
+	}
+
+	if (c->count_keys >= c->max_keys) {
+		/* evict the least recently used idle handle, if any */
+		if (!victim)
+			return NULL;
+		k = *victim;
+		*victim = k->next;
+		lws_jws_cache_key_free(k);
+		c->count_keys--;
+	}
+
+	k = lws_zalloc(sizeof(*k), "jws cache key");
+	if (!k)
+		return NULL;
+
+	if (lws_genrsa_create(&k->rsactx, &jwk->el)) {
+		lwsl_notice("%s: lws_genrsa_create failed\n", __func__);
+		lws_free(k);
+
+		return NULL;
+	}
+
+	memcpy(k->id, id, sizeof(k->id));
+	k->refcount = 1;
+	k->next = c->keys;
+	c->keys = k;
+	c->count_keys++;
+
+	return k;
+}
+
+static void
+lws_jws_cache_key_put(struct lws_jws_cache *c, struct lws_jws_cache_key *k)
+{
+	if (!k)
+		return;
+
+	lws_jws_cache_lock(c);
+	if (!--k->refcount && k->orphaned)
+		lws_jws_cache_key_free(k);
+	lws_jws_cache_unlock(c);
+}
+
+static unsigned int
+lws_jws_cache_bucket(struct lws_jws_cache *c, const uint8_t *digest)
+{
+	return (digest[0] | (digest[1] << 8) | (digest[2] << 16) |
+		((unsigned int)digest[3] << 24)) & c->hash_mask;
+}
+
+/* called with the cache lock held */
+
+static void
+lws_jws_cache_token_unlink(struct lws_jws_cache *c,
+			   struct lws_jws_cache_token *t)
+{
+	struct lws_jws_cache_token **pt;
+
+	pt = &c->hash_table[lws_jws_cache_bucket(c, t->digest)];
+	while (*pt != t)
+		pt = &(*pt)->hash_next;
+	*pt = t->hash_next;
+
+	if (t->lru_prev)
+		t->lru_prev->lru_next = t->lru_next;
+	else
+		c->lru_head = t->lru_next;
+	if (t->lru_next)
+		t->lru_next->lru_prev = t->lru_prev;
+	else
+		c->lru_tail = t->lru_prev;
+}
+
+static void
+lws_jws_cache_token_lru_head(struct lws_jws_cache *c,
+			     struct lws_jws_cache_token *t)
+{
+	t->lru_prev = NULL;
+	t->lru_next = c->lru_head;
+	if (c->lru_head)
+		c->lru_head->lru_prev = t;
+	c->lru_head = t;
+	if (!c->lru_tail)
+		c->lru_tail = t;
+}
+
+static int
+lws_jws_cache_token_find(struct lws_jws_cache *c, const uint8_t *digest,
+			 time_t now)
+{
+	struct lws_jws_cache_token *t;
+
+	t = c->hash_table[lws_jws_cache_bucket(c, digest)];
+	while (t) {
+		if (!memcmp(t->digest, digest, sizeof(t->digest)))
+			break;
+		t = t->hash_next;
+	}
+	if (!t)
+		return 0;
+
+	lws_jws_cache_token_unlink(c, t);
+
+	if (t->expiry <= now) {
+		t->hash_next = c->free_list;
+		c->free_list = t;
+
+		return 0;
+	}
+
+	/* it's a hit, re-add it as most recently used */
+
+	t->hash_next = c->hash_table[lws_jws_cache_bucket(c, digest)];
+	c->hash_table[lws_jws_cache_bucket(c, digest)] = t;
+	lws_jws_cache_token_lru_head(c, t);
+
+	return 1;
+}
+
+static void
+lws_jws_cache_token_add(struct lws_jws_cache *c, const uint8_t *digest,
+			time_t expiry)
+{
+	struct lws_jws_cache_token *t;
+	unsigned int b = lws_jws_cache_bucket(c, digest);
+
+	/* another thread may have verified and added it meanwhile */
+
+	t = c->hash_table[b];
+	while (t) {
+		if (!memcmp(t->digest, digest, sizeof(t->digest)))
+			return;
+		t = t->hash_next;
+	}
+
+	t = c->free_list;
+	if (t)
+		c->free_list = t->hash_next;
+	else {
+		t = c->lru_tail;
+		lws_jws_cache_token_unlink(c, t);
+	}
+
+	memcpy(t->digest, digest, sizeof(t->digest));
+	t->expiry = expiry;
+	t->hash_next = c->hash_table[b];
+	c->hash_table[b] = t;
+	lws_jws_cache_token_lru_head(c, t);
+}
+
+struct cb_exp_s {
+	long long exp;
+	char has_exp;
+};
+
+static const char * const jexp_tok[] = {
+	"exp",
+};
+
+static signed char
+cb_exp(struct lejp_ctx *ctx, char reason)
+{
+	struct cb_exp_s *s = (struct cb_exp_s *)ctx->user;
+
+	if (!(reason & LEJP_FLAG_CB_IS_VALUE) || !ctx->path_match)
+		return 0;
+
+	/* RFC7519 NumericDate, which may have a fractional part */
+
+	if (reason != LEJPCB_VAL_NUM_INT && reason != LEJPCB_VAL_NUM_FLOAT)
+		return -1;
+
+	s->exp = atoll(ctx->buf);
+	s->has_exp = 1;
+
+	return 0;
+}
+
+/*
+ * Returns -1 if the payload isn't JSON or has an unusable "exp", else 0 with
+ * s->has_exp set if there is an "exp" claim
+ */
+
+static int
+lws_jws_payload_exp(const char *in, size_t len, struct cb_exp_s *s)
+{
+	const char *p = memchr(in, '.', len), *p1;
+	char buf[2048], *dec = buf;
+	struct lejp_ctx jctx;
+	int n, m, size = sizeof(buf);
+
+	s->has_exp = 0;
+
+	if (!p)
+		return -1;
+	p++;
+	p1 = memchr(p, '.', len - (p - in));
+	if (!p1)
+		return -1;
+
+	if (((p1 - p) * 3) / 4 + 4 > size) {
+		size = ((p1 - p) * 3) / 4 + 4;
+		dec = lws_malloc(size, "jws payload");
+		if (!dec)
+			return -1;
+	}
+
+	n = lws_b64_decode_string_len(p, p1 - p, dec, size - 1);
+	if (n < 0) {
+		m = -1;
+		goto bail;
+	}
+
+	lejp_construct(&jctx, cb_exp, s, jexp_tok, ARRAY_SIZE(jexp_tok));
+	m = (int)(signed char)lejp_parse(&jctx, (uint8_t *)dec, n);
+	lejp_destruct(&jctx);
+
+bail:
+	if (dec != buf)
+		lws_free(dec);
+
+	return m < 0 ? -1 : 0;
+}
+
+LWS_VISIBLE int
+lws_jws_confirm_sig_cached(struct lws_jws_cache *c, const char *in,
+			   size_t len, struct lws_jwk *jwk)
+{
+	struct lws_jws_cache_key *k = NULL;
+	uint8_t id[32], digest[32];
+	struct lws_genhash_ctx ctx;
+	struct cb_exp_s exp;
+	time_t now, expiry;
+	int n;
+
+	if (!c)
+		return lws_jws_confirm_sig(in, len, jwk);
+
+	/* the cache key binds the token to the key it verified with */
+
+	if (lws_jws_cache_key_id(jwk, id))
+		return -1;
+	if (lws_genhash_init(&ctx, LWS_GENHASH_TYPE_SHA256))
+		return -1;
+	if (lws_genhash_update(&ctx, id, sizeof(id)) ||
+	    lws_genhash_update(&ctx, in, len)) {
+		lws_genhash_destroy(&ctx, NULL);
+		return -1;
+	}
+	if (lws_genhash_destroy(&ctx, digest))
+		return -1;
+
+	now = (time_t)lws_now_secs();
+
+	lws_jws_cache_lock(c);
+	if (lws_jws_cache_token_find(c, digest, now)) {
+		lws_jws_cache_unlock(c);
+
+		return 0;
+	}
+	if (!strcmp(jwk->keytype, "RSA"))
+		/* if no handle is available, we fall back to a one-off ctx */
+		k = lws_jws_cache_key_get(c, jwk, id);
+	lws_jws_cache_unlock(c);
+
+	/* an expired token isn't valid, even if the signature is */
+
+	if (lws_jws_payload_exp(in, len, &exp))
+		goto bail;
+	if (exp.has_exp && (time_t)exp.exp <= now) {
+		lwsl_info("%s: token expired\n", __func__);
+		goto bail;
+	}
+
+	n = lws_jws_confirm_sig_ctx(in, len, jwk, k ? &k->rsactx : NULL);
+	lws_jws_cache_key_put(c, k);
+	if (n < 0)
+		return -1;
+
+	expiry = now + c->ttl_secs;
+	if (exp.has_exp && (time_t)exp.exp < expiry)
+		expiry = (time_t)exp.exp;
+
+	lws_jws_cache_lock(c);
+	lws_jws_cache_token_add(c, digest, expiry);
+	lws_jws_cache_unlock(c);
+
+	return 0;
+
+bail:
+	lws_jws_cache_key_put(c, k);
+
+	return -1;
+}
+
+static void
+lws_jws_batch_run(struct lws_jws_cache *c, struct lws_jws_batch_job *job)
+{
+	int n;
+
+	for (n = 0; n < job->count; n++)
+		job->items[n].result = lws_jws_confirm_sig_cached(c,
+					job->items[n].in, job->items[n].len,
+					job->items[n].jwk);
+
+	job->cb(job->opaque, job->items, job->count);
+}
+
+#if defined(LWS_JWS_CACHE_THREADS)
+static void *
+lws_jws_cache_worker(void *d)
+{
+	struct lws_jws_cache *c = (struct lws_jws_cache *)d;
+	struct lws_jws_batch_job *job;
+
+	pthread_mutex_lock(&c->lock);
+
+	while (1) {
+		while (!c->job_head && !c->stopping)
+			pthread_cond_wait(&c->cond_job, &c->lock);
+		if (!c->job_head)
+			break;
+
+		job = c->job_head;
+		c->job_head = job->next;
+		if (!c->job_head)
+			c->job_tail = NULL;
+		pthread_mutex_unlock(&c->lock);
+
+		lws_jws_batch_run(c, job);
+		lws_free(job);
+
+		pthread_mutex_lock(&c->lock);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+#endif
+
+LWS_VISIBLE int
+lws_jws_confirm_sig_batch(struct lws_jws_cache *c, struct lws_jws_batch *items,
+			  int count, lws_jws_batch_cb cb, void *opaque)
+{
+	struct lws_jws_batch_job *job;
+
+	if (!c || !items || count <= 0 || !cb)
+		return -1;
+
+	job = lws_zalloc(sizeof(*job), "jws batch");
+	if (!job)
+		return -1;
+
+	job->items = items;
+	job->count = count;
+	job->cb = cb;
+	job->opaque = opaque;
+
+#if defined(LWS_JWS_CACHE_THREADS)
+	pthread_mutex_lock(&c->lock);
+	if (c->stopping) {
+		pthread_mutex_unlock(&c->lock);
+		lws_free(job);
+
+		return -1;
+	}
+	if (!c->worker_running) {
+		if (pthread_create(&c->worker, NULL, lws_jws_cache_worker, c)) {
+			pthread_mutex_unlock(&c->lock);
+			lwsl_err("%s: unable to create worker\n", __func__);
+			lws_free(job);
+
+			return -1;
+		}
+		c->worker_running = 1;
+	}
+	if (c->job_tail)
+		c->job_tail->next = job;
+	else
+		c->job_head = job;
+	c->job_tail = job;
+	pthread_cond_signal(&c->cond_job);
+	pthread_mutex_unlock(&c->lock);
+#else
+	/* no threads... do it inline, cb is called before we return */
+	lws_jws_batch_run(c, job);
+	lws_free(job);
+#endif
+
+	return 0;
+}
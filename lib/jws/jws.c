@@ -73,6 +73,8 @@ static const char
 			  " \"k\":\"AyM1SysPpbyDfgZld3umj1qzKObwVMkoqQ-EstJQ"
 			  "Lr_T-1qS0gZH75aKtMN3Yj0iPS4hcgUuTwjAzZr1Z9CAow\"}",
 	   *hash_enc	= "dBjftJeZ4CVP-mB92K27uhbUJU1p1r_wW1gFWFOEjXk",
+	   *test3	= "{\"alg\":\"RS256\"}",
+	   *test4	= "{\"iss\":\"joe\"}",
 	   /* the key from worked example in RFC7515 A-1, as a JWK */
 	   *rfc7515_rsa_key =
 	"{\"kty\":\"RSA\","
@@ -236,13 +238,19 @@ cb_hdr(struct lejp_ctx *ctx, char reason)
 	return 0;
 }
 
-LWS_VISIBLE int
-lws_jws_confirm_sig(const char *in, size_t len, struct lws_jwk *jwk)
+/*
+ * If rsactx is non-NULL, it's a key handle already created from jwk by the
+ * caller (see jws-cache.c) and is used instead of creating a new one
+ */
+
+int
+lws_jws_confirm_sig_ctx(const char *in, size_t len, struct lws_jwk *jwk,
+			struct lws_genrsa_ctx *rsactx)
 {
 	int sig_pos = lws_jws_find_sig(in, len), pos = 0, n, m, h_len;
 	uint8_t digest[LWS_GENHASH_LARGEST];
 	struct lws_genhash_ctx hash_ctx;
-	struct lws_genrsa_ctx rsactx;
+	struct lws_genrsa_ctx _rsactx;
 	struct lws_genhmac_ctx ctx;
 	struct cb_hdr_s args;
 	struct lejp_ctx jctx;
@@ -305,16 +313,23 @@ lws_jws_confirm_sig(const char *in, size_t len, struct lws_jwk *jwk)
 
 		h_len = lws_genhash_size(args.hash_type);
 
-		if (lws_genrsa_create(&rsactx, &jwk->el)) {
-			lwsl_notice("%s: lws_genrsa_public_decrypt_create\n",
-				    __func__);
-			return -1;
+		if (rsactx)
+			n = lws_genrsa_public_verify(rsactx, digest,
+						     args.hash_type,
+						     (uint8_t *)buf, m);
+		else {
+			if (lws_genrsa_create(&_rsactx, &jwk->el)) {
+				lwsl_notice("%s: lws_genrsa_create failed\n",
+					    __func__);
+				return -1;
+			}
+
+			n = lws_genrsa_public_verify(&_rsactx, digest,
+						     args.hash_type,
+						     (uint8_t *)buf, m);
+
+			lws_genrsa_destroy(&_rsactx);
 		}
-
-		n = lws_genrsa_public_verify(&rsactx, digest, args.hash_type,
-					     (uint8_t *)buf, m);
-
-		lws_genrsa_destroy(&rsactx);
 		if (n < 0) {
 			lwsl_notice("decrypt fail\n");
 			return -1;
@@ -354,6 +369,12 @@ lws_jws_confirm_sig(const char *in, size_t len, struct lws_jwk *jwk)
 	return 0;
 }
 
+LWS_VISIBLE int
+lws_jws_confirm_sig(const char *in, size_t len, struct lws_jwk *jwk)
+{
+	return lws_jws_confirm_sig_ctx(in, len, jwk, NULL);
+}
+
 LWS_VISIBLE int
 lws_jws_sign_from_b64(const char *b64_hdr, size_t hdr_len, const char *b64_pay,
 		      size_t pay_len, char *b64_sig, size_t sig_len,
@@ -524,11 +545,12 @@ bail:
 int
 lws_jws_selftest(void)
 {
+	struct lws_jws_cache *cache;
 	struct lws_genhmac_ctx ctx;
 	struct lws_jwk jwk;
 	char buf[2048], *p = buf, *end = buf + sizeof(buf) - 1, *enc_ptr, *p1;
 	uint8_t digest[LWS_GENHASH_LARGEST];
-	int n;
+	int n, m;
 
 	/* Test 1: SHA256 on RFC7515 worked example */
 
@@ -621,6 +643,51 @@ lws_jws_selftest(void)
 		goto bail;
 	}
 
+	/* Test 3: the verified token cache */
+
+	cache = lws_jws_cache_create(4, 1, 0);
+	if (!cache)
+		goto bail;
+
+	/* 3.1: the RFC7515 A-1 payload "exp" is long gone, it must fail */
+
+	if (!lws_jws_confirm_sig_cached(cache, rfc7515_rsa_a1,
+					strlen(rfc7515_rsa_a1), &jwk)) {
+		lwsl_notice("cached confirm accepted expired token\n");
+		goto bail_cache;
+	}
+
+	/* 3.2: sign a token with no "exp", it must pass, twice */
+
+	p = buf;
+	end = buf + sizeof(buf) - 1;
+	if (lws_jws_encode_section(test3, strlen(test3), 1, &p, end) < 0)
+		goto bail_cache;
+	p1 = p;
+	if (lws_jws_encode_section(test4, strlen(test4), 0, &p, end) < 0)
+		goto bail_cache;
+	*p++ = '.';
+	n = lws_jws_sign_from_b64(buf, p1 - buf, p1 + 1, p - p1 - 2, p,
+				  end - p, LWS_GENHASH_TYPE_SHA256, &jwk);
+	if (n < 0)
+		goto bail_cache;
+
+	for (m = 0; m < 2; m++)
+		if (lws_jws_confirm_sig_cached(cache, buf, (p + n) - buf,
+					       &jwk) < 0) {
+			lwsl_notice("cached confirm %d failed\n", m);
+			goto bail_cache;
+		}
+
+	/* 3.3: a damaged copy must not be accepted */
+
+	buf[(p + n) - buf - 2] ^= 1;
+	if (!lws_jws_confirm_sig_cached(cache, buf, (p + n) - buf, &jwk)) {
+		lwsl_notice("cached confirm accepted bad sig\n");
+		goto bail_cache;
+	}
+
+	lws_jws_cache_destroy(&cache);
 	lws_jwk_destroy(&jwk);
 
 	/* end */
@@ -629,6 +696,10 @@ lws_jws_selftest(void)
 
 	return 0;
 
+bail_cache:
+	lws_jws_cache_destroy(&cache);
+	goto bail;
+
 bail_destroy_hmac:
 	lws_genhmac_destroy(&ctx, NULL);
 
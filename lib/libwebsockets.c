@@ -58,6 +58,222 @@ static const char * const log_level_names[] = {
 };
 #endif
 
+/*
+ * Each pt keeps up to context->wsi_cache_max freed wsi, and the same number
+ * of freed lws-allocated per-session data of each of a few sizes, for reuse.
+ * That way connection churn doesn't hit the heap allocator every time, and
+ * the memory stays warm and local to the pt.
+ */
+
+struct lws *
+lws_wsi_alloc(struct lws_context *context, int tsi, const char *reason)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct lws *wsi;
+
+	lws_pt_lock(pt, __func__);
+	wsi = pt->wsi_free_list;
+	if (wsi) {
+		pt->wsi_free_list = wsi->sibling_list;
+		pt->count_wsi_free--;
+	}
+	lws_pt_unlock(pt);
+
+	if (!wsi)
+		return lws_zalloc(sizeof(*wsi), reason);
+
+	memset(wsi, 0, sizeof(*wsi));
+
+	return wsi;
+}
+
+static void *
+lws_pss_alloc(struct lws *wsi, size_t size)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	void *p = NULL;
+	int n;
+
+	if (size >= sizeof(void *)) {
+		lws_pt_lock(pt, __func__);
+		for (n = 0; n < LWS_PSS_CACHE_SIZES; n++)
+			if (pt->pss_cache[n].size == size &&
+			    pt->pss_cache[n].head) {
+				p = pt->pss_cache[n].head;
+				memcpy(&pt->pss_cache[n].head, p, sizeof(void *));
+				pt->pss_cache[n].count--;
+				break;
+			}
+		lws_pt_unlock(pt);
+	}
+
+	if (p)
+		memset(p, 0, size);
+	else
+		p = lws_zalloc(size, "user space");
+
+	if (p)
+		wsi->user_space_len = (uint32_t)size;
+
+	return p;
+}
+
+void
+lws_pss_free(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_pss_cache *c = NULL;
+	int n;
+
+	if (!wsi->user_space || wsi->user_space_externally_allocated)
+		return;
+
+	if (wsi->user_space_len >= sizeof(void *) &&
+	    !wsi->context->being_destroyed) {
+		lws_pt_lock(pt, __func__);
+		for (n = 0; n < LWS_PSS_CACHE_SIZES; n++) {
+			if (pt->pss_cache[n].size == wsi->user_space_len) {
+				c = &pt->pss_cache[n];
+				break;
+			}
+			/* otherwise we can take over an unused size */
+			if (!c && !pt->pss_cache[n].count)
+				c = &pt->pss_cache[n];
+		}
+		if (c && c->count < wsi->context->wsi_cache_max) {
+			c->size = wsi->user_space_len;
+			memcpy(wsi->user_space, &c->head, sizeof(void *));
+			c->head = wsi->user_space;
+			c->count++;
+			wsi->user_space = NULL;
+		}
+		lws_pt_unlock(pt);
+	}
+
+	lws_free_set_NULL(wsi->user_space);
+	wsi->user_space_len = 0;
+}
+
+/*
+ * Per-transaction bump allocator.  Everything a transaction allocates with
+ * lws_txn_alloc() is released in one go by lws_txn_release() when it
+ * completes or the wsi closes.  The standard size chunks go back to the pt
+ * pool, capped like the wsi cache, so keepalive request loops reuse the same
+ * warm chunk instead of visiting the heap allocator per allocation.
+ */
+
+LWS_VISIBLE void *
+lws_txn_alloc(struct lws *wsi, size_t size)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_txn_chunk *c = wsi->txn;
+	void *p;
+
+	size = (size + 7) & ~7;
+
+	if (!c || c->size - c->used < size) {
+		c = NULL;
+		if (size <= LWS_TXN_CHUNK) {
+			lws_pt_lock(pt, __func__);
+			c = pt->txn_pool;
+			if (c) {
+				pt->txn_pool = c->next;
+				pt->count_txn_pool--;
+			}
+			lws_pt_unlock(pt);
+		}
+		if (!c) {
+			c = lws_malloc(LWS_TXN_HDR + (size > LWS_TXN_CHUNK ?
+						size : LWS_TXN_CHUNK), "txn");
+			if (!c)
+				return NULL;
+			c->size = size > LWS_TXN_CHUNK ? size : LWS_TXN_CHUNK;
+		}
+		c->used = 0;
+		c->next = wsi->txn;
+		wsi->txn = c;
+	}
+
+	p = (uint8_t *)c + LWS_TXN_HDR + c->used;
+	c->used += size;
+
+	return p;
+}
+
+char *
+lws_txn_strdup(struct lws *wsi, const char *s)
+{
+	size_t l = strlen(s) + 1;
+	char *d = lws_txn_alloc(wsi, l);
+
+	if (d)
+		memcpy(d, s, l);
+
+	return d;
+}
+
+void
+lws_txn_release(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_txn_chunk *c;
+
+	if (!wsi->txn)
+		return;
+
+	lws_pt_lock(pt, __func__);
+	while (wsi->txn) {
+		c = wsi->txn;
+		wsi->txn = c->next;
+		if (c->size == LWS_TXN_CHUNK &&
+		    !wsi->context->being_destroyed &&
+		    pt->count_txn_pool < wsi->context->wsi_cache_max) {
+			c->next = pt->txn_pool;
+			pt->txn_pool = c;
+			pt->count_txn_pool++;
+		} else
+			lws_free(c);
+	}
+	lws_pt_unlock(pt);
+}
+
+void
+lws_pt_caches_destroy(struct lws_context_per_thread *pt)
+{
+	struct lws *wsi;
+	void *p;
+	int n;
+
+	while (pt->wsi_free_list) {
+		wsi = pt->wsi_free_list;
+		pt->wsi_free_list = wsi->sibling_list;
+		lws_free(wsi);
+	}
+	pt->count_wsi_free = 0;
+
+	for (n = 0; n < LWS_PSS_CACHE_SIZES; n++) {
+		while (pt->pss_cache[n].head) {
+			p = pt->pss_cache[n].head;
+			memcpy(&pt->pss_cache[n].head, p, sizeof(void *));
+			lws_free(p);
+		}
+		pt->pss_cache[n].count = 0;
+	}
+
+	while (pt->tx_coalesce_pool) {
+		p = pt->tx_coalesce_pool;
+		pt->tx_coalesce_pool = pt->tx_coalesce_pool->next;
+		lws_free(p);
+	}
+
+	while (pt->txn_pool) {
+		p = pt->txn_pool;
+		pt->txn_pool = pt->txn_pool->next;
+		lws_free(p);
+	}
+	pt->count_txn_pool = 0;
+}
+
 void
 __lws_free_wsi(struct lws *wsi)
 {
@@ -73,13 +289,16 @@ __lws_free_wsi(struct lws *wsi)
 	 * Protocol user data may be allocated either internally by lws
 	 * or by specified the user. We should only free what we allocated.
 	 */
-	if (wsi->protocol && wsi->protocol->per_session_data_size &&
-	    wsi->user_space && !wsi->user_space_externally_allocated)
-		lws_free(wsi->user_space);
+	lws_pss_free(wsi);
+	lws_txn_release(wsi);
 
 	lws_free_set_NULL(wsi->rxflow_buffer);
 	lws_free_set_NULL(wsi->trunc_alloc);
+	lws_free_set_NULL(wsi->tx_coalesce);
 	lws_free_set_NULL(wsi->ws);
+#ifndef LWS_NO_SERVER
+	lws_udp_destroy(wsi);
+#endif
 
 	/* we may not have an ah, but may be on the waiting list... */
 	lwsl_info("ah det due to close\n");
@@ -110,6 +329,7 @@ __lws_free_wsi(struct lws *wsi)
 #if defined(LWS_WITH_HTTP2)
 	if (wsi->upgraded_to_http2 || wsi->http2_substream) {
 		lws_hpack_destroy_dynamic_header(wsi);
+		lws_h2_rx_win_release(wsi);
 
 		if (wsi->h2.h2n)
 			lws_free_set_NULL(wsi->h2.h2n);
@@ -129,6 +349,16 @@ __lws_free_wsi(struct lws *wsi)
 	lwsl_debug("%s: %p, remaining wsi %d\n", __func__, wsi,
 			wsi->context->count_wsi_allocated);
 
+	lws_pt_lock(pt, __func__);
+	if (!wsi->context->being_destroyed &&
+	    pt->count_wsi_free < wsi->context->wsi_cache_max) {
+		wsi->sibling_list = pt->wsi_free_list;
+		pt->wsi_free_list = wsi;
+		pt->count_wsi_free++;
+		wsi = NULL;
+	}
+	lws_pt_unlock(pt);
+
 	lws_free(wsi);
 }
 
@@ -245,11 +475,6 @@ __lws_set_timer_usecs(struct lws *wsi, lws_usec_t usecs)
 	struct lws *wsi1;
 	int bef = 0;
 
-	if (LWS_LIBEV_ENABLED(wsi->context))
-		lwsl_warn("%s: lws hrtimer not implemented for libev\n", __func__);
-	if (LWS_LIBEVENT_ENABLED(wsi->context))
-		lwsl_warn("%s: lws hrtimer not implemented for libevent\n", __func__);
-
 	lws_dll_lws_remove(&wsi->dll_hrtimer);
 
 	if (usecs == LWS_SET_TIMER_USEC_CANCEL)
@@ -303,6 +528,16 @@ __lws_set_timer_usecs(struct lws *wsi, lws_usec_t usecs)
 		dd->next = &wsi->dll_hrtimer;
 	}
 
+	/*
+	 * If we are now the earliest, the event lib's timer must be brought
+	 * forward to our deadline.  Otherwise it will already fire in time
+	 * for the head, and the service of that rearms it for whoever is next.
+	 */
+	if (pt->dll_head_hrtimer.next == &wsi->dll_hrtimer) {
+		lws_libev_hrtimer_set(pt, usecs);
+		lws_libevent_hrtimer_set(pt, usecs);
+	}
+
 //	lws_dll_dump(&pt->dll_head_hrtimer, "after set_timer_usec");
 }
 
@@ -475,8 +710,7 @@ lws_bind_protocol(struct lws *wsi, const struct lws_protocols *p)
 	if (wsi->protocol)
 		wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP_DROP_PROTOCOL,
 					wsi->user_space, NULL, 0);
-	if (!wsi->user_space_externally_allocated)
-		lws_free_set_NULL(wsi->user_space);
+	lws_pss_free(wsi);
 
 	lws_same_vh_protocol_remove(wsi);
 
@@ -529,6 +763,9 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason, const char *
 	if (!wsi)
 		return;
 
+	/* an offload worker may be in the middle of SSL_accept() for us */
+	lws_tls_offload_cancel(wsi);
+
 	lws_access_log(wsi);
 
 	/* we're closing, losing some rx is OK */
@@ -638,6 +875,9 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason, const char *
 		goto just_kill_connection;
 
 	if (!wsi->told_user_closed &&
+#if defined(LWS_WITH_HTTP2)
+	    !wsi->h2.client_stream &&
+#endif
 	    (wsi->mode == LWSCM_HTTP_SERVING ||
 	     wsi->mode == LWSCM_HTTP2_SERVING)) {
 		if (wsi->user_space)
@@ -726,6 +966,19 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason, const char *
 
 just_kill_connection:
 
+#if defined(LWS_H2_CLIENT)
+	/* stop others joining us, fail anyone waiting, cancel our stream */
+	if (wsi->h2.client_peer || wsi->h2.client_pending.next ||
+	    wsi->h2.dll_client_pending.prev || wsi->h2.client_stream)
+		lws_h2_client_leave(wsi);
+#endif
+#if !defined(LWS_NO_CLIENT)
+	/* nobody else can queue on us, anyone queued goes elsewhere */
+	if (wsi->http.client_peer || wsi->http.client_pending.next ||
+	    wsi->http.dll_client_pending.prev)
+		lws_client_pipeline_leave(wsi);
+#endif
+
 #if defined(LWS_WITH_HTTP2)
 
 	if (wsi->http2_substream && wsi->h2_stream_carries_ws)
@@ -822,7 +1075,8 @@ just_kill_connection:
 	}
 
 	if ((wsi->mode == LWSCM_WSCL_WAITING_SERVER_REPLY ||
-			   wsi->mode == LWSCM_WSCL_WAITING_CONNECT) &&
+			   wsi->mode == LWSCM_WSCL_WAITING_CONNECT ||
+			   wsi->mode == LWSCM_WSCL_PENDING_CANDIDATE_CHILD) &&
 			   !wsi->already_did_cce) {
 				wsi->protocol->callback(wsi,
 					LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
@@ -840,6 +1094,22 @@ just_kill_connection:
 		wsi->told_user_closed = 1;
 	}
 
+#if defined(LWS_H2_CLIENT)
+	if (wsi->h2.client_stream && !wsi->told_user_closed) {
+		/* the stream went before the response headers came */
+		if ((wsi->state_pre_close == LWSS_HTTP2_CLIENT_SEND_HEADERS ||
+		     wsi->state_pre_close == LWSS_HTTP2_CLIENT_ESTABLISHED) &&
+		    !wsi->already_did_cce)
+			wsi->protocol->callback(wsi,
+					LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
+					wsi->user_space,
+					(void *)"h2 stream closed", 16);
+		wsi->protocol->callback(wsi, LWS_CALLBACK_CLOSED_CLIENT_HTTP,
+					wsi->user_space, NULL, 0);
+		wsi->told_user_closed = 1;
+	}
+#endif
+
 
 #if LWS_POSIX
 	/*
@@ -1067,7 +1337,8 @@ __lws_close_free_wsi_final(struct lws *wsi)
 				close(wsi->cgi->pipe_fds[n][!!(n == 0)]);
 		}
 
-		lws_free(wsi->cgi);
+		/* it's in the txn arena, released with the wsi below */
+		wsi->cgi = NULL;
 	}
 #endif
 
@@ -1766,10 +2037,17 @@ int user_callback_handle_rxflow(lws_callback_function callback_function,
 				void *in, size_t len)
 {
 	int n;
+#if defined(LWS_WITH_STATS)
+	uint64_t us = time_in_microseconds();
+#endif
 
 	wsi->rxflow_will_be_applied = 1;
 	n = callback_function(wsi, reason, user, in, len);
 	wsi->rxflow_will_be_applied = 0;
+#if defined(LWS_WITH_STATS)
+	lws_stats_hist_add(&wsi->context->pt[(int)wsi->tsi],
+			   LWSSTATS_H_CALLBACK, time_in_microseconds() - us);
+#endif
 	if (!n)
 		n = __lws_rx_flow_control(wsi);
 
@@ -1941,8 +2219,8 @@ lws_ensure_user_space(struct lws *wsi)
 	/* allocate the per-connection user memory (if any) */
 
 	if (wsi->protocol->per_session_data_size && !wsi->user_space) {
-		wsi->user_space = lws_zalloc(
-			    wsi->protocol->per_session_data_size, "user space");
+		wsi->user_space = lws_pss_alloc(wsi,
+					wsi->protocol->per_session_data_size);
 		if (wsi->user_space == NULL) {
 			lwsl_err("%s: OOM\n", __func__);
 			return 1;
@@ -2593,6 +2871,118 @@ lws_socket_bind(struct lws_vhost *vhost, lws_sockfd_type sockfd, int port,
 	return port;
 }
 
+/*
+ * Find an unused listen socket inherited from a previous server instance that
+ * is bound to the address lws_socket_bind() would have used for this vhost.
+ * If found, it's removed from the inherited list and returned.
+ */
+
+lws_sockfd_type
+lws_socket_inherited(struct lws_vhost *vhost, int port, const char *iface)
+{
+#if LWS_POSIX && !defined(LWS_PLAT_OPTEE) && !defined(LWS_WITH_ESP32) && \
+    !defined(_WIN32)
+	struct lws_context *context = vhost->context;
+	struct sockaddr_storage sin, want;
+	socklen_t len;
+	int n, fd, family = AF_INET, wport = 0;
+
+	if (!context->count_listen_fds || (!port && !iface))
+		return LWS_SOCK_INVALID;
+
+	/* unless there's an iface, we bind to the wildcard address */
+	memset(&want, 0, sizeof(want));
+#ifdef LWS_WITH_UNIX_SOCK
+	if (LWS_UNIX_SOCK_ENABLED(vhost)) {
+		if (!iface)
+			return LWS_SOCK_INVALID;
+		family = AF_UNIX;
+	} else
+#endif
+	{
+#if defined(LWS_WITH_IPV6)
+		if (LWS_IPV6_ENABLED(vhost))
+			family = AF_INET6;
+#endif
+		if (iface && interface_to_sa(vhost, iface,
+					     (struct sockaddr_in *)&want,
+					     family == AF_INET6 ?
+						sizeof(struct sockaddr_in6) :
+						sizeof(struct sockaddr_in)) < 0)
+			return LWS_SOCK_INVALID;
+	}
+
+	for (n = 0; n < context->count_listen_fds; n++) {
+		fd = context->listen_fds[n];
+		if (fd < 0)
+			continue;
+
+		len = sizeof(sin);
+		if (getsockname(fd, (struct sockaddr *)&sin, &len) ||
+		    sin.ss_family != family)
+			continue;
+
+		switch (family) {
+#ifdef LWS_WITH_UNIX_SOCK
+		case AF_UNIX:
+		{
+			const char *p = ((struct sockaddr_un *)&sin)->sun_path;
+
+			/* abstract namespace names start with NUL */
+			if (iface[0] == '@' ? (p[0] || strcmp(p + 1, iface + 1)) :
+					      strcmp(p, iface))
+				continue;
+			break;
+		}
+#endif
+#if defined(LWS_WITH_IPV6)
+		case AF_INET6:
+			wport = ntohs(((struct sockaddr_in6 *)&sin)->sin6_port);
+			if (memcmp(&((struct sockaddr_in6 *)&sin)->sin6_addr,
+			    &((struct sockaddr_in6 *)&want)->sin6_addr,
+			    sizeof(struct in6_addr)))
+				continue;
+			break;
+#endif
+		default:
+			wport = ntohs(((struct sockaddr_in *)&sin)->sin_port);
+			if (((struct sockaddr_in *)&sin)->sin_addr.s_addr !=
+			    ((struct sockaddr_in *)&want)->sin_addr.s_addr)
+				continue;
+			break;
+		}
+
+		if (family != AF_UNIX && wport != port)
+			continue;
+
+		context->listen_fds[n] = -1;
+
+		return fd;
+	}
+#endif
+
+	return LWS_SOCK_INVALID;
+}
+
+void
+lws_inherited_listen_fds_close(struct lws_context *context)
+{
+	int n;
+
+	if (!context->listen_fds)
+		return;
+
+	for (n = 0; n < context->count_listen_fds; n++)
+		if (context->listen_fds[n] >= 0) {
+			lwsl_notice("%s: closing unused inherited fd %d\n",
+				    __func__, context->listen_fds[n]);
+			compatible_close(context->listen_fds[n]);
+		}
+
+	lws_free_set_NULL(context->listen_fds);
+	context->count_listen_fds = 0;
+}
+
 #if defined(LWS_WITH_IPV6)
 LWS_EXTERN unsigned long
 lws_get_addr_scope(const char *ipaddr)
@@ -3180,6 +3570,11 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len,
 	buf += lws_snprintf(buf, end - buf, ",\n \"cgi_alive\":\"%d\"\n ",
 			cgi_count);
 
+#if defined(LWS_WITH_STATS)
+	buf += lws_snprintf(buf, end - buf, ",");
+	buf += lws_stats_json_dump_hist(context, buf, end - buf);
+#endif
+
 	buf += lws_snprintf(buf, end - buf, "}");
 
 
@@ -3192,24 +3587,159 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len,
 
 #if defined(LWS_WITH_STATS)
 
+static const char * const hist_names[] = {
+	"writable_delay",
+	"ssl_accept_delay",
+	"hdr_parse",
+	"callback",
+};
+
 LWS_VISIBLE LWS_EXTERN uint64_t
 lws_stats_get(struct lws_context *context, int index)
 {
+	uint64_t u = 0;
+	int n;
+
 	if (index >= LWSSTATS_SIZE)
 		return 0;
 
-	return context->lws_stats[index];
+	for (n = 0; n < context->count_threads; n++) {
+		uint64_t v = context->pt[n].stats.c[index];
+
+		if (index != LWSSTATS_MS_WORST_WRITABLE_DELAY)
+			u += v;
+		else
+			if (v > u)
+				u = v;
+	}
+
+	return u;
+}
+
+/* sums the per-pt buckets of one histogram into b[], returns total count */
+
+static uint64_t
+lws_stats_hist_sum(const struct lws_context *context, int index, uint64_t *b,
+		   uint64_t *sum)
+{
+	uint64_t total = 0;
+	int n, m;
+
+	memset(b, 0, sizeof(*b) * LWS_STATS_HIST_BUCKETS);
+	*sum = 0;
+
+	for (n = 0; n < context->count_threads; n++) {
+		const struct lws_pt_stats *ps = &context->pt[n].stats;
+
+		for (m = 0; m < LWS_STATS_HIST_BUCKETS; m++)
+			b[m] += ps->hist[index][m];
+		*sum += ps->hist_sum[index];
+	}
+
+	for (m = 0; m < LWS_STATS_HIST_BUCKETS; m++)
+		total += b[m];
+
+	return total;
+}
+
+static uint64_t
+lws_stats_hist_pc(const uint64_t *b, uint64_t total, int permille)
+{
+	uint64_t acc = 0, target;
+	int m;
+
+	if (!total)
+		return 0;
+
+	target = (total * permille + 999) / 1000;
+	if (!target)
+		target = 1;
+
+	for (m = 0; m < LWS_STATS_HIST_BUCKETS; m++) {
+		acc += b[m];
+		if (acc >= target)
+			return lws_stats_hist_bucket_floor(m);
+	}
+
+	return lws_stats_hist_bucket_floor(LWS_STATS_HIST_BUCKETS - 1);
+}
+
+LWS_VISIBLE LWS_EXTERN uint64_t
+lws_stats_hist_percentile(struct lws_context *context, int index, int permille)
+{
+	uint64_t b[LWS_STATS_HIST_BUCKETS], sum, total;
+
+	if (index < 0 || index >= LWSSTATS_H_SIZE)
+		return 0;
+
+	total = lws_stats_hist_sum(context, index, b, &sum);
+
+	return lws_stats_hist_pc(b, total, permille);
+}
+
+#if defined(LWS_WITH_SERVER_STATUS)
+int
+lws_stats_json_dump_hist(const struct lws_context *context, char *buf, int len)
+{
+	uint64_t b[LWS_STATS_HIST_BUCKETS], sum, total;
+	char *orig = buf, *end;
+	int n, m, first;
+
+	if (len < 1)
+		return 0;
+	end = buf + len - 1;
+
+	buf += lws_snprintf(buf, end - buf, "\"hist\":{");
+
+	for (n = 0; n < LWSSTATS_H_SIZE; n++) {
+		total = lws_stats_hist_sum(context, n, b, &sum);
+
+		buf += lws_snprintf(buf, end - buf,
+			"%s\n  \"%s_us\":{\"count\":\"%llu\",\"sum\":\"%llu\","
+			"\"p50\":\"%llu\",\"p90\":\"%llu\",\"p99\":\"%llu\","
+			"\"p999\":\"%llu\",\"buckets\":[",
+			n ? "," : "", hist_names[n],
+			(unsigned long long)total, (unsigned long long)sum,
+			(unsigned long long)lws_stats_hist_pc(b, total, 500),
+			(unsigned long long)lws_stats_hist_pc(b, total, 900),
+			(unsigned long long)lws_stats_hist_pc(b, total, 990),
+			(unsigned long long)lws_stats_hist_pc(b, total, 999));
+
+		first = 1;
+		for (m = 0; m < LWS_STATS_HIST_BUCKETS; m++) {
+			if (!b[m])
+				continue;
+			buf += lws_snprintf(buf, end - buf, "%s[%llu,%llu]",
+				first ? "" : ",",
+				(unsigned long long)lws_stats_hist_bucket_floor(m),
+				(unsigned long long)b[m]);
+			first = 0;
+		}
+
+		buf += lws_snprintf(buf, end - buf, "]}");
+	}
+
+	buf += lws_snprintf(buf, end - buf, "}");
+
+	return buf - orig;
 }
+#endif
 
 LWS_VISIBLE LWS_EXTERN void
 lws_stats_log_dump(struct lws_context *context)
 {
 	struct lws_vhost *v = context->vhost_list;
-	int n, m;
+	int n, m, updated = context->updated;
 
 	(void)m;
 
-	if (!context->updated)
+	for (n = 0; n < context->count_threads; n++)
+		if (context->pt[n].stats.updated) {
+			context->pt[n].stats.updated = 0;
+			updated = 1;
+		}
+
+	if (!updated)
 		return;
 
 	context->updated = 0;
@@ -3261,6 +3791,21 @@ lws_stats_log_dump(struct lws_context *context)
 	lwsl_notice("LWSSTATS_C_PEER_LIMIT_WSI_DENIED:           %8llu\n",
 		(unsigned long long)lws_stats_get(context,
 					LWSSTATS_C_PEER_LIMIT_WSI_DENIED));
+	lwsl_notice("LWSSTATS_C_SSL_SESSIONS_RESUMED:            %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_SSL_SESSIONS_RESUMED));
+	lwsl_notice("LWSSTATS_C_SSL_SESSION_EXT_HITS:            %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_SSL_SESSION_EXT_HITS));
+	lwsl_notice("LWSSTATS_C_TLS_RECORDS_SMALL:               %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_TLS_RECORDS_SMALL));
+	lwsl_notice("LWSSTATS_C_TLS_RECORDS_MEDIUM:              %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_TLS_RECORDS_MEDIUM));
+	lwsl_notice("LWSSTATS_C_TLS_RECORDS_FULL:                %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_TLS_RECORDS_FULL));
 
 	lwsl_notice("LWSSTATS_C_TIMEOUTS:                        %8llu\n",
 		(unsigned long long)lws_stats_get(context,
@@ -3305,6 +3850,18 @@ lws_stats_log_dump(struct lws_context *context)
 			(unsigned long long)(lws_stats_get(context,
 					LWSSTATS_MS_WRITABLE_DELAY) /
 			lws_stats_get(context, LWSSTATS_C_WRITEABLE_CB)));
+	for (n = 0; n < LWSSTATS_H_SIZE; n++) {
+		uint64_t b[LWS_STATS_HIST_BUCKETS], sum, total;
+
+		total = lws_stats_hist_sum(context, n, b, &sum);
+		if (!total)
+			continue;
+		lwsl_notice("  %-18s n %llu, p50 %lluus, p99 %lluus, p99.9 %lluus\n",
+			    hist_names[n], (unsigned long long)total,
+			    (unsigned long long)lws_stats_hist_pc(b, total, 500),
+			    (unsigned long long)lws_stats_hist_pc(b, total, 990),
+			    (unsigned long long)lws_stats_hist_pc(b, total, 999));
+	}
 	lwsl_notice("Simultaneous SSL restriction:               %8d/%d/%d\n",
 			context->simultaneous_ssl,
 			context->simultaneous_ssl_restriction,
@@ -3397,28 +3954,5 @@ lws_stats_log_dump(struct lws_context *context)
 	lwsl_notice("\n");
 }
 
-void
-lws_stats_atomic_bump(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t bump)
-{
-	lws_pt_stats_lock(pt);
-	context->lws_stats[index] += bump;
-	if (index != LWSSTATS_C_SERVICE_ENTRY)
-		context->updated = 1;
-	lws_pt_stats_unlock(pt);
-}
-
-void
-lws_stats_atomic_max(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t val)
-{
-	lws_pt_stats_lock(pt);
-	if (val > context->lws_stats[index]) {
-		context->lws_stats[index] = val;
-		context->updated = 1;
-	}
-	lws_pt_stats_unlock(pt);
-}
-
 #endif
 
@@ -1930,6 +1930,107 @@ lws_jwk_rfc7638_fingerprint(struct lws_jwk *s, char *digest32);
 LWS_VISIBLE LWS_EXTERN int
 lws_jws_confirm_sig(const char *in, size_t len, struct lws_jwk *jwk);
 
+struct lws_jws_cache;
+
+/**
+ * lws_jws_cache_create() - create a cache of verified JWS
+ *
+ * \param max_tokens: max number of verified tokens to remember, or 0 for 256
+ * \param max_keys: max number of preparsed RSA key handles, or 0 for 8
+ * \param ttl_secs: max seconds to remember a token for, or 0 for 60
+ *
+ * Creates an opaque cache that lws_jws_confirm_sig_cached() and
+ * lws_jws_confirm_sig_batch() use to skip the crypto for tokens that already
+ * verified OK with the same key.  A cached token is forgotten after
+ * \p ttl_secs, or when its "exp" claim is reached if that is sooner.
+ *
+ * The cache may be used from multiple threads at once.
+ *
+ * Returns the cache or NULL for OOM.
+ */
+LWS_VISIBLE LWS_EXTERN struct lws_jws_cache *
+lws_jws_cache_create(int max_tokens, int max_keys, int ttl_secs);
+
+/**
+ * lws_jws_cache_destroy() - destroy a JWS cache
+ *
+ * \param pcache: pointer to the cache pointer, set to NULL after
+ *
+ * Any batches still queued are completed, with their callbacks, first.
+ */
+LWS_VISIBLE LWS_EXTERN void
+lws_jws_cache_destroy(struct lws_jws_cache **pcache);
+
+/**
+ * lws_jws_cache_flush() - forget everything in the cache
+ *
+ * \param cache: the cache
+ *
+ * Eg, after revoking a key or tokens, make sure the next check of every token
+ * does the full verification again.
+ */
+LWS_VISIBLE LWS_EXTERN void
+lws_jws_cache_flush(struct lws_jws_cache *cache);
+
+/**
+ * lws_jws_confirm_sig_cached() - lws_jws_confirm_sig() using a cache
+ *
+ * \param cache: the cache from lws_jws_cache_create(), or NULL
+ * \param in: the compact JWS
+ * \param len: length of \p in
+ * \param jwk: the key to check the signature with
+ *
+ * Like lws_jws_confirm_sig(), but a token that verified OK with the same key
+ * recently is accepted from the cache without repeating the crypto, and RSA
+ * keys are prepared once and reused.
+ *
+ * Unlike lws_jws_confirm_sig(), the payload must be JSON and if it has an
+ * "exp" claim that is in the past, the token is rejected.
+ *
+ * If \p cache is NULL, it's the same as calling lws_jws_confirm_sig().
+ *
+ * Returns 0 if the signature is OK, or -1.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_jws_confirm_sig_cached(struct lws_jws_cache *cache, const char *in,
+			   size_t len, struct lws_jwk *jwk);
+
+struct lws_jws_batch {
+	const char *in;		/**< the compact JWS */
+	size_t len;		/**< length of in */
+	struct lws_jwk *jwk;	/**< key to check it with */
+	int result;		/**< set to lws_jws_confirm_sig_cached() result */
+};
+
+typedef void (*lws_jws_batch_cb)(void *opaque, struct lws_jws_batch *items,
+				 int count);
+
+/**
+ * lws_jws_confirm_sig_batch() - verify a batch of JWS off the service thread
+ *
+ * \param cache: the cache from lws_jws_cache_create()
+ * \param items: array of tokens to check, must stay valid until \p cb
+ * \param count: number of entries in \p items
+ * \param cb: called when the whole batch has been checked
+ * \param opaque: passed to \p cb
+ *
+ * Where lws was built with pthreads, the batch is queued to a worker thread
+ * belonging to the cache, which sets .result in each item the same as
+ * lws_jws_confirm_sig_cached() would, and then calls \p cb **from the worker
+ * thread**.  Usually the cb should just note the batch is done and use
+ * lws_cancel_service() to get the service thread to act on the results.
+ *
+ * Without pthreads, the batch is checked inline and \p cb is called before
+ * this returns.
+ *
+ * Returns 0 if the batch was accepted, in which case \p cb will be called, or
+ * -1.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_jws_confirm_sig_batch(struct lws_jws_cache *cache,
+			  struct lws_jws_batch *items, int count,
+			  lws_jws_batch_cb cb, void *opaque);
+
 /**
  * lws_jws_sign_from_b64() - add b64 sig to b64 hdr + payload
  *
@@ -2570,6 +2671,24 @@ enum lws_context_options {
 	 * example the ACME plugin was configured to fetch a cert, this lets
 	 * you bootstrap your vhost from having no cert to start with.
 	 */
+	LWS_SERVER_OPTION_SSL_CTX_SHARE				= (1 << 27),
+	/**< (VH) If another vhost also using this option was already created
+	 * with the same TLS cert, key, CA, ciphers, ssl options and
+	 * protocols[0] callback, share its SSL_CTX instead of creating a new
+	 * one and loading the same cert and key again.  Since the shared
+	 * SSL_CTX has already been set up, the
+	 * LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS callback is not
+	 * repeated for the vhosts that share it.
+	 */
+	LWS_SERVER_OPTION_SSL_CTX_DEFER				= (1 << 28),
+	/**< (VH) Don't create the vhost SSL_CTX and load the cert + key from
+	 * the filesystem when the vhost is created.  Instead, it's done for
+	 * all such vhosts in parallel by lws_tls_vhosts_prepare(), or if that
+	 * is never called, on demand the first time SNI selects the vhost
+	 * or a connection is accepted on it.  Requires both
+	 * .ssl_cert_filepath and .ssl_private_key_filepath, otherwise the
+	 * SSL_CTX is created immediately as usual.
+	 */
 
 	/****** add new things just above ---^ ******/
 };
@@ -2578,6 +2697,35 @@ enum lws_context_options {
 
 struct lws_plat_file_ops;
 
+#define LWS_TLS_TICKET_KEY_LEN 80 /* 16 name + 32 HMAC + 32 AES-256 */
+
+/** struct lws_tls_session_ops - external TLS server session store
+ *
+ * Optional callbacks letting the server TLS session cache and ticket keys
+ * be shared with other processes or machines, eg, via memcached.  Any
+ * member may be NULL.  The callbacks are made from the service thread
+ * doing the handshake, which may be any service thread.
+ */
+struct lws_tls_session_ops {
+	int (*store)(struct lws_context *context, const uint8_t *id,
+		     size_t id_len, const uint8_t *sess, size_t sess_len,
+		     int timeout_secs);
+	/**< store the DER serialized session sess under session id */
+	int (*lookup)(struct lws_context *context, const uint8_t *id,
+		      size_t id_len, uint8_t *sess, size_t *sess_len);
+	/**< copy the DER session stored under id into sess, *sess_len is the
+	 * space available in sess on entry and should be set to the length
+	 * used.  Return 0 if found, nonzero if not. */
+	void (*remove)(struct lws_context *context, const uint8_t *id,
+		       size_t id_len);
+	/**< the session stored under id should no longer be used */
+	int (*new_ticket_key)(struct lws_context *context, uint8_t *key,
+			      size_t len);
+	/**< fill key with LWS_TLS_TICKET_KEY_LEN bytes for the next session
+	 * ticket key, eg, from a keystore shared by all the servers.  Return
+	 * nonzero to have lws use a random key instead. */
+};
+
 /** struct lws_context_creation_info - parameters to create context and /or vhost with
  *
  * This is also used to create vhosts.... if LWS_SERVER_OPTION_EXPLICIT_VHOSTS
@@ -2717,8 +2865,9 @@ struct lws_context_creation_info {
 	/**< VHOST: pointer to optional linked list of per-vhost
 	 * options made accessible to protocols */
 	int keepalive_timeout;
-	/**< VHOST: (default = 0 = 60s) seconds to allow remote
-	 * client to hold on to an idle HTTP/1.1 connection */
+	/**< VHOST: (default = 0 = 5s) seconds to allow remote
+	 * client to hold on to an idle HTTP/1.1 connection.  Also how long
+	 * an idle LCCSCF_PIPELINE client connection is kept for reuse */
 	const char *log_filepath;
 	/**< VHOST: filepath to append logs to... this is opened before
 	 *		any dropping of initial privileges */
@@ -2756,7 +2905,9 @@ struct lws_context_creation_info {
 	 */
 	const struct lws_protocol_vhost_options *headers;
 		/**< VHOST: pointer to optional linked list of per-vhost
-		 * canned headers that are added to server responses */
+		 * canned headers that are added to server responses.  They
+		 * are encoded once when the vhost is created, so later changes
+		 * to the list are not seen. */
 
 	const struct lws_protocol_vhost_options *reject_service_keywords;
 	/**< CONTEXT: Optional list of keywords and rejection codes + text.
@@ -2865,6 +3016,103 @@ struct lws_context_creation_info {
 	/**< VHOST: If non-NULL, when asked to serve a non-existent file,
 	 *          lws attempts to server this url path instead.  Eg,
 	 *          "/404.html" */
+	int tls_ctx_build_threads;
+	/**< CONTEXT: max number of threads lws_tls_vhosts_prepare() may use to
+	 * create the SSL_CTX of vhosts using LWS_SERVER_OPTION_SSL_CTX_DEFER,
+	 * 0 defaults to 4.  Threads are only used if LWS_MAX_SMP > 1 */
+	const int *listen_fds;
+	/**< CONTEXT: NULL, or an array of listening sockets inherited from a
+	 * previous server instance, eg, from lws_listen_fds_recv().  A vhost
+	 * listening on the same address and port adopts one of these instead
+	 * of creating and binding a new listen socket.  Any left unused when
+	 * the protocols are initialized are closed.  The context takes
+	 * ownership of the fds. */
+	int count_listen_fds;
+	/**< CONTEXT: number of fds in listen_fds */
+	int tls_session_cache_size;
+	/**< VHOST: max number of sessions kept in the vhost's server TLS
+	 * session cache, which is shared by all service threads.  0 leaves
+	 * the TLS library default, -1 disables the internal cache. */
+	int tls_session_timeout;
+	/**< VHOST: lifetime in seconds of server TLS sessions and tickets,
+	 * 0 leaves the TLS library default (usually 300s) */
+	const struct lws_tls_session_ops *tls_session_ops;
+	/**< CONTEXT: NULL, or callbacks for an external TLS session store
+	 * and ticket key source */
+	int tls_ticket_key_rotate_secs;
+	/**< CONTEXT: 0 leaves session tickets to the TLS library, which uses
+	 * a random key per SSL_CTX for its lifetime.  >0 means lws manages
+	 * one set of ticket keys for all vhosts and rotates it at this
+	 * interval, the previous two keys still being accepted for
+	 * resumption.  -1 disables session tickets. */
+	int tls_offload_threads;
+	/**< CONTEXT: 0 does server TLS handshakes on the service thread as
+	 * usual.  >0 starts this many worker threads (max 32) that do the
+	 * SSL_accept() steps, so the private key operations don't stall the
+	 * other connections on the service thread.  Needs the library built
+	 * with LWS_WITH_TLS_OFFLOAD and OpenSSL 1.1.0+, otherwise ignored.
+	 * The tls verify, SNI and session store callbacks may then be called
+	 * from a worker thread. */
+	int wsi_cache_per_thread;
+	/**< CONTEXT: each service thread keeps up to this many freed
+	 * connection structs, and the same number of freed per-session data
+	 * allocations of each of a few sizes, for reuse by new connections.
+	 * The same cap applies to the free lws_txn_alloc() arena chunks.
+	 * 0 defaults to 64, -1 disables the caching, eg, when debugging
+	 * use-after-free with valgrind. */
+	int h2_rx_window_max;
+	/**< VHOST: http/2 receive windows start from the initial window size,
+	 * and are doubled when the peer is seen using half of one in less
+	 * than two round trips, so uploads over long, fast paths are not held
+	 * back by flow control.  This is the most a single stream's or
+	 * connection's window may grow to, in bytes.  0 defaults to 16MiB,
+	 * -1 disables the growth. */
+	int h2_rx_window_vhost_max;
+	/**< VHOST: cap in bytes on how much all the h2 receive windows on
+	 * the vhost together may grow beyond their initial sizes, since
+	 * that's data peers may send us without waiting.  0 defaults to
+	 * 64MiB. */
+	int client_conns_per_peer;
+	/**< VHOST: LCCSCF_PIPELINE client requests to the same peer from a
+	 * service thread are spread over up to this many connections, and
+	 * only queue behind one in use when there are already this many.
+	 * 0 defaults to 1, ie, they are all serialized on one connection. */
+	unsigned int fcache_size;
+	/**< CONTEXT: 0 disables the file cache, otherwise the most bytes of
+	 * file content lws_serve_http_file() may keep in memory, shared by
+	 * all the service threads.  Files served from the cache, and 304
+	 * replies to them, need no filesystem syscalls. */
+	unsigned int fcache_file_max;
+	/**< CONTEXT: files bigger than this are not kept in the file cache.
+	 * 0 defaults to 64KiB. */
+	unsigned int fcache_ttl_secs;
+	/**< CONTEXT: a cached file is checked to still have the same size and
+	 * modification time, with stat(), when it is requested after being in
+	 * the cache this long.  So changes to files may take up to this long
+	 * to be seen.  0 defaults to 5s. */
+	unsigned int tx_coalesce_size;
+	/**< CONTEXT: 0 sends each lws_write() as it is made.  Otherwise
+	 * writes made during a WRITEABLE callback are collected in a buffer
+	 * of up to this many bytes and sent together, in as few TLS records
+	 * as the record sizing allows, when the callback returns or the
+	 * buffer is full.  The
+	 * callback may then make several writes, eg, headers and body parts.
+	 * Buffers are only held while a callback runs, and are reused.  See
+	 * lws_tx_coalesce_flush(). */
+	int tls_record_size_small;
+	/**< VHOST: a TLS record can't be decrypted until all of it arrived,
+	 * so at the start of a connection, and after it was idle, records
+	 * are kept to this much payload.  Then the peer can use the first
+	 * bytes of a response after one segment instead of a 16KiB record's
+	 * worth of round trips.  0 defaults to 1369, which fits a 1460-byte
+	 * TCP segment with the TLS overhead.  -1 disables it, writes then go
+	 * out in records of up to 16KiB. */
+	int tls_record_boost_bytes;
+	/**< VHOST: once a connection sent this many bytes in small records,
+	 * it moves to 16KiB records for throughput.  0 defaults to 64KiB. */
+	int tls_record_idle_ms;
+	/**< VHOST: a connection that wrote nothing for this long goes back
+	 * to small records.  0 defaults to 1000ms. */
 
 	/* Add new things just above here ---^
 	 * This is part of the ABI, don't needlessly break compatibility
@@ -2962,6 +3210,52 @@ lws_context_deprecate(struct lws_context *context, lws_reload_func cb);
 LWS_VISIBLE LWS_EXTERN int
 lws_context_is_deprecated(struct lws_context *context);
 
+/**
+ * lws_context_listen_fds_send() - pass the listen sockets to another process
+ *
+ * \param context: Websocket context, usually about to be deprecated
+ * \param unix_fd: connected AF_UNIX socket leading to the other process
+ * \param blob: NULL, or opaque data to send along with the fds
+ * \param blob_len: length of blob
+ *
+ *	Sends every listen socket of the context over unix_fd using
+ *	SCM_RIGHTS, so a replacement server process can adopt them with
+ *	lws_listen_fds_recv() and info.listen_fds instead of binding its own.
+ *	Because the listen sockets are never actually closed, connections
+ *	arriving during the handover wait in the accept queue instead of
+ *	being refused.
+ *
+ *	The context keeps its own copies of the fds, it's normal to call
+ *	lws_context_deprecate() afterwards, which closes them without
+ *	affecting the other process' copies.
+ *
+ *	Returns the number of fds sent, or -1 on error.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_context_listen_fds_send(struct lws_context *context, int unix_fd,
+			    const void *blob, size_t blob_len);
+
+/**
+ * lws_listen_fds_recv() - receive listen sockets from another process
+ *
+ * \param unix_fd: AF_UNIX socket leading to the old server process
+ * \param fds: array to take the received fds
+ * \param max_fds: number of entries available in fds
+ * \param blob: NULL, or buffer to take any opaque data sent with the fds
+ * \param blob_len: NULL, or on entry the size of blob, on exit the length
+ *		     of the blob data received
+ * \param timeout_ms: how long to wait for the fds to arrive
+ *
+ *	Receives the listen sockets sent by lws_context_listen_fds_send() in
+ *	the old process.  Pass them to the new context using
+ *	info.listen_fds and info.count_listen_fds.
+ *
+ *	Returns the number of fds received, or -1 on error or timeout.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_listen_fds_recv(int unix_fd, int *fds, int max_fds, void *blob,
+		    size_t *blob_len, int timeout_ms);
+
 /**
  * lws_set_proxy() - Setups proxy to lws_context.
  * \param vhost:	pointer to struct lws_vhost you want set proxy for
@@ -3017,6 +3311,77 @@ LWS_VISIBLE LWS_EXTERN struct lws_vhost *
 lws_create_vhost(struct lws_context *context,
 		 struct lws_context_creation_info *info);
 
+/**
+ * lws_tls_vhosts_prepare() - create any deferred vhost SSL_CTX now, in parallel
+ * \param context:	pointer to result of lws_create_context()
+ *
+ * Vhosts created with LWS_SERVER_OPTION_SSL_CTX_DEFER don't load their cert
+ * and key at creation time.  After creating all your vhosts, you can call
+ * this to do the expensive part of creating all their SSL_CTX, ie, loading
+ * and checking the certs and keys, on up to info.tls_ctx_build_threads
+ * threads.  The protocol callbacks about the new SSL_CTX are still made
+ * from the calling thread, after the workers completed.
+ *
+ * If you don't call it, each deferred SSL_CTX is created lazily from the
+ * service thread the first time it is needed.
+ *
+ * Returns 0 if all the deferred SSL_CTX were created OK.
+ */
+#if defined(LWS_OPENSSL_SUPPORT) && !defined(LWS_NO_SERVER)
+LWS_VISIBLE LWS_EXTERN int
+lws_tls_vhosts_prepare(struct lws_context *context);
+#else
+static LWS_INLINE int
+lws_tls_vhosts_prepare(struct lws_context *context) { (void)context; return 0; }
+#endif
+
+/**
+ * lws_tls_ticket_keys_get() - copy out the server session ticket keys
+ *
+ * \param context:	Websocket context
+ * \param buf:		destination
+ * \param len:		space in buf
+ *
+ * When lws manages the session ticket keys (info.tls_ticket_key_rotate_secs
+ * > 0), this copies the current key followed by any older keys still
+ * accepted, each LWS_TLS_TICKET_KEY_LEN bytes.  A replacement server
+ * process can apply them with lws_tls_ticket_keys_set() so tickets issued
+ * by the old process keep working.
+ *
+ * Returns the number of bytes copied, or -1 if no keys or no space.
+ */
+#if defined(LWS_OPENSSL_SUPPORT)
+LWS_VISIBLE LWS_EXTERN int
+lws_tls_ticket_keys_get(struct lws_context *context, uint8_t *buf, size_t len);
+#else
+static LWS_INLINE int
+lws_tls_ticket_keys_get(struct lws_context *context, uint8_t *buf, size_t len)
+{ (void)context; (void)buf; (void)len; return -1; }
+#endif
+
+/**
+ * lws_tls_ticket_keys_set() - replace the server session ticket keys
+ *
+ * \param context:	Websocket context
+ * \param buf:		keys as produced by lws_tls_ticket_keys_get()
+ * \param len:		length of buf, a multiple of LWS_TLS_TICKET_KEY_LEN
+ *
+ * The first key is used to issue new tickets, the rest are only accepted.
+ * The rotation timer restarts from now.
+ *
+ * Returns 0 if OK.
+ */
+#if defined(LWS_OPENSSL_SUPPORT)
+LWS_VISIBLE LWS_EXTERN int
+lws_tls_ticket_keys_set(struct lws_context *context, const uint8_t *buf,
+			size_t len);
+#else
+static LWS_INLINE int
+lws_tls_ticket_keys_set(struct lws_context *context, const uint8_t *buf,
+			size_t len)
+{ (void)context; (void)buf; (void)len; return -1; }
+#endif
+
 /**
  * lws_vhost_destroy() - Destroy a vhost (virtual server context)
  *
@@ -3266,7 +3631,21 @@ enum lws_client_connect_ssl_connection_flags {
 	LCCSCF_USE_SSL 				= (1 << 0),
 	LCCSCF_ALLOW_SELFSIGNED			= (1 << 1),
 	LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK	= (1 << 2),
-	LCCSCF_ALLOW_EXPIRED			= (1 << 3)
+	LCCSCF_ALLOW_EXPIRED			= (1 << 3),
+	LCCSCF_OFFER_H2				= (1 << 4),
+	/**< offer http/2 by ALPN on a TLS http client connection.  If the
+	 * server picks h2, this and later requests to the same address, port
+	 * and ssl flags are sent as streams on the one connection.  Ignored if
+	 * lws has no http/2 support or the TLS library can't do client ALPN. */
+	LCCSCF_PIPELINE				= (1 << 5),
+	/**< serialize this http/1.1 client request onto an existing keep-alive
+	 * connection made by an earlier request with this flag to the same
+	 * address, port, host and ssl flags on the same vhost, instead of
+	 * making a new connection.  The wsi of a completed request is not
+	 * closed right away: it keeps the connection open for up to the
+	 * vhost's keepalive_timeout so a later request can take it over, so
+	 * issue follow-on requests from LWS_CALLBACK_COMPLETED_CLIENT_HTTP
+	 * rather than LWS_CALLBACK_CLOSED_CLIENT_HTTP. */
 };
 
 /** struct lws_client_connect_info - parameters to connect with when using
@@ -3578,6 +3957,10 @@ lws_cancel_service_pt(struct lws *wsi);
  *
  * lws_cancel_service() may be called from another thread while the context
  * exists, and its effect will be immediately serialized.
+ *
+ * Calls made while a service thread has already been signalled, but has not
+ * yet got around to issuing the LWS_CALLBACK_EVENT_WAIT_CANCELLED, are
+ * coalesced into that one pending callback.
  */
 LWS_VISIBLE LWS_EXTERN void
 lws_cancel_service(struct lws_context *context);
@@ -4057,6 +4440,7 @@ lws_get_urlarg_by_name(struct lws *wsi, const char *name, char *buf, int len);
 
 #define LWSAHH_CODE_MASK			((1 << 16) - 1)
 #define LWSAHH_FLAG_NO_SERVER_NAME		(1 << 30)
+#define LWSAHH_FLAG_NO_DATE			(1 << 29)
 
 /**
  * lws_add_http_header_status() - add the HTTP response status code
@@ -4066,11 +4450,16 @@ lws_get_urlarg_by_name(struct lws *wsi, const char *name, char *buf, int len);
  * \param p: pointer to current position in buffer pointer
  * \param end: pointer to end of buffer
  *
- * Adds the initial response code, so should be called first.
+ * Adds the initial response code, so should be called first.  It's followed
+ * by the vhost's constant headers, ie, Server, any from the creation info
+ * .headers, and Strict-Transport-Security if the vhost has
+ * LWS_SERVER_OPTION_STS, and a Date header.
  *
  * Code may additionally take OR'd flags:
  *
  *    LWSAHH_FLAG_NO_SERVER_NAME:  don't apply server name header this time
+ *    LWSAHH_FLAG_NO_DATE:  don't apply the Date header this time, eg, because
+ *			    the caller is passing through its own
  */
 LWS_VISIBLE LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_add_http_header_status(struct lws *wsi,
@@ -4222,6 +4611,10 @@ enum lws_spa_fileupload_states {
  *
  * Notice name and filename shouldn't be trusted, as they are passed from
  * HTTP provided by the client.
+ *
+ * File content is usually passed straight from the buffer given to
+ * lws_spa_process() rather than copied, so \p buf may be much larger than
+ * the spa's max_storage and must be treated as read-only.
  */
 typedef int (*lws_spa_fileupload_cb)(void *data, const char *name,
 			const char *filename, char *buf, int len,
@@ -4383,6 +4776,24 @@ lws_http_redirect(struct lws *wsi, int code, const unsigned char *loc, int len,
  */
 LWS_VISIBLE LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_http_transaction_completed(struct lws *wsi);
+
+/**
+ * lws_txn_alloc() - allocate memory that lives for the current transaction
+ * \param wsi:	connection the allocation belongs to
+ * \param size:	bytes needed
+ *
+ *	Returns 8-byte aligned memory that is NOT zeroed, or NULL on OOM.
+ *
+ *	There's no way to free it individually, everything allocated this way
+ *	on the wsi is released in one go when the http transaction completes,
+ *	or when the wsi closes, whichever comes first.  Don't keep pointers
+ *	into it across lws_http_transaction_completed().
+ *
+ *	Small allocations are bumped out of a per-thread pool of chunks, so
+ *	it is much cheaper than malloc() for short-lived per-request data.
+ */
+LWS_VISIBLE LWS_EXTERN void *
+lws_txn_alloc(struct lws *wsi, size_t size);
 ///@}
 
 /*! \defgroup pur Sanitize / purify SQL and JSON helpers
@@ -4555,6 +4966,7 @@ enum pending_timeout {
 	PENDING_TIMEOUT_KILLED_BY_PARENT			= 23,
 	PENDING_TIMEOUT_CLOSE_SEND				= 24,
 	PENDING_TIMEOUT_HOLDING_AH				= 25,
+	PENDING_TIMEOUT_CLIENT_CONN_IDLE			= 26,
 
 	/****** add new things just above ---^ ******/
 
@@ -4604,8 +5016,8 @@ lws_set_timeout(struct lws *wsi, enum pending_timeout reason, int secs);
  *
  *  default poll() loop:   yes
  *  libuv event loop:      yes
- *  libev:    not implemented (patch welcome)
- *  libevent: not implemented (patch welcome)
+ *  libev:                 yes
+ *  libevent:              yes
  *
  * After the deadline expires, the wsi will get a callback of type
  * LWS_CALLBACK_TIMER and the timer is exhausted.  The deadline may be
@@ -4826,6 +5238,21 @@ lws_write(struct lws *wsi, unsigned char *buf, size_t len,
 /* helper for case where buffer may be const */
 #define lws_write_http(wsi, buf, len) \
 	lws_write(wsi, (unsigned char *)(buf), len, LWS_WRITE_HTTP)
+
+/**
+ * lws_tx_coalesce_flush() - send what was written so far in this callback
+ *
+ * \param wsi: lws connection
+ *
+ * When the context was created with a nonzero info.tx_coalesce_size, writes
+ * made in a WRITEABLE callback are held back until it returns, so they can
+ * go out in one send.  This sends anything held so far immediately, eg,
+ * before the callback does something slow.  It does nothing otherwise.
+ *
+ * Returns 0, or -1 if the connection failed.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_tx_coalesce_flush(struct lws *wsi);
 ///@}
 
 /** \defgroup callback-when-writeable Callback when writeable
@@ -5153,6 +5580,10 @@ typedef enum {
 					 *   if given must be only flag
 					 *   wsi put directly into ws mode
 					 */
+	LWS_ADOPT_FLAG_UDP = 16,	/* flag: socket is UDP, datagram mode
+					 *   requires LWS_ADOPT_SOCKET, implies
+					 *   RAW, no tls
+					 */
 } lws_adoption_type;
 
 typedef union {
@@ -5178,12 +5609,58 @@ typedef union {
 *
 * parent may be NULL, if given it should be an existing wsi that will become the
 * parent of the new wsi created by this call.
+*
+* If LWS_ADOPT_FLAG_UDP is also set, the socket is a bound (and usually
+* unconnected) UDP socket, adopted in RAW datagram mode.  Each datagram
+* arrives as its own LWS_CALLBACK_RAW_RX, up to 16 of them drained per
+* wakeup with recvmmsg() where the platform has it; lws_udp_peer() tells you
+* who sent the one being delivered.  Don't use lws_write() on it, queue
+* datagrams with lws_udp_send() instead.  The rx buffer for each datagram is
+* the protocol's rx_buffer_size, or the context pt_serv_buf_size if that is
+* zero; larger datagrams are dropped.
 */
 LWS_VISIBLE LWS_EXTERN struct lws *
 lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
 			   lws_sock_file_fd_type fd, const char *vh_prot_name,
 			   struct lws *parent);
 
+/**
+ * lws_udp_peer() - address of the peer that sent the current UDP datagram
+ *
+ * \param wsi:	wsi adopted with LWS_ADOPT_FLAG_UDP
+ * \param salen:	NULL, or set to the length of the returned sockaddr
+ *
+ * Returns the source address of the datagram being delivered in
+ * LWS_CALLBACK_RAW_RX.  Returns NULL outside of that callback, or if wsi is
+ * not a UDP wsi; keep a copy of the address if you want to send to it later.
+ */
+LWS_VISIBLE LWS_EXTERN const struct sockaddr *
+lws_udp_peer(struct lws *wsi, size_t *salen);
+
+/**
+ * lws_udp_send() - queue a datagram on a UDP wsi
+ *
+ * \param wsi:	wsi adopted with LWS_ADOPT_FLAG_UDP
+ * \param buf:	datagram payload, copied
+ * \param len:	datagram length
+ * \param sa:	NULL to reply to lws_udp_peer(), else the destination
+ * \param salen:	length of sa
+ *
+ * Returns 0 if queued, 1 if the send queue (128 datagrams) is full and
+ * nothing was queued, or -1 on error.  sa may only be NULL from inside
+ * LWS_CALLBACK_RAW_RX, elsewhere there's no current peer and it fails with -1.
+ *
+ * The queue is flushed with sendmmsg() where available, as many datagrams
+ * per syscall as the socket will take.  Anything queued from RAW_RX is sent
+ * at the end of that rx batch, otherwise it goes when the socket is next
+ * writeable.  LWS_CALLBACK_RAW_WRITEABLE is only issued once the queue has
+ * emptied, which also happens if the queue was what asked for POLLOUT, so
+ * the callback must cope with being called when it has nothing to send.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_udp_send(struct lws *wsi, const void *buf, size_t len,
+	     const struct sockaddr *sa, size_t salen);
+
 /**
  * lws_adopt_socket_readbuf() - adopt foreign socket and first rx as if listen socket accepted it
  * for the default vhost of context.
@@ -6001,10 +6478,91 @@ lws_tls_cert_updated(struct lws_context *context, const char *certpath,
  *  still unread by anyone.
  *
  *   - lws_ring_update_oldest_tail()
+ *
+ *  Normal lws_ring are not threadsafe, if other threads touch them you must
+ *  serialize all access with your own lock.  For the common case of one or
+ *  more foreign threads producing into a ring that is consumed from the lws
+ *  service thread, you can instead create it with
+ *
+ *   - lws_ring_create_lockfree()
+ *
+ *  giving LWS_RING_SPSC (exactly one producer thread) or LWS_RING_MPSC (any
+ *  number of producer threads).  Then inserts need no lock, and neither do the
+ *  consumers, so long as all the tails are only used from the one consumer
+ *  thread.  The rest of the api, including multiple tails and the
+ *  destroy_element callback, is used the same way.  After inserting, the
+ *  producer can call lws_cancel_service() to have the service thread learn
+ *  about it via LWS_CALLBACK_EVENT_WAIT_CANCELLED... those wakes are coalesced,
+ *  so a burst of inserts costs one wake of the service thread, not one each.
+ *
+ *  Instead of managing the tails and the oldest tail yourself, on normal rings
+ *  you can register a struct lws_ring_consumer for each consumer
+ *
+ *   - lws_ring_consumer_add()
+ *   - lws_ring_consumer_get_element()
+ *   - lws_ring_consumer_consume()
+ *   - lws_ring_consumer_remove()
+ *
+ *  Then the ring tracks the oldest tail itself, and each consumer has a
+ *  policy for when it falls behind: hold its elements until it reads them,
+ *  lose its oldest elements when the ring is full, or with
+ *  lws_ring_set_conflation_key(), only get the latest element for each key.
+ *  Consumers can also be evicted when they lag by more than a given number
+ *  of elements.  That way one slow consumer doesn't have to hold up the
+ *  producer and every other consumer.
  */
 ///@{
 struct lws_ring;
 
+enum lws_ring_consumer_policy {
+	LWS_RING_CP_BLOCK,
+	/**< elements stay in the ring until the consumer reads them, so
+	 * inserting into a full ring fails, as with unregistered tails */
+	LWS_RING_CP_DROP_OLDEST,
+	/**< if the ring is full when inserting, the consumer loses its oldest
+	 * unread elements to make space */
+	LWS_RING_CP_CONFLATE,
+	/**< the consumer skips any element that a later element with the
+	 * same key replaced, including to make space when inserting into a
+	 * full ring.  Otherwise it behaves like LWS_RING_CP_BLOCK */
+};
+
+/**
+ * struct lws_ring_consumer - a consumer registered with a ring
+ *
+ * Usually embedded in your pss, and set up by lws_ring_consumer_add().  The
+ * counters may be read at any time to see how the consumer is keeping up.
+ */
+struct lws_ring_consumer {
+	struct lws_ring_consumer *next; /**< private to lws_ring */
+	uint32_t tail;
+	/**< the consumer's tail, you can use it with
+	 * lws_ring_get_count_waiting_elements() to find its current lag */
+	uint32_t lag_limit;
+	/**< evict the consumer if it would have more than this many elements
+	 * waiting, or 0 for no limit */
+	uint32_t lag_max;
+	/**< the most elements that have been waiting for the consumer */
+	uint32_t dropped;
+	/**< LWS_RING_CP_DROP_OLDEST: elements it lost to make space */
+	uint32_t conflated;
+	/**< LWS_RING_CP_CONFLATE: replaced elements it skipped */
+	uint8_t policy;
+	/**< enum lws_ring_consumer_policy */
+	uint8_t evicted;
+	/**< it went over its lag_limit, and was removed from the ring.  It
+	 * gets no more elements, you should close the connection */
+};
+
+enum lws_ring_flags {
+	LWS_RING_SPSC		= (1 << 0),
+	/**< exactly one producer thread inserts, one consumer thread uses
+	 * the tails */
+	LWS_RING_MPSC		= (1 << 1),
+	/**< any number of producer threads insert, one consumer thread uses
+	 * the tails */
+};
+
 /**
  * lws_ring_create(): create a new ringbuffer
  *
@@ -6026,6 +6584,33 @@ LWS_VISIBLE LWS_EXTERN struct lws_ring *
 lws_ring_create(size_t element_len, size_t count,
 		void (*destroy_element)(void *element));
 
+/**
+ * lws_ring_create_lockfree(): create a new ringbuffer usable across threads
+ *
+ * \param element_len: the size in bytes of one element in the ringbuffer
+ * \param count: the minimum number of elements the ringbuffer can contain
+ * \param destroy_element: NULL, or callback to be called for each element
+ *			   that is removed from the ringbuffer due to the
+ *			   oldest tail moving beyond it
+ * \param flags: LWS_RING_SPSC or LWS_RING_MPSC
+ *
+ * Like lws_ring_create(), but the ring may be inserted into from other
+ * threads without locking, and consumed from one thread without locking.
+ *
+ * count is rounded up to the next power of two, and unlike lws_ring_create()
+ * all of the elements are usable.  destroy_element is called on the consumer
+ * thread.
+ *
+ * lws_ring_next_linear_insert_range() and lws_ring_bump_head() can only be
+ * used on LWS_RING_SPSC rings, and must be given whole elements.
+ *
+ * Returns NULL if the allocation failed, or if the toolchain lws was built
+ * with doesn't provide the atomics needed.
+ */
+LWS_VISIBLE LWS_EXTERN struct lws_ring *
+lws_ring_create_lockfree(size_t element_len, size_t count,
+			 void (*destroy_element)(void *element), int flags);
+
 /**
  * lws_ring_destroy():  destroy a previously created ringbuffer
  *
@@ -6229,6 +6814,86 @@ lws_ring_dump(struct lws_ring *ring, uint32_t *tail);
 	lws_ring_consume(___ring, ___ptail, NULL, ___count); \
 	lws_ring_update_oldest_tail(___ring, *(___ptail)); \
 }
+
+/**
+ * lws_ring_set_conflation_key():  enable conflation by key on a ring
+ *
+ * \param ring: the struct lws_ring to operate on
+ * \param key: callback returning the key for an element in the ring
+ *
+ * Elements with the same key are treated as updates of the same thing, so
+ * consumers with LWS_RING_CP_CONFLATE can skip any element a later one with
+ * the same key replaced.  Different things must have different keys.
+ *
+ * Must be called before anything is inserted.  Normal rings only, returns
+ * nonzero if it failed.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_ring_set_conflation_key(struct lws_ring *ring,
+			    uint64_t (*key)(const void *element));
+
+/**
+ * lws_ring_consumer_add():  register a consumer with its own tail and policy
+ *
+ * \param ring: the struct lws_ring to operate on
+ * \param c: the consumer struct to initialize and register
+ * \param policy: what happens to the consumer's unread elements when the ring
+ *		  is full, one of enum lws_ring_consumer_policy
+ * \param lag_limit: 0, or evict the consumer when it would have more than this
+ *		     many elements waiting
+ *
+ * The consumer starts from the oldest element still in the ring.  While a
+ * ring has registered consumers, it tracks the oldest tail itself, so you
+ * should only consume using lws_ring_consumer_consume(), and not call
+ * lws_ring_update_oldest_tail() or its helpers on it.  Producers should use
+ * lws_ring_insert(), which applies the policies to make space if needed.
+ *
+ * Normal rings only, returns nonzero if it failed.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_ring_consumer_add(struct lws_ring *ring, struct lws_ring_consumer *c,
+		      enum lws_ring_consumer_policy policy, uint32_t lag_limit);
+
+/**
+ * lws_ring_consumer_remove():  unregister a consumer
+ *
+ * \param ring: the struct lws_ring to operate on
+ * \param c: the consumer to remove
+ *
+ * Elements that were only waiting for this consumer are freed.  It's OK to
+ * call this on a consumer that was already evicted.
+ */
+LWS_VISIBLE LWS_EXTERN void
+lws_ring_consumer_remove(struct lws_ring *ring, struct lws_ring_consumer *c);
+
+/**
+ * lws_ring_consumer_get_element():  get the next element for a consumer
+ *
+ * \param ring: the struct lws_ring to operate on
+ * \param c: the consumer
+ *
+ * Like lws_ring_get_element(), returns NULL if nothing is waiting for the
+ * consumer, or if it was evicted.  Use lws_ring_consumer_consume() with NULL
+ * dest when you are done with the element.
+ */
+LWS_VISIBLE LWS_EXTERN const void *
+lws_ring_consumer_get_element(struct lws_ring *ring,
+			      struct lws_ring_consumer *c);
+
+/**
+ * lws_ring_consumer_consume():  consume elements for a consumer
+ *
+ * \param ring: the struct lws_ring to operate on
+ * \param c: the consumer
+ * \param dest: where to copy the elements, or NULL to only consume them
+ * \param max_count: the most elements to consume
+ *
+ * Like lws_ring_consume() followed by updating the oldest tail if it was this
+ * consumer's.  Returns the number of elements consumed.
+ */
+LWS_VISIBLE LWS_EXTERN size_t
+lws_ring_consumer_consume(struct lws_ring *ring, struct lws_ring_consumer *c,
+			  void *dest, size_t max_count);
 ///@}
 
 /** \defgroup sha SHA and B64 helpers
@@ -6813,7 +7478,8 @@ enum lejp_reasons {
 	LEJP_REJECT_NUM_TOO_LONG = -20,
 	LEJP_REJECT_MP_C_OR_E_NEITHER = -21,
 	LEJP_REJECT_UNKNOWN = -22,
-	LEJP_REJECT_CALLBACK = -23
+	LEJP_REJECT_CALLBACK = -23,
+	LEJP_REJECT_MP_STRING_TOO_LONG = -24
 };
 
 #define LEJP_FLAG_CB_IS_VALUE 64
@@ -6949,6 +7615,8 @@ struct lejp_ctx {
 
 	/* arrays */
 
+	uint64_t pmask[LEJP_MAX_DEPTH]; /* paths[0..63] still possible */
+	uint64_t plit[LEJP_MAX_DEPTH]; /* ... and no * before this level */
 	struct _lejp_stack st[LEJP_MAX_DEPTH];
 	uint16_t i[LEJP_MAX_INDEX_DEPTH]; /* index array */
 	uint16_t wild[LEJP_MAX_INDEX_DEPTH]; /* index array */
@@ -7030,21 +7698,57 @@ enum {
 	LWSSTATS_MS_SSL_RX_DELAY, /**< aggregate delay between ssl accept complete and first RX */
 	LWSSTATS_C_PEER_LIMIT_AH_DENIED, /**< number of times we would have given an ah but for the peer limit */
 	LWSSTATS_C_PEER_LIMIT_WSI_DENIED, /**< number of times we would have given a wsi but for the peer limit */
+	LWSSTATS_C_SSL_SESSIONS_RESUMED, /**< count of accepted SSL conns that resumed a session, from the cache or a ticket */
+	LWSSTATS_C_SSL_SESSION_EXT_HITS, /**< count of sessions found in the external session store */
+	LWSSTATS_C_TLS_RECORDS_SMALL, /**< count of TLS records written with up to the small record size of payload */
+	LWSSTATS_C_TLS_RECORDS_MEDIUM, /**< count of TLS records written bigger than small, but less than 16KiB */
+	LWSSTATS_C_TLS_RECORDS_FULL, /**< count of 16KiB TLS records written */
 
 	/* Add new things just above here ---^
 	 * This is part of the ABI, don't needlessly break compatibility */
 	LWSSTATS_SIZE
 };
 
+/*
+ * Latency histograms, all in microseconds.  These are also exported in
+ * lws_json_dump_context() as count, sum, percentiles and nonempty buckets.
+ */
+
+enum {
+	LWSSTATS_H_WRITABLE_DELAY, /**< delay between asking for writable and getting cb */
+	LWSSTATS_H_SSL_ACCEPT_DELAY, /**< time from first SSL_accept() to accepted */
+	LWSSTATS_H_HDR_PARSE, /**< time spent in the http header parser per request */
+	LWSSTATS_H_CALLBACK, /**< duration of user rx and writable callbacks */
+
+	/* Add new things just above here ---^
+	 * This is part of the ABI, don't needlessly break compatibility */
+	LWSSTATS_H_SIZE
+};
+
 #if defined(LWS_WITH_STATS)
 
 LWS_VISIBLE LWS_EXTERN uint64_t
 lws_stats_get(struct lws_context *context, int index);
+/**
+ * lws_stats_hist_percentile() - estimate a latency percentile from a histogram
+ *
+ * \param context: the context
+ * \param index: LWSSTATS_H_ histogram index
+ * \param permille: the percentile wanted, in 1/1000 units, eg, 990 for p99
+ *
+ * Returns the lower bound in us of the histogram bucket containing the
+ * requested percentile, summed across all service threads, or 0 if the
+ * histogram is empty.
+ */
+LWS_VISIBLE LWS_EXTERN uint64_t
+lws_stats_hist_percentile(struct lws_context *context, int index, int permille);
 LWS_VISIBLE LWS_EXTERN void
 lws_stats_log_dump(struct lws_context *context);
 #else
 static LWS_INLINE uint64_t
 lws_stats_get(struct lws_context *context, int index) { (void)context; (void)index;  return 0; }
+static LWS_INLINE uint64_t
+lws_stats_hist_percentile(struct lws_context *context, int index, int permille) { (void)context; (void)index; (void)permille; return 0; }
 static LWS_INLINE void
 lws_stats_log_dump(struct lws_context *context) { (void)context; }
 #endif
@@ -49,16 +49,57 @@ static const char encode_url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 static const char decode[] = "|$$$}rstuvwxyz{$$$$$$$>?@ABCDEFGHIJKLMNOPQRSTUVW"
 			     "$$$$$$XYZ[\\]^_`abcdefghijklmnopq";
 
+/*
+ * for the whole-quad fast path, both alphabets: 0 - 63, or 255 for anything
+ * that needs the slow path's handling, including '=' and NUL
+ */
+#define XX 255
+static const unsigned char decode_fast[] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, 62, XX, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, XX, XX, XX,
+	XX,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, 63,
+	XX, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+#undef XX
+
 static int
 _lws_b64_encode_string(const char *encode, const char *in, int in_len,
 		       char *out, int out_size)
 {
+	const unsigned char *u;
 	unsigned char triple[3];
 	int i;
 	int len;
 	int line = 0;
 	int done = 0;
 
+	/* whole triples first, without the per-byte padding decisions */
+
+	while (in_len >= 3 && done + 4 < out_size) {
+		u = (const unsigned char *)in;
+
+		*out++ = encode[u[0] >> 2];
+		*out++ = encode[((u[0] & 0x03) << 4) | (u[1] >> 4)];
+		*out++ = encode[((u[1] & 0x0f) << 2) | (u[2] >> 6)];
+		*out++ = encode[u[2] & 0x3f];
+
+		in += 3;
+		in_len -= 3;
+		done += 4;
+	}
+
 	while (in_len) {
 		len = 0;
 		for (i = 0; i < 3; i++) {
@@ -115,11 +156,37 @@ lws_b64_encode_string_url(const char *in, int in_len, char *out, int out_size)
 static int
 _lws_b64_decode_string(const char *in, int in_len, char *out, int out_size)
 {
+	const unsigned char *u;
 	int len, i, c = 0, done = 0;
-	unsigned char v, quad[4];
+	unsigned char v, quad[4], fq[4];
 
 	while (in_len && *in) {
 
+		/*
+		 * Fast path for four ordinary chars that aren't the end...
+		 * checking each one in turn also stops us reading past a NUL
+		 */
+
+		u = (const unsigned char *)in;
+		while ((in_len < 0 || in_len >= 4) && done + 3 <= out_size &&
+		       (fq[0] = decode_fast[u[0]]) != 255 &&
+		       (fq[1] = decode_fast[u[1]]) != 255 &&
+		       (fq[2] = decode_fast[u[2]]) != 255 &&
+		       (fq[3] = decode_fast[u[3]]) != 255) {
+			*out++ = fq[0] << 2 | fq[1] >> 4;
+			*out++ = fq[1] << 4 | fq[2] >> 2;
+			*out++ = fq[2] << 6 | fq[3];
+			/* the slow path may reuse these for a short quad */
+			memcpy(quad, fq, 4);
+			u += 4;
+			if (in_len > 0)
+				in_len -= 4;
+			done += 3;
+		}
+		in = (const char *)u;
+		if (!in_len || !*in)
+			break;
+
 		len = 0;
 		for (i = 0; i < 4 && in_len && *in; i++) {
 
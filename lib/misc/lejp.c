@@ -53,6 +53,9 @@ lejp_construct(struct lejp_ctx *ctx,
 	ctx->user = user;
 	ctx->paths = paths;
 	ctx->count_paths = count_paths;
+	ctx->pmask[0] = count_paths >= 64 ? ~(uint64_t)0 :
+					    ((uint64_t)1 << count_paths) - 1;
+	ctx->plit[0] = 0;
 	ctx->line = 1;
 	ctx->callback(ctx, LEJPCB_CONSTRUCTED);
 }
@@ -106,39 +109,124 @@ lejp_change_callback(struct lejp_ctx *ctx,
 	ctx->callback(ctx, LEJPCB_START);
 }
 
+/*
+ * Match the path against the pattern q, starting at offset off into both:
+ * the caller knows they are identical before that.  If wild is non-NULL,
+ * the offsets into path matched by each * are recorded there.
+ *
+ * With prefix set, path is only the start of a path, ending in '.'.  Then we
+ * return whether any path starting with it could match q.
+ */
+
+static int
+lejp_path_cmp(const char *path, int off, const char *q, uint16_t *wild,
+	      uint8_t *wildcount, int prefix)
+{
+	const char *p = path + off;
+
+	q += off;
+
+	while (*p && *q) {
+		if (*q != '*') {
+			if (*p != *q)
+				return 0;
+			p++;
+			q++;
+			continue;
+		}
+		if (wild)
+			wild[(*wildcount)++] = p - path;
+		q++;
+		/*
+		 * if * has something after it, match to .
+		 * if ends with *, eat everything.
+		 * This implies match sequences must be ordered like
+		 *  x.*.*
+		 *  x.*
+		 * if both options are possible
+		 */
+		while (*p && (*p != '.' || !*q))
+			p++;
+	}
+
+	if (prefix)
+		return !*p;
+
+	return !*p && !*q;
+}
+
+/*
+ * We just opened an object at ctx->sp.  Every member name inside it will be
+ * prefixed by the current path plus '.', so we can rule out the paths that
+ * can't match anything with that prefix once here, instead of trying them
+ * again for every member.  The survivors that have no * in the prefix part
+ * are also marked in plit, so later we can compare only the part after it.
+ *
+ * Only the first 64 paths are tracked this way, any beyond that are always
+ * tried in full.
+ */
+
 static void
-lejp_check_path_match(struct lejp_ctx *ctx)
+lejp_narrow_paths(struct lejp_ctx *ctx)
 {
-	const char *p, *q;
+	uint64_t m = ctx->pmask[ctx->sp], lit = 0, b;
 	int n;
 
+	ctx->plit[ctx->sp] = 0;
+
+	if (!ctx->ppos || ctx->ppos + 1 >= (int)sizeof(ctx->path))
+		return;
+
+	ctx->path[ctx->ppos] = '.';
+	ctx->path[ctx->ppos + 1] = '\0';
+
+	for (n = 0; n < 64 && m >> n; n++) {
+		b = (uint64_t)1 << n;
+		if (!(m & b))
+			continue;
+		if (!lejp_path_cmp(ctx->path, 0, ctx->paths[n], NULL, NULL, 1))
+			m &= ~b;
+		else
+			if (strcspn(ctx->paths[n], "*") > ctx->ppos)
+				lit |= b;
+	}
+
+	ctx->path[ctx->ppos] = '\0';
+	ctx->pmask[ctx->sp] = m;
+	ctx->plit[ctx->sp] = lit;
+}
+
+/*
+ * The path must still start with the prefix pmask[level] was narrowed for.
+ * That's true for the current level while a member name or value is being
+ * parsed, but after an object closes the path is cut back to the prefix of
+ * the level below.
+ */
+
+static void
+lejp_check_path_match(struct lejp_ctx *ctx, int level)
+{
+	uint64_t m = ctx->pmask[level], b;
+	int n, off;
+
 	/* we only need to check if a match is not active */
 	for (n = 0; !ctx->path_match && n < ctx->count_paths; n++) {
-		ctx->wildcount = 0;
-		p = ctx->path;
-		q = ctx->paths[n];
-		while (*p && *q) {
-			if (*q != '*') {
-				if (*p != *q)
-					break;
-				p++;
-				q++;
+		off = 0;
+		if (n < 64) {
+			b = (uint64_t)1 << n;
+			if (!(m & b)) {
+				if (!(m >> n))
+					n = 63; /* nothing else tracked */
 				continue;
 			}
-			ctx->wild[ctx->wildcount++] = p - ctx->path;
-			q++;
-			/*
-			 * if * has something after it, match to .
-			 * if ends with *, eat everything.
-			 * This implies match sequences must be ordered like
-			 *  x.*.*
-			 *  x.*
-			 * if both options are possible
-			 */
-			while (*p && (*p != '.' || !*q))
-				p++;
+			if (ctx->plit[level] & b)
+				/* the path prefix is known to match */
+				off = (unsigned char)ctx->st[level - 1].p + 1;
 		}
-		if (*p || *q)
+
+		ctx->wildcount = 0;
+		if (!lejp_path_cmp(ctx->path, off, ctx->paths[n], ctx->wild,
+				   &ctx->wildcount, 0))
 			continue;
 
 		ctx->path_match = n + 1;
@@ -150,6 +238,38 @@ lejp_check_path_match(struct lejp_ctx *ctx)
 		ctx->wildcount = 0;
 }
 
+/*
+ * Return how many bytes from p are plain string content, that needs no
+ * action besides copying: anything except '"', '\\' and control chars.
+ * We look at a word at a time while there's nothing interesting in it.
+ */
+
+static int
+lejp_string_run(const unsigned char *p, int len)
+{
+	const uint64_t ones = 0x0101010101010101ull, highs = ones << 7;
+	const unsigned char *op = p;
+	uint64_t w, x;
+
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		/* bytes < 0x20 */
+		x = (w - ones * 0x20) & ~w;
+		/* bytes == '"' or '\\' */
+		x |= ((w ^ (ones * '"')) - ones) & ~(w ^ (ones * '"'));
+		x |= ((w ^ (ones * '\\')) - ones) & ~(w ^ (ones * '\\'));
+		if (x & highs)
+			break;
+		p += 8;
+		len -= 8;
+	}
+
+	while (len-- && *p != '"' && *p != '\\' && *p >= ' ')
+		p++;
+
+	return lws_ptr_diff(p, op);
+}
+
 int
 lejp_get_wildcard(struct lejp_ctx *ctx, int wildcard, char *dest, int len)
 {
@@ -189,7 +309,7 @@ lejp_get_wildcard(struct lejp_ctx *ctx, int wildcard, char *dest, int len)
 int
 lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 {
-	unsigned char c, n, s, ret = LEJP_REJECT_UNKNOWN;
+	unsigned char c, n, m, s, ret = LEJP_REJECT_UNKNOWN;
 	static const char esc_char[] = "\"\\/bfnrt";
 	static const char esc_tran[] = "\"\\/\b\f\n\r\t";
 	static const char tokens[] = "rue alse ull ";
@@ -211,12 +331,27 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 				if (c == '#')
 					ctx->st[ctx->sp].s |=
 						LEJP_FLAG_WS_COMMENTLINE;
+				else
+					/* skip any indentation in one go */
+					while (len && (*json == ' ' ||
+						       *json == '\t')) {
+						json++;
+						len--;
+					}
 				continue;
 			}
 		}
 
-		if (ctx->st[ctx->sp].s & LEJP_FLAG_WS_COMMENTLINE)
+		if (ctx->st[ctx->sp].s & LEJP_FLAG_WS_COMMENTLINE) {
+			/* the rest of the comment is of no interest */
+			const unsigned char *nl = memchr(json, '\n', len);
+
+			if (!nl)
+				return LEJP_CONTINUE;
+			len -= lws_ptr_diff(nl, json);
+			json = nl;
 			continue;
+		}
 
 		switch (s) {
 		case LEJP_IDLE:
@@ -274,7 +409,45 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 				ret = LEJP_REJECT_MP_ILLEGAL_CTRL;
 				goto reject;
 			}
-			goto emit_string_char;
+			/*
+			 * c is plain string content... copy it and any more
+			 * plain content following it in one go
+			 */
+			json--;
+			len++;
+			n = (unsigned char)lejp_string_run(json, len > 255 ?
+							   255 : len);
+			if (ctx->sp && ctx->st[ctx->sp - 1].s == LEJP_MP_DELIM) {
+				/* name part of name:value pair */
+				if (n > (int)sizeof(ctx->path) - 2 - ctx->ppos) {
+					ret = LEJP_REJECT_MP_STRING_TOO_LONG;
+					goto reject;
+				}
+				memcpy(&ctx->path[ctx->ppos], json, n);
+				ctx->ppos += n;
+				json += n;
+				len -= n;
+				continue;
+			}
+			while (n) {
+				m = sizeof(ctx->buf) - 1 - ctx->npos;
+				if (m > n)
+					m = n;
+				memcpy(&ctx->buf[ctx->npos], json, m);
+				ctx->npos += m;
+				json += m;
+				len -= m;
+				n -= m;
+				if (ctx->npos == sizeof(ctx->buf) - 1) {
+					if (ctx->callback(ctx,
+						      LEJPCB_VAL_STR_CHUNK)) {
+						ret = LEJP_REJECT_CALLBACK;
+						goto reject;
+					}
+					ctx->npos = 0;
+				}
+			}
+			continue;
 
 		case LEJP_MP_STRING_ESC:
 			if (c == 'u') {
@@ -365,7 +538,7 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 			ctx->st[ctx->sp].s = LEJP_MP_VALUE;
 			ctx->path[ctx->ppos] = '\0';
 
-			lejp_check_path_match(ctx);
+			lejp_check_path_match(ctx, ctx->sp);
 			if (ctx->callback(ctx, LEJPCB_PAIR_NAME)) {
 				ret = LEJP_REJECT_CALLBACK;
 				goto reject;
@@ -397,7 +570,7 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 				/* push */
 				ctx->st[ctx->sp].s = LEJP_MP_COMMA_OR_END;
 				c = LEJP_MEMBERS;
-				lejp_check_path_match(ctx);
+				lejp_check_path_match(ctx, ctx->sp);
 				if (ctx->callback(ctx, LEJPCB_OBJECT_START)) {
 					ret = LEJP_REJECT_CALLBACK;
 					goto reject;
@@ -424,6 +597,10 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 				goto add_stack_level;
 
 			case ']':
+				if (!ctx->sp) {
+					ret = LEJP_REJECT_MP_C_OR_E_UNDERF;
+					goto reject;
+				}
 				/* pop */
 				ctx->sp--;
 				if (ctx->st[ctx->sp].s != LEJP_MP_ARRAY_END) {
@@ -431,8 +608,10 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 					goto reject;
 				}
 				/* drop the path [n] bit */
-				ctx->ppos = ctx->st[ctx->sp - 1].p;
-				ctx->ipos = ctx->st[ctx->sp - 1].i;
+				if (ctx->sp) {
+					ctx->ppos = ctx->st[ctx->sp - 1].p;
+					ctx->ipos = ctx->st[ctx->sp - 1].i;
+				}
 				ctx->path[ctx->ppos] = '\0';
 				if (ctx->path_match &&
 					       ctx->ppos <= ctx->path_match_len)
@@ -632,7 +811,7 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 			}
 			if (c == '}') {
 				if (ctx->sp == 0) {
-					lejp_check_path_match(ctx);
+					lejp_check_path_match(ctx, ctx->sp);
 					if (ctx->callback(ctx, LEJPCB_OBJECT_END)) {
 						ret = LEJP_REJECT_CALLBACK;
 						goto reject;
@@ -655,7 +834,8 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 					 * smaller than the matching point
 					 */
 					ctx->path_match = 0;
-				lejp_check_path_match(ctx);
+				lejp_check_path_match(ctx, ctx->sp ?
+							   ctx->sp - 1 : 0);
 				if (ctx->callback(ctx, LEJPCB_OBJECT_END)) {
 					ret = LEJP_REJECT_CALLBACK;
 					goto reject;
@@ -705,6 +885,10 @@ emit_string_char:
 			continue;
 		}
 		/* name part of name:value pair */
+		if (ctx->ppos >= sizeof(ctx->path) - 2) {
+			ret = LEJP_REJECT_MP_STRING_TOO_LONG;
+			goto reject;
+		}
 		ctx->path[ctx->ppos++] = c;
 		continue;
 
@@ -723,6 +907,10 @@ add_stack_level:
 		ctx->path[ctx->ppos] = '\0';
 		ctx->st[ctx->sp].s = c;
 		ctx->st[ctx->sp].b = 0;
+		ctx->pmask[ctx->sp] = ctx->pmask[ctx->sp - 1];
+		ctx->plit[ctx->sp] = 0;
+		if (c == LEJP_MEMBERS)
+			lejp_narrow_paths(ctx);
 		continue;
 
 append_npos:
@@ -21,6 +21,10 @@
 
 #include "private-libwebsockets.h"
 
+#if defined(LWS_ATOMICS)
+#include <sched.h>
+#endif
+
 LWS_VISIBLE LWS_EXTERN struct lws_ring *
 lws_ring_create(size_t element_len, size_t count,
 		void (*destroy_element)(void *))
@@ -34,7 +38,14 @@ lws_ring_create(size_t element_len, size_t count,
 	ring->element_len = (uint32_t)element_len;
 	ring->head = 0;
 	ring->oldest_tail = 0;
+	ring->flags = 0;
 	ring->destroy_element = destroy_element;
+	ring->consumers = NULL;
+	ring->conflation_key = NULL;
+	ring->cf = NULL;
+	ring->cf_keys = NULL;
+	ring->cf_keys_mask = 0;
+	ring->cf_seq = 0;
 
 	ring->buf = lws_malloc(ring->buflen, "ring buf");
 	if (!ring->buf) {
@@ -46,9 +57,162 @@ lws_ring_create(size_t element_len, size_t count,
 	return ring;
 }
 
+/*
+ * Lockfree rings
+ *
+ * The buffer is a power of two elements, and head, reserve and the tails are
+ * free-running element counts that we mask to find the slot.  So they never
+ * need a modulo or division, full and empty are distinguishable without
+ * wasting an element, and differences are correct across the uint32_t wrap.
+ *
+ * Producers only write head (and reserve), the consumer thread only writes
+ * the tails and oldest_tail.  The producer fills slots and then publishes
+ * head with release semantics, so a consumer that acquires head can read the
+ * slots before it.  Likewise the consumer releases oldest_tail only after it
+ * finished with, and destroyed, the slots before it.
+ *
+ * For MPSC, producers claim a range by CAS on reserve, fill it, then wait
+ * for the producers that claimed before them to publish head before
+ * publishing their range in turn.
+ */
+
+#define lws_ring_lf(_r) ((_r)->flags & (LWS_RING_SPSC | LWS_RING_MPSC))
+#define lws_ring_slot(_r, _i) ((uint8_t *)(_r)->buf + \
+			       ((_i) & (_r)->mask) * (_r)->element_len)
+
+LWS_VISIBLE LWS_EXTERN struct lws_ring *
+lws_ring_create_lockfree(size_t element_len, size_t count,
+			 void (*destroy_element)(void *), int flags)
+{
+#if defined(LWS_ATOMICS)
+	struct lws_ring *ring;
+	uint32_t n = 1;
+
+	if (!(flags & (LWS_RING_SPSC | LWS_RING_MPSC)) || !count ||
+	    count > (1u << 30))
+		return NULL;
+
+	while (n < count)
+		n <<= 1;
+
+	ring = lws_ring_create(element_len, n, destroy_element);
+	if (!ring)
+		return NULL;
+
+	ring->mask = n - 1;
+	ring->reserve = 0;
+	ring->flags = flags & LWS_RING_MPSC ? LWS_RING_MPSC : LWS_RING_SPSC;
+
+	return ring;
+#else
+	lwsl_err("%s: no atomics in this build\n", __func__);
+
+	return NULL;
+#endif
+}
+
+#if defined(LWS_ATOMICS)
+
+/* consumer thread only */
+
+static void
+lws_ring_lf_update_oldest_tail(struct lws_ring *ring, uint32_t tail)
+{
+	uint32_t t = ring->oldest_tail;
+
+	if (ring->destroy_element)
+		while (t != tail)
+			ring->destroy_element(lws_ring_slot(ring, t++));
+
+	/* the slots are free for the producers to reuse after this */
+	lws_atomic_store(&ring->oldest_tail, tail);
+}
+
+static size_t
+lws_ring_lf_insert(struct lws_ring *ring, const void *src, size_t max_count)
+{
+	uint32_t r, n, first, len = ring->element_len;
+	unsigned int spins = 0;
+
+	if (ring->flags & LWS_RING_SPSC)
+		r = ring->head;
+	else
+		r = lws_atomic_load(&ring->reserve);
+
+	do {
+		n = (ring->mask + 1) - (r - lws_atomic_load(&ring->oldest_tail));
+		if (n > max_count)
+			n = (uint32_t)max_count;
+		if (!n)
+			return 0;
+		if (ring->flags & LWS_RING_SPSC)
+			break;
+		/* on failure, r is updated to the current reserve */
+	} while (!lws_atomic_cas(&ring->reserve, &r, r + n));
+
+	/* the slots r .. r + n - 1 are ours to fill */
+
+	first = (ring->mask + 1) - (r & ring->mask);
+	if (first > n)
+		first = n;
+
+	memcpy(lws_ring_slot(ring, r), src, first * len);
+	if (first != n)
+		memcpy(ring->buf, (const uint8_t *)src + (first * len),
+		       (n - first) * len);
+
+	if (ring->flags & LWS_RING_MPSC)
+		/* producers that claimed earlier ranges publish first */
+		while (lws_atomic_load(&ring->head) != r)
+			if (!(++spins & 63))
+				sched_yield();
+
+	lws_atomic_store(&ring->head, r + n);
+
+	return n;
+}
+
+static size_t
+lws_ring_lf_consume(struct lws_ring *ring, uint32_t *tail, void *dest,
+		    size_t max_count)
+{
+	uint32_t n, first, len = ring->element_len, t = *tail;
+
+	n = lws_atomic_load(&ring->head) - t;
+	if (n > max_count)
+		n = (uint32_t)max_count;
+
+	if (dest && n) {
+		first = (ring->mask + 1) - (t & ring->mask);
+		if (first > n)
+			first = n;
+
+		memcpy(dest, lws_ring_slot(ring, t), first * len);
+		if (first != n)
+			memcpy((uint8_t *)dest + (first * len), ring->buf,
+			       (n - first) * len);
+	}
+
+	*tail = t + n;
+
+	return n;
+}
+
+#endif
+
 LWS_VISIBLE LWS_EXTERN void
 lws_ring_destroy(struct lws_ring *ring)
 {
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring)) {
+		/* any producer threads must be finished with the ring by now */
+		lws_ring_lf_update_oldest_tail(ring, ring->head);
+		lws_free_set_NULL(ring->buf);
+		lws_free(ring);
+
+		return;
+	}
+#endif
 	if (ring->destroy_element)
 		while (ring->oldest_tail != ring->head) {
 			ring->destroy_element((uint8_t *)ring->buf +
@@ -59,6 +223,10 @@ lws_ring_destroy(struct lws_ring *ring)
 		}
 	if (ring->buf)
 		lws_free_set_NULL(ring->buf);
+	if (ring->cf) {
+		lws_free_set_NULL(ring->cf);
+		lws_free_set_NULL(ring->cf_keys);
+	}
 
 	lws_free(ring);
 }
@@ -68,6 +236,14 @@ lws_ring_get_count_free_elements(struct lws_ring *ring)
 {
 	int f;
 
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring))
+		return (ring->mask + 1) -
+		       (lws_atomic_load(ring->flags & LWS_RING_MPSC ?
+				       &ring->reserve : &ring->head) -
+			lws_atomic_load(&ring->oldest_tail));
+#endif
+
 	/*
 	 * possible ringbuf patterns
 	 *
@@ -99,6 +275,12 @@ lws_ring_get_count_waiting_elements(struct lws_ring *ring, uint32_t *tail)
 
 	if (!tail)
 		tail = &ring->oldest_tail;
+
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring))
+		return lws_atomic_load(&ring->head) - *tail;
+#endif
+
 	/*
 	 * possible ringbuf patterns
 	 *
@@ -125,6 +307,28 @@ lws_ring_next_linear_insert_range(struct lws_ring *ring, void **start,
 {
 	int n;
 
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring)) {
+		uint32_t e, first;
+
+		if (ring->flags & LWS_RING_MPSC)
+			return 1;
+
+		e = (uint32_t)lws_ring_get_count_free_elements(ring);
+		if (!e)
+			return 1;
+
+		first = (ring->mask + 1) - (ring->head & ring->mask);
+		if (e > first)
+			e = first;
+
+		*start = lws_ring_slot(ring, ring->head);
+		*bytes = e * ring->element_len;
+
+		return 0;
+	}
+#endif
+
 	/* n is how many bytes the whole fifo can take */
 	n = (int)(lws_ring_get_count_free_elements(ring) * ring->element_len);
 
@@ -144,9 +348,176 @@ lws_ring_next_linear_insert_range(struct lws_ring *ring, void **start,
 	return 0;
 }
 
+/*
+ * Consumers
+ *
+ * A normal ring can also keep a list of struct lws_ring_consumer, each with
+ * its own tail and its own policy about falling behind.  The ring then works
+ * out the oldest tail itself, and lws_ring_insert() can make space by moving
+ * on the tails of the lagging consumers whose policy allows it, rather than
+ * the slowest consumer holding up everybody else.
+ *
+ * For conflation, each slot records a sequence number for what was inserted
+ * there, and a small table maps each key to the slot of the latest element
+ * inserted with it.  When another element with the same key is inserted, the
+ * earlier one is marked superseded, so long as its slot still holds it.
+ */
+
+#define lws_ring_next(_r, _t) (((_t) + (_r)->element_len) % (_r)->buflen)
+
+static void
+lws_ring_cf_mark(struct lws_ring *ring, uint32_t pos, size_t count)
+{
+	struct lws_ring_cf_key *k;
+	uint32_t slot;
+	uint64_t key;
+
+	while (count--) {
+		slot = pos / ring->element_len;
+		key = ring->conflation_key((uint8_t *)ring->buf + pos);
+		k = &ring->cf_keys[(uint32_t)((key * 0x9e3779b97f4a7c15ull) >>
+				   32) & ring->cf_keys_mask];
+
+		if (k->seq && k->key == key && ring->cf[k->slot].seq == k->seq)
+			ring->cf[k->slot].superseded = 1;
+
+		if (!++ring->cf_seq)
+			ring->cf_seq = 1;
+		ring->cf[slot].seq = ring->cf_seq;
+		ring->cf[slot].superseded = 0;
+
+		/* a different key hashing here just loses its entry */
+		k->key = key;
+		k->seq = ring->cf_seq;
+		k->slot = slot;
+
+		pos = lws_ring_next(ring, pos);
+	}
+}
+
+static void
+lws_ring_consumers_update_oldest_tail(struct lws_ring *ring)
+{
+	uint32_t oldest = ring->head, worst = 0, w;
+	struct lws_ring_consumer *c;
+
+	for (c = ring->consumers; c; c = c->next) {
+		w = (uint32_t)lws_ring_get_count_waiting_elements(ring,
+								  &c->tail);
+		if (w >= worst) {
+			worst = w;
+			oldest = c->tail;
+		}
+	}
+
+	lws_ring_update_oldest_tail(ring, oldest);
+}
+
+/* remove any consumers that would go over their lag limit */
+
+static void
+lws_ring_consumers_evict(struct lws_ring *ring, size_t incoming)
+{
+	struct lws_ring_consumer **pc = &ring->consumers, *c;
+	int evicted = 0;
+
+	while (*pc) {
+		c = *pc;
+		if (c->lag_limit &&
+		    lws_ring_get_count_waiting_elements(ring, &c->tail) +
+						incoming > c->lag_limit) {
+			*pc = c->next;
+			c->next = NULL;
+			c->evicted = 1;
+			evicted = 1;
+			continue;
+		}
+		pc = &c->next;
+	}
+
+	if (evicted)
+		lws_ring_consumers_update_oldest_tail(ring);
+}
+
+/*
+ * Retire the oldest element by moving on every consumer still waiting for it,
+ * if their policies all allow it.  Returns nonzero if it can't.
+ */
+
+static int
+lws_ring_consumers_drop_oldest(struct lws_ring *ring)
+{
+	uint32_t o = ring->oldest_tail;
+	struct lws_ring_consumer *c;
+	int sup;
+
+	if (o == ring->head)
+		return 1;
+
+	sup = ring->cf && ring->cf[o / ring->element_len].superseded;
+
+	for (c = ring->consumers; c; c = c->next)
+		if (c->tail == o && c->policy != LWS_RING_CP_DROP_OLDEST &&
+		    (c->policy != LWS_RING_CP_CONFLATE || !sup))
+			return 1;
+
+	for (c = ring->consumers; c; c = c->next)
+		if (c->tail == o) {
+			c->tail = lws_ring_next(ring, o);
+			if (c->policy == LWS_RING_CP_CONFLATE)
+				c->conflated++;
+			else
+				c->dropped++;
+		}
+
+	lws_ring_consumers_update_oldest_tail(ring);
+
+	return 0;
+}
+
+static void
+lws_ring_consumers_update_lag(struct lws_ring *ring)
+{
+	struct lws_ring_consumer *c;
+	uint32_t w;
+
+	for (c = ring->consumers; c; c = c->next) {
+		w = (uint32_t)lws_ring_get_count_waiting_elements(ring,
+								  &c->tail);
+		if (w > c->lag_max)
+			c->lag_max = w;
+	}
+}
+
+/* a conflating consumer moves past anything that was replaced since */
+
+static void
+lws_ring_consumer_skip_superseded(struct lws_ring *ring,
+				  struct lws_ring_consumer *c)
+{
+	if (c->policy != LWS_RING_CP_CONFLATE || !ring->cf)
+		return;
+
+	while (c->tail != ring->head &&
+	       ring->cf[c->tail / ring->element_len].superseded) {
+		c->tail = lws_ring_next(ring, c->tail);
+		c->conflated++;
+	}
+}
+
 LWS_VISIBLE LWS_EXTERN void
 lws_ring_bump_head(struct lws_ring *ring, size_t bytes)
 {
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring)) {
+		if (!(ring->flags & LWS_RING_MPSC))
+			lws_atomic_store(&ring->head, ring->head +
+				(uint32_t)(bytes / ring->element_len));
+		return;
+	}
+#endif
+	if (ring->cf)
+		lws_ring_cf_mark(ring, ring->head, bytes / ring->element_len);
 	ring->head = (ring->head + (uint32_t)bytes) % ring->buflen;
 }
 
@@ -154,8 +525,23 @@ LWS_VISIBLE LWS_EXTERN size_t
 lws_ring_insert(struct lws_ring *ring, const void *src, size_t max_count)
 {
 	const uint8_t *osrc = src;
+	uint32_t h = ring->head;
+	size_t count;
 	int m, n;
 
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring))
+		return lws_ring_lf_insert(ring, src, max_count);
+#endif
+
+	if (ring->consumers) {
+		/* apply the consumers' policies to make the space we want */
+		lws_ring_consumers_evict(ring, max_count);
+		while (lws_ring_get_count_free_elements(ring) < max_count &&
+		       !lws_ring_consumers_drop_oldest(ring))
+			;
+	}
+
 	/* n is how many bytes the whole fifo can take */
 	n = (int)(lws_ring_get_count_free_elements(ring) * ring->element_len);
 
@@ -188,7 +574,14 @@ lws_ring_insert(struct lws_ring *ring, const void *src, size_t max_count)
 	memcpy(((uint8_t *)ring->buf) + ring->head, src, n);
 	ring->head = (ring->head + n) % ring->buflen;
 
-	return (((uint8_t *)src + n) - osrc) / ring->element_len;
+	count = (((uint8_t *)src + n) - osrc) / ring->element_len;
+
+	if (ring->cf)
+		lws_ring_cf_mark(ring, h, count);
+	if (ring->consumers)
+		lws_ring_consumers_update_lag(ring);
+
+	return count;
 }
 
 LWS_VISIBLE LWS_EXTERN size_t
@@ -205,6 +598,16 @@ lws_ring_consume(struct lws_ring *ring, uint32_t *tail, void *dest,
 		tail = &fake_tail;
 	}
 
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring)) {
+		n = (int)lws_ring_lf_consume(ring, tail, dest, max_count);
+		if (!orig_tail) /* single tail */
+			lws_ring_lf_update_oldest_tail(ring, *tail);
+
+		return n;
+	}
+#endif
+
 	/* n is how many bytes the whole fifo has for us */
 	n = (int)(lws_ring_get_count_waiting_elements(ring, tail) *
 							ring->element_len);
@@ -253,6 +656,15 @@ lws_ring_get_element(struct lws_ring *ring, uint32_t *tail)
 	if (!tail)
 		tail = &ring->oldest_tail;
 
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring)) {
+		if (*tail == lws_atomic_load(&ring->head))
+			return NULL;
+
+		return lws_ring_slot(ring, *tail);
+	}
+#endif
+
 	if (*tail == ring->head)
 		return NULL;
 
@@ -262,6 +674,12 @@ lws_ring_get_element(struct lws_ring *ring, uint32_t *tail)
 LWS_VISIBLE LWS_EXTERN void
 lws_ring_update_oldest_tail(struct lws_ring *ring, uint32_t tail)
 {
+#if defined(LWS_ATOMICS)
+	if (lws_ring_lf(ring)) {
+		lws_ring_lf_update_oldest_tail(ring, tail);
+		return;
+	}
+#endif
 	if (!ring->destroy_element) {
 		ring->oldest_tail = tail;
 		return;
@@ -292,3 +710,113 @@ lws_ring_dump(struct lws_ring *ring, uint32_t *tail)
 		    (int)lws_ring_get_count_free_elements(ring), *tail,
 		    (int)lws_ring_get_count_waiting_elements(ring, tail));
 }
+
+LWS_VISIBLE LWS_EXTERN int
+lws_ring_set_conflation_key(struct lws_ring *ring,
+			    uint64_t (*key)(const void *element))
+{
+	uint32_t slots = ring->buflen / ring->element_len, n = 1;
+
+	if (lws_ring_lf(ring) || ring->cf)
+		return 1;
+
+	while (n < slots * 2)
+		n <<= 1;
+
+	ring->cf = lws_zalloc(slots * sizeof(*ring->cf), "ring cf");
+	ring->cf_keys = lws_zalloc(n * sizeof(*ring->cf_keys), "ring cf keys");
+	if (!ring->cf || !ring->cf_keys) {
+		lws_free_set_NULL(ring->cf);
+		lws_free_set_NULL(ring->cf_keys);
+
+		return 1;
+	}
+
+	ring->cf_keys_mask = n - 1;
+	ring->conflation_key = key;
+
+	return 0;
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_ring_consumer_add(struct lws_ring *ring, struct lws_ring_consumer *c,
+		      enum lws_ring_consumer_policy policy, uint32_t lag_limit)
+{
+	/* moving tails on needs the producer and consumer on one thread */
+	if (lws_ring_lf(ring))
+		return 1;
+
+	memset(c, 0, sizeof(*c));
+	c->policy = (uint8_t)policy;
+	c->lag_limit = lag_limit;
+	c->tail = ring->oldest_tail;
+
+	c->next = ring->consumers;
+	ring->consumers = c;
+
+	return 0;
+}
+
+LWS_VISIBLE LWS_EXTERN void
+lws_ring_consumer_remove(struct lws_ring *ring, struct lws_ring_consumer *c)
+{
+	lws_start_foreach_llp(struct lws_ring_consumer **, pc,
+			      ring->consumers) {
+		if (*pc == c) {
+			*pc = c->next;
+			c->next = NULL;
+			/* he may have been the one holding the oldest tail */
+			lws_ring_consumers_update_oldest_tail(ring);
+
+			return;
+		}
+	} lws_end_foreach_llp(pc, next);
+}
+
+LWS_VISIBLE LWS_EXTERN const void *
+lws_ring_consumer_get_element(struct lws_ring *ring,
+			      struct lws_ring_consumer *c)
+{
+	uint32_t t = c->tail;
+
+	if (c->evicted)
+		return NULL;
+
+	lws_ring_consumer_skip_superseded(ring, c);
+	if (t != c->tail && t == ring->oldest_tail)
+		lws_ring_consumers_update_oldest_tail(ring);
+
+	return lws_ring_get_element(ring, &c->tail);
+}
+
+LWS_VISIBLE LWS_EXTERN size_t
+lws_ring_consumer_consume(struct lws_ring *ring, struct lws_ring_consumer *c,
+			  void *dest, size_t max_count)
+{
+	uint32_t t = c->tail;
+	size_t n = 0;
+
+	if (c->evicted)
+		return 0;
+
+	if (c->policy == LWS_RING_CP_CONFLATE && ring->cf)
+		while (n < max_count) {
+			lws_ring_consumer_skip_superseded(ring, c);
+			if (c->tail == ring->head)
+				break;
+			if (dest)
+				memcpy((uint8_t *)dest +
+				       (n * ring->element_len),
+				       (uint8_t *)ring->buf + c->tail,
+				       ring->element_len);
+			c->tail = lws_ring_next(ring, c->tail);
+			n++;
+		}
+	else
+		n = lws_ring_consume(ring, &c->tail, dest, max_count);
+
+	if (t != c->tail && t == ring->oldest_tail)
+		lws_ring_consumers_update_oldest_tail(ring);
+
+	return n;
+}
@@ -281,6 +281,219 @@ sha1_result(struct sha1_ctxt *ctxt, void *digest0)
 #endif
 }
 
+/*
+ * Where the cpu has SHA-1 instructions, use them for whole blocks.  We can
+ * only tell at runtime, so the functions using them are built for that
+ * target only and lws_SHA1() looks once at what the cpu has.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define LWS_SHA1_SHANI
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 6))
+#define LWS_SHA1_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#if defined(__clang__)
+#define LWS_SHA1_ARMV8_TARGET __attribute__((target("crypto")))
+#else
+#define LWS_SHA1_ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+#if defined(LWS_SHA1_SHANI) || defined(LWS_SHA1_ARMV8)
+
+typedef void (*lws_sha1_blocks_t)(uint32_t *state, const uint8_t *d,
+				  size_t blocks);
+
+#if defined(LWS_SHA1_SHANI)
+
+/*
+ * Each group of four rounds g takes the E for it from the ABCD before the
+ * previous group (sha1nexte), and the message schedule for g >= 4 is made
+ * from the last four groups' message words in place
+ */
+
+#define SHANI_GROUP(g, f) { \
+	if (g >= 4) \
+		m[g & 3] = _mm_sha1msg2_epu32(_mm_xor_si128( \
+				_mm_sha1msg1_epu32(m[g & 3], m[(g + 1) & 3]), \
+				m[(g + 2) & 3]), m[(g + 3) & 3]); \
+	if (g) \
+		e1 = _mm_sha1nexte_epu32(e0, m[g & 3]); \
+	else \
+		e1 = _mm_add_epi32(e, m[0]); \
+	e0 = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, f); \
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+sha1_blocks_shani(uint32_t *state, const uint8_t *d, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_saved, e, e0, e1, m[4];
+	int n;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state),
+				 0x1b);
+	e = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	while (blocks--) {
+		abcd_saved = abcd;
+
+		for (n = 0; n < 4; n++)
+			m[n] = _mm_shuffle_epi8(_mm_loadu_si128(
+				(const __m128i *)(d + (n * 16))), bswap);
+
+		SHANI_GROUP(0, 0);  SHANI_GROUP(1, 0);  SHANI_GROUP(2, 0);
+		SHANI_GROUP(3, 0);  SHANI_GROUP(4, 0);  SHANI_GROUP(5, 1);
+		SHANI_GROUP(6, 1);  SHANI_GROUP(7, 1);  SHANI_GROUP(8, 1);
+		SHANI_GROUP(9, 1);  SHANI_GROUP(10, 2); SHANI_GROUP(11, 2);
+		SHANI_GROUP(12, 2); SHANI_GROUP(13, 2); SHANI_GROUP(14, 2);
+		SHANI_GROUP(15, 3); SHANI_GROUP(16, 3); SHANI_GROUP(17, 3);
+		SHANI_GROUP(18, 3); SHANI_GROUP(19, 3);
+
+		e = _mm_sha1nexte_epu32(e0, e);
+		abcd = _mm_add_epi32(abcd, abcd_saved);
+		d += 64;
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = (uint32_t)_mm_extract_epi32(e, 3);
+}
+
+static int
+sha1_have_shani(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) ||
+	    !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+
+	__cpuid_count(7, 0, a, b, c, d);
+
+	return !!(b & (1 << 29)); /* SHA extensions */
+}
+#endif
+
+#if defined(LWS_SHA1_ARMV8)
+LWS_SHA1_ARMV8_TARGET
+static void
+sha1_blocks_armv8(uint32_t *state, const uint8_t *d, size_t blocks)
+{
+	static const uint32_t k[] = { 0x5a827999, 0x6ed9eba1,
+				      0x8f1bbcdc, 0xca62c1d6 };
+	uint32x4_t abcd, abcd_saved, m[4], t;
+	uint32_t e, e_saved, e1;
+	int n, g;
+
+	abcd = vld1q_u32(state);
+	e = state[4];
+
+	while (blocks--) {
+		abcd_saved = abcd;
+		e_saved = e;
+
+		for (n = 0; n < 4; n++)
+			m[n] = vreinterpretq_u32_u8(vrev32q_u8(
+					vld1q_u8(d + (n * 16))));
+
+		for (g = 0; g < 20; g++) {
+			if (g >= 4)
+				m[g & 3] = vsha1su1q_u32(vsha1su0q_u32(m[g & 3],
+						m[(g + 1) & 3], m[(g + 2) & 3]),
+						m[(g + 3) & 3]);
+			t = vaddq_u32(m[g & 3], vdupq_n_u32(k[g / 5]));
+			e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+			if (g < 5)
+				abcd = vsha1cq_u32(abcd, e, t);
+			else
+				if (g >= 10 && g < 15)
+					abcd = vsha1mq_u32(abcd, e, t);
+				else
+					abcd = vsha1pq_u32(abcd, e, t);
+			e = e1;
+		}
+
+		abcd = vaddq_u32(abcd, abcd_saved);
+		e += e_saved;
+		d += 64;
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e;
+}
+#endif
+
+static lws_sha1_blocks_t
+sha1_accel(void)
+{
+	/* 0 = not checked yet, 1 = nothing, else the block function */
+	static volatile lws_intptr_t checked;
+	lws_sha1_blocks_t f = NULL;
+
+	if (checked)
+		return checked == 1 ? NULL : (lws_sha1_blocks_t)checked;
+
+#if defined(LWS_SHA1_SHANI)
+	if (sha1_have_shani())
+		f = sha1_blocks_shani;
+#endif
+#if defined(LWS_SHA1_ARMV8)
+	if (getauxval(AT_HWCAP) & HWCAP_SHA1)
+		f = sha1_blocks_armv8;
+#endif
+
+	/* racing threads all come to the same answer */
+	checked = f ? (lws_intptr_t)f : 1;
+
+	return f;
+}
+
+static void
+sha1_accel_oneshot(lws_sha1_blocks_t f, const unsigned char *d, size_t n,
+		   unsigned char *md)
+{
+	uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe,
+			      0x10325476, 0xc3d2e1f0 };
+	uint64_t bits = (uint64_t)n * 8;
+	unsigned char tail[128];
+	size_t whole = n / 64, left = n % 64, tl;
+	int i;
+
+	if (whole)
+		f(state, d, whole);
+
+	/* the remainder, 0x80, zeros and the bit count fill one or two */
+
+	tl = left < 56 ? 64 : 128;
+	memcpy(tail, d + (whole * 64), left);
+	tail[left] = 0x80;
+	memset(tail + left + 1, 0, tl - left - 9);
+	for (i = 0; i < 8; i++)
+		tail[tl - 1 - i] = (unsigned char)(bits >> (i * 8));
+	f(state, tail, tl / 64);
+
+	for (i = 0; i < 5; i++) {
+		md[i * 4] = (unsigned char)(state[i] >> 24);
+		md[(i * 4) + 1] = (unsigned char)(state[i] >> 16);
+		md[(i * 4) + 2] = (unsigned char)(state[i] >> 8);
+		md[(i * 4) + 3] = (unsigned char)state[i];
+	}
+}
+#endif
+
 /*
  * This should look and work like the libcrypto implementation
  */
@@ -289,6 +502,15 @@ LWS_VISIBLE unsigned char *
 lws_SHA1(const unsigned char *d, size_t n, unsigned char *md)
 {
 	struct sha1_ctxt ctx;
+#if defined(LWS_SHA1_SHANI) || defined(LWS_SHA1_ARMV8)
+	lws_sha1_blocks_t f = sha1_accel();
+
+	if (f) {
+		sha1_accel_oneshot(f, d, n, md);
+
+		return md;
+	}
+#endif
 
 	_sha1_init(&ctx);
 	sha1_loop(&ctx, d, n);
@@ -40,6 +40,202 @@ lws_0405_frame_mask_generate(struct lws *wsi)
 	return 0;
 }
 
+/* the most lws_issue_raw() will try to send on wsi in one go */
+
+static unsigned int
+lws_issue_raw_limit(struct lws *wsi)
+{
+	unsigned int n;
+
+	if (wsi->protocol->tx_packet_size)
+		n = (unsigned int)wsi->protocol->tx_packet_size;
+	else {
+		n = (unsigned int)wsi->protocol->rx_buffer_size;
+		if (!n)
+			n = wsi->context->pt_serv_buf_size;
+	}
+
+	return n + LWS_PRE + 4;
+}
+
+/*
+ * Output coalescing
+ *
+ * With context->tx_coalesce_size set, everything sent on a network wsi while
+ * a writeable callback is dispatched is collected in a buffer from the pt
+ * pool.  It goes out as one send, and so one TLS record, when the callback
+ * returns, when the buffer fills, or on lws_tx_coalesce_flush().  Since
+ * nothing reaches the socket before then, the callback may lws_write() more
+ * than once.
+ *
+ * If a flush only partly goes out, the rest is held as a normal truncated
+ * send, and anything else written in the same callback is appended to it to
+ * keep the order on the wire.
+ */
+
+static int
+lws_trunc_append(struct lws *wsi, unsigned char *buf, size_t len)
+{
+	unsigned char *p;
+
+	if (wsi->trunc_offset + wsi->trunc_len + len > wsi->trunc_alloc_len) {
+		p = lws_malloc(wsi->trunc_len + len, "truncated send alloc");
+		if (!p) {
+			lwsl_err("%s: OOM\n", __func__);
+			return -1;
+		}
+		memcpy(p, wsi->trunc_alloc + wsi->trunc_offset,
+		       wsi->trunc_len);
+		lws_free(wsi->trunc_alloc);
+		wsi->trunc_alloc = p;
+		wsi->trunc_alloc_len = wsi->trunc_len + (unsigned int)len;
+		wsi->trunc_offset = 0;
+	}
+
+	memcpy(wsi->trunc_alloc + wsi->trunc_offset + wsi->trunc_len, buf, len);
+	wsi->trunc_len += (unsigned int)len;
+
+	return (int)len;
+}
+
+/* send on wsi directly, only used when nothing is pending on it */
+
+static int
+lws_tx_coalesce_bypass(struct lws *wsi, unsigned char *buf, size_t len)
+{
+	struct lws_tx_coalesce *co = wsi->tx_coalesce;
+	int n;
+
+	wsi->tx_coalesce = NULL;
+	wsi->could_have_pending = 0;
+	n = lws_issue_raw(wsi, buf, len);
+	wsi->tx_coalesce = co;
+
+	return n;
+}
+
+static int
+__lws_tx_coalesce_flush(struct lws *wsi)
+{
+	struct lws_tx_coalesce *co = wsi->tx_coalesce;
+	unsigned int len = co->len;
+
+	if (!len)
+		return 0;
+
+	/* any part that can't go now is copied to trunc_alloc */
+	co->len = 0;
+
+	return lws_tx_coalesce_bypass(wsi, (unsigned char *)&co[1], len) < 0;
+}
+
+static int
+lws_tx_coalesce_add(struct lws *wsi, unsigned char *buf, size_t len)
+{
+	struct lws_tx_coalesce *co = wsi->tx_coalesce;
+	unsigned int size = wsi->context->tx_coalesce_size, n;
+
+	if (!len)
+		return 0;
+
+	if (wsi->trunc_len) {
+		/* spilling the partial itself, eg, from the file server */
+		if (buf >= wsi->trunc_alloc &&
+		    buf < wsi->trunc_alloc + wsi->trunc_alloc_len)
+			return lws_tx_coalesce_bypass(wsi, buf, len);
+
+		return lws_trunc_append(wsi, buf, len);
+	}
+
+	/* there's no point holding more than one send can take */
+	n = lws_issue_raw_limit(wsi);
+	if (size > n)
+		size = n;
+
+	if (co->len + len > size) {
+		if (__lws_tx_coalesce_flush(wsi))
+			return -1;
+		if (wsi->trunc_len)
+			return lws_trunc_append(wsi, buf, len);
+		if (len > size)
+			return lws_tx_coalesce_bypass(wsi, buf, len);
+	}
+
+	memcpy((unsigned char *)&co[1] + co->len, buf, len);
+	co->len += (unsigned int)len;
+
+	return (int)len;
+}
+
+int
+lws_tx_coalesce_begin(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt;
+	struct lws_tx_coalesce *co;
+	struct lws *nwsi;
+
+	if (!wsi->context->tx_coalesce_size || wsi->parent_carries_io)
+		return 0;
+
+	nwsi = lws_get_network_wsi(wsi);
+	if (nwsi->tx_coalesce || nwsi->trunc_len)
+		return 0;
+
+	pt = &wsi->context->pt[(int)nwsi->tsi];
+
+	lws_pt_lock(pt, __func__);
+	co = pt->tx_coalesce_pool;
+	if (co)
+		pt->tx_coalesce_pool = co->next;
+	lws_pt_unlock(pt);
+
+	if (!co) {
+		co = lws_malloc(sizeof(*co) + wsi->context->tx_coalesce_size,
+				"tx coalesce");
+		if (!co)
+			/* we can still send it all uncoalesced */
+			return 0;
+	}
+
+	co->len = 0;
+	nwsi->tx_coalesce = co;
+
+	return 1;
+}
+
+int
+lws_tx_coalesce_end(struct lws *wsi)
+{
+	struct lws *nwsi = lws_get_network_wsi(wsi);
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)nwsi->tsi];
+	struct lws_tx_coalesce *co = nwsi->tx_coalesce;
+	int n;
+
+	if (!co)
+		return 0;
+
+	n = __lws_tx_coalesce_flush(nwsi);
+	nwsi->tx_coalesce = NULL;
+
+	lws_pt_lock(pt, __func__);
+	co->next = pt->tx_coalesce_pool;
+	pt->tx_coalesce_pool = co;
+	lws_pt_unlock(pt);
+
+	return n ? -1 : 0;
+}
+
+LWS_VISIBLE int
+lws_tx_coalesce_flush(struct lws *wsi)
+{
+	struct lws *nwsi = lws_get_network_wsi(wsi);
+
+	if (!nwsi->tx_coalesce || nwsi->trunc_len)
+		return 0;
+
+	return __lws_tx_coalesce_flush(nwsi) ? -1 : 0;
+}
+
 /*
  * notice this returns number of bytes consumed, or -1
  */
@@ -53,6 +249,9 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 	int m;
 #endif
 
+	if (wsi->tx_coalesce)
+		return lws_tx_coalesce_add(wsi, buf, len);
+
 	/*
 	 * Detect if we got called twice without going through the
 	 * event loop to handle pending.  This would be caused by either
@@ -104,14 +303,7 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 		lwsl_warn("** error invalid sock but expected to send\n");
 
 	/* limit sending */
-	if (wsi->protocol->tx_packet_size)
-		n = (int)wsi->protocol->tx_packet_size;
-	else {
-		n = (int)wsi->protocol->rx_buffer_size;
-		if (!n)
-			n = context->pt_serv_buf_size;
-	}
-	n += LWS_PRE + 4;
+	n = lws_issue_raw_limit(wsi);
 	if (n > len)
 		n = (int)len;
 
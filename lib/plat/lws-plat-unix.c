@@ -129,6 +129,175 @@ lws_poll_listen_fd(struct lws_pollfd *fd)
 	return poll(fd, 1, 0);
 }
 
+/*
+ * Listen socket handoff to a replacement server process... the fds travel as
+ * SCM_RIGHTS ancillary data on a single message, with a small header and the
+ * optional user blob as the payload
+ */
+
+#define LWS_LISTEN_FDS_MAGIC 0x4c575346 /* "LWSF" */
+#define LWS_LISTEN_FDS_MAX 64
+
+struct lws_listen_fds_hdr {
+	uint32_t magic;
+	uint32_t count;
+	uint32_t blob_len;
+};
+
+LWS_VISIBLE int
+lws_context_listen_fds_send(struct lws_context *context, int unix_fd,
+			    const void *blob, size_t blob_len)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * LWS_LISTEN_FDS_MAX)];
+		struct cmsghdr align;
+	} u;
+	struct lws_listen_fds_hdr hdr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov[2];
+	int fds[LWS_LISTEN_FDS_MAX], n, m, count = 0;
+	struct lws *wsi;
+
+	for (m = 0; m < context->count_threads; m++) {
+		struct lws_context_per_thread *pt = &context->pt[m];
+
+		for (n = 0; n < (int)pt->fds_count; n++) {
+			wsi = wsi_from_fd(context, pt->fds[n].fd);
+			if (!wsi || wsi->mode != LWSCM_SERVER_LISTENER)
+				continue;
+			if (count == LWS_LISTEN_FDS_MAX) {
+				lwsl_err("%s: too many listen sockets\n",
+					 __func__);
+				return -1;
+			}
+			fds[count++] = wsi->desc.sockfd;
+		}
+	}
+
+	if (!count)
+		return 0;
+
+	hdr.magic = LWS_LISTEN_FDS_MAGIC;
+	hdr.count = count;
+	hdr.blob_len = (uint32_t)blob_len;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)blob;
+	iov[1].iov_len = blob ? blob_len : 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&u, 0, sizeof(u));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = blob && blob_len ? 2 : 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+	do {
+		n = sendmsg(unix_fd, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		lwsl_err("%s: sendmsg failed: %d\n", __func__, errno);
+		return -1;
+	}
+
+	lwsl_notice("%s: sent %d listen fds\n", __func__, count);
+
+	return count;
+}
+
+LWS_VISIBLE int
+lws_listen_fds_recv(int unix_fd, int *fds, int max_fds, void *blob,
+		    size_t *blob_len, int timeout_ms)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * LWS_LISTEN_FDS_MAX)];
+		struct cmsghdr align;
+	} u;
+	struct lws_listen_fds_hdr hdr;
+	struct cmsghdr *cmsg;
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct iovec iov[2];
+	int n, m, len, count = 0, *rx;
+
+	pfd.fd = unix_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	do {
+		n = poll(&pfd, 1, timeout_ms);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		lwsl_notice("%s: no listen fds arrived\n", __func__);
+		return -1;
+	}
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = blob;
+	iov[1].iov_len = blob && blob_len ? *blob_len : 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	do {
+		len = recvmsg(unix_fd, &msg, 0
+#if defined(MSG_CMSG_CLOEXEC)
+			    | MSG_CMSG_CLOEXEC
+#endif
+		);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) {
+		lwsl_err("%s: recvmsg failed: %d\n", __func__, errno);
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		rx = (int *)CMSG_DATA(cmsg);
+		m = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		for (n = 0; n < m; n++)
+			/* we must close any we can't pass on */
+			if (count < max_fds)
+				fds[count++] = rx[n];
+			else
+				close(rx[n]);
+	}
+
+	/* a blob we didn't ask for is just discarded */
+	if (len < (int)sizeof(hdr) || hdr.magic != LWS_LISTEN_FDS_MAGIC ||
+	    (msg.msg_flags & MSG_CTRUNC) || hdr.count != (uint32_t)count ||
+	    (iov[1].iov_len && hdr.blob_len > iov[1].iov_len)) {
+		lwsl_err("%s: bad or truncated listen fd message\n", __func__);
+		while (count)
+			close(fds[--count]);
+
+		return -1;
+	}
+
+	if (blob_len)
+		*blob_len = iov[1].iov_len ? hdr.blob_len : 0;
+
+	lwsl_notice("%s: received %d listen fds\n", __func__, count);
+
+	return count;
+}
+
 LWS_VISIBLE void lwsl_emit_syslog(int level, const char *line)
 {
 	int syslog_level = LOG_DEBUG;
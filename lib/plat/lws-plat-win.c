@@ -164,6 +164,22 @@ lws_poll_listen_fd(struct lws_pollfd *fd)
 	return select(((int)fd->fd) + 1, &readfds, NULL, NULL, &tv);
 }
 
+LWS_VISIBLE int
+lws_context_listen_fds_send(struct lws_context *context, int unix_fd,
+			    const void *blob, size_t blob_len)
+{
+	/* no SCM_RIGHTS on this platform */
+
+	return -1;
+}
+
+LWS_VISIBLE int
+lws_listen_fds_recv(int unix_fd, int *fds, int max_fds, void *blob,
+		    size_t *blob_len, int timeout_ms)
+{
+	return -1;
+}
+
 LWS_VISIBLE void
 lwsl_emit_syslog(int level, const char *line)
 {
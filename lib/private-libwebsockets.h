@@ -23,7 +23,8 @@
 #include "lws_config_private.h"
 
 
-#if defined(LWS_WITH_CGI) && defined(LWS_HAVE_VFORK)
+#if (defined(LWS_WITH_CGI) && defined(LWS_HAVE_VFORK)) || \
+    defined(LWS_HAVE_RECVMMSG) || defined(LWS_HAVE_SENDMMSG)
 #define  _GNU_SOURCE
 #endif
 
@@ -51,7 +52,7 @@ typedef struct { long double x, y; } _Float128;
 
 #define STORE_IN_ROM
 #include <assert.h>
-#if LWS_MAX_SMP > 1
+#if LWS_MAX_SMP > 1 || defined(LWS_WITH_TLS_OFFLOAD)
 #include <pthread.h>
 #endif
 
@@ -259,6 +260,17 @@ int fork(void);
 #endif /* not USE_WOLFSSL */
 #endif
 
+/*
+ * The http/2 client needs to offer and read back ALPN on the client SSL, we
+ * only do that on OpenSSL 1.0.2+
+ */
+#if defined(LWS_WITH_HTTP2) && !defined(LWS_NO_CLIENT) && \
+    defined(LWS_OPENSSL_SUPPORT) && !defined(LWS_WITH_MBEDTLS) && \
+    !defined(USE_WOLFSSL) && !defined(LWS_WITH_ESP32) && \
+    defined(OPENSSL_VERSION_NUMBER) && OPENSSL_VERSION_NUMBER >= 0x10002000L
+#define LWS_H2_CLIENT
+#endif
+
 #include "libwebsockets.h"
 #if defined(WIN32) || defined(_WIN32)
 #else
@@ -379,6 +391,8 @@ extern "C" {
 #ifndef LWS_DEF_HEADER_POOL
 #define LWS_DEF_HEADER_POOL 4
 #endif
+/* power of 2, at least twice the number of header names we know */
+#define LWS_HDR_HASH_SIZE 256
 #ifndef LWS_MAX_PROTOCOLS
 #define LWS_MAX_PROTOCOLS 5
 #endif
@@ -437,6 +451,13 @@ typedef X509 lws_tls_x509;
 #endif
 #endif
 
+/*
+ * TLS records are at most 16KiB of payload.  The small ones are sized so the
+ * record plus TLS, TCP and IP overhead fits one 1460-byte segment.
+ */
+#define LWS_TLS_RECORD_MAX 16384
+#define LWS_TLS_RECORD_SMALL 1369
+
 /*
  * All lws_tls...() functions must return this type, converting the
  * native backend result and doing the extra work to determine which one
@@ -462,6 +483,26 @@ enum lws_ssl_capable_status {
 #define lws_memory_barrier()
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define LWS_CACHELINE_ALIGNED __attribute__((aligned(64)))
+#else
+#define LWS_CACHELINE_ALIGNED
+#endif
+
+/*
+ * Where the toolchain has them, acquire / release atomics used by the
+ * lockfree lws_ring variants and the coalesced pt wake
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__ATOMIC_ACQUIRE) && \
+    !defined(_WIN32)
+#define LWS_ATOMICS
+#define lws_atomic_load(_p) __atomic_load_n(_p, __ATOMIC_ACQUIRE)
+#define lws_atomic_store(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELEASE)
+#define lws_atomic_xchg(_p, _v) __atomic_exchange_n(_p, _v, __ATOMIC_ACQ_REL)
+#define lws_atomic_cas(_p, _pexp, _v) __atomic_compare_exchange_n(_p, _pexp, \
+			_v, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#endif
+
 enum lws_websocket_opcodes_07 {
 	LWSWSOPC_CONTINUATION = 0,
 	LWSWSOPC_TEXT_FRAME = 1,
@@ -519,6 +560,9 @@ enum lws_connection_states {
 
 	LWSS_HTTP_DEFERRING_ACTION			= _LSF_CCB | 19 |
 							  _LSF_POLLOUT,
+
+	LWSS_HTTP2_CLIENT_SEND_HEADERS			= 20 | _LSF_POLLOUT,
+	LWSS_HTTP2_CLIENT_ESTABLISHED			= 21 | _LSF_POLLOUT,
 };
 
 #define lws_state_is_ws(s) (!!((s) & _LSF_WEBSOCKET))
@@ -605,6 +649,7 @@ enum connection_mode {
 	LWSCM_WSCL_WAITING_SOCKS_GREETING_REPLY,
 	LWSCM_WSCL_WAITING_SOCKS_CONNECT_REPLY,
 	LWSCM_WSCL_WAITING_SOCKS_AUTH_REPLY,
+	LWSCM_HTTP_CLIENT_IDLE, /* keep-alive conn waiting for a queued wsi */
 
 	/****** add new things just above ---^ ******/
 };
@@ -674,13 +719,39 @@ enum {
 	LWS_RXFLOW_PENDING_CHANGE = (1 << 1),
 };
 
+struct lws_ring_cf {
+	uint32_t seq;		/* identifies what was inserted in the slot */
+	uint8_t superseded;	/* a later element has the same key */
+};
+
+struct lws_ring_cf_key {
+	uint64_t key;
+	uint32_t seq;		/* 0 = unused */
+	uint32_t slot;
+};
+
 struct lws_ring {
 	void *buf;
 	void (*destroy_element)(void *element);
 	uint32_t buflen;
 	uint32_t element_len;
-	uint32_t head;
-	uint32_t oldest_tail;
+	/*
+	 * For lockfree rings, head, reserve and the tails are free-running
+	 * element counts, masked with mask to find the slot
+	 */
+	uint32_t mask;
+	uint32_t reserve; /* MPSC: producers claim space by moving this */
+	/* normal rings only: registered consumers and conflation by key */
+	struct lws_ring_consumer *consumers;
+	uint64_t (*conflation_key)(const void *element);
+	struct lws_ring_cf *cf; /* one per element slot */
+	struct lws_ring_cf_key *cf_keys; /* latest slot seen for a key */
+	uint32_t cf_keys_mask;
+	uint32_t cf_seq;
+	uint8_t flags;
+	/* keep what the producers and the consumer write on their own lines */
+	uint32_t head LWS_CACHELINE_ALIGNED;
+	uint32_t oldest_tail LWS_CACHELINE_ALIGNED;
 };
 
 /* this is not usable directly by user code any more, lws_close_reason() */
@@ -802,19 +873,107 @@ struct allocated_headers {
 	char esc_stash;
 	char post_literal_equal;
 	uint8_t /* enum lws_token_indexes */ parser_state;
+#if defined(LWS_WITH_STATS)
+	uint32_t parse_us; /* cumulative time spent in lws_parse() */
+#endif
 };
 
 #define LWS_HRTIMER_NOWAIT (0x7fffffffffffffffll)
 
+#if defined(LWS_WITH_STATS)
+/*
+ * Stats are kept per-pt and only summed when somebody reads them, so the
+ * service threads never contend on a lock or a shared cacheline to count.
+ *
+ * Histograms are log-linear over microseconds: 4 linear buckets per power
+ * of two, so 1us resolution at the bottom and 25% resolution elsewhere,
+ * up to ~2 minutes (anything larger lands in the last bucket).
+ */
+#define LWS_STATS_HIST_SUBBITS 2
+#define LWS_STATS_HIST_BUCKETS 104
+
+struct lws_pt_stats {
+	uint64_t c[LWSSTATS_SIZE];
+	uint64_t hist[LWSSTATS_H_SIZE][LWS_STATS_HIST_BUCKETS];
+	uint64_t hist_sum[LWSSTATS_H_SIZE];
+	char updated;
+} LWS_CACHELINE_ALIGNED;
+#endif
+
 /*
  * so we can have n connections being serviced simultaneously,
  * these things need to be isolated per-thread.
  */
 
+/*
+ * freed lws-allocated per-session data of one size, kept by a pt for reuse
+ */
+
+#define LWS_PSS_CACHE_SIZES 4
+
+struct lws_pss_cache {
+	void *head; /* linked through the first pointer of each */
+	uint32_t size;
+	unsigned int count;
+};
+
+/*
+ * output accumulated on a network wsi during a writeable callback, when
+ * context->tx_coalesce_size is set.  The buffer follows the struct.
+ */
+
+struct lws_tx_coalesce {
+	struct lws_tx_coalesce *next; /* pt pool of unused ones */
+	unsigned int len;
+};
+
+/*
+ * a chunk of a wsi's transaction arena, see lws_txn_alloc().  Chunks of
+ * LWS_TXN_CHUNK are recycled via the pt pool, bigger ones are freed.  The
+ * arena data follows the struct, from LWS_TXN_HDR.
+ */
+
+#define LWS_TXN_CHUNK 2048
+#define LWS_TXN_HDR ((sizeof(struct lws_txn_chunk) + 7) & ~7)
+
+struct lws_txn_chunk {
+	struct lws_txn_chunk *next; /* older chunks, or next in pt pool */
+	size_t size;
+	size_t used;
+};
+
+/*
+ * a raw wsi adopted with LWS_ADOPT_FLAG_UDP.  Rx is drained LWS_UDP_BATCH
+ * datagrams at a time into rx, which follows the struct; tx is queued on a
+ * ring and flushed in batches when the socket is writeable.
+ */
+
+#define LWS_UDP_BATCH 16
+#define LWS_UDP_TX_QUEUE 128
+
+struct lws_udp_tx {
+	uint8_t *buf;
+	size_t len;
+	struct sockaddr_storage sa;
+	socklen_t salen;
+};
+
+struct lws_udp {
+	struct lws_ring *tx; /* of struct lws_udp_tx */
+	uint8_t *rx; /* LWS_UDP_BATCH * rx_size */
+	struct sockaddr_storage peer[LWS_UDP_BATCH];
+	socklen_t peer_len[LWS_UDP_BATCH];
+#if !defined(LWS_HAVE_RECVMMSG)
+	int rx_len[LWS_UDP_BATCH];
+#endif
+	unsigned int rx_size;
+	uint8_t cur; /* datagram being delivered, LWS_UDP_BATCH = none yet */
+	uint8_t in_service; /* the service path will flush tx itself */
+};
+
 struct lws_context_per_thread {
 #if LWS_MAX_SMP > 1
 	pthread_mutex_t lock;
-	pthread_mutex_t lock_stats;
 #endif
 	struct lws_pollfd *fds;
 	volatile struct lws_foreign_thread_pollfd * volatile foreign_pfd_list;
@@ -822,7 +981,8 @@ struct lws_context_per_thread {
 	struct lws *tx_draining_ext_list;
 	struct lws_dll_lws dll_head_timeout;
 	struct lws_dll_lws dll_head_hrtimer;
-#if defined(LWS_WITH_LIBUV) || defined(LWS_WITH_LIBEVENT)
+#if defined(LWS_WITH_LIBUV) || defined(LWS_WITH_LIBEV) || \
+    defined(LWS_WITH_LIBEVENT)
 	struct lws_context *context;
 #endif
 #ifdef LWS_WITH_CGI
@@ -838,8 +998,17 @@ struct lws_context_per_thread {
 #ifdef LWS_OPENSSL_SUPPORT
 	struct lws *pending_read_list; /* linked list */
 #endif
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	struct lws *tls_offload_done; /* accept steps the workers finished */
+#endif
+	struct lws *wsi_free_list; /* freed wsi kept for reuse, by sibling_list */
+	struct lws_pss_cache pss_cache[LWS_PSS_CACHE_SIZES];
+	struct lws_tx_coalesce *tx_coalesce_pool;
+	struct lws_txn_chunk *txn_pool;
 #if defined(LWS_WITH_LIBEV)
 	struct ev_loop *io_loop_ev;
+	ev_timer ev_timeout_watcher;
+	ev_timer ev_hrtimer;
 #endif
 #if defined(LWS_WITH_LIBUV)
 	uv_loop_t *io_loop_uv;
@@ -850,6 +1019,8 @@ struct lws_context_per_thread {
 #endif
 #if defined(LWS_WITH_LIBEVENT)
 	struct event_base *io_loop_event_base;
+	struct event *event_timeout_watcher;
+	struct event *event_hrtimer;
 #endif
 #if defined(LWS_WITH_LIBEV) || defined(LWS_WITH_LIBUV) || defined(LWS_WITH_LIBEVENT)
 	struct lws_signal_watcher w_sigint;
@@ -857,6 +1028,8 @@ struct lws_context_per_thread {
 #endif
 
 	unsigned long count_conns;
+	time_t http_date_secs; /* when http_date was formatted */
+	char http_date[30]; /* Date: value for http responses */
 	/*
 	 * usable by anything in the service code, but only if the scope
 	 * does not last longer than the service action (since next service
@@ -871,8 +1044,11 @@ struct lws_context_per_thread {
 
 	volatile unsigned char inside_poll;
 	volatile unsigned char foreign_spinlock;
+	unsigned char wake_pending; /* pipe signalled, not serviced yet */
 
 	unsigned int fds_count;
+	unsigned int count_wsi_free;
+	unsigned int count_txn_pool;
 	uint32_t ah_pool_length;
 
 	short ah_count_in_use;
@@ -881,6 +1057,10 @@ struct lws_context_per_thread {
 #if LWS_MAX_SMP > 1
 	pthread_t lock_owner;
 #endif
+#if defined(LWS_WITH_STATS)
+	/* kept last, so other pt members don't share its cachelines */
+	struct lws_pt_stats stats;
+#endif
 };
 
 struct lws_conn_stats {
@@ -945,6 +1125,13 @@ struct lws_vhost {
 #endif
 #if defined(LWS_WITH_HTTP2)
 	struct http2_settings set;
+	uint64_t h2_rx_win_grown; /* total rx_win_grown of all our h2 wsi */
+	uint64_t h2_rx_win_cap;
+	uint32_t h2_rx_win_max;
+	struct lws_dll_lws dll_h2_client_conns; /* h2 client nwsi to share */
+#endif
+#if !defined(LWS_NO_CLIENT)
+	struct lws_dll_lws dll_h1_client_conns; /* h1 client conns to queue on */
 #endif
 #if defined(LWS_WITH_SOCKS5)
 	char socks_proxy_address[128];
@@ -970,12 +1157,16 @@ struct lws_vhost {
 	void **protocol_vh_privs;
 	const struct lws_protocol_vhost_options *pvo;
 	const struct lws_protocol_vhost_options *headers;
+	unsigned char *hdr_tpl; /* see lws_vhost_compile_headers() */
+	unsigned short *ws101_ofs; /* see lws_vhost_compile_ws101() */
+	char *ws101_tpl; /* follows the count_protocols + 1 offsets */
 	struct lws **same_vh_protocol_list;
 	const char *error_document_404;
 #ifdef LWS_OPENSSL_SUPPORT
 	lws_tls_ctx *ssl_ctx;
 	lws_tls_ctx *ssl_client_ctx;
 	struct lws_tls_ss_pieces *ss; /* for acme tls certs */
+	struct lws_vhost_tls_conf *tls_conf; /* for ctx sharing / deferral */
 	char ecdh_curve[16];
 #endif
 #if defined(LWS_WITH_MBEDTLS)
@@ -999,7 +1190,12 @@ struct lws_vhost {
 	int ka_interval;
 	int keepalive_timeout;
 	int timeout_secs_ah_idle;
+	int client_conns_per_peer;
 	int ssl_info_event_mask;
+	int hdr_tpl_h1_len;
+	int hdr_tpl_h1_server; /* length of the leading Server: part */
+	int hdr_tpl_h2_len; /* the h2 HPACK version follows the h1 one */
+	int hdr_tpl_h2_server;
 #ifdef LWS_WITH_ACCESS_LOG
 	int log_fd;
 #endif
@@ -1007,7 +1203,11 @@ struct lws_vhost {
 #ifdef LWS_OPENSSL_SUPPORT
 	int use_ssl;
 	int allow_non_ssl_on_ssl_port;
+	int tls_rec_small; /* 0 = no dynamic record sizing */
+	unsigned int tls_rec_boost; /* bytes in small records before 16KiB */
+	unsigned int tls_rec_idle_us; /* idle time that resets to small */
 	unsigned int user_supplied_ssl_ctx:1;
+	unsigned int tls_deferred:1;
 #endif
 
 	unsigned int created_vhost_protocols:1;
@@ -1019,6 +1219,28 @@ struct lws_vhost {
 	unsigned char raw_protocol_index;
 };
 
+#ifdef LWS_OPENSSL_SUPPORT
+/*
+ * A copy of the info members needed to create a vhost server tls ctx later,
+ * also the identity used to decide if two vhosts can share one tls ctx.
+ * The strings live in the same allocation, after the struct.
+ */
+struct lws_vhost_tls_conf {
+	const char *cert;
+	const char *key;
+	const char *ca;
+	const char *cipher_list;
+	const char *passphrase;
+	lws_callback_function *cb; /* protocols[0] is told about the ctx */
+	long ssl_options_set;
+	long ssl_options_clear;
+	int session_cache_size;
+	int session_timeout;
+	unsigned int options;
+	uint32_t hash;
+};
+#endif
+
 struct lws_deferred_free
 {
 	struct lws_deferred_free *next;
@@ -1054,6 +1276,103 @@ struct lws_peer {
 };
 #endif
 
+#if defined(LWS_OPENSSL_SUPPORT)
+/* matches the LWS_TLS_TICKET_KEY_LEN layout used by the public apis */
+struct lws_tls_ticket_key {
+	uint8_t name[16];
+	uint8_t hmac[32];
+	uint8_t aes[32];
+};
+
+#define LWS_TLS_TICKET_KEYS 3 /* current + two previous still accepted */
+#endif
+
+#if defined(LWS_WITH_TLS_OFFLOAD)
+#define LWS_TLS_OFFLOAD_MAX_THREADS 32
+
+enum lws_tls_offload_state {
+	LWS_TLS_OFFLOAD_NONE,
+	LWS_TLS_OFFLOAD_QUEUED,		/* on tls_offload.queue */
+	LWS_TLS_OFFLOAD_RUNNING,	/* a worker owns wsi->ssl */
+	LWS_TLS_OFFLOAD_DONE,		/* on pt->tls_offload_done */
+};
+
+/*
+ * Pool of workers that run the server SSL_accept() step for connections
+ * owned by the service threads.  Everything here, the per-pt done lists and
+ * the wsi tls_offload_* members are protected by .lock.
+ */
+
+struct lws_tls_offload {
+	pthread_t thread[LWS_TLS_OFFLOAD_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_mutex_t cb_lock; /* tls state handshake callbacks may touch */
+	pthread_cond_t cond_job; /* workers wait here for queued wsi */
+	pthread_cond_t cond_done; /* closers wait here for a running wsi */
+	struct lws *queue_head;
+	struct lws *queue_tail;
+	int count_threads;
+	unsigned char inited;
+	unsigned char stopping;
+};
+
+/*
+ * With offload, the SNI, ticket key and session callbacks may run on a
+ * worker thread concurrently with the service threads
+ */
+#define lws_tls_cb_lock(_c) pthread_mutex_lock(&(_c)->tls_offload.cb_lock)
+#define lws_tls_cb_unlock(_c) pthread_mutex_unlock(&(_c)->tls_offload.cb_lock)
+#else
+#define lws_tls_cb_lock(_c) lws_context_lock(_c)
+#define lws_tls_cb_unlock(_c) lws_context_unlock(_c)
+#endif
+
+#if !defined(LWS_NO_SERVER) && !defined(LWS_WITH_ESP32)
+#define LWS_WITH_FCACHE
+#define LWS_FCACHE_HASH 64
+
+/*
+ * A file held in memory by the file cache.  key is the path that was asked
+ * for, path the regular file that was actually served for it, eg, with
+ * /index.html appended to a dir.  The struct is overallocated by the two
+ * strings and the file content.
+ *
+ * Open memory fop_fds on it each hold a reference, an entry evicted while it
+ * has any is only unlinked, and freed when the last one is closed.
+ */
+
+struct lws_fcache_entry {
+	struct lws_fcache_entry *hash_next;
+	struct lws_fcache_entry *lru_prev; /* towards most recently used */
+	struct lws_fcache_entry *lru_next;
+	struct lws_fcache *fc;
+	const char *key;
+	const char *path;
+	const uint8_t *data;
+	lws_filepos_t len;
+	time_t checked; /* when it was last known to match the file */
+	uint32_t mod_time;
+	uint32_t hash;
+	int refcount;
+	unsigned char evicted;
+};
+
+/* everything here and in the entries is protected by .lock */
+
+struct lws_fcache {
+	struct lws_fcache_entry *hash_table[LWS_FCACHE_HASH];
+	struct lws_fcache_entry *lru_head;
+	struct lws_fcache_entry *lru_tail;
+	size_t size;
+	size_t used;
+	unsigned int file_max;
+	unsigned int ttl_secs;
+#if LWS_MAX_SMP > 1
+	pthread_mutex_t lock;
+#endif
+};
+#endif
+
 /*
  * the rest is managed per-context, that includes
  *
@@ -1065,6 +1384,12 @@ struct lws_context {
 	time_t last_timeout_check_s;
 	time_t last_ws_ping_pong_check_s;
 	time_t last_cert_check_s;
+#if defined(LWS_OPENSSL_SUPPORT)
+	time_t last_ticket_key_rotation_s;
+	/* protected by context->lock */
+	struct lws_tls_ticket_key ticket_keys[LWS_TLS_TICKET_KEYS];
+	const struct lws_tls_session_ops *tls_session_ops;
+#endif
 	time_t time_up;
 	time_t time_discontiguity;
 	time_t time_fixup;
@@ -1078,6 +1403,12 @@ struct lws_context {
 #endif
 	struct lws_context_per_thread pt[LWS_MAX_SMP];
 	struct lws_conn_stats conn_stats;
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	struct lws_tls_offload tls_offload;
+#endif
+#if defined(LWS_WITH_FCACHE)
+	struct lws_fcache fcache;
+#endif
 #if LWS_MAX_SMP > 1
 	pthread_mutex_t lock;
 	int lock_depth;
@@ -1125,13 +1456,17 @@ struct lws_context {
 #endif
 #endif
 	char canonical_hostname[128];
+	/* "name:" hash -> 1 + token index, for the lws_parse() fast path */
+	unsigned char hdr_hash[LWS_HDR_HASH_SIZE];
+	/* tokens the trie matches without a ':' after, eg "put" */
+	unsigned char hdr_prefix[8];
+	unsigned char count_hdr_prefix;
 #ifdef LWS_LATENCY
 	unsigned long worst_latency;
 	char worst_latency_info[256];
 #endif
 
 #if defined(LWS_WITH_STATS)
-	uint64_t lws_stats[LWSSTATS_SIZE];
 	uint64_t last_dump;
 	int updated;
 #endif
@@ -1158,6 +1493,13 @@ struct lws_context {
 	int max_http_header_data;
 	int simultaneous_ssl_restriction;
 	int simultaneous_ssl;
+	unsigned int wsi_cache_max; /* per pt, for wsi and each pss size */
+	unsigned int tx_coalesce_size; /* 0 = no output coalescing */
+#if defined(LWS_OPENSSL_SUPPORT)
+	int tls_ctx_build_threads;
+	int tls_ticket_key_rotate_secs;
+	int count_ticket_keys;
+#endif
 #if defined(LWS_WITH_PEER_LIMITS)
 	uint32_t pl_hash_elements;	/* protected by context->lock */
 	uint32_t count_peers;		/* protected by context->lock */
@@ -1180,6 +1522,9 @@ struct lws_context {
 	volatile int service_tid;
 	int service_tid_detected;
 
+	int *listen_fds; /* inherited, unused ones are -1 */
+	int count_listen_fds;
+
 	short max_http_header_pool;
 	short count_threads;
 	short plugin_protocol_count;
@@ -1242,6 +1587,8 @@ LWS_EXTERN void
 lws_libev_destroyloop(struct lws_context *context, int tsi);
 LWS_EXTERN void
 lws_libev_run(const struct lws_context *context, int tsi);
+LWS_EXTERN void
+lws_libev_hrtimer_set(struct lws_context_per_thread *pt, lws_usec_t us);
 #define LWS_LIBEV_ENABLED(context) lws_check_opt(context->options, LWS_SERVER_OPTION_LIBEV)
 LWS_EXTERN void lws_feature_status_libev(struct lws_context_creation_info *info);
 #else
@@ -1250,6 +1597,7 @@ LWS_EXTERN void lws_feature_status_libev(struct lws_context_creation_info *info)
 #define lws_libev_init_fd_table(_a) (0)
 #define lws_libev_run(_a, _b) ((void) 0)
 #define lws_libev_destroyloop(_a, _b) ((void) 0)
+#define lws_libev_hrtimer_set(_a, _b) ((void) 0)
 #define LWS_LIBEV_ENABLED(context) (0)
 #if LWS_POSIX && !defined(LWS_WITH_ESP32)
 #define lws_feature_status_libev(_a) \
@@ -1302,6 +1650,8 @@ LWS_EXTERN void
 lws_libevent_destroyloop(struct lws_context *context, int tsi);
 LWS_EXTERN void
 lws_libevent_run(const struct lws_context *context, int tsi);
+LWS_EXTERN void
+lws_libevent_hrtimer_set(struct lws_context_per_thread *pt, lws_usec_t us);
 #define LWS_LIBEVENT_ENABLED(context) lws_check_opt(context->options, LWS_SERVER_OPTION_LIBEVENT)
 LWS_EXTERN void lws_feature_status_libevent(struct lws_context_creation_info *info);
 #else
@@ -1311,6 +1661,7 @@ LWS_EXTERN void lws_feature_status_libevent(struct lws_context_creation_info *in
 #define lws_libevent_init_fd_table(_a) (0)
 #define lws_libevent_run(_a, _b) ((void) 0)
 #define lws_libevent_destroyloop(_a, _b) ((void) 0)
+#define lws_libevent_hrtimer_set(_a, _b) ((void) 0)
 #define LWS_LIBEVENT_ENABLED(context) (0)
 #if LWS_POSIX && !defined(LWS_WITH_ESP32)
 #define lws_feature_status_libevent(_a) \
@@ -1411,6 +1762,13 @@ struct _lws_http_mode_related {
 	lws_filepos_t tx_content_remain;
 	lws_filepos_t rx_content_length;
 	lws_filepos_t rx_content_remain;
+
+#if !defined(LWS_NO_CLIENT)
+	struct lws_dll_lws dll_client_conns; /* conn owner on vhost list */
+	struct lws_dll_lws client_pending; /* conn owner: head of queued wsi */
+	struct lws_dll_lws dll_client_pending; /* queued wsi: on owner's list */
+	char *client_peer; /* conn owner: peer key others can queue on */
+#endif
 };
 
 #define LWS_H2_FRAME_HEADER_LENGTH 9
@@ -1582,6 +1940,7 @@ enum lws_h2_protocol_send_type {
 	LWS_H2_PPS_GOAWAY,
 	LWS_H2_PPS_RST_STREAM,
 	LWS_H2_PPS_UPDATE_WINDOW,
+	LWS_H2_PPS_PING,
 };
 
 struct lws_h2_protocol_send {
@@ -1631,7 +1990,11 @@ struct lws_h2_ghost_sid {
 struct lws_h2_netconn {
 	struct http2_settings set;
 	struct hpack_dynamic_table hpack_dyn_table;
+	lws_usec_t ping_sent_us; /* our PING in flight, or 0 */
+	lws_usec_t rtt_us; /* from our last PING round trip, 0 = unknown */
+	lws_usec_t rtt_taken_us; /* when rtt_us was measured */
 	uint8_t	ping_payload[8];
+	uint8_t	my_ping_payload[8];
 	uint8_t one_setting[LWS_H2_SETTINGS_LEN];
 	char goaway_str[32]; /* for rx */
 	struct lws *swsi;
@@ -1694,8 +2057,17 @@ struct _lws_h2_related {
 
 	char *pending_status_body;
 
+	struct lws_dll_lws dll_client_conns; /* nwsi on vhost client list */
+	struct lws_dll_lws client_pending; /* leader: head of waiting wsi */
+	struct lws_dll_lws dll_client_pending; /* waiter: on leader's list */
+	char *client_peer; /* leader: "address:port:ssl" we can be shared on */
+
+	lws_usec_t rx_win_us; /* when we last topped up the peer's credit */
+
 	int tx_cr;
 	int peer_tx_cr_est;
+	uint32_t rx_win; /* receive window we keep open for the peer */
+	uint32_t rx_win_grown; /* part of rx_win charged to the vhost cap */
 	unsigned int my_sid;
 	unsigned int child_count;
 	int my_priority;
@@ -1707,6 +2079,10 @@ struct _lws_h2_related {
 	unsigned int GOING_AWAY;
 	unsigned int requested_POLLOUT:1;
 	unsigned int skint:1;
+	unsigned int client_offer:1; /* client wsi offering h2 by ALPN */
+	unsigned int client_alpn:1; /* client nwsi that negotiated h2 */
+	unsigned int client_stream:1; /* client stream on a client_alpn nwsi */
+	unsigned int discard_headers:1; /* decodes HEADERS for a closed sid */
 
 	uint16_t round_robin_POLLOUT;
 	uint16_t count_POLLOUT_children;
@@ -1774,6 +2150,7 @@ enum {
 	SIGNIFICANT_HDR_LOCATION,
 	SIGNIFICANT_HDR_STATUS,
 	SIGNIFICANT_HDR_TRANSFER_ENCODING,
+	SIGNIFICANT_HDR_DATE,
 
 	SIGNIFICANT_HDR_COUNT
 };
@@ -1804,6 +2181,7 @@ struct lws_cgi {
 
 	unsigned char being_closed:1;
 	unsigned char explicitly_chunked:1;
+	unsigned char explicit_date:1;
 
 	unsigned char chunked_grace;
 };
@@ -1841,29 +2219,95 @@ struct lws_access_log {
 #endif
 
 struct lws {
-	/* structs */
+	/*
+	 * Members the service loop looks at for every POLLIN / POLLOUT come
+	 * first, so they share the first cachelines.  The big embedded
+	 * structs that are only used in particular modes go last.
+	 */
 
-	struct _lws_http_mode_related http;
-#ifdef LWS_WITH_HTTP2
-	struct _lws_h2_related h2;
+	struct lws_context *context;
+	struct lws_vhost *vhost;
+	const struct lws_protocols *protocol;
+	void *user_space;
+#ifdef LWS_OPENSSL_SUPPORT
+	lws_tls_conn *ssl;
 #endif
+	/* truncated send handling */
+	unsigned char *trunc_alloc; /* non-NULL means buffering in progress */
+	struct lws_tx_coalesce *tx_coalesce; /* only during writeable cb */
+	struct lws_udp *udp; /* only for LWS_ADOPT_FLAG_UDP */
+	struct lws_txn_chunk *txn; /* transaction arena, newest chunk first */
+	lws_sock_file_fd_type desc; /* .filefd / .sockfd */
+	int position_in_fds_table;
+	uint8_t state; /* enum lws_connection_states */
+	uint8_t mode; /* enum connection_mode */
+	char tsi; /* thread service index we belong to */
+	uint8_t rxflow_bitmap;
+	unsigned int trunc_len; /* how much is buffered */
+	/* volatile to make sure code is aware other thread can change */
+	volatile char handling_pollout;
+	volatile char leave_pollout_active;
 
-	/* lifetime members */
+	unsigned int hdr_parsing_completed:1;
+	unsigned int http2_substream:1;
+	unsigned int upgraded_to_http2:1;
+	unsigned int h2_stream_carries_ws:1;
+	unsigned int seen_nonpseudoheader:1;
+	unsigned int listener:1;
+	unsigned int user_space_externally_allocated:1;
+	unsigned int socket_is_permanently_unusable:1;
+	unsigned int rxflow_change_to:2;
+	unsigned int conn_stat_done:1;
+	unsigned int cache_reuse:1;
+	unsigned int cache_revalidate:1;
+	unsigned int cache_intermediaries:1;
+	unsigned int favoured_pollin:1;
+	unsigned int sending_chunked:1;
+	unsigned int interpreting:1;
+	unsigned int already_did_cce:1;
+	unsigned int told_user_closed:1;
+	unsigned int waiting_to_send_close_frame:1;
+	unsigned int ipv6:1;
+	unsigned int parent_carries_io:1;
+	unsigned int parent_pending_cb_on_writable:1;
+	unsigned int cgi_stdout_zero_length:1;
+	unsigned int seen_zero_length_recv:1;
+	unsigned int rxflow_will_be_applied:1;
+	unsigned int event_pipe:1;
+	unsigned int on_same_vh_list:1;
+	unsigned int handling_404;
 
-#if defined(LWS_WITH_LIBEV) || defined(LWS_WITH_LIBUV) || defined(LWS_WITH_LIBEVENT)
-	struct lws_io_watcher w_read;
+	unsigned int could_have_pending:1; /* detect back-to-back writes */
+	unsigned int outer_will_close:1;
+
+#ifdef LWS_WITH_ACCESS_LOG
+	unsigned int access_log_pending:1;
 #endif
-#if defined(LWS_WITH_LIBEV) || defined(LWS_WITH_LIBEVENT)
-	struct lws_io_watcher w_write;
+#ifndef LWS_NO_CLIENT
+	unsigned int do_ws:1; /* whether we are doing http or ws flow */
+	unsigned int chunked:1; /* if the clientside connection is chunked */
+	unsigned int client_rx_avail:1;
+	unsigned int client_http_body_pending:1;
+	unsigned int client_pipeline:1; /* LCCSCF_PIPELINE */
 #endif
-#ifdef LWS_WITH_ACCESS_LOG
-	struct lws_access_log access_log;
+#ifdef LWS_WITH_HTTP_PROXY
+	unsigned int perform_rewrite:1;
+#endif
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+	unsigned int extension_data_pending:1;
+#endif
+#ifdef LWS_OPENSSL_SUPPORT
+	unsigned int use_ssl:4;
+#endif
+#ifdef _WIN32
+	unsigned int sock_send_blocking:1;
+#endif
+#ifdef LWS_OPENSSL_SUPPORT
+	unsigned int redirect_to_https:1;
 #endif
 
 	/* pointers */
 
-	struct lws_context *context;
-	struct lws_vhost *vhost;
 	struct lws *parent; /* points to parent, if any */
 	struct lws *child_list; /* points to first child */
 	struct lws *sibling_list; /* subsequent children at same level */
@@ -1871,7 +2315,6 @@ struct lws {
 #ifdef LWS_WITH_CGI
 	struct lws_cgi *cgi; /* wsi being cgi master have one of these */
 #endif
-	const struct lws_protocols *protocol;
 	struct lws **same_vh_protocol_prev, *same_vh_protocol_next;
 	/* we get on the list if either the timeout or the timer is valid */
 	struct lws_dll_lws dll_timeout;
@@ -1885,22 +2328,28 @@ struct lws {
 #ifndef LWS_NO_CLIENT
 	struct client_info_stash *stash;
 #endif
-	void *user_space;
 	void *opaque_parent_data;
 	/* rxflow handling */
 	unsigned char *rxflow_buffer;
-	/* truncated send handling */
-	unsigned char *trunc_alloc; /* non-NULL means buffering in progress */
 
 #if !defined(LWS_WITHOUT_EXTENSIONS)
 	const struct lws_extension *active_extensions[LWS_MAX_EXTENSIONS_ACTIVE];
 	void *act_ext_user[LWS_MAX_EXTENSIONS_ACTIVE];
 #endif
 #ifdef LWS_OPENSSL_SUPPORT
-	lws_tls_conn *ssl;
 	lws_tls_bio *client_bio;
 	struct lws *pending_read_list_prev, *pending_read_list_next;
 #endif
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	struct lws *tls_offload_next;
+	int tls_offload_n, tls_offload_err; /* SSL_accept() + SSL_get_error() */
+#endif
+#ifdef LWS_OPENSSL_SUPPORT
+	/* dynamic record sizing, see lws_tls_record_size() */
+	unsigned long long tls_rec_last_us; /* last time we wrote anything */
+	unsigned int tls_rec_sent; /* since connect or idle, saturates */
+	int tls_rec_wpend; /* SSL_write() len that must be retried, or 0 */
+#endif
 #ifdef LWS_WITH_HTTP_PROXY
 	struct lws_rewrite *rw;
 #endif
@@ -1908,7 +2357,6 @@ struct lws {
 	unsigned long action_start;
 	unsigned long latency_start;
 #endif
-	lws_sock_file_fd_type desc; /* .filefd / .sockfd */
 #if defined(LWS_WITH_STATS)
 	uint64_t active_writable_req_us;
 #if defined(LWS_OPENSSL_SUPPORT)
@@ -1920,83 +2368,22 @@ struct lws {
 	time_t pending_timeout_set;
 
 	/* ints */
-	int position_in_fds_table;
 	uint32_t rxflow_len;
 	uint32_t rxflow_pos;
 	uint32_t preamble_rx_len;
 	unsigned int trunc_alloc_len; /* size of malloc */
 	unsigned int trunc_offset; /* where we are in terms of spilling */
-	unsigned int trunc_len; /* how much is buffered */
 #ifndef LWS_NO_CLIENT
 	int chunk_remaining;
 #endif
 	unsigned int cache_secs;
-
-	unsigned int hdr_parsing_completed:1;
-	unsigned int http2_substream:1;
-	unsigned int upgraded_to_http2:1;
-	unsigned int h2_stream_carries_ws:1;
-	unsigned int seen_nonpseudoheader:1;
-	unsigned int listener:1;
-	unsigned int user_space_externally_allocated:1;
-	unsigned int socket_is_permanently_unusable:1;
-	unsigned int rxflow_change_to:2;
-	unsigned int conn_stat_done:1;
-	unsigned int cache_reuse:1;
-	unsigned int cache_revalidate:1;
-	unsigned int cache_intermediaries:1;
-	unsigned int favoured_pollin:1;
-	unsigned int sending_chunked:1;
-	unsigned int interpreting:1;
-	unsigned int already_did_cce:1;
-	unsigned int told_user_closed:1;
-	unsigned int waiting_to_send_close_frame:1;
-	unsigned int ipv6:1;
-	unsigned int parent_carries_io:1;
-	unsigned int parent_pending_cb_on_writable:1;
-	unsigned int cgi_stdout_zero_length:1;
-	unsigned int seen_zero_length_recv:1;
-	unsigned int rxflow_will_be_applied:1;
-	unsigned int event_pipe:1;
-	unsigned int on_same_vh_list:1;
-	unsigned int handling_404;
-
-	unsigned int could_have_pending:1; /* detect back-to-back writes */
-	unsigned int outer_will_close:1;
-
-#ifdef LWS_WITH_ACCESS_LOG
-	unsigned int access_log_pending:1;
-#endif
-#ifndef LWS_NO_CLIENT
-	unsigned int do_ws:1; /* whether we are doing http or ws flow */
-	unsigned int chunked:1; /* if the clientside connection is chunked */
-	unsigned int client_rx_avail:1;
-	unsigned int client_http_body_pending:1;
-#endif
-#ifdef LWS_WITH_HTTP_PROXY
-	unsigned int perform_rewrite:1;
-#endif
-#if !defined(LWS_WITHOUT_EXTENSIONS)
-	unsigned int extension_data_pending:1;
-#endif
-#ifdef LWS_OPENSSL_SUPPORT
-	unsigned int use_ssl:4;
-#endif
-#ifdef _WIN32
-	unsigned int sock_send_blocking:1;
-#endif
-#ifdef LWS_OPENSSL_SUPPORT
-	unsigned int redirect_to_https:1;
-#endif
+	uint32_t user_space_len; /* size of the lws-allocated user_space */
 
 #ifndef LWS_NO_CLIENT
 	unsigned short c_port;
 #endif
 	unsigned short pending_timeout_limit;
 
-	uint8_t state; /* enum lws_connection_states */
-	uint8_t mode; /* enum connection_mode */
-
 	/* chars */
 #if !defined(LWS_WITHOUT_EXTENSIONS)
 	uint8_t count_act_ext;
@@ -2005,10 +2392,8 @@ struct lws {
 	char lws_rx_parse_state; /* enum lws_rx_parse_state */
 	char rx_frame_type; /* enum lws_write_protocol */
 	char pending_timeout; /* enum pending_timeout */
-	char tsi; /* thread service index we belong to */
 	char protocol_interpret_idx;
 	char redirects;
-	uint8_t rxflow_bitmap;
 #ifdef LWS_WITH_CGI
 	char cgi_channel; /* which of stdin/out/err */
 	char hdr_state;
@@ -2021,11 +2406,31 @@ struct lws {
 #endif
 #if defined(LWS_WITH_STATS) && defined(LWS_OPENSSL_SUPPORT)
 	char seen_rx;
+#endif
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	char tls_offload_state; /* enum lws_tls_offload_state */
+	char tls_offload_result; /* tls_offload_n / _err waiting to be used */
 #endif
 	uint8_t ws_over_h2_count;
-	/* volatile to make sure code is aware other thread can change */
-	volatile char handling_pollout;
-	volatile char leave_pollout_active;
+
+	/* structs */
+
+	struct _lws_http_mode_related http;
+#ifdef LWS_WITH_HTTP2
+	struct _lws_h2_related h2;
+#endif
+
+	/* lifetime members */
+
+#if defined(LWS_WITH_LIBEV) || defined(LWS_WITH_LIBUV) || defined(LWS_WITH_LIBEVENT)
+	struct lws_io_watcher w_read;
+#endif
+#if defined(LWS_WITH_LIBEV) || defined(LWS_WITH_LIBEVENT)
+	struct lws_io_watcher w_write;
+#endif
+#ifdef LWS_WITH_ACCESS_LOG
+	struct lws_access_log access_log;
+#endif
 };
 
 #define lws_is_flowcontrolled(w) (!!(wsi->rxflow_bitmap))
@@ -2036,6 +2441,12 @@ LWS_EXTERN int
 lws_socket_bind(struct lws_vhost *vhost, lws_sockfd_type sockfd, int port,
 		const char *iface);
 
+LWS_EXTERN lws_sockfd_type
+lws_socket_inherited(struct lws_vhost *vhost, int port, const char *iface);
+
+LWS_EXTERN void
+lws_inherited_listen_fds_close(struct lws_context *context);
+
 #if defined(LWS_WITH_IPV6)
 LWS_EXTERN unsigned long
 lws_get_addr_scope(const char *ipaddr);
@@ -2049,6 +2460,17 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status, const char *caller)
 LWS_EXTERN void
 __lws_free_wsi(struct lws *wsi);
 
+LWS_EXTERN struct lws *
+lws_wsi_alloc(struct lws_context *context, int tsi, const char *reason);
+LWS_EXTERN void
+lws_pss_free(struct lws *wsi);
+LWS_EXTERN void
+lws_txn_release(struct lws *wsi);
+LWS_EXTERN char *
+lws_txn_strdup(struct lws *wsi, const char *s);
+LWS_EXTERN void
+lws_pt_caches_destroy(struct lws_context_per_thread *pt);
+
 LWS_EXTERN int
 __remove_wsi_socket_from_fds(struct lws *wsi);
 LWS_EXTERN int
@@ -2083,6 +2505,9 @@ lws_parse(struct lws *wsi, unsigned char *buf, int *len);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_parse_urldecode(struct lws *wsi, uint8_t *_c);
 
+LWS_EXTERN void
+lws_header_hash_init(struct lws_context *context);
+
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_http_action(struct lws *wsi);
 
@@ -2115,6 +2540,22 @@ __insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi);
 
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len);
+LWS_EXTERN int
+lws_tx_coalesce_begin(struct lws *wsi);
+LWS_EXTERN int
+lws_tx_coalesce_end(struct lws *wsi);
+#ifndef LWS_NO_SERVER
+LWS_EXTERN int
+lws_udp_create(struct lws *wsi);
+LWS_EXTERN void
+lws_udp_destroy(struct lws *wsi);
+LWS_EXTERN int
+lws_udp_flush(struct lws *wsi);
+LWS_EXTERN int
+lws_udp_service_rx(struct lws *wsi);
+LWS_EXTERN int
+lws_udp_service_tx(struct lws *wsi);
+#endif
 
 LWS_EXTERN void
 lws_remove_from_timeout_list(struct lws *wsi);
@@ -2144,6 +2585,15 @@ _lws_destroy_ah(struct lws_context_per_thread *pt, struct allocated_headers *ah)
 LWS_EXTERN void
 lws_client_stash_destroy(struct lws *wsi);
 
+LWS_EXTERN void
+lws_client_peer_key(struct lws *wsi, char *buf, int len);
+LWS_EXTERN int
+lws_client_pipeline_join(struct lws *wsi);
+LWS_EXTERN void
+lws_client_pipeline_leave(struct lws *wsi);
+LWS_EXTERN int
+lws_client_idle_service(struct lws *wsi, struct lws_pollfd *pollfd);
+
 /*
  * EXTENSIONS
  */
@@ -2201,6 +2651,7 @@ LWS_EXTERN int
 lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 	      lws_filepos_t *inused);
 LWS_EXTERN int lws_h2_do_pps_send(struct lws *wsi);
+LWS_EXTERN void lws_h2_rx_win_release(struct lws *wsi);
 LWS_EXTERN int lws_h2_frame_write(struct lws *wsi, int type, int flags,
 				     unsigned int sid, unsigned int len,
 				     unsigned char *buf);
@@ -2219,6 +2670,10 @@ lws_add_http2_header_by_token(struct lws *wsi,
 			    const unsigned char *value, int length,
 			    unsigned char **p, unsigned char *end);
 LWS_EXTERN int
+lws_hpack_encode_literal(const unsigned char *name, int len,
+			 const unsigned char *value, int length,
+			 unsigned char **p, unsigned char *end);
+LWS_EXTERN int
 lws_add_http2_header_status(struct lws *wsi,
 			    unsigned int code, unsigned char **p,
 			    unsigned char *end);
@@ -2242,6 +2697,18 @@ lws_pps_schedule(struct lws *wsi, struct lws_h2_protocol_send *pss);
 LWS_EXTERN const struct http2_settings lws_h2_defaults;
 LWS_EXTERN int
 lws_h2_ws_handshake(struct lws *wsi);
+#if defined(LWS_H2_CLIENT)
+LWS_EXTERN int
+lws_h2_client_join(struct lws *wsi);
+LWS_EXTERN void
+lws_h2_client_leave(struct lws *wsi);
+LWS_EXTERN int
+lws_h2_client_alpn(struct lws *wsi);
+LWS_EXTERN int
+lws_h2_client_handshake(struct lws *wsi);
+LWS_EXTERN void
+lws_h2_client_sent_end_stream(struct lws *wsi);
+#endif
 #else
 #define lws_h2_configure_if_upgraded(x)
 #endif
@@ -2281,6 +2748,9 @@ lws_hdr_simple_ptr(struct lws *wsi, enum lws_token_indexes h);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_hdr_simple_create(struct lws *wsi, enum lws_token_indexes h, const char *s);
 
+LWS_EXTERN int
+lws_vhost_compile_headers(struct lws_vhost *vh);
+
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ensure_user_space(struct lws *wsi);
 
@@ -2294,6 +2764,8 @@ LWS_EXTERN struct lws_vhost *
 lws_select_vhost(struct lws_context *context, int port, const char *servername);
 LWS_EXTERN int
 handshake_0405(struct lws_context *context, struct lws *wsi);
+LWS_EXTERN int
+lws_vhost_compile_ws101(struct lws_vhost *vh);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_interpret_incoming_packet(struct lws *wsi, unsigned char **buf, size_t len);
 LWS_EXTERN void
@@ -2302,6 +2774,7 @@ lws_server_get_canonical_hostname(struct lws_context *context,
 #else
 #define lws_context_init_server(_a, _b) (0)
 #define lws_interpret_incoming_packet(_a, _b, _c) (0)
+#define lws_vhost_compile_ws101(_a) (0)
 #define lws_server_get_canonical_hostname(_a, _b)
 #endif
 
@@ -2333,6 +2806,7 @@ LWS_EXTERN void lwsl_emit_stderr(int level, const char *line);
 #define lws_context_init_ssl_library(_a)
 #define lws_ssl_anybody_has_buffered_read_tsi(_a, _b) (0)
 #define lws_tls_check_all_cert_lifetimes(_a)
+#define lws_tls_ticket_keys_check(_a, _b)
 #define lws_tls_acme_sni_cert_destroy(_a)
 #else
 #define LWS_SSL_ENABLED(context) (context->use_ssl)
@@ -2349,6 +2823,12 @@ LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_capable_read(struct lws *wsi, unsigned char *buf, int len);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_capable_write(struct lws *wsi, unsigned char *buf, int len);
+LWS_EXTERN void
+lws_tls_record_begin(struct lws *wsi);
+LWS_EXTERN int
+lws_tls_record_size(struct lws *wsi, int len);
+LWS_EXTERN void
+lws_tls_record_sent(struct lws *wsi, int n);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_pending(struct lws *wsi);
 LWS_EXTERN int
@@ -2386,6 +2866,13 @@ lws_tls_openssl_cert_info(X509 *x509, enum lws_tls_cert_info type,
 			  union lws_tls_cert_info_results *buf, size_t len);
 LWS_EXTERN int
 lws_tls_check_all_cert_lifetimes(struct lws_context *context);
+LWS_EXTERN void
+lws_tls_ticket_keys_check(struct lws_context *context, time_t now);
+LWS_EXTERN int
+lws_tls_ticket_key_find(struct lws_context *context, const uint8_t *name,
+			struct lws_tls_ticket_key *key);
+LWS_EXTERN int
+lws_tls_session_is_reused(struct lws *wsi);
 LWS_EXTERN int
 lws_tls_server_certs_load(struct lws_vhost *vhost, struct lws *wsi,
 			  const char *cert, const char *private_key,
@@ -2402,10 +2889,13 @@ lws_tls_alloc_pem_to_der_file(struct lws_context *context, const char *filename,
 LWS_EXTERN int
 lws_context_init_server_ssl(struct lws_context_creation_info *info,
 			    struct lws_vhost *vhost);
+LWS_EXTERN int
+lws_tls_server_vhost_deferred_init(struct lws_vhost *vhost);
 void
 lws_tls_acme_sni_cert_destroy(struct lws_vhost *vhost);
 #else
 #define lws_context_init_server_ssl(_a, _b) (0)
+#define lws_tls_server_vhost_deferred_init(_a) (0)
 #define lws_tls_acme_sni_cert_destroy(_a)
 #endif
 LWS_EXTERN void
@@ -2424,9 +2914,15 @@ lws_tls_server_vhost_backend_init(struct lws_context_creation_info *info,
 				  struct lws_vhost *vhost, struct lws *wsi);
 LWS_EXTERN int
 lws_tls_server_new_nonblocking(struct lws *wsi, lws_sockfd_type accept_fd);
+LWS_EXTERN int
+lws_tls_ctx_ref(lws_tls_ctx *ctx);
 
 LWS_EXTERN enum lws_ssl_capable_status
 lws_tls_server_accept(struct lws *wsi);
+LWS_EXTERN int
+lws_tls_server_accept_raw(struct lws *wsi, int *err);
+LWS_EXTERN enum lws_ssl_capable_status
+lws_tls_server_accept_complete(struct lws *wsi, int n, int err);
 
 LWS_EXTERN enum lws_ssl_capable_status
 lws_tls_server_abort_connection(struct lws *wsi);
@@ -2436,6 +2932,8 @@ __lws_tls_shutdown(struct lws *wsi);
 
 LWS_EXTERN enum lws_ssl_capable_status
 lws_tls_client_connect(struct lws *wsi);
+LWS_EXTERN void
+lws_tls_client_reuse(struct lws *wsi);
 LWS_EXTERN int
 lws_tls_client_confirm_peer_cert(struct lws *wsi);
 LWS_EXTERN int
@@ -2461,19 +2959,53 @@ lws_context_init_http2_ssl(struct lws_vhost *vhost);
 #endif
 #endif
 
+#if defined(LWS_WITH_FCACHE)
+LWS_EXTERN void
+lws_fcache_init(struct lws_context *context,
+		const struct lws_context_creation_info *info);
+LWS_EXTERN void
+lws_fcache_destroy(struct lws_context *context);
+LWS_EXTERN lws_fop_fd_t
+lws_fcache_open(struct lws_context *context, const char *key, char *path,
+		size_t path_len);
+LWS_EXTERN int
+lws_fcache_insert(struct lws *wsi, const char *key, const char *path);
+#else
+#define lws_fcache_init(_a, _b)
+#define lws_fcache_destroy(_a)
+#define lws_fcache_open(_a, _b, _c, _d) (NULL)
+#define lws_fcache_insert(_a, _b, _c) (0)
+#endif
+
+#if defined(LWS_WITH_TLS_OFFLOAD)
+LWS_EXTERN int
+lws_tls_offload_create(struct lws_context *context, int threads);
+LWS_EXTERN void
+lws_tls_offload_destroy(struct lws_context *context);
+LWS_EXTERN void
+lws_tls_offload_destroy2(struct lws_context *context);
+LWS_EXTERN int
+lws_tls_offload_queue(struct lws *wsi);
+LWS_EXTERN void
+lws_tls_offload_cancel(struct lws *wsi);
+LWS_EXTERN void
+lws_tls_offload_service_pt(struct lws_context_per_thread *pt);
+#else
+#define lws_tls_offload_cancel(_a)
+#define lws_tls_offload_service_pt(_a)
+#endif
+
 #if LWS_MAX_SMP > 1
 
 static LWS_INLINE void
 lws_pt_mutex_init(struct lws_context_per_thread *pt)
 {
 	pthread_mutex_init(&pt->lock, NULL);
-	pthread_mutex_init(&pt->lock_stats, NULL);
 }
 
 static LWS_INLINE void
 lws_pt_mutex_destroy(struct lws_context_per_thread *pt)
 {
-	pthread_mutex_destroy(&pt->lock_stats);
 	pthread_mutex_destroy(&pt->lock);
 }
 
@@ -2503,18 +3035,6 @@ lws_pt_unlock(struct lws_context_per_thread *pt)
 	pthread_mutex_unlock(&pt->lock);
 }
 
-static LWS_INLINE void
-lws_pt_stats_lock(struct lws_context_per_thread *pt)
-{
-	pthread_mutex_lock(&pt->lock_stats);
-}
-
-static LWS_INLINE void
-lws_pt_stats_unlock(struct lws_context_per_thread *pt)
-{
-	pthread_mutex_unlock(&pt->lock_stats);
-}
-
 static LWS_INLINE void
 lws_context_lock(struct lws_context *context)
 {
@@ -2549,8 +3069,6 @@ lws_vhost_unlock(struct lws_vhost *vhost)
 #define lws_context_unlock(_a) (void)(_a)
 #define lws_vhost_lock(_a) (void)(_a)
 #define lws_vhost_unlock(_a) (void)(_a)
-#define lws_pt_stats_lock(_a) (void)(_a)
-#define lws_pt_stats_unlock(_a) (void)(_a)
 #endif
 
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
@@ -2566,6 +3084,11 @@ int
 lws_tls_check_cert_lifetime(struct lws_vhost *vhost);
 
 int lws_jws_selftest(void);
+#if defined(LWS_WITH_JWS)
+int
+lws_jws_confirm_sig_ctx(const char *in, size_t len, struct lws_jwk *jwk,
+			struct lws_genrsa_ctx *rsactx);
+#endif
 
 #ifdef LWS_WITH_HTTP_PROXY
 struct lws_rewrite {
@@ -2683,6 +3206,8 @@ lws_plat_pipe_create(struct lws *wsi);
 int
 lws_plat_pipe_signal(struct lws *wsi);
 void
+lws_pt_wake(struct lws_context_per_thread *pt);
+void
 lws_plat_pipe_close(struct lws *wsi);
 int
 lws_create_event_pipes(struct lws_context *context);
@@ -2747,12 +3272,93 @@ LWS_EXTERN int
 lws_broadcast(struct lws_context *context, int reason, void *in, size_t len);
 
 #if defined(LWS_WITH_STATS)
-void
+
+/*
+ * The pt stats are normally only written by the pt's own service thread,
+ * but a few places (eg, peer limit denial during adoption, or session
+ * callbacks on tls offload workers) may bump another thread's pt counters.
+ * Where the toolchain gives us cheap 64-bit atomics, use relaxed ones for
+ * that, there's no ordering to preserve.  Otherwise a rare lost count is
+ * acceptable for statistics.
+ */
+#if (LWS_MAX_SMP > 1 || defined(LWS_WITH_TLS_OFFLOAD)) && \
+    (defined(__GNUC__) || defined(__clang__)) && \
+    defined(__SIZEOF_POINTER__) && __SIZEOF_POINTER__ == 8
+#define lws_stats_add(_p, _v) __atomic_fetch_add(_p, _v, __ATOMIC_RELAXED)
+#else
+#define lws_stats_add(_p, _v) (*(_p) += (_v))
+#endif
+
+static LWS_INLINE void
 lws_stats_atomic_bump(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t bump);
-void
+		struct lws_context_per_thread *pt, int index, uint64_t bump)
+{
+	(void)context;
+	lws_stats_add(&pt->stats.c[index], bump);
+	if (index != LWSSTATS_C_SERVICE_ENTRY && !pt->stats.updated)
+		pt->stats.updated = 1;
+}
+
+static LWS_INLINE void
 lws_stats_atomic_max(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t val);
+		struct lws_context_per_thread *pt, int index, uint64_t val)
+{
+	(void)context;
+	/* a racing bigger value from another thread may get lost, it's ok */
+	if (val > pt->stats.c[index]) {
+		pt->stats.c[index] = val;
+		pt->stats.updated = 1;
+	}
+}
+
+static LWS_INLINE int
+lws_stats_hist_bucket(uint64_t us)
+{
+	int e, n;
+
+	if (us < (1 << LWS_STATS_HIST_SUBBITS))
+		return (int)us;
+
+	if (us >> 32)
+		return LWS_STATS_HIST_BUCKETS - 1;
+
+#if defined(__GNUC__) || defined(__clang__)
+	e = 31 - __builtin_clz((unsigned int)us);
+#else
+	e = 0;
+	while (us >> (e + 1))
+		e++;
+#endif
+	n = ((e - LWS_STATS_HIST_SUBBITS + 1) << LWS_STATS_HIST_SUBBITS) +
+	    (int)((us >> (e - LWS_STATS_HIST_SUBBITS)) &
+		  ((1 << LWS_STATS_HIST_SUBBITS) - 1));
+
+	if (n >= LWS_STATS_HIST_BUCKETS)
+		n = LWS_STATS_HIST_BUCKETS - 1;
+
+	return n;
+}
+
+static LWS_INLINE uint64_t
+lws_stats_hist_bucket_floor(int bucket)
+{
+	int e = (bucket >> LWS_STATS_HIST_SUBBITS) + LWS_STATS_HIST_SUBBITS - 1;
+
+	if (bucket < (1 << LWS_STATS_HIST_SUBBITS))
+		return (uint64_t)bucket;
+
+	return ((uint64_t)(1 << LWS_STATS_HIST_SUBBITS) +
+		(bucket & ((1 << LWS_STATS_HIST_SUBBITS) - 1))) <<
+			(e - LWS_STATS_HIST_SUBBITS);
+}
+
+static LWS_INLINE void
+lws_stats_hist_add(struct lws_context_per_thread *pt, int index, uint64_t us)
+{
+	lws_stats_add(&pt->stats.hist[index][lws_stats_hist_bucket(us)], 1);
+	lws_stats_add(&pt->stats.hist_sum[index], us);
+}
+
 #else
 static inline uint64_t lws_stats_atomic_bump(struct lws_context * context,
 		struct lws_context_per_thread *pt, int index, uint64_t bump) {
@@ -2760,6 +3366,12 @@ static inline uint64_t lws_stats_atomic_bump(struct lws_context * context,
 static inline uint64_t lws_stats_atomic_max(struct lws_context * context,
 		struct lws_context_per_thread *pt, int index, uint64_t val) {
 	(void)context; (void)pt; (void)index; (void)val; return 0; }
+#define lws_stats_hist_add(_a, _b, _c) ((void)(_a))
+#endif
+
+#if defined(LWS_WITH_STATS) && defined(LWS_WITH_SERVER_STATUS)
+int
+lws_stats_json_dump_hist(const struct lws_context *context, char *buf, int len);
 #endif
 
 /* socks */
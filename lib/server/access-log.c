@@ -58,7 +58,8 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int meth)
 	if (wsi->access_log_pending)
 		lws_access_log(wsi);
 
-	wsi->access_log.header_log = lws_malloc(l, "access log");
+	/* these all live in the txn arena, until the transaction completes */
+	wsi->access_log.header_log = lws_txn_alloc(wsi, l);
 	if (wsi->access_log.header_log) {
 
 		tmp = localtime(&t);
@@ -85,10 +86,10 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int meth)
 
 		l = lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_USER_AGENT);
 		if (l) {
-			wsi->access_log.user_agent = lws_malloc(l + 2, "access log");
+			wsi->access_log.user_agent = lws_txn_alloc(wsi, l + 2);
 			if (!wsi->access_log.user_agent) {
 				lwsl_err("OOM getting user agent\n");
-				lws_free_set_NULL(wsi->access_log.header_log);
+				wsi->access_log.header_log = NULL;
 				return;
 			}
 
@@ -101,11 +102,11 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int meth)
 		}
 		l = lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_REFERER);
 		if (l) {
-			wsi->access_log.referrer = lws_malloc(l + 2, "referrer");
+			wsi->access_log.referrer = lws_txn_alloc(wsi, l + 2);
 			if (!wsi->access_log.referrer) {
 				lwsl_err("OOM getting user agent\n");
-				lws_free_set_NULL(wsi->access_log.user_agent);
-				lws_free_set_NULL(wsi->access_log.header_log);
+				wsi->access_log.user_agent = NULL;
+				wsi->access_log.header_log = NULL;
 				return;
 			}
 			lws_hdr_copy(wsi, wsi->access_log.referrer,
@@ -160,18 +161,10 @@ lws_access_log(struct lws *wsi)
 	if (write(wsi->vhost->log_fd, ass, l) != l)
 		lwsl_err("Failed to write log\n");
 
-	if (wsi->access_log.header_log) {
-		lws_free(wsi->access_log.header_log);
-		wsi->access_log.header_log = NULL;
-	}
-	if (wsi->access_log.user_agent) {
-		lws_free(wsi->access_log.user_agent);
-		wsi->access_log.user_agent = NULL;
-	}
-	if (wsi->access_log.referrer) {
-		lws_free(wsi->access_log.referrer);
-		wsi->access_log.referrer = NULL;
-	}
+	/* the strings themselves go when the txn arena is released */
+	wsi->access_log.header_log = NULL;
+	wsi->access_log.user_agent = NULL;
+	wsi->access_log.referrer = NULL;
 	wsi->access_log_pending = 0;
 
 	return 0;
@@ -118,14 +118,16 @@ lws_cgi(struct lws *wsi, const char * const *exec_array, int script_uri_path_len
 	int n, m = 0, i, uritok = -1;
 
 	/*
-	 * give the master wsi a cgi struct
+	 * give the master wsi a cgi struct... it's in the txn arena, a cgi
+	 * connection always closes when the cgi is done
 	 */
 
-	wsi->cgi = lws_zalloc(sizeof(*wsi->cgi), "new cgi");
+	wsi->cgi = lws_txn_alloc(wsi, sizeof(*wsi->cgi));
 	if (!wsi->cgi) {
 		lwsl_err("%s: OOM\n", __func__);
 		return -1;
 	}
+	memset(wsi->cgi, 0, sizeof(*wsi->cgi));
 
 	wsi->cgi->response_code = HTTP_STATUS_OK;
 
@@ -460,7 +462,7 @@ bail1:
 			close(cgi->pipe_fds[n][1]);
 	}
 
-	lws_free_set_NULL(wsi->cgi);
+	wsi->cgi = NULL;
 
 	lwsl_err("%s: failed\n", __func__);
 
@@ -474,6 +476,7 @@ static const char * const significant_hdr[SIGNIFICANT_HDR_COUNT] = {
 	"location: ",
 	"status: ",
 	"transfer-encoding: chunked",
+	"date: ",
 };
 
 enum header_recode {
@@ -505,8 +508,10 @@ lws_cgi_write_split_stdout_headers(struct lws *wsi)
 			lwsl_debug("LHCS_RESPONSE: issuing response %d\n",
 				   wsi->cgi->response_code);
 			if (lws_add_http_header_status(wsi,
-						       wsi->cgi->response_code,
-						       &p, end))
+						wsi->cgi->response_code |
+						(wsi->cgi->explicit_date ?
+						 LWSAHH_FLAG_NO_DATE : 0),
+						&p, end))
 				return 1;
 			if (!wsi->cgi->explicitly_chunked &&
 			    !wsi->cgi->content_length &&
@@ -646,8 +651,8 @@ post_hpack_recode:
 			wsi->cgi->headers_dumped += n;
 			if (wsi->cgi->headers_dumped == wsi->cgi->headers_pos) {
 				wsi->hdr_state = LHCS_PAYLOAD;
-				lws_free_set_NULL(wsi->cgi->headers_buf);
-				lwsl_debug("freed cgi headers\n");
+				wsi->cgi->headers_buf = NULL;
+				lwsl_debug("done with cgi headers\n");
 			} else {
 				wsi->reason_bf |= LWS_CB_REASON_AUX_BF__CGI_HEADERS;
 				lws_callback_on_writable(wsi);
@@ -664,8 +669,8 @@ post_hpack_recode:
 			n = 2048;
 			if (wsi->http2_substream)
 				n = 4096;
-			wsi->cgi->headers_buf = lws_malloc(n + LWS_PRE,
-							   "cgi hdr buf");
+			wsi->cgi->headers_buf = lws_txn_alloc(wsi,
+							      n + LWS_PRE);
 			if (!wsi->cgi->headers_buf) {
 				lwsl_err("OOM\n");
 				return -1;
@@ -771,6 +776,14 @@ post_hpack_recode:
 				wsi->cgi->response_code = 302;
 			}
 
+			/* the cgi's own Date: replaces the one we would add */
+			if (wsi->hdr_state != LCHS_HEADER &&
+			    !significant_hdr[SIGNIFICANT_HDR_DATE][
+				     wsi->cgi->match[SIGNIFICANT_HDR_DATE]]) {
+				lwsl_debug("CGI: Date hdr seen\n");
+				wsi->cgi->explicit_date = 1;
+			}
+
 			break;
 		case LCHS_LF1:
 			*wsi->cgi->headers_pos++ = c;
@@ -1108,10 +1121,8 @@ lws_cgi_remove_and_kill(struct lws *wsi)
 		}
 		pcgi = &(*pcgi)->cgi_list;
 	}
-	if (wsi->cgi->headers_buf) {
-		lwsl_debug("close: freed cgi headers\n");
-		lws_free_set_NULL(wsi->cgi->headers_buf);
-	}
+	/* headers_buf is in the txn arena, it goes when the wsi is freed */
+	wsi->cgi->headers_buf = NULL;
 	/* we have a cgi going, we must kill it */
 	wsi->cgi->being_closed = 1;
 	lws_cgi_kill(wsi);
@@ -0,0 +1,413 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * Context-wide cache of the small static files lws_serve_http_file() sends.
+ *
+ * The whole file content is kept along with the size and modification time
+ * it had when it was read, so a hit can be served, or answered with a 304,
+ * without touching the filesystem at all.  Once an entry has been in the
+ * cache for ttl_secs, the next request for it stat()s the file to confirm it
+ * didn't change.  When adding a file would take the content over the cache
+ * size, the least recently used entries are dropped.
+ *
+ * Hits are served through a memory fop_fd using fops_fcache, so the rest of
+ * the file serving code, including ranges, doesn't know the difference.
+ */
+
+#define LWS_FCACHE_DEF_FILE_MAX (64 * 1024)
+#define LWS_FCACHE_DEF_TTL_SECS 5
+
+static void
+lws_fcache_lock(struct lws_fcache *fc)
+{
+#if LWS_MAX_SMP > 1
+	pthread_mutex_lock(&fc->lock);
+#else
+	(void)fc;
+#endif
+}
+
+static void
+lws_fcache_unlock(struct lws_fcache *fc)
+{
+#if LWS_MAX_SMP > 1
+	pthread_mutex_unlock(&fc->lock);
+#else
+	(void)fc;
+#endif
+}
+
+static uint32_t
+lws_fcache_hash(const char *key)
+{
+	uint32_t h = 0x811c9dc5;
+
+	while (*key)
+		h = (h ^ (uint8_t)*key++) * 0x01000193;
+
+	return h;
+}
+
+static void
+__lws_fcache_lru_unlink(struct lws_fcache *fc, struct lws_fcache_entry *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		fc->lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		fc->lru_tail = e->lru_prev;
+
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void
+__lws_fcache_lru_add_head(struct lws_fcache *fc, struct lws_fcache_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = fc->lru_head;
+	if (fc->lru_head)
+		fc->lru_head->lru_prev = e;
+	else
+		fc->lru_tail = e;
+	fc->lru_head = e;
+}
+
+static void
+__lws_fcache_evict(struct lws_fcache *fc, struct lws_fcache_entry *e)
+{
+	lws_start_foreach_llp(struct lws_fcache_entry **, pe,
+			fc->hash_table[e->hash % LWS_FCACHE_HASH]) {
+		if (*pe == e) {
+			*pe = e->hash_next;
+			break;
+		}
+	} lws_end_foreach_llp(pe, hash_next);
+
+	__lws_fcache_lru_unlink(fc, e);
+	fc->used -= (size_t)e->len;
+	e->evicted = 1;
+
+	/* if anybody is still sending it, the last close frees it */
+	if (!e->refcount)
+		lws_free(e);
+}
+
+static void
+lws_fcache_entry_unref(struct lws_fcache_entry *e)
+{
+	struct lws_fcache *fc = e->fc;
+
+	lws_fcache_lock(fc);
+	if (!--e->refcount && e->evicted)
+		lws_free(e);
+	lws_fcache_unlock(fc);
+}
+
+static int
+fops_fcache_close(lws_fop_fd_t *fop_fd)
+{
+	lws_fcache_entry_unref((*fop_fd)->filesystem_priv);
+	lws_free_set_NULL(*fop_fd);
+
+	return 0;
+}
+
+static lws_fileofs_t
+fops_fcache_seek_cur(lws_fop_fd_t fop_fd, lws_fileofs_t offset)
+{
+	if (offset > 0 &&
+	    offset > (lws_fileofs_t)fop_fd->len - (lws_fileofs_t)fop_fd->pos)
+		offset = fop_fd->len - fop_fd->pos;
+
+	if ((lws_fileofs_t)fop_fd->pos + offset < 0)
+		offset = -fop_fd->pos;
+
+	fop_fd->pos += offset;
+
+	return fop_fd->pos;
+}
+
+static int
+fops_fcache_read(lws_fop_fd_t fop_fd, lws_filepos_t *amount, uint8_t *buf,
+		 lws_filepos_t len)
+{
+	struct lws_fcache_entry *e = fop_fd->filesystem_priv;
+
+	if (len > fop_fd->len - fop_fd->pos)
+		len = fop_fd->len - fop_fd->pos;
+
+	memcpy(buf, e->data + fop_fd->pos, (size_t)len);
+	fop_fd->pos += len;
+	*amount = len;
+
+	return 0;
+}
+
+static const struct lws_plat_file_ops fops_fcache = {
+	NULL,			/* open: we make these fop_fds ourselves */
+	fops_fcache_close,
+	fops_fcache_seek_cur,
+	fops_fcache_read,
+	NULL,			/* write */
+	{ { NULL, 0 } },
+	NULL
+};
+
+/* takes over the caller's reference on e */
+
+static lws_fop_fd_t
+lws_fcache_fop_fd(struct lws_fcache_entry *e)
+{
+	lws_fop_fd_t fop_fd = lws_malloc(sizeof(*fop_fd), "fcache fop_fd");
+
+	if (!fop_fd) {
+		lws_fcache_entry_unref(e);
+
+		return NULL;
+	}
+
+	fop_fd->fd = LWS_INVALID_FILE;
+	fop_fd->fops = &fops_fcache;
+	fop_fd->filesystem_priv = e;
+	fop_fd->pos = 0;
+	fop_fd->len = e->len;
+	fop_fd->flags = LWS_O_RDONLY | LWS_FOP_FLAG_MOD_TIME_VALID;
+	fop_fd->mod_time = e->mod_time;
+
+	return fop_fd;
+}
+
+void
+lws_fcache_init(struct lws_context *context,
+		const struct lws_context_creation_info *info)
+{
+	struct lws_fcache *fc = &context->fcache;
+
+	memset(fc, 0, sizeof(*fc));
+
+	fc->size = info->fcache_size;
+	fc->file_max = info->fcache_file_max;
+	if (!fc->file_max)
+		fc->file_max = LWS_FCACHE_DEF_FILE_MAX;
+	fc->ttl_secs = info->fcache_ttl_secs;
+	if (!fc->ttl_secs)
+		fc->ttl_secs = LWS_FCACHE_DEF_TTL_SECS;
+#if LWS_MAX_SMP > 1
+	pthread_mutex_init(&fc->lock, NULL);
+#endif
+}
+
+void
+lws_fcache_destroy(struct lws_context *context)
+{
+	struct lws_fcache *fc = &context->fcache;
+
+	/* every connection is closed by now, so nothing is still referenced */
+
+	while (fc->lru_head)
+		__lws_fcache_evict(fc, fc->lru_head);
+
+#if LWS_MAX_SMP > 1
+	pthread_mutex_destroy(&fc->lock);
+#endif
+}
+
+/*
+ * Returns a memory fop_fd for the file cached for key, or NULL if none.  If
+ * path is given, it's set to the name of the file that was cached for key.
+ */
+
+lws_fop_fd_t
+lws_fcache_open(struct lws_context *context, const char *key, char *path,
+		size_t path_len)
+{
+	struct lws_fcache *fc = &context->fcache;
+	struct lws_fcache_entry *e;
+	time_t now;
+	uint32_t h;
+	int stale;
+	struct stat st;
+
+	if (!fc->size)
+		return NULL;
+
+	h = lws_fcache_hash(key);
+
+	lws_fcache_lock(fc);
+	e = fc->hash_table[h % LWS_FCACHE_HASH];
+	while (e && (e->hash != h || strcmp(e->key, key)))
+		e = e->hash_next;
+	if (!e) {
+		lws_fcache_unlock(fc);
+
+		return NULL;
+	}
+	e->refcount++;
+	__lws_fcache_lru_unlink(fc, e);
+	__lws_fcache_lru_add_head(fc, e);
+
+	now = lws_now_secs();
+	stale = (unsigned int)(now - e->checked) >= fc->ttl_secs;
+	lws_fcache_unlock(fc);
+
+	if (stale) {
+		/* check it against the filesystem without holding the lock */
+		if (stat(e->path, &st) ||
+		    (S_IFMT & st.st_mode) != S_IFREG ||
+		    (lws_filepos_t)st.st_size != e->len ||
+		    (uint32_t)st.st_mtime != e->mod_time) {
+			lwsl_info("%s: %s changed\n", __func__, e->path);
+			lws_fcache_lock(fc);
+			if (!e->evicted)
+				__lws_fcache_evict(fc, e);
+			lws_fcache_unlock(fc);
+			lws_fcache_entry_unref(e);
+
+			return NULL;
+		}
+
+		lws_fcache_lock(fc);
+		e->checked = now;
+		lws_fcache_unlock(fc);
+	}
+
+	if (path)
+		lws_strncpy(path, e->path, path_len);
+
+	return lws_fcache_fop_fd(e);
+}
+
+/*
+ * wsi->http.fop_fd has just been opened on path, at the start of the file, to
+ * serve a request for key.  If the file is suitable, read it into a new cache
+ * entry and replace the fop_fd with a memory one on that.
+ *
+ * Returns nonzero only if the fop_fd was lost.
+ */
+
+int
+lws_fcache_insert(struct lws *wsi, const char *key, const char *path)
+{
+	struct lws_fcache *fc = &wsi->context->fcache;
+	lws_fop_fd_t fop_fd = wsi->http.fop_fd, nfd;
+	size_t klen, plen, len;
+	struct lws_fcache_entry *e;
+	lws_filepos_t amount, got = 0;
+	uint32_t mod_time;
+	struct stat st;
+	uint8_t *p;
+
+	if (!fc->size || fop_fd->fops != wsi->context->fops || fop_fd->pos ||
+	    (fop_fd->flags & (LWS_FOP_FLAG_COMPR_IS_GZIP |
+			      LWS_FOP_FLAG_VIRTUAL)) ||
+	    fop_fd->len > fc->file_max || fop_fd->len > fc->size)
+		return 0;
+
+	if (fop_fd->flags & LWS_FOP_FLAG_MOD_TIME_VALID)
+		mod_time = fop_fd->mod_time;
+	else {
+		if (stat(path, &st) || (S_IFMT & st.st_mode) != S_IFREG ||
+		    (lws_filepos_t)st.st_size != fop_fd->len)
+			return 0;
+		mod_time = (uint32_t)st.st_mtime;
+	}
+
+	len = (size_t)fop_fd->len;
+	klen = strlen(key) + 1;
+	plen = strlen(path) + 1;
+
+	e = lws_malloc(sizeof(*e) + klen + plen + len, "fcache entry");
+	if (!e)
+		return 0;
+
+	p = (uint8_t *)&e[1];
+	while (got < fop_fd->len) {
+		if (lws_vfs_file_read(fop_fd, &amount, p + klen + plen + got,
+				      fop_fd->len - got) || !amount)
+			break;
+		got += amount;
+	}
+	if (got != fop_fd->len) {
+		lws_free(e);
+		/* the file changed under us... go on with what we have */
+		if (got && lws_vfs_file_seek_cur(fop_fd,
+						 -(lws_fileofs_t)got) < 0)
+			return 1;
+
+		return 0;
+	}
+
+	memset(e, 0, sizeof(*e));
+	memcpy(p, key, klen);
+	e->key = (const char *)p;
+	memcpy(p + klen, path, plen);
+	e->path = (const char *)p + klen;
+	e->data = p + klen + plen;
+	e->len = fop_fd->len;
+	e->mod_time = mod_time;
+	e->hash = lws_fcache_hash(key);
+	e->checked = lws_now_secs();
+	e->fc = fc;
+	e->refcount = 1; /* the fop_fd we are going to give the wsi */
+
+	nfd = lws_fcache_fop_fd(e);
+	if (!nfd) {
+		lws_free(e);
+
+		return 1;
+	}
+
+	lws_fcache_lock(fc);
+
+	/* another thread may have beaten us to it, replace that one */
+	lws_start_foreach_llp(struct lws_fcache_entry **, pe,
+			fc->hash_table[e->hash % LWS_FCACHE_HASH]) {
+		if ((*pe)->hash == e->hash && !strcmp((*pe)->key, key)) {
+			__lws_fcache_evict(fc, *pe);
+			break;
+		}
+	} lws_end_foreach_llp(pe, hash_next);
+
+	while (fc->lru_tail && fc->used + len > fc->size)
+		__lws_fcache_evict(fc, fc->lru_tail);
+
+	e->hash_next = fc->hash_table[e->hash % LWS_FCACHE_HASH];
+	fc->hash_table[e->hash % LWS_FCACHE_HASH] = e;
+	__lws_fcache_lru_add_head(fc, e);
+	fc->used += len;
+
+	lws_fcache_unlock(fc);
+
+	lwsl_info("%s: cached %s (%lu), %lu / %lu\n", __func__, path,
+		  (unsigned long)len, (unsigned long)fc->used,
+		  (unsigned long)fc->size);
+
+	lws_vfs_file_close(&wsi->http.fop_fd);
+	wsi->http.fop_fd = nfd;
+
+	return 0;
+}
@@ -39,6 +39,11 @@ static const char * const paths_global[] = {
 	"global.timeout-secs",
 	"global.reject-service-keywords[].*",
 	"global.reject-service-keywords[]",
+	"global.tls-ctx-share",
+	"global.tls-ctx-lazy",
+	"global.tls-ctx-threads",
+	"global.tls-ticket-key-rotate-secs",
+	"global.tls-offload-threads",
 };
 
 enum lejp_global_paths {
@@ -51,7 +56,12 @@ enum lejp_global_paths {
 	LWJPGP_PINGPONG_SECS,
 	LWJPGP_TIMEOUT_SECS,
 	LWJPGP_REJECT_SERVICE_KEYWORDS_NAME,
-	LWJPGP_REJECT_SERVICE_KEYWORDS
+	LWJPGP_REJECT_SERVICE_KEYWORDS,
+	LWJPGP_TLS_CTX_SHARE,
+	LWJPGP_TLS_CTX_LAZY,
+	LWJPGP_TLS_CTX_THREADS,
+	LWJPGP_TLS_TICKET_KEY_ROTATE_SECS,
+	LWJPGP_TLS_OFFLOAD_THREADS,
 };
 
 static const char * const paths_vhosts[] = {
@@ -102,6 +112,13 @@ static const char * const paths_vhosts[] = {
 	"vhosts[].client-cert-required",
 	"vhosts[].ignore-missing-cert",
 	"vhosts[].error-document-404",
+	"vhosts[].tls-session-cache-size",
+	"vhosts[].tls-session-timeout",
+	"vhosts[].h2-rx-window-max",
+	"vhosts[].h2-rx-window-vhost-max",
+	"vhosts[].tls-record-size-small",
+	"vhosts[].tls-record-boost-bytes",
+	"vhosts[].tls-record-idle-ms",
 };
 
 enum lejp_vhost_paths {
@@ -152,6 +169,13 @@ enum lejp_vhost_paths {
 	LEJPVP_FLAG_CLIENT_CERT_REQUIRED,
 	LEJPVP_IGNORE_MISSING_CERT,
 	LEJPVP_ERROR_DOCUMENT_404,
+	LEJPVP_TLS_SESSION_CACHE_SIZE,
+	LEJPVP_TLS_SESSION_TIMEOUT,
+	LEJPVP_H2_RX_WINDOW_MAX,
+	LEJPVP_H2_RX_WINDOW_VHOST_MAX,
+	LEJPVP_TLS_RECORD_SIZE_SMALL,
+	LEJPVP_TLS_RECORD_BOOST_BYTES,
+	LEJPVP_TLS_RECORD_IDLE_MS,
 };
 
 static const char * const parser_errs[] = {
@@ -290,6 +314,31 @@ lejp_globals_cb(struct lejp_ctx *ctx, char reason)
 		a->info->timeout_secs = atoi(ctx->buf);
 		return 0;
 
+	case LWJPGP_TLS_CTX_SHARE:
+		if (arg_to_bool(ctx->buf))
+			a->info->options |= LWS_SERVER_OPTION_SSL_CTX_SHARE;
+		return 0;
+
+	case LWJPGP_TLS_CTX_LAZY:
+		if (arg_to_bool(ctx->buf))
+			a->info->options |= LWS_SERVER_OPTION_SSL_CTX_DEFER;
+		return 0;
+
+	case LWJPGP_TLS_TICKET_KEY_ROTATE_SECS:
+		a->info->tls_ticket_key_rotate_secs = atoi(ctx->buf);
+		return 0;
+
+	case LWJPGP_TLS_OFFLOAD_THREADS:
+		a->info->tls_offload_threads = atoi(ctx->buf);
+		return 0;
+
+	case LWJPGP_TLS_CTX_THREADS:
+		/* defer the vhost ctx, then build them all in one go */
+		a->info->tls_ctx_build_threads = atoi(ctx->buf);
+		if (a->info->tls_ctx_build_threads)
+			a->info->options |= LWS_SERVER_OPTION_SSL_CTX_DEFER;
+		return 0;
+
 	default:
 		return 0;
 	}
@@ -333,7 +382,9 @@ lejp_vhosts_cb(struct lejp_ctx *ctx, char reason)
 			LWS_SERVER_OPTION_EXPLICIT_VHOSTS |
 			LWS_SERVER_OPTION_UV_NO_SIGSEGV_SIGFPE_SPIN |
 			LWS_SERVER_OPTION_LIBEVENT |
-			LWS_SERVER_OPTION_LIBEV
+			LWS_SERVER_OPTION_LIBEV |
+			LWS_SERVER_OPTION_SSL_CTX_SHARE |
+			LWS_SERVER_OPTION_SSL_CTX_DEFER
 				);
 		ss = a->info->server_string;
 		i[2] = a->info->ws_ping_pong_interval;
@@ -725,6 +776,34 @@ lejp_vhosts_cb(struct lejp_ctx *ctx, char reason)
 		a->info->error_document_404 = a->p;
 		break;
 
+	case LEJPVP_TLS_SESSION_CACHE_SIZE:
+		a->info->tls_session_cache_size = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_TLS_SESSION_TIMEOUT:
+		a->info->tls_session_timeout = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_H2_RX_WINDOW_MAX:
+		a->info->h2_rx_window_max = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_H2_RX_WINDOW_VHOST_MAX:
+		a->info->h2_rx_window_vhost_max = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_TLS_RECORD_SIZE_SMALL:
+		a->info->tls_record_size_small = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_TLS_RECORD_BOOST_BYTES:
+		a->info->tls_record_boost_bytes = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_TLS_RECORD_IDLE_MS:
+		a->info->tls_record_idle_ms = atoi(ctx->buf);
+		return 0;
+
 	case LEJPVP_SSL_OPTION_SET:
 		a->info->ssl_options_set |= atol(ctx->buf);
 		return 0;
@@ -965,6 +1044,12 @@ lwsws_get_config_vhosts(struct lws_context *context,
 		return 1;
 	}
 
+#if defined(LWS_OPENSSL_SUPPORT)
+	/* create any deferred vhost tls ctx in parallel now they're all known */
+	if (context->tls_ctx_build_threads && lws_tls_vhosts_prepare(context))
+		return 1;
+#endif
+
 //	lws_finalize_startup(context);
 
 	return 0;
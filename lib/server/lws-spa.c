@@ -55,16 +55,19 @@ struct lws_urldecode_stateful {
 	char content_disp[32];
 	char content_disp_filename[256];
 	char mime_boundary[128];
+	unsigned char skip[256]; /* Horspool shifts for mime_boundary */
 	int out_len;
 	int pos;
 	int hdr_idx;
 	int mp;
 	int sum;
+	int bl; /* strlen(mime_boundary) */
 
 	unsigned int multipart_form_data:1;
 	unsigned int inside_quote:1;
 	unsigned int subname:1;
 	unsigned int boundary_real_crlf:1;
+	unsigned int part_content:1;
 
 	enum urldecode_stateful state;
 
@@ -113,6 +116,18 @@ lws_urldecode_s_create(struct lws *wsi, char *out, int out_len, void *data,
 					s->mime_boundary[m++] = *p++;
 
 				s->mime_boundary[m] = '\0';
+				s->bl = m;
+
+				/*
+				 * Horspool bad-character shifts, so the body
+				 * scan can skip up to a boundary length at a
+				 * time through part content
+				 */
+				memset(s->skip, m, sizeof(s->skip));
+				for (m = 0; m < s->bl - 1; m++)
+					s->skip[(unsigned char)
+						s->mime_boundary[m]] =
+							s->bl - 1 - m;
 
 				lwsl_notice("boundary '%s'\n", s->mime_boundary);
 			}
@@ -122,21 +137,110 @@ lws_urldecode_s_create(struct lws *wsi, char *out, int out_len, void *data,
 	return s;
 }
 
+/*
+ * Returns how many bytes at the start of in can't be the start of the mime
+ * boundary, ie, are certainly part content.  A boundary split across the end
+ * of in stops the run where it starts, so the bytewise state machine can
+ * deal with it.
+ */
+
+static int
+lws_urldecode_s_scan(struct lws_urldecode_stateful *s, const char *in,
+		     int len)
+{
+	const unsigned char *u = (const unsigned char *)in;
+	int n = 0, m;
+
+	while (n + s->bl <= len) {
+		m = s->bl - 1;
+		while (m >= 0 && u[n + m] == (unsigned char)s->mime_boundary[m])
+			m--;
+		if (m < 0)
+			return n;
+
+		n += s->skip[u[n + s->bl - 1]];
+	}
+
+	/* the tail may hold the start of a boundary */
+
+	for (; n < len; n++)
+		if (u[n] == '\x0d' &&
+		    !memcmp(in + n, s->mime_boundary, len - n))
+			return n;
+
+	return len;
+}
+
 static int
 lws_urldecode_s_process(struct lws_urldecode_stateful *s, const char *in,
 			int len)
 {
 	int n, m, hit = 0;
-	char c, was_end = 0;
+	char c, was_end = 0, *p;
 
 	while (len--) {
-		if (s->pos == s->out_len - s->mp - 1) {
+		if (s->pos >= s->out_len - s->mp - 1) {
 			if (s->output(s->data, s->name, &s->out, s->pos, 0))
 				return -1;
 
 			was_end = s->pos;
 			s->pos = 0;
+			s->part_content = 1;
 		}
+
+		/*
+		 * Bulk paths for the states that see almost all of the body:
+		 * runs of plain url arg characters are copied in one go, and
+		 * multipart content is consumed up to the next possible
+		 * boundary.  File content isn't copied at all, the user
+		 * callback is given it straight from in.
+		 */
+
+		if (s->state == US_IDLE) {
+			m = s->out_len - s->mp - 1 - s->pos;
+			if (m > len + 1)
+				m = len + 1;
+			for (n = 0; n < m; n++) {
+				c = in[n];
+				if (c == '%' || c == '&' || c == '+')
+					break;
+				s->out[s->pos + n] = c;
+			}
+			if (n) {
+				s->pos += n;
+				in += n;
+				len -= n - 1;
+				continue;
+			}
+		}
+
+		if (s->state == MT_LOOK_BOUND_IN && !s->mp && s->bl) {
+			n = lws_urldecode_s_scan(s, in, len + 1);
+			if (n && s->content_disp_filename[0]) {
+				if (s->pos) {
+					if (s->output(s->data, s->name,
+						      &s->out, s->pos, 0))
+						return -1;
+					s->pos = 0;
+				}
+				p = (char *)in;
+				if (s->output(s->data, s->name, &p, n, 0))
+					return -1;
+				s->part_content = 1;
+			} else if (n) {
+				m = s->out_len - 1 - s->pos;
+				if (n > m)
+					n = m;
+				memcpy(s->out + s->pos, in, n);
+				s->pos += n;
+			}
+			if (n) {
+				in += n;
+				len -= n - 1;
+				continue;
+			}
+		}
+
 		switch (s->state) {
 
 		/* states for url arg style */
@@ -222,12 +326,14 @@ retry_as_first:
 					s->mp = 0;
 					s->state = MT_IGNORE1;
 
-					if (s->pos || was_end)
+					if (s->pos || was_end ||
+					    s->part_content)
 						if (s->output(s->data, s->name,
 						      &s->out, s->pos, 1))
 							return -1;
 
 					s->pos = 0;
+					s->part_content = 0;
 
 					s->content_disp[0] = '\0';
 					s->name[0] = '\0';
@@ -241,6 +347,12 @@ retry_as_first:
 				if (!s->boundary_real_crlf)
 					n = 2;
 
+				if (s->pos + s->mp > s->out_len - 1) {
+					lwsl_notice("%s: exceeded storage\n",
+						    __func__);
+					return -1;
+				}
+
 				memcpy(s->out + s->pos, s->mime_boundary + n,
 				       s->mp - n);
 				s->pos += s->mp;
@@ -259,7 +371,8 @@ retry_as_first:
 			if (c >= 'A' && c <= 'Z')
 				c += 'a' - 'A';
 			for (n = 0; n < (int)ARRAY_SIZE(mp_hdr); n++)
-				if (c == mp_hdr[n][s->mp]) {
+				if (s->mp < (int)strlen(mp_hdr[n]) &&
+				    c == mp_hdr[n][s->mp]) {
 					m++;
 					hit = n;
 				}
@@ -402,6 +515,8 @@ struct lws_spa {
 	int count_params;
 	char **params;
 	int *param_length;
+	int *param_hash; /* open addressed, param index + 1, 0 = empty */
+	unsigned int hash_mask;
 	void *opt_data;
 
 	char *storage;
@@ -411,15 +526,28 @@ struct lws_spa {
 	char finalized;
 };
 
+static uint32_t
+lws_urldecode_spa_hash(const char *name)
+{
+	uint32_t h = 0x811c9dc5;
+
+	while (*name)
+		h = (h ^ (uint8_t)*name++) * 0x01000193;
+
+	return h;
+}
+
 static int
 lws_urldecode_spa_lookup(struct lws_spa *spa,
 			 const char *name)
 {
-	int n;
+	unsigned int n = lws_urldecode_spa_hash(name) & spa->hash_mask;
 
-	for (n = 0; n < spa->count_params; n++)
-		if (!strcmp(spa->param_names[n], name))
-			return n;
+	while (spa->param_hash[n]) {
+		if (!strcmp(spa->param_names[spa->param_hash[n] - 1], name))
+			return spa->param_hash[n] - 1;
+		n = (n + 1) & spa->hash_mask;
+	}
 
 	return -1;
 }
@@ -473,6 +601,8 @@ lws_spa_create(struct lws *wsi, const char * const *param_names,
 			 lws_spa_fileupload_cb opt_cb, void *opt_data)
 {
 	struct lws_spa *spa = lws_zalloc(sizeof(*spa), "spa");
+	unsigned int h;
+	int n;
 
 	if (!spa)
 		return NULL;
@@ -502,10 +632,36 @@ lws_spa_create(struct lws *wsi, const char * const *param_names,
 	if (!spa->param_length)
 		goto bail5;
 
+	/*
+	 * hash the param names once here, so lookups during parsing don't
+	 * have to compare the name against every one.  The table is kept at
+	 * most half full; the first of any duplicated names wins as before.
+	 */
+
+	spa->hash_mask = 3;
+	while (spa->hash_mask + 1 < (unsigned int)count_params * 2)
+		spa->hash_mask = (spa->hash_mask << 1) | 1;
+
+	spa->param_hash = lws_zalloc(sizeof(int) * (spa->hash_mask + 1),
+				     "spa param hash");
+	if (!spa->param_hash)
+		goto bail6;
+
+	for (n = 0; n < count_params; n++) {
+		if (lws_urldecode_spa_lookup(spa, param_names[n]) >= 0)
+			continue;
+		h = lws_urldecode_spa_hash(param_names[n]) & spa->hash_mask;
+		while (spa->param_hash[h])
+			h = (h + 1) & spa->hash_mask;
+		spa->param_hash[h] = n + 1;
+	}
+
 	lwsl_info("%s: Created SPA %p\n", __func__, spa);
 
 	return spa;
 
+bail6:
+	lws_free(spa->param_length);
 bail5:
 	lws_urldecode_s_destroy(spa->s);
 bail4:
@@ -579,6 +735,7 @@ lws_spa_destroy(struct lws_spa *spa)
 			spa->storage,
 			spa);
 
+	lws_free(spa->param_hash);
 	lws_free(spa->param_length);
 	lws_free(spa->params);
 	lws_free(spa->storage);
@@ -21,12 +21,217 @@
 
 #include "private-libwebsockets.h"
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#endif
+
 static const unsigned char lextable[] = {
 	#include "lextable.h"
 };
 
 #define FAIL_CHAR 0x08
 
+/*
+ * Take one step through the lextable trie from pos with the lower-case char
+ * c.  Returns the new pos, which is a terminal if lextable[pos] < FAIL_CHAR,
+ * or -1 if no header name we know about goes this way.
+ */
+
+static int
+lextable_decode(int pos, unsigned char c)
+{
+	while (1) {
+		if (lextable[pos] & (1 << 7)) { /* 1-byte, fail on mismatch */
+			if ((lextable[pos] & 0x7f) != c)
+				return -1;
+			/* fall thru */
+			pos++;
+			if (lextable[pos] == FAIL_CHAR)
+				return -1;
+
+			return pos;
+		}
+
+		if (lextable[pos] == FAIL_CHAR)
+			return -1;
+
+		/* b7 = 0, end or 3-byte */
+		if (lextable[pos] < FAIL_CHAR) /* terminal marker */
+			return pos;
+
+		if (lextable[pos] == c) /* goto */
+			return pos + (lextable[pos + 1]) +
+				     (lextable[pos + 2] << 8);
+
+		/* fall thru goto */
+		pos += 3;
+		/* continue */
+	}
+}
+
+/*
+ * The http/1 header fast path finds header names by hashing them, instead of
+ * walking the trie a char at a time.  The table holds 1 + the token index of
+ * every "name:" the trie knows, by the FNV-1a hash of its lower-case name.
+ * Setting 0x20 on each char is enough to fold A-Z for the hash, the compare
+ * after it is exact.
+ */
+
+static LWS_INLINE unsigned int
+lws_hdr_hash(const unsigned char *p, int len)
+{
+	unsigned int h = 0x811c9dc5;
+
+	while (len--)
+		h = (h ^ (*p++ | 0x20)) * 0x01000193;
+
+	return h & (LWS_HDR_HASH_SIZE - 1);
+}
+
+void
+lws_header_hash_init(struct lws_context *context)
+{
+	const unsigned char *name;
+	unsigned int h;
+	int t, n, pos, len;
+
+	memset(context->hdr_hash, 0, sizeof(context->hdr_hash));
+	context->count_hdr_prefix = 0;
+
+	for (t = 0; t < WSI_TOKEN_COUNT; t++) {
+		name = lws_token_to_string((enum lws_token_indexes)t);
+		if (!name)
+			break;
+		len = (int)strlen((const char *)name);
+		/*
+		 * h2 pseudoheaders start with ':', and methods end with ' ',
+		 * neither can match a header name without a space before ':'
+		 */
+		if (len < 2 || name[0] == ':' || name[len - 1] == ' ')
+			continue;
+
+		/* only take it if the trie decodes it to the same token */
+		pos = 0;
+		for (n = 0; n < len && pos >= 0 && lextable[pos] >= FAIL_CHAR;
+		     n++)
+			pos = lextable_decode(pos, name[n]);
+		if (n != len || pos < 0 || lextable[pos] >= FAIL_CHAR ||
+		    ((lextable[pos] << 8) | lextable[pos + 1]) != t)
+			continue;
+
+		if (name[len - 1] != ':') {
+			/*
+			 * eg, "put" or "x-forwarded-for": the trie takes any
+			 * name starting with these, the fast path must not
+			 */
+			if (context->count_hdr_prefix <
+					ARRAY_SIZE(context->hdr_prefix))
+				context->hdr_prefix[
+					context->count_hdr_prefix++] =
+							(unsigned char)t;
+			else
+				lwsl_err("%s: hdr_prefix too small\n",
+					 __func__);
+			continue;
+		}
+
+		h = lws_hdr_hash(name, len);
+		while (context->hdr_hash[h])
+			h = (h + 1) & (LWS_HDR_HASH_SIZE - 1);
+		context->hdr_hash[h] = (unsigned char)(t + 1);
+	}
+}
+
+static int
+lws_hdr_hash_lookup(struct lws_context *context, const unsigned char *name,
+		    int len)
+{
+	unsigned int h = lws_hdr_hash(name, len);
+	const unsigned char *s;
+	unsigned char c;
+	int t, n;
+
+	while ((t = context->hdr_hash[h])) {
+		s = lws_token_to_string((enum lws_token_indexes)(t - 1));
+		for (n = 0; n < len; n++) {
+			c = name[n];
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+			if (c != s[n])
+				break;
+		}
+		if (n == len && !s[n])
+			return t - 1;
+
+		h = (h + 1) & (LWS_HDR_HASH_SIZE - 1);
+	}
+
+	return -1;
+}
+
+/*
+ * Count the bytes from p that are neither stop nor less than lo.  16 bytes
+ * are checked at a time while none of them are interesting.
+ */
+
+static int
+lws_hdr_span(const unsigned char *p, int len, unsigned char stop,
+	     unsigned char lo)
+{
+	const unsigned char *op = p;
+#if defined(__GNUC__) && defined(__SSE2__)
+	const __m128i vs = _mm_set1_epi8((char)stop),
+		      vl = _mm_set1_epi8((char)(lo - 1));
+	__m128i v;
+	int m;
+
+	while (len >= 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		/* == stop, or unsigned <= lo - 1 */
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vs),
+				_mm_cmpeq_epi8(_mm_min_epu8(v, vl), v)));
+		if (m)
+			return lws_ptr_diff(p, op) + __builtin_ctz(m);
+		p += 16;
+		len -= 16;
+	}
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	const uint8x16_t vs = vdupq_n_u8(stop), vl = vdupq_n_u8(lo);
+	uint64x2_t x;
+
+	while (len >= 16) {
+		uint8x16_t v = vld1q_u8(p);
+
+		x = vreinterpretq_u64_u8(vorrq_u8(vceqq_u8(v, vs),
+						  vcltq_u8(v, vl)));
+		if (vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1))
+			break;
+		p += 16;
+		len -= 16;
+	}
+#else
+	const uint64_t ones = 0x0101010101010101ull, highs = ones << 7;
+	uint64_t w, x;
+
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		x = (w - ones * lo) & ~w;
+		x |= ((w ^ (ones * stop)) - ones) & ~(w ^ (ones * stop));
+		if (x & highs)
+			break;
+		p += 8;
+		len -= 8;
+	}
+#endif
+
+	while (len-- && *p != stop && *p >= lo)
+		p++;
+
+	return lws_ptr_diff(p, op);
+}
+
 static struct allocated_headers *
 _lws_create_ah(struct lws_context_per_thread *pt, ah_data_idx_t data_size)
 {
@@ -81,6 +286,9 @@ _lws_header_table_reset(struct allocated_headers *ah)
 	ah->nfrag = 0;
 	ah->pos = 0;
 	ah->http_response = 0;
+#if defined(LWS_WITH_STATS)
+	ah->parse_us = 0;
+#endif
 }
 
 // doesn't scrub the ah rxbuffer by default, parent must do if needed
@@ -871,6 +1079,28 @@ excessive:
 	return LPUR_EXCESSIVE;
 }
 
+/* chars lws_parse_urldecode() has no special processing for */
+
+static LWS_INLINE int
+lws_uri_char_is_plain(unsigned char c)
+{
+	if (c <= ' ')
+		return 0;
+
+	switch (c) {
+	case '%':
+	case '&':
+	case ';':
+	case '=':
+	case '+':
+	case '/':
+	case '?':
+		return 0;
+	}
+
+	return 1;
+}
+
 static const unsigned char methods[] = {
 	WSI_TOKEN_GET_URI,
 	WSI_TOKEN_POST_URI,
@@ -882,6 +1112,142 @@ static const unsigned char methods[] = {
 	WSI_TOKEN_HEAD_URI,
 };
 
+/*
+ * Fast path for a whole "name: value\x0d\x0a" header line at buf, when the
+ * parser is at the start of a header line.  Returns how many bytes it used,
+ * 0 to have the byte-wise parser deal with the line, or -1 on fatal error.
+ *
+ * The ah ends up the same as if the byte-wise parser had seen the line, but
+ * the name is found by hash and the value is copied in one go.  Anything
+ * unusual, like a line that isn't all here yet, a space before the ':', an
+ * embedded NUL or a lone CR, is left for the byte-wise parser.
+ */
+
+static int
+lws_parse_header_line(struct lws *wsi, const unsigned char *buf, int len)
+{
+	struct allocated_headers *ah = wsi->ah;
+	struct lws_context *context = wsi->context;
+	const unsigned char *s;
+	int k, v, e, t, n, room;
+	unsigned char c;
+	unsigned int m;
+
+	/* the name runs up to the ':' */
+	k = lws_hdr_span(buf, len, ':', 0x21);
+	if (!k || k + 1 >= len || buf[k] != ':')
+		return 0;
+
+	/* the value runs from after it to the CR */
+	v = k + 1;
+	e = v + lws_hdr_span(buf + v, len - v, '\x0d', 1);
+	if (e + 1 >= len || buf[e] != '\x0d' || buf[e + 1] != '\x0a')
+		return 0;
+
+	/* names the trie would take by their start belong to it */
+	for (n = 0; n < context->count_hdr_prefix; n++) {
+		s = lws_token_to_string((enum lws_token_indexes)
+					context->hdr_prefix[n]);
+		for (t = 0; s[t] && t < k; t++) {
+			c = buf[t];
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+			if (c != s[t])
+				break;
+		}
+		if (!s[t])
+			return 0;
+	}
+
+	t = lws_hdr_hash_lookup(context, buf, v);
+	if (t < 0) {
+		/*
+		 * the server must decide if it's an unknown method, let the
+		 * byte-wise parser do that... otherwise we just skip it
+		 */
+		if (wsi->mode == LWSCM_HTTP_SERVING) {
+			for (m = 0; m < ARRAY_SIZE(methods); m++)
+				if (ah->frag_index[methods[m]])
+					break;
+			if (m == ARRAY_SIZE(methods))
+				return 0;
+		}
+
+		return e + 2;
+	}
+
+	if (t == WSI_TOKEN_SWORIGIN)
+		t = WSI_TOKEN_ORIGIN;
+
+	/*
+	 * the byte-wise parser drops every space in a repeated header if the
+	 * first one was empty, leave that to it
+	 */
+	n = ah->frag_index[t];
+	if (n && !ah->frags[n].len)
+		return 0;
+
+	ah->parser_state = (enum lws_token_indexes)t;
+	ah->ups = URIPS_IDLE;
+
+	if (context->token_limits)
+		ah->current_token_limit =
+				context->token_limits->token_limit[t];
+	else
+		ah->current_token_limit = context->max_http_header_data;
+
+	ah->nfrag++;
+	if (ah->nfrag == ARRAY_SIZE(ah->frags)) {
+		lwsl_warn("More hdr frags than we can deal with\n");
+		return -1;
+	}
+
+	ah->frags[ah->nfrag].offset = ah->pos;
+	ah->frags[ah->nfrag].len = 0;
+	ah->frags[ah->nfrag].nfrag = 0;
+	ah->frags[ah->nfrag].flags = 2;
+
+	if (!n) { /* first fragment */
+		ah->frag_index[t] = ah->nfrag;
+		ah->hdr_token_idx = t;
+
+		/* optional initial space swallow */
+		while (v < e && buf[v] == ' ')
+			v++;
+	} else {
+		/* continuation */
+		while (ah->frags[n].nfrag)
+			n = ah->frags[n].nfrag;
+		ah->frags[n].nfrag = ah->nfrag;
+
+		if (issue_char(wsi, ' ') < 0)
+			return -1;
+	}
+
+	/* copy up to the token limit, then always a NUL */
+	room = ah->current_token_limit - ah->frags[ah->nfrag].len;
+	n = e - v;
+	if (n >= room) {
+		n = room;
+		lwsl_warn("header %i exceeds limit %d\n", ah->parser_state,
+			  ah->current_token_limit);
+	}
+	if ((int)ah->pos + n + 1 > context->max_http_header_data) {
+		lwsl_err("Ran out of header data space\n");
+		return -1;
+	}
+
+	memcpy(ah->data + ah->pos, buf + v, n);
+	ah->pos += n;
+	ah->frags[ah->nfrag].len += n;
+	ah->data[ah->pos++] = '\0';
+
+	ah->parser_state = WSI_TOKEN_NAME_PART;
+	ah->lextable_pos = 0;
+
+	return e + 2;
+}
+
 /*
  * possible returns:, -1 fail, 0 ok or 2, transition to raw
  */
@@ -893,11 +1259,23 @@ lws_parse(struct lws *wsi, unsigned char *buf, int *len)
 	struct lws_context *context = wsi->context;
 	unsigned int n, m;
 	unsigned char c;
-	int r, pos;
+	int r;
 
 	assert(wsi->ah);
 
 	do {
+		if (ah->parser_state == WSI_TOKEN_NAME_PART &&
+		    !ah->lextable_pos && ah->ues == URIES_IDLE && *len >= 4) {
+			r = lws_parse_header_line(wsi, buf, *len);
+			if (r < 0)
+				return -1;
+			if (r) {
+				buf += r;
+				*len -= r;
+				continue;
+			}
+		}
+
 		(*len)--;
 		c = *buf++;
 
@@ -951,6 +1329,34 @@ lws_parse(struct lws *wsi, unsigned char *buf, int *len)
 				goto start_fragment;
 			}
 
+			/*
+			 * A run of uri chars that lws_parse_urldecode() would
+			 * pass straight through can be copied in one go, up to
+			 * where issue_char() would have something to say
+			 */
+			if (ah->ups == URIPS_IDLE && ah->ues == URIES_IDLE &&
+			    lws_uri_char_is_plain(c)) {
+				n = 1;
+				while ((int)n <= *len && lws_uri_char_is_plain(
+							buf[n - 1]))
+					n++;
+				m = ah->current_token_limit -
+					ah->frags[ah->nfrag].len;
+				if (n > m)
+					n = m;
+				m = context->max_http_header_data - ah->pos;
+				if (n > m)
+					n = m;
+				if (n > 1) {
+					memcpy(ah->data + ah->pos, buf - 1, n);
+					ah->pos += n;
+					ah->frags[ah->nfrag].len += n;
+					buf += n - 1;
+					*len -= n - 1;
+					break;
+				}
+			}
+
 			r = lws_parse_urldecode(wsi, &c);
 			switch (r) {
 			case LPUR_CONTINUE:
@@ -979,7 +1385,8 @@ check_eol:
 			n = issue_char(wsi, c);
 			if ((int)n < 0)
 				return -1;
-			if (n > 0)
+			/* hitting the limit with the EOL itself is not a skip */
+			if (n > 0 && ah->parser_state != WSI_TOKEN_SKIPPING_SAW_CR)
 				ah->parser_state = WSI_TOKEN_SKIPPING;
 
 swallow:
@@ -998,43 +1405,7 @@ swallow:
 			if (c >= 'A' && c <= 'Z')
 				c += 'a' - 'A';
 
-			pos = ah->lextable_pos;
-
-			while (1) {
-				if (lextable[pos] & (1 << 7)) { /* 1-byte, fail on mismatch */
-					if ((lextable[pos] & 0x7f) != c) {
-nope:
-						ah->lextable_pos = -1;
-						break;
-					}
-					/* fall thru */
-					pos++;
-					if (lextable[pos] == FAIL_CHAR)
-						goto nope;
-
-					ah->lextable_pos = pos;
-					break;
-				}
-
-				if (lextable[pos] == FAIL_CHAR)
-					goto nope;
-
-				/* b7 = 0, end or 3-byte */
-				if (lextable[pos] < FAIL_CHAR) { /* terminal marker */
-					ah->lextable_pos = pos;
-					break;
-				}
-
-				if (lextable[pos] == c) { /* goto */
-					ah->lextable_pos = pos + (lextable[pos + 1]) +
-							(lextable[pos + 2] << 8);
-					break;
-				}
-
-				/* fall thru goto */
-				pos += 3;
-				/* continue */
-			}
+			ah->lextable_pos = lextable_decode(ah->lextable_pos, c);
 
 			/*
 			 * Server needs to look out for unknown methods...
@@ -1710,7 +2081,6 @@ drain_extension:
 		 * eff_buf may be pointing somewhere completely different now,
 		 * it's the output
 		 */
-		wsi->ws->first_fragment = 0;
 #if !defined(LWS_WITHOUT_EXTENSIONS)
 		if (n < 0) {
 			/*
@@ -1751,6 +2121,9 @@ drain_extension:
 			}
 			else
 				lwsl_err("No callback on payload spill!\n");
+
+			/* the user got to see it was the first fragment */
+			wsi->ws->first_fragment = 0;
 		}
 
 already_done:
@@ -4,18 +4,17 @@
 LWS_EXTERN struct lws_rewrite *
 lws_rewrite_create(struct lws *wsi, hubbub_callback_t cb, const char *from, const char *to)
 {
-	struct lws_rewrite *r = lws_malloc(sizeof(*r), "rewrite");
+	/* lives in the wsi's txn arena, it goes away with the wsi */
+	struct lws_rewrite *r = lws_txn_alloc(wsi, sizeof(*r));
 
 	if (!r) {
 		lwsl_err("OOM\n");
 		return NULL;
 	}
 
-	if (hubbub_parser_create("UTF-8", false, &r->parser) != HUBBUB_OK) {
-		lws_free(r);
-
+	if (hubbub_parser_create("UTF-8", false, &r->parser) != HUBBUB_OK)
 		return NULL;
-	}
+
 	r->from = from;
 	r->from_len = strlen(from);
 	r->to = to;
@@ -25,7 +24,7 @@ lws_rewrite_create(struct lws *wsi, hubbub_callback_t cb, const char *from, cons
 	r->params.token_handler.pw = (void *)r;
 	if (hubbub_parser_setopt(r->parser, HUBBUB_PARSER_TOKEN_HANDLER,
 				 &r->params) != HUBBUB_OK) {
-		lws_free(r);
+		hubbub_parser_destroy(r->parser);
 
 		return NULL;
 	}
@@ -47,6 +46,5 @@ LWS_EXTERN void
 lws_rewrite_destroy(struct lws_rewrite *r)
 {
 	hubbub_parser_destroy(r->parser);
-	lws_free(r);
 }
 
@@ -226,13 +226,78 @@ lws_extension_server_handshake(struct lws *wsi, char **p, int budget)
 	return 0;
 }
 #endif
+
+static const char ws101_prefix[] = "HTTP/1.1 101 Switching Protocols\x0d\x0a"
+				   "Upgrade: WebSocket\x0d\x0a"
+				   "Connection: Upgrade\x0d\x0a"
+				   "Sec-WebSocket-Accept: ";
+static const char ws_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/* b64 of the 20-byte SHA-1 is always 28 chars */
+#define LWS_WS101_ACCEPT_LEN 28
+#define LWS_WS101_ACCEPT_END (sizeof(ws101_prefix) - 1 + LWS_WS101_ACCEPT_LEN)
+
+/*
+ * For each vhost protocol, prepare the start of the 101 response: the fixed
+ * part, a 28-char hole for the Sec-WebSocket-Accept value, then the
+ * Sec-WebSocket-Protocol header naming the protocol.  The upgrade copies it
+ * in one go, fills in the hole, and drops the protocol header if the client
+ * didn't ask for one.
+ */
+
+int
+lws_vhost_compile_ws101(struct lws_vhost *vh)
+{
+	static const char proto[] = "\x0d\x0aSec-WebSocket-Protocol: ";
+	size_t size = (vh->count_protocols + 1) * sizeof(unsigned short);
+	char *p;
+	int n, m;
+
+	for (n = 0; n < vh->count_protocols; n++) {
+		size += LWS_WS101_ACCEPT_END;
+		if (vh->protocols[n].name && vh->protocols[n].name[0])
+			size += sizeof(proto) - 1 +
+				strnlen(vh->protocols[n].name, 127);
+	}
+
+	lws_free_set_NULL(vh->ws101_ofs);
+	vh->ws101_tpl = NULL;
+	if (size > 65535) /* a silly number of protocols */
+		return 0;
+
+	vh->ws101_ofs = lws_malloc(size, "ws101 tpl");
+	if (!vh->ws101_ofs)
+		return 1;
+
+	vh->ws101_tpl = p = (char *)&vh->ws101_ofs[vh->count_protocols + 1];
+
+	for (n = 0; n < vh->count_protocols; n++) {
+		vh->ws101_ofs[n] = (unsigned short)lws_ptr_diff(p,
+							       vh->ws101_tpl);
+		memcpy(p, ws101_prefix, sizeof(ws101_prefix) - 1);
+		p += LWS_WS101_ACCEPT_END;
+		if (!vh->protocols[n].name || !vh->protocols[n].name[0])
+			continue;
+		memcpy(p, proto, sizeof(proto) - 1);
+		p += sizeof(proto) - 1;
+		m = (int)strnlen(vh->protocols[n].name, 127);
+		memcpy(p, vh->protocols[n].name, m);
+		p += m;
+	}
+	vh->ws101_ofs[n] = (unsigned short)lws_ptr_diff(p, vh->ws101_tpl);
+
+	return 0;
+}
+
 int
 handshake_0405(struct lws_context *context, struct lws *wsi)
 {
 	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
 	struct lws_process_html_args args;
+	struct lws_vhost *vh = wsi->vhost;
 	unsigned char hash[20];
-	int n, accept_len;
+	char accept[32];
+	int n, m, accept_len;
 	char *response;
 	char *p;
 
@@ -252,15 +317,15 @@ handshake_0405(struct lws_context *context, struct lws *wsi)
 	 * since key length is restricted above (currently 128), cannot
 	 * overflow
 	 */
-	n = sprintf((char *)pt->serv_buf,
-		    "%s258EAFA5-E914-47DA-95CA-C5AB0DC85B11",
-		    lws_hdr_simple_ptr(wsi, WSI_TOKEN_KEY));
+	n = lws_hdr_total_length(wsi, WSI_TOKEN_KEY);
+	memcpy(pt->serv_buf, lws_hdr_simple_ptr(wsi, WSI_TOKEN_KEY), n);
+	memcpy(pt->serv_buf + n, ws_guid, sizeof(ws_guid) - 1);
 
-	lws_SHA1(pt->serv_buf, n, hash);
+	lws_SHA1(pt->serv_buf, n + sizeof(ws_guid) - 1, hash);
 
-	accept_len = lws_b64_encode_string((char *)hash, 20,
-			(char *)pt->serv_buf, context->pt_serv_buf_size);
-	if (accept_len < 0) {
+	accept_len = lws_b64_encode_string((char *)hash, 20, accept,
+					   sizeof(accept));
+	if (accept_len != LWS_WS101_ACCEPT_LEN) {
 		lwsl_warn("Base64 encoded hash too long\n");
 		goto bail;
 	}
@@ -275,21 +340,35 @@ handshake_0405(struct lws_context *context, struct lws *wsi)
 
 	response = (char *)pt->serv_buf + MAX_WEBSOCKET_04_KEY_LEN + LWS_PRE;
 	p = response;
-	LWS_CPYAPP(p, "HTTP/1.1 101 Switching Protocols\x0d\x0a"
-		      "Upgrade: WebSocket\x0d\x0a"
-		      "Connection: Upgrade\x0d\x0a"
-		      "Sec-WebSocket-Accept: ");
-	strcpy(p, (char *)pt->serv_buf);
-	p += accept_len;
-
-	/* we can only return the protocol header if:
-	 *  - one came in, and ... */
-	if (lws_hdr_total_length(wsi, WSI_TOKEN_PROTOCOL) &&
-	    /*  - it is not an empty string */
-	    wsi->protocol->name &&
-	    wsi->protocol->name[0]) {
-		LWS_CPYAPP(p, "\x0d\x0aSec-WebSocket-Protocol: ");
-		p += lws_snprintf(p, 128, "%s", wsi->protocol->name);
+
+	n = (int)(wsi->protocol - vh->protocols);
+	if (vh->ws101_tpl && n >= 0 && n < vh->count_protocols) {
+		/*
+		 * the vhost's prepared response for this protocol... we can
+		 * only keep the protocol header in it if one came in
+		 */
+		if (lws_hdr_total_length(wsi, WSI_TOKEN_PROTOCOL))
+			m = vh->ws101_ofs[n + 1] - vh->ws101_ofs[n];
+		else
+			m = LWS_WS101_ACCEPT_END;
+		memcpy(p, vh->ws101_tpl + vh->ws101_ofs[n], m);
+		memcpy(p + sizeof(ws101_prefix) - 1, accept,
+		       LWS_WS101_ACCEPT_LEN);
+		p += m;
+	} else {
+		LWS_CPYAPP(p, ws101_prefix);
+		memcpy(p, accept, LWS_WS101_ACCEPT_LEN);
+		p += LWS_WS101_ACCEPT_LEN;
+
+		/* we can only return the protocol header if:
+		 *  - one came in, and ... */
+		if (lws_hdr_total_length(wsi, WSI_TOKEN_PROTOCOL) &&
+		    /*  - it is not an empty string */
+		    wsi->protocol->name &&
+		    wsi->protocol->name[0]) {
+			LWS_CPYAPP(p, "\x0d\x0aSec-WebSocket-Protocol: ");
+			p += lws_snprintf(p, 128, "%s", wsi->protocol->name);
+		}
 	}
 
 #if !defined(LWS_WITHOUT_EXTENSIONS)
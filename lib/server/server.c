@@ -74,6 +74,14 @@ lws_context_init_server(struct lws_context_creation_info *info,
 #endif
 
 	for (m = 0; m < limit; m++) {
+		/* prefer a listen socket handed to us by our predecessor */
+		sockfd = lws_socket_inherited(vhost, info->port, info->iface);
+		if (sockfd != LWS_SOCK_INVALID) {
+			lwsl_notice(" adopting inherited listen fd %d\n", sockfd);
+			lws_plat_set_socket_options(vhost, sockfd);
+			goto adopt;
+		}
+
 #ifdef LWS_WITH_UNIX_SOCK
 		if (LWS_UNIX_SOCK_ENABLED(vhost))
 			sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -158,6 +166,7 @@ lws_context_init_server(struct lws_context_creation_info *info,
 		if (n < 0)
 			goto bail;
 		info->port = n;
+adopt:
 #endif
 		vhost->listen_port = info->port;
 		vhost->iface = info->iface;
@@ -379,6 +388,7 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 	struct stat st;
 #endif
 	int spin = 0;
+	char key[256];
 #endif
 	char path[256], sym[512];
 	unsigned char *p = (unsigned char *)sym + 32 + LWS_PRE, *start = p;
@@ -402,6 +412,17 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 
 	fflags |= lws_vfs_prepare_flags(wsi);
 
+	if (wsi->http.fop_fd)
+		lws_vfs_file_close(&wsi->http.fop_fd);
+
+	/* if we have it in memory, we don't need to look at the filesystem */
+	wsi->http.fop_fd = lws_fcache_open(wsi->context, path, path,
+					   sizeof(path));
+	if (wsi->http.fop_fd)
+		goto cached;
+
+	lws_strncpy(key, path, sizeof(key));
+
 	do {
 		spin++;
 		fops = lws_vfs_select_fops(wsi->context->fops, path, &vpath);
@@ -467,6 +488,12 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 
 	if (spin == 5)
 		lwsl_err("symlink loop %s \n", path);
+	else
+		if (!(fflags & LWS_FOP_FLAG_VIRTUAL) &&
+		    lws_fcache_insert(wsi, key, path))
+			return -1;
+
+cached:
 
 	n = sprintf(sym, "%08llX%08lX",
 		    (unsigned long long)lws_vfs_get_length(wsi->http.fop_fd),
@@ -1577,7 +1604,17 @@ lws_handshake_server(struct lws *wsi, unsigned char **buf, size_t len)
 		}
 
 		i = (int)len;
+#if defined(LWS_WITH_STATS)
+		{
+			uint64_t us = time_in_microseconds();
+
+			m = lws_parse(wsi, *buf, &i);
+			wsi->ah->parse_us += (uint32_t)
+					(time_in_microseconds() - us);
+		}
+#else
 		m = lws_parse(wsi, *buf, &i);
+#endif
 		(*buf) += (int)len - i;
 		len = i;
 		if (m) {
@@ -1619,6 +1656,8 @@ raw_transition:
 			continue;
 
 		lwsl_parser("%s: lws_parse sees parsing complete\n", __func__);
+		lws_stats_hist_add(&context->pt[(int)wsi->tsi],
+				   LWSSTATS_H_HDR_PARSE, wsi->ah->parse_us);
 
 		/* select vhost */
 
@@ -1837,7 +1876,7 @@ lws_create_new_server_wsi(struct lws_vhost *vhost)
 		return NULL;
 	}
 
-	new_wsi = lws_zalloc(sizeof(struct lws), "new server wsi");
+	new_wsi = lws_wsi_alloc(vhost->context, n, "new server wsi");
 	if (new_wsi == NULL) {
 		lwsl_err("Out of memory for new connection\n");
 		return NULL;
@@ -1900,6 +1939,15 @@ lws_http_transaction_completed(struct lws *wsi)
 		return 0;
 	}
 
+	/*
+	 * the transaction's lws_txn_alloc() allocations all go in one go...
+	 * unless a cgi is still attached, it lives until we close
+	 */
+#ifdef LWS_WITH_CGI
+	if (!wsi->cgi)
+#endif
+		lws_txn_release(wsi);
+
 	/* if we can't go back to accept new headers, drop the connection */
 	if (wsi->http2_substream)
 		return 0;
@@ -2009,7 +2057,9 @@ lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
 #if defined(LWS_WITH_PEER_LIMITS)
 	struct lws_peer *peer = NULL;
 
-	if (type & LWS_ADOPT_SOCKET && !(type & LWS_ADOPT_WS_PARENTIO)) {
+	/* an unconnected UDP socket has no single peer to account against */
+	if (type & LWS_ADOPT_SOCKET && !(type & LWS_ADOPT_WS_PARENTIO) &&
+	    !(type & LWS_ADOPT_FLAG_UDP)) {
 		peer = lws_get_or_create_peer(vh, fd.sockfd);
 
 		if (!peer) {
@@ -2027,6 +2077,17 @@ lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
 	}
 #endif
 
+	if (type & LWS_ADOPT_FLAG_UDP) {
+		if ((type & LWS_ADOPT_HTTP) || !(type & LWS_ADOPT_SOCKET)) {
+			lwsl_err("%s: UDP adoption must be a raw socket\n",
+				 __func__);
+			compatible_close(fd.sockfd);
+			return NULL;
+		}
+		/* there's no tls over plain datagrams */
+		type &= ~LWS_ADOPT_ALLOW_SSL;
+	}
+
 	new_wsi = lws_create_new_server_wsi(vh);
 	if (!new_wsi) {
 		if (type & LWS_ADOPT_SOCKET && !(type & LWS_ADOPT_WS_PARENTIO))
@@ -2136,6 +2197,11 @@ lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
 		ssl = 1;
 	}
 
+	if ((type & LWS_ADOPT_FLAG_UDP) && lws_udp_create(new_wsi)) {
+		lwsl_err("%s: OOM\n", __func__);
+		goto fail;
+	}
+
 	lws_libev_accept(new_wsi, new_wsi->desc);
 	lws_libuv_accept(new_wsi, new_wsi->desc);
 	lws_libevent_accept(new_wsi, new_wsi->desc);
@@ -2313,7 +2379,7 @@ lws_server_socket_service(struct lws_context *context, struct lws *wsi,
 	struct sockaddr_storage cli_addr;
 	socklen_t clilen;
 #endif
-	int n, len;
+	int n, m, len;
 
 	switch (wsi->mode) {
 
@@ -2363,6 +2429,14 @@ lws_server_socket_service(struct lws_context *context, struct lws *wsi,
 			goto try_pollout;
 		}
 
+		if (wsi->udp) {
+			if (lws_udp_service_rx(wsi))
+				goto fail;
+			if (pollfd->revents & LWS_POLLOUT)
+				wsi->favoured_pollin = 1;
+			goto try_pollout;
+		}
+
 		/* these states imply we MUST have an ah attached */
 
 		if (wsi->mode != LWSCM_RAW && (wsi->state == LWSS_HTTP ||
@@ -2584,12 +2658,22 @@ try_pollout:
 						LWSSTATS_MS_WRITABLE_DELAY, ul);
 				lws_stats_atomic_max(wsi->context, pt,
 					  LWSSTATS_MS_WORST_WRITABLE_DELAY, ul);
+				lws_stats_hist_add(pt,
+					LWSSTATS_H_WRITABLE_DELAY, ul);
 				wsi->active_writable_req_us = 0;
 			}
 #endif
+			if (wsi->udp) {
+				if (lws_udp_service_tx(wsi))
+					goto fail;
+				break;
+			}
+			m = lws_tx_coalesce_begin(wsi);
 			n = user_callback_handle_rxflow(wsi->protocol->callback,
 					wsi, LWS_CALLBACK_RAW_WRITEABLE,
 					wsi->user_space, NULL, 0);
+			if (m && lws_tx_coalesce_end(wsi))
+				n = -1;
 			if (n < 0) {
 				lwsl_info("writeable_fail\n");
 				goto fail;
@@ -2613,13 +2697,18 @@ try_pollout:
 						LWSSTATS_MS_WRITABLE_DELAY, ul);
 				lws_stats_atomic_max(wsi->context, pt,
 					  LWSSTATS_MS_WORST_WRITABLE_DELAY, ul);
+				lws_stats_hist_add(pt,
+					LWSSTATS_H_WRITABLE_DELAY, ul);
 				wsi->active_writable_req_us = 0;
 			}
 #endif
 
+			m = lws_tx_coalesce_begin(wsi);
 			n = user_callback_handle_rxflow(wsi->protocol->callback,
 					wsi, LWS_CALLBACK_HTTP_WRITEABLE,
 					wsi->user_space, NULL, 0);
+			if (m && lws_tx_coalesce_end(wsi))
+				n = -1;
 			if (n < 0) {
 				lwsl_info("writeable_fail\n");
 				goto fail;
@@ -2791,6 +2880,8 @@ lws_serve_http_file(struct lws *wsi, const char *file, const char *content_type,
 	 *
 	 * If wsi->http.fop_fd is already set, the caller already opened it
 	 */
+	if (!wsi->http.fop_fd)
+		wsi->http.fop_fd = lws_fcache_open(context, file, NULL, 0);
 	if (!wsi->http.fop_fd) {
 		fops = lws_vfs_select_fops(wsi->context->fops, file, &vpath);
 		fflags |= lws_vfs_prepare_flags(wsi);
@@ -2801,6 +2892,8 @@ lws_serve_http_file(struct lws *wsi, const char *file, const char *content_type,
 
 			return -1;
 		}
+		if (!vpath && lws_fcache_insert(wsi, file, file))
+			return -1;
 	}
 	wsi->http.filelen = lws_vfs_get_length(wsi->http.fop_fd);
 	total_content_length = wsi->http.filelen;
@@ -21,6 +21,397 @@
 
 #include "private-libwebsockets.h"
 
+/*
+ * OpenSSL before 1.1.0 needs locking callbacks set up to be used from more
+ * than one thread, which lws doesn't do.
+ */
+#if LWS_MAX_SMP > 1 && !defined(LWS_WITH_MBEDTLS) && \
+    defined(OPENSSL_VERSION_NUMBER) && OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define LWS_TLS_PREPARE_THREADS
+#endif
+
+#define LWS_TLS_CONF_OPTS_MASK (LWS_SERVER_OPTION_REQUIRE_VALID_OPENSSL_CLIENT_CERT | \
+				LWS_SERVER_OPTION_PEER_CERT_NOT_REQUIRED | \
+				LWS_SERVER_OPTION_SSL_ECDH | \
+				LWS_SERVER_OPTION_IGNORE_MISSING_CERT)
+
+static const char *
+lws_tls_conf_str(char **p, const char *s)
+{
+	char *r = *p;
+	size_t n;
+
+	if (!s)
+		return NULL;
+
+	n = strlen(s) + 1;
+	memcpy(r, s, n);
+	*p += n;
+
+	return r;
+}
+
+static uint32_t
+lws_tls_conf_hash(uint32_t h, const char *s)
+{
+	if (!s)
+		return h * 31;
+
+	while (*s)
+		h = (h * 31) + (uint8_t)*s++;
+
+	return h;
+}
+
+static struct lws_vhost_tls_conf *
+lws_vhost_tls_conf_create(struct lws_context_creation_info *info,
+			  struct lws_vhost *vhost)
+{
+	const char *in[] = { info->ssl_cert_filepath,
+			     info->ssl_private_key_filepath,
+			     info->ssl_ca_filepath, info->ssl_cipher_list,
+			     info->ssl_private_key_password };
+	struct lws_vhost_tls_conf *conf;
+	size_t len = sizeof(*conf);
+	char *p;
+	int n;
+
+	for (n = 0; n < (int)ARRAY_SIZE(in); n++)
+		if (in[n])
+			len += strlen(in[n]) + 1;
+
+	conf = lws_zalloc(len, "vh tls conf");
+	if (!conf)
+		return NULL;
+
+	p = (char *)&conf[1];
+	conf->cert = lws_tls_conf_str(&p, info->ssl_cert_filepath);
+	conf->key = lws_tls_conf_str(&p, info->ssl_private_key_filepath);
+	conf->ca = lws_tls_conf_str(&p, info->ssl_ca_filepath);
+	conf->cipher_list = lws_tls_conf_str(&p, info->ssl_cipher_list);
+	conf->passphrase = lws_tls_conf_str(&p, info->ssl_private_key_password);
+	conf->cb = vhost->protocols[0].callback;
+	conf->ssl_options_set = info->ssl_options_set;
+	conf->ssl_options_clear = info->ssl_options_clear;
+	conf->session_cache_size = info->tls_session_cache_size;
+	conf->session_timeout = info->tls_session_timeout;
+	conf->options = vhost->options & LWS_TLS_CONF_OPTS_MASK;
+
+	conf->hash = conf->options ^ (uint32_t)conf->ssl_options_set ^
+		     ((uint32_t)conf->ssl_options_clear << 16) ^
+		     ((uint32_t)conf->session_cache_size << 8) ^
+		     ((uint32_t)conf->session_timeout << 24);
+	for (n = 0; n < (int)ARRAY_SIZE(in); n++)
+		conf->hash = lws_tls_conf_hash(conf->hash, in[n]);
+	conf->hash = lws_tls_conf_hash(conf->hash, vhost->ecdh_curve);
+
+	return conf;
+}
+
+static int
+lws_tls_conf_strcmp(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a != b;
+
+	return strcmp(a, b);
+}
+
+/* returns 0 if the two vhosts would create identical server tls ctx */
+
+static int
+lws_vhost_tls_conf_cmp(const struct lws_vhost *a, const struct lws_vhost *b)
+{
+	const struct lws_vhost_tls_conf *ca = a->tls_conf, *cb = b->tls_conf;
+
+	return ca->hash != cb->hash || ca->cb != cb->cb ||
+	       ca->options != cb->options ||
+	       ca->ssl_options_set != cb->ssl_options_set ||
+	       ca->ssl_options_clear != cb->ssl_options_clear ||
+	       ca->session_cache_size != cb->session_cache_size ||
+	       ca->session_timeout != cb->session_timeout ||
+	       strcmp(a->ecdh_curve, b->ecdh_curve) ||
+	       lws_tls_conf_strcmp(ca->cert, cb->cert) ||
+	       lws_tls_conf_strcmp(ca->key, cb->key) ||
+	       lws_tls_conf_strcmp(ca->ca, cb->ca) ||
+	       lws_tls_conf_strcmp(ca->cipher_list, cb->cipher_list) ||
+	       lws_tls_conf_strcmp(ca->passphrase, cb->passphrase);
+}
+
+static void
+lws_vhost_tls_conf_to_info(struct lws_vhost *vhost,
+			   struct lws_context_creation_info *info)
+{
+	const struct lws_vhost_tls_conf *conf = vhost->tls_conf;
+
+	memset(info, 0, sizeof(*info));
+	info->port = vhost->listen_port;
+	info->options = vhost->options;
+	info->ssl_cert_filepath = conf->cert;
+	info->ssl_private_key_filepath = conf->key;
+	info->ssl_ca_filepath = conf->ca;
+	info->ssl_cipher_list = conf->cipher_list;
+	info->ssl_private_key_password = conf->passphrase;
+	info->ssl_options_set = conf->ssl_options_set;
+	info->ssl_options_clear = conf->ssl_options_clear;
+	info->tls_session_cache_size = conf->session_cache_size;
+	info->tls_session_timeout = conf->session_timeout;
+}
+
+/*
+ * If another sharing vhost already has an equivalent tls ctx, take a
+ * reference on it and use that.  Returns 0 if we did that.
+ */
+
+static int
+lws_tls_server_vhost_share(struct lws_vhost *vhost)
+{
+	struct lws_vhost *v = vhost->context->vhost_list;
+
+	if (!vhost->tls_conf ||
+	    !lws_check_opt(vhost->options, LWS_SERVER_OPTION_SSL_CTX_SHARE))
+		return 1;
+
+	while (v) {
+		if (v != vhost && !v->being_destroyed && v->ssl_ctx &&
+		    v->tls_conf &&
+		    lws_check_opt(v->options, LWS_SERVER_OPTION_SSL_CTX_SHARE) &&
+		    !lws_vhost_tls_conf_cmp(vhost, v) &&
+		    !lws_tls_ctx_ref(v->ssl_ctx)) {
+			vhost->ssl_ctx = v->ssl_ctx;
+			vhost->skipped_certs = v->skipped_certs;
+			lwsl_info("%s: vhost %s shares tls ctx of vhost %s\n",
+				  __func__, vhost->name, v->name);
+
+			return 0;
+		}
+		v = v->vhost_next;
+	}
+
+	return 1;
+}
+
+/*
+ * The parts of setting up the vhost server tls ctx that happen after the
+ * cert and key were loaded, including telling protocols[0] about it
+ */
+
+static int
+lws_tls_server_vhost_finalize(struct lws_vhost *vhost, struct lws *wsi)
+{
+	lws_tls_server_client_cert_verify_config(vhost);
+
+	if (vhost->protocols[0].callback(wsi,
+		    LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS,
+		    vhost->ssl_ctx, vhost, 0))
+		return -1;
+
+	/*
+	 * SSL is happy and has a cert it's content with
+	 * If we're supporting HTTP2, initialize that
+	 */
+	lws_context_init_http2_ssl(vhost);
+
+	return 0;
+}
+
+static int
+_lws_tls_server_vhost_deferred_init(struct lws_vhost *vhost)
+{
+	struct lws_context_creation_info info;
+	struct lws wsi;
+
+	if (!vhost->tls_deferred)
+		return 0;
+
+	vhost->tls_deferred = 0;
+
+	if (!lws_tls_server_vhost_share(vhost))
+		return 0;
+
+	lwsl_info("%s: creating deferred tls ctx for vhost %s\n", __func__,
+		  vhost->name);
+
+	memset(&wsi, 0, sizeof(wsi));
+	wsi.vhost = vhost;
+	wsi.context = vhost->context;
+
+	lws_vhost_tls_conf_to_info(vhost, &info);
+	if (lws_tls_server_vhost_backend_init(&info, vhost, &wsi)) {
+		lwsl_err("%s: vhost %s: unable to create tls ctx\n", __func__,
+			 vhost->name);
+		return 1;
+	}
+
+	return lws_tls_server_vhost_finalize(vhost, &wsi);
+}
+
+int
+lws_tls_server_vhost_deferred_init(struct lws_vhost *vhost)
+{
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	int n;
+
+	/* the SNI callback may bring us here from a tls offload worker */
+	lws_tls_cb_lock(vhost->context);
+	n = _lws_tls_server_vhost_deferred_init(vhost);
+	lws_tls_cb_unlock(vhost->context);
+
+	return n;
+#else
+	return _lws_tls_server_vhost_deferred_init(vhost);
+#endif
+}
+
+struct lws_tls_prepare {
+	struct lws_vhost **vh;
+	char *failed;
+	int count;
+	int next;
+#if defined(LWS_TLS_PREPARE_THREADS)
+	pthread_mutex_t lock;
+#endif
+};
+
+static void *
+lws_tls_prepare_worker(void *d)
+{
+	struct lws_tls_prepare *tp = (struct lws_tls_prepare *)d;
+	struct lws_context_creation_info info;
+	struct lws wsi;
+	int n;
+
+	while (1) {
+#if defined(LWS_TLS_PREPARE_THREADS)
+		pthread_mutex_lock(&tp->lock);
+#endif
+		n = tp->next++;
+#if defined(LWS_TLS_PREPARE_THREADS)
+		pthread_mutex_unlock(&tp->lock);
+#endif
+		if (n >= tp->count)
+			break;
+
+		memset(&wsi, 0, sizeof(wsi));
+		wsi.vhost = tp->vh[n];
+		wsi.context = tp->vh[n]->context;
+
+		/*
+		 * Deferral requires a private key filepath, so this doesn't
+		 * call back into user code
+		 */
+		lws_vhost_tls_conf_to_info(tp->vh[n], &info);
+		tp->failed[n] = !!lws_tls_server_vhost_backend_init(&info,
+							     tp->vh[n], &wsi);
+	}
+
+	return NULL;
+}
+
+LWS_VISIBLE int
+lws_tls_vhosts_prepare(struct lws_context *context)
+{
+	struct lws_vhost *v, *v1;
+	struct lws_tls_prepare tp;
+	int n, ret = 0;
+#if defined(LWS_TLS_PREPARE_THREADS)
+	pthread_t pts[32];
+	int threads = context->tls_ctx_build_threads;
+#endif
+
+	memset(&tp, 0, sizeof(tp));
+
+	/*
+	 * Collect the deferred vhosts that can't expect to share a tls ctx
+	 * with a vhost before them, those are the ones to actually build
+	 */
+
+	for (v = context->vhost_list; v; v = v->vhost_next)
+		if (v->tls_deferred)
+			tp.count++;
+
+	if (!tp.count)
+		return 0;
+
+	tp.vh = lws_malloc((sizeof(*tp.vh) + 1) * tp.count, "tls prepare");
+	if (!tp.vh)
+		return 1;
+	tp.failed = (char *)&tp.vh[tp.count];
+	tp.count = 0;
+
+	for (v = context->vhost_list; v; v = v->vhost_next) {
+		if (!v->tls_deferred)
+			continue;
+		v1 = v;
+		if (lws_check_opt(v->options, LWS_SERVER_OPTION_SSL_CTX_SHARE))
+			for (v1 = context->vhost_list; v1 != v;
+			     v1 = v1->vhost_next)
+				if ((v1->ssl_ctx || v1->tls_deferred) &&
+				    v1->tls_conf && lws_check_opt(v1->options,
+					     LWS_SERVER_OPTION_SSL_CTX_SHARE) &&
+				    !lws_vhost_tls_conf_cmp(v, v1))
+					break;
+
+		if (v1 == v)
+			tp.vh[tp.count++] = v;
+	}
+
+	lwsl_notice("%s: creating %d tls ctx\n", __func__, tp.count);
+
+#if defined(LWS_TLS_PREPARE_THREADS)
+	if (!threads)
+		threads = 4;
+	if (threads > (int)ARRAY_SIZE(pts))
+		threads = ARRAY_SIZE(pts);
+	if (threads > tp.count)
+		threads = tp.count;
+
+	pthread_mutex_init(&tp.lock, NULL);
+	for (n = 0; n < threads; n++)
+		if (pthread_create(&pts[n], NULL, lws_tls_prepare_worker, &tp))
+			break;
+	threads = n;
+	/* if we couldn't get any threads, do it ourselves */
+	lws_tls_prepare_worker(&tp);
+	for (n = 0; n < threads; n++)
+		pthread_join(pts[n], NULL);
+	pthread_mutex_destroy(&tp.lock);
+#else
+	lws_tls_prepare_worker(&tp);
+#endif
+
+	/* back on the calling thread, tell user code about the new ctx */
+
+	for (n = 0; n < tp.count; n++) {
+		struct lws wsi;
+
+		tp.vh[n]->tls_deferred = 0;
+		if (tp.failed[n]) {
+			lwsl_err("%s: vhost %s: unable to create tls ctx\n",
+				 __func__, tp.vh[n]->name);
+			ret = 1;
+			continue;
+		}
+
+		memset(&wsi, 0, sizeof(wsi));
+		wsi.vhost = tp.vh[n];
+		wsi.context = context;
+
+		if (lws_tls_server_vhost_finalize(tp.vh[n], &wsi))
+			ret = 1;
+	}
+
+	lws_free(tp.vh);
+
+	/* the remaining deferred vhosts can share what we just made */
+
+	for (v = context->vhost_list; v; v = v->vhost_next)
+		if (lws_tls_server_vhost_deferred_init(v))
+			ret = 1;
+
+	return ret;
+}
+
 LWS_VISIBLE int
 lws_context_init_server_ssl(struct lws_context_creation_info *info,
 			    struct lws_vhost *vhost)
@@ -78,30 +469,36 @@ lws_context_init_server_ssl(struct lws_context_creation_info *info,
 		/* Normally SSL listener rejects non-ssl, optionally allow */
 		vhost->allow_non_ssl_on_ssl_port = 1;
 
-	/*
-	 * give user code a chance to load certs into the server
-	 * allowing it to verify incoming client certs
-	 */
-	if (vhost->use_ssl) {
-		if (lws_tls_server_vhost_backend_init(info, vhost, &wsi))
+	if (!vhost->use_ssl)
+		return 0;
+
+	if (info->ssl_cert_filepath &&
+	    (vhost->options & (LWS_SERVER_OPTION_SSL_CTX_SHARE |
+			       LWS_SERVER_OPTION_SSL_CTX_DEFER))) {
+		vhost->tls_conf = lws_vhost_tls_conf_create(info, vhost);
+		if (!vhost->tls_conf)
 			return -1;
 
-		lws_tls_server_client_cert_verify_config(vhost);
+		if (!lws_tls_server_vhost_share(vhost))
+			return 0;
 
-		if (vhost->protocols[0].callback(&wsi,
-			    LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS,
-			    vhost->ssl_ctx, vhost, 0))
-			return -1;
+		if (lws_check_opt(vhost->options,
+				  LWS_SERVER_OPTION_SSL_CTX_DEFER) &&
+		    info->ssl_private_key_filepath) {
+			vhost->tls_deferred = 1;
+
+			return 0;
+		}
 	}
 
-	if (vhost->use_ssl)
-		/*
-		 * SSL is happy and has a cert it's content with
-		 * If we're supporting HTTP2, initialize that
-		 */
-		lws_context_init_http2_ssl(vhost);
+	/*
+	 * give user code a chance to load certs into the server
+	 * allowing it to verify incoming client certs
+	 */
+	if (lws_tls_server_vhost_backend_init(info, vhost, &wsi))
+		return -1;
 
-	return 0;
+	return lws_tls_server_vhost_finalize(vhost, &wsi);
 }
 
 LWS_VISIBLE int
@@ -111,6 +508,9 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 	struct lws_vhost *vh;
 	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
 	int n;
+#if defined(LWS_WITH_TLS_OFFLOAD)
+	int offload = 1;
+#endif
         char buf[256];
 
         (void)buf;
@@ -132,7 +532,8 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 			return 1;
 		}
 
-		if (lws_tls_server_new_nonblocking(wsi, accept_fd)) {
+		if (lws_tls_server_vhost_deferred_init(wsi->vhost) ||
+		    lws_tls_server_new_nonblocking(wsi, accept_fd)) {
 			if (accept_fd != LWS_SOCK_INVALID)
 				compatible_close(accept_fd);
 			goto fail;
@@ -173,10 +574,25 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 
 		lwsl_debug("inserted SSL accept into fds, trying SSL_accept\n");
 
+#if defined(LWS_WITH_TLS_OFFLOAD)
+		/*
+		 * the ClientHello is rarely here yet, that attempt is cheap
+		 * and our caller may not be finished setting up the wsi
+		 */
+		offload = 0;
+#endif
+
 		/* fallthru */
 
 	case LWSCM_SSL_ACK_PENDING:
 	case LWSCM_SSL_ACK_PENDING_RAW:
+#if defined(LWS_WITH_TLS_OFFLOAD)
+		if (wsi->tls_offload_state != LWS_TLS_OFFLOAD_NONE)
+			/* a worker owns the SSL, eg, POLLHUP came meanwhile */
+			return 0;
+		if (wsi->tls_offload_result)
+			goto offload_result;
+#endif
 		if (lws_change_pollfd(wsi, LWS_POLLOUT, 0)) {
 			lwsl_err("%s: lws_change_pollfd failed\n", __func__);
 			goto fail;
@@ -256,6 +672,21 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 		errno = 0;
 		lws_stats_atomic_bump(wsi->context, pt,
 				      LWSSTATS_C_SSL_CONNECTIONS_ACCEPT_SPIN, 1);
+#if defined(LWS_WITH_TLS_OFFLOAD)
+		if (offload && !lws_tls_offload_queue(wsi))
+			/* we'll be back via the pt event pipe */
+			return 0;
+
+offload_result:
+		if (wsi->tls_offload_result) {
+			wsi->tls_offload_result = 0;
+			/* the interest we took away while the worker had it */
+			if (lws_change_pollfd(wsi, 0, LWS_POLLIN))
+				goto fail;
+			n = lws_tls_server_accept_complete(wsi, wsi->tls_offload_n,
+							   wsi->tls_offload_err);
+		} else
+#endif
 		n = lws_tls_server_accept(wsi);
 		lws_latency(context, wsi,
 			"SSL_accept LWSCM_SSL_ACK_PENDING\n", n, n == 1);
@@ -278,18 +709,33 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 		lws_stats_atomic_bump(wsi->context, pt,
 				      LWSSTATS_C_SSL_CONNECTIONS_ACCEPTED, 1);
 #if defined(LWS_WITH_STATS)
-		lws_stats_atomic_bump(wsi->context, pt,
+		{
+			uint64_t now = time_in_microseconds();
+
+			lws_stats_atomic_bump(wsi->context, pt,
 				      LWSSTATS_MS_SSL_CONNECTIONS_ACCEPTED_DELAY,
-				      time_in_microseconds() - wsi->accept_start_us);
-		wsi->accept_start_us = time_in_microseconds();
+				      now - wsi->accept_start_us);
+			lws_stats_hist_add(pt, LWSSTATS_H_SSL_ACCEPT_DELAY,
+					   now - wsi->accept_start_us);
+			wsi->accept_start_us = now;
+		}
+		if (lws_tls_session_is_reused(wsi))
+			lws_stats_atomic_bump(wsi->context, pt,
+					LWSSTATS_C_SSL_SESSIONS_RESUMED, 1);
 #endif
 
 accepted:
 
-		/* adapt our vhost to match the SNI SSL_CTX that was chosen */
+		/*
+		 * adapt our vhost to match the SNI SSL_CTX that was chosen...
+		 * if the SNI callback already bound us to a vhost using the
+		 * chosen (maybe shared) SSL_CTX, that's the right one
+		 */
 		vh = context->vhost_list;
+		if (!wsi->ssl || wsi->vhost->ssl_ctx == lws_tls_ctx_from_wsi(wsi))
+			vh = NULL;
 		while (vh) {
-			if (!vh->being_destroyed && wsi->ssl &&
+			if (!vh->being_destroyed &&
 			    vh->ssl_ctx == lws_tls_ctx_from_wsi(wsi)) {
 				lwsl_info("setting wsi to vh %s\n", vh->name);
 				wsi->vhost = vh;
@@ -0,0 +1,282 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2017 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * The expensive part of a server tls handshake is the private key operation
+ * inside SSL_accept().  Rather than let that stall every other connection on
+ * the service thread, when enabled we hand the whole SSL_accept() step for a
+ * connection in LWSCM_SSL_ACK_PENDING to a small pool of workers.
+ *
+ * While a worker owns wsi->ssl, the wsi has no POLLIN / POLLOUT interest and
+ * the service thread won't touch its SSL.  When the step completes, the wsi
+ * goes on its pt's done list and the pt is woken via its event pipe, where
+ * the rest of the accept processing continues on the service thread as if
+ * SSL_accept() had just returned there.
+ */
+
+static void *
+lws_tls_offload_worker(void *d)
+{
+	struct lws_context *context = (struct lws_context *)d;
+	struct lws_tls_offload *o = &context->tls_offload;
+	struct lws_context_per_thread *pt;
+	struct lws *wsi;
+	int n, m;
+
+	pthread_mutex_lock(&o->lock);
+
+	while (1) {
+		while (!o->queue_head && !o->stopping)
+			pthread_cond_wait(&o->cond_job, &o->lock);
+		if (o->stopping)
+			break;
+
+		wsi = o->queue_head;
+		o->queue_head = wsi->tls_offload_next;
+		if (!o->queue_head)
+			o->queue_tail = NULL;
+		wsi->tls_offload_state = LWS_TLS_OFFLOAD_RUNNING;
+		pthread_mutex_unlock(&o->lock);
+
+		n = lws_tls_server_accept_raw(wsi, &m);
+
+		pt = &context->pt[(int)wsi->tsi];
+
+		pthread_mutex_lock(&o->lock);
+		wsi->tls_offload_n = n;
+		wsi->tls_offload_err = m;
+		wsi->tls_offload_state = LWS_TLS_OFFLOAD_DONE;
+		wsi->tls_offload_next = pt->tls_offload_done;
+		pt->tls_offload_done = wsi;
+		pthread_cond_broadcast(&o->cond_done);
+		/*
+		 * signal while we hold the lock, so a racing close can't
+		 * finish destroying the wsi or the pt pipe underneath us
+		 */
+		lws_pt_wake(pt);
+	}
+
+	pthread_mutex_unlock(&o->lock);
+
+	return NULL;
+}
+
+int
+lws_tls_offload_create(struct lws_context *context, int threads)
+{
+	struct lws_tls_offload *o = &context->tls_offload;
+	int n;
+
+	pthread_mutex_init(&o->lock, NULL);
+	pthread_mutex_init(&o->cb_lock, NULL);
+	pthread_cond_init(&o->cond_job, NULL);
+	pthread_cond_init(&o->cond_done, NULL);
+	o->inited = 1;
+
+	if (threads <= 0)
+		return 0;
+
+#if !defined(LWS_WITH_MBEDTLS) && OPENSSL_VERSION_NUMBER < 0x10100000L
+	/* OpenSSL needs locking callbacks lws doesn't set to be threadsafe */
+	lwsl_err("%s: tls offload needs OpenSSL 1.1.0+\n", __func__);
+	return 0;
+#endif
+
+	if (threads > LWS_TLS_OFFLOAD_MAX_THREADS)
+		threads = LWS_TLS_OFFLOAD_MAX_THREADS;
+
+	for (n = 0; n < threads; n++)
+		if (pthread_create(&o->thread[n], NULL, lws_tls_offload_worker,
+				   context)) {
+			lwsl_err("%s: unable to create thread %d\n",
+				 __func__, n);
+			break;
+		}
+
+	o->count_threads = n;
+	lwsl_notice("%s: %d tls accept workers\n", __func__, n);
+
+	return 0;
+}
+
+void
+lws_tls_offload_destroy(struct lws_context *context)
+{
+	struct lws_tls_offload *o = &context->tls_offload;
+	int n;
+
+	if (!o->inited)
+		return;
+
+	/*
+	 * Workers finish any accept step in progress, but queued ones stay
+	 * queued... they are taken off the queue when the wsi is closed.
+	 */
+
+	pthread_mutex_lock(&o->lock);
+	o->stopping = 1;
+	pthread_cond_broadcast(&o->cond_job);
+	pthread_mutex_unlock(&o->lock);
+
+	for (n = 0; n < o->count_threads; n++)
+		pthread_join(o->thread[n], NULL);
+
+	o->count_threads = 0;
+}
+
+void
+lws_tls_offload_destroy2(struct lws_context *context)
+{
+	struct lws_tls_offload *o = &context->tls_offload;
+
+	if (!o->inited)
+		return;
+
+	o->inited = 0;
+	pthread_cond_destroy(&o->cond_done);
+	pthread_cond_destroy(&o->cond_job);
+	pthread_mutex_destroy(&o->cb_lock);
+	pthread_mutex_destroy(&o->lock);
+}
+
+/*
+ * Returns 0 if the wsi was queued for a worker, or nonzero if the caller
+ * should do the accept step itself.
+ */
+
+int
+lws_tls_offload_queue(struct lws *wsi)
+{
+	struct lws_tls_offload *o = &wsi->context->tls_offload;
+
+	if (!o->count_threads)
+		return 1;
+
+	/* the worker owns the SSL now, stop hearing about the socket */
+
+	if (lws_change_pollfd(wsi, LWS_POLLIN | LWS_POLLOUT, 0))
+		return 1;
+
+	pthread_mutex_lock(&o->lock);
+	if (o->stopping) {
+		pthread_mutex_unlock(&o->lock);
+
+		return 1;
+	}
+	wsi->tls_offload_next = NULL;
+	if (o->queue_tail)
+		o->queue_tail->tls_offload_next = wsi;
+	else
+		o->queue_head = wsi;
+	o->queue_tail = wsi;
+	wsi->tls_offload_state = LWS_TLS_OFFLOAD_QUEUED;
+	pthread_cond_signal(&o->cond_job);
+	pthread_mutex_unlock(&o->lock);
+
+	return 0;
+}
+
+/*
+ * The wsi is being closed: make sure no worker still holds it, and that it's
+ * on no offload list.  Only the wsi's service thread moves it out of
+ * LWS_TLS_OFFLOAD_NONE, so that check needs no lock.
+ */
+
+void
+lws_tls_offload_cancel(struct lws *wsi)
+{
+	struct lws_tls_offload *o = &wsi->context->tls_offload;
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws **pw, *prev = NULL;
+
+	if (wsi->tls_offload_state == LWS_TLS_OFFLOAD_NONE) {
+		wsi->tls_offload_result = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&o->lock);
+
+	while (wsi->tls_offload_state == LWS_TLS_OFFLOAD_RUNNING)
+		pthread_cond_wait(&o->cond_done, &o->lock);
+
+	if (wsi->tls_offload_state == LWS_TLS_OFFLOAD_QUEUED)
+		pw = &o->queue_head;
+	else
+		pw = &pt->tls_offload_done;
+
+	while (*pw) {
+		if (*pw == wsi) {
+			*pw = wsi->tls_offload_next;
+			break;
+		}
+		prev = *pw;
+		pw = &(*pw)->tls_offload_next;
+	}
+
+	if (wsi->tls_offload_state == LWS_TLS_OFFLOAD_QUEUED &&
+	    o->queue_tail == wsi)
+		o->queue_tail = prev;
+
+	wsi->tls_offload_state = LWS_TLS_OFFLOAD_NONE;
+	wsi->tls_offload_result = 0;
+
+	pthread_mutex_unlock(&o->lock);
+}
+
+/*
+ * Called on the service thread when its event pipe was signalled, to carry
+ * on with any accept steps the workers finished for us
+ */
+
+void
+lws_tls_offload_service_pt(struct lws_context_per_thread *pt)
+{
+	struct lws_context *context;
+	struct lws_tls_offload *o;
+	struct lws *wsi;
+
+	if (!pt->pipe_wsi)
+		return;
+
+	context = pt->pipe_wsi->context;
+	o = &context->tls_offload;
+
+	while (1) {
+		/* take them one at a time, servicing one may close another */
+		pthread_mutex_lock(&o->lock);
+		wsi = pt->tls_offload_done;
+		if (wsi) {
+			pt->tls_offload_done = wsi->tls_offload_next;
+			wsi->tls_offload_state = LWS_TLS_OFFLOAD_NONE;
+			wsi->tls_offload_result = 1;
+		}
+		pthread_mutex_unlock(&o->lock);
+
+		if (!wsi)
+			return;
+
+		if (lws_server_socket_service_ssl(wsi, LWS_SOCK_INVALID))
+			lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS,
+					   "tls offload accept fail");
+	}
+}
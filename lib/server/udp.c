@@ -0,0 +1,354 @@
+/*
+ * libwebsockets - UDP datagram mode for adopted raw sockets
+ *
+ * Copyright (C) 2010-2017 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+static void
+lws_udp_tx_destroy(void *element)
+{
+	struct lws_udp_tx *tx = (struct lws_udp_tx *)element;
+
+	lws_free_set_NULL(tx->buf);
+}
+
+int
+lws_udp_create(struct lws *wsi)
+{
+	struct lws_udp *udp;
+#if defined(WIN32) || defined(_WIN32)
+	u_long nb = 1;
+#endif
+	size_t rs;
+
+	/*
+	 * The rx and tx paths drain / fill the socket until it would block,
+	 * without recvmmsg() / sendmmsg() there's no MSG_DONTWAIT everywhere
+	 */
+#if defined(WIN32) || defined(_WIN32)
+	if (ioctlsocket(wsi->desc.sockfd, FIONBIO, &nb))
+		return 1;
+#else
+	if (fcntl(wsi->desc.sockfd, F_SETFL,
+		  fcntl(wsi->desc.sockfd, F_GETFL) | O_NONBLOCK) < 0)
+		return 1;
+#endif
+
+	rs = wsi->protocol->rx_buffer_size;
+	if (!rs)
+		rs = wsi->context->pt_serv_buf_size;
+
+	udp = lws_zalloc(sizeof(*udp) + (LWS_UDP_BATCH * rs), "udp");
+	if (!udp)
+		return 1;
+
+	udp->tx = lws_ring_create(sizeof(struct lws_udp_tx), LWS_UDP_TX_QUEUE,
+				  lws_udp_tx_destroy);
+	if (!udp->tx) {
+		lws_free(udp);
+		return 1;
+	}
+	udp->rx = (uint8_t *)&udp[1];
+	udp->rx_size = (unsigned int)rs;
+	udp->cur = LWS_UDP_BATCH; /* no current peer */
+	wsi->udp = udp;
+
+	return 0;
+}
+
+void
+lws_udp_destroy(struct lws *wsi)
+{
+	if (!wsi->udp)
+		return;
+
+	lws_ring_destroy(wsi->udp->tx);
+	lws_free_set_NULL(wsi->udp);
+}
+
+LWS_VISIBLE const struct sockaddr *
+lws_udp_peer(struct lws *wsi, size_t *salen)
+{
+	struct lws_udp *udp = wsi->udp;
+
+	if (!udp || udp->cur >= LWS_UDP_BATCH)
+		return NULL;
+
+	if (salen)
+		*salen = udp->peer_len[udp->cur];
+
+	return (const struct sockaddr *)&udp->peer[udp->cur];
+}
+
+LWS_VISIBLE int
+lws_udp_send(struct lws *wsi, const void *buf, size_t len,
+	     const struct sockaddr *sa, size_t salen)
+{
+	struct lws_udp *udp = wsi->udp;
+	struct lws_udp_tx tx;
+
+	if (!udp)
+		return -1;
+
+	if (!sa) {
+		sa = lws_udp_peer(wsi, &salen);
+		if (!sa)
+			return -1;
+	}
+	if (salen > sizeof(tx.sa))
+		return -1;
+
+	if (!lws_ring_get_count_free_elements(udp->tx))
+		return 1;
+
+	tx.buf = lws_malloc(len ? len : 1, "udp tx");
+	if (!tx.buf)
+		return -1;
+	memcpy(tx.buf, buf, len);
+	tx.len = len;
+	memcpy(&tx.sa, sa, salen);
+	tx.salen = (socklen_t)salen;
+
+	lws_ring_insert(udp->tx, &tx, 1);
+
+	/* the service path flushes the queue itself when it's done */
+	if (!udp->in_service &&
+	    lws_change_pollfd(wsi, 0, LWS_POLLOUT))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Send as much of the tx queue as the socket will take right now.
+ *
+ * Returns -1 on fatal error, 0 if the queue emptied, or 1 if there is still
+ * something waiting (the socket filled up, wait for POLLOUT).
+ *
+ * Errors belonging to a single datagram (ICMP unreachable reported back to
+ * us, EMSGSIZE...) drop just that datagram, it's UDP.
+ */
+
+int
+lws_udp_flush(struct lws *wsi)
+{
+	struct lws_udp *udp = wsi->udp;
+	const struct lws_udp_tx *tx[LWS_UDP_BATCH];
+#if defined(LWS_HAVE_SENDMMSG)
+	struct mmsghdr msg[LWS_UDP_BATCH];
+	struct iovec iov[LWS_UDP_BATCH];
+#endif
+	uint32_t tail;
+	int n, count;
+
+	while (1) {
+		/* peek a batch without consuming it */
+		tail = udp->tx->oldest_tail;
+		count = 0;
+		while (count < LWS_UDP_BATCH &&
+		       (tx[count] = lws_ring_get_element(udp->tx, &tail))) {
+			lws_ring_consume(udp->tx, &tail, NULL, 1);
+			count++;
+		}
+		if (!count)
+			return 0;
+
+#if defined(LWS_HAVE_SENDMMSG)
+		memset(msg, 0, sizeof(msg[0]) * count);
+		for (n = 0; n < count; n++) {
+			iov[n].iov_base = tx[n]->buf;
+			iov[n].iov_len = tx[n]->len;
+			msg[n].msg_hdr.msg_name = (void *)&tx[n]->sa;
+			msg[n].msg_hdr.msg_namelen = tx[n]->salen;
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = sendmmsg(wsi->desc.sockfd, msg, count, MSG_DONTWAIT);
+#else
+		for (n = 0; n < count; n++)
+			if (sendto(wsi->desc.sockfd, (const char *)tx[n]->buf,
+				   (int)tx[n]->len, 0,
+				   (const struct sockaddr *)&tx[n]->sa,
+				   tx[n]->salen) < 0)
+				break;
+		if (!n)
+			n = -1;
+#endif
+		if (n < 0) {
+			n = LWS_ERRNO;
+			if (n == LWS_EAGAIN || n == LWS_EWOULDBLOCK)
+				return 1;
+			if (n == LWS_EINTR)
+				continue;
+			lwsl_info("%s: wsi %p: dropping datagram, errno %d\n",
+				  __func__, wsi, n);
+			n = 1;
+		}
+
+		for (count = 0; count < n; count++)
+			lws_stats_atomic_bump(wsi->context,
+					&wsi->context->pt[(int)wsi->tsi],
+					LWSSTATS_B_WRITE, tx[count]->len);
+
+		/* the ring's destroy_element frees the sent ones' buf */
+		lws_ring_consume(udp->tx, NULL, NULL, n);
+	}
+}
+
+/*
+ * Drain up to LWS_UDP_BATCH datagrams in one go and pass them one at a time
+ * to the protocol callback as LWS_CALLBACK_RAW_RX.
+ *
+ * Returns -1 if the wsi should be closed.
+ */
+
+int
+lws_udp_service_rx(struct lws *wsi)
+{
+	struct lws_udp *udp = wsi->udp;
+#if defined(LWS_HAVE_RECVMMSG)
+	struct mmsghdr msg[LWS_UDP_BATCH];
+	struct iovec iov[LWS_UDP_BATCH];
+#else
+	socklen_t sl;
+#endif
+	int n, m, count, len;
+
+#if defined(LWS_HAVE_RECVMMSG)
+	memset(msg, 0, sizeof(msg));
+	for (n = 0; n < LWS_UDP_BATCH; n++) {
+		iov[n].iov_base = udp->rx + (n * udp->rx_size);
+		iov[n].iov_len = udp->rx_size;
+		msg[n].msg_hdr.msg_name = &udp->peer[n];
+		msg[n].msg_hdr.msg_namelen = sizeof(udp->peer[n]);
+		msg[n].msg_hdr.msg_iov = &iov[n];
+		msg[n].msg_hdr.msg_iovlen = 1;
+	}
+
+	count = recvmmsg(wsi->desc.sockfd, msg, LWS_UDP_BATCH, MSG_DONTWAIT,
+			 NULL);
+#else
+	for (count = 0; count < LWS_UDP_BATCH; count++) {
+		sl = sizeof(udp->peer[count]);
+		udp->rx_len[count] = recvfrom(wsi->desc.sockfd,
+				(char *)udp->rx + (count * udp->rx_size),
+				udp->rx_size, 0,
+				(struct sockaddr *)&udp->peer[count], &sl);
+		if (udp->rx_len[count] < 0)
+			break;
+		udp->peer_len[count] = sl;
+	}
+	if (!count)
+		count = -1;
+#endif
+	if (count < 0) {
+		n = LWS_ERRNO;
+		if (n == LWS_EAGAIN || n == LWS_EWOULDBLOCK || n == LWS_EINTR)
+			return 0;
+		/* eg, ECONNREFUSED from an earlier send, not fatal for UDP */
+		lwsl_info("%s: wsi %p: errno %d\n", __func__, wsi, n);
+
+		return 0;
+	}
+
+	udp->in_service = 1;
+	for (n = 0; n < count; n++) {
+#if defined(LWS_HAVE_RECVMMSG)
+		udp->peer_len[n] = msg[n].msg_hdr.msg_namelen;
+		len = (int)msg[n].msg_len;
+		if (msg[n].msg_hdr.msg_flags & MSG_TRUNC) {
+			lwsl_info("%s: dropping datagram > rx buf %u\n",
+				  __func__, udp->rx_size);
+			continue;
+		}
+#else
+		len = (int)udp->rx_len[n];
+#endif
+		lws_stats_atomic_bump(wsi->context,
+				      &wsi->context->pt[(int)wsi->tsi],
+				      LWSSTATS_B_READ, len);
+		udp->cur = n;
+		m = user_callback_handle_rxflow(wsi->protocol->callback,
+						wsi, LWS_CALLBACK_RAW_RX,
+						wsi->user_space,
+						udp->rx + (n * udp->rx_size),
+						len);
+		if (m < 0) {
+			udp->in_service = 0;
+			udp->cur = LWS_UDP_BATCH;
+			return -1;
+		}
+	}
+	/* the peer is only meaningful during RAW_RX */
+	udp->cur = LWS_UDP_BATCH;
+
+	/* send any replies queued during the batch right away */
+	n = lws_udp_flush(wsi);
+	udp->in_service = 0;
+	if (n < 0)
+		return -1;
+	if (n && lws_change_pollfd(wsi, 0, LWS_POLLOUT))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * POLLOUT on a UDP wsi: the tx queue goes first, the user only gets
+ * LWS_CALLBACK_RAW_WRITEABLE once it is empty, and anything he queues from
+ * there is flushed before we return to the event loop.
+ *
+ * Returns -1 if the wsi should be closed.
+ */
+
+int
+lws_udp_service_tx(struct lws *wsi)
+{
+	struct lws_udp *udp = wsi->udp;
+	int n;
+
+	n = lws_udp_flush(wsi);
+	if (n < 0)
+		return -1;
+	if (n)
+		goto again;
+
+	udp->in_service = 1;
+	n = user_callback_handle_rxflow(wsi->protocol->callback,
+					wsi, LWS_CALLBACK_RAW_WRITEABLE,
+					wsi->user_space, NULL, 0);
+	if (n < 0) {
+		udp->in_service = 0;
+		return -1;
+	}
+	n = lws_udp_flush(wsi);
+	udp->in_service = 0;
+	if (n < 0)
+		return -1;
+	if (!n)
+		return 0;
+
+again:
+	if (lws_change_pollfd(wsi, 0, LWS_POLLOUT))
+		return -1;
+
+	return 0;
+}
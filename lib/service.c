@@ -25,7 +25,7 @@ static int
 lws_calllback_as_writeable(struct lws *wsi)
 {
 	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
-	int n, m;
+	int n, m, co;
 
 	lws_stats_atomic_bump(wsi->context, pt, LWSSTATS_C_WRITEABLE_CB, 1);
 #if defined(LWS_WITH_STATS)
@@ -37,6 +37,7 @@ lws_calllback_as_writeable(struct lws *wsi)
 				      LWSSTATS_MS_WRITABLE_DELAY, ul);
 		lws_stats_atomic_max(wsi->context, pt,
 				     LWSSTATS_MS_WORST_WRITABLE_DELAY, ul);
+		lws_stats_hist_add(pt, LWSSTATS_H_WRITABLE_DELAY, ul);
 		wsi->active_writable_req_us = 0;
 	}
 #endif
@@ -60,13 +61,23 @@ lws_calllback_as_writeable(struct lws *wsi)
 		break;
 	default:
 		n = LWS_CALLBACK_HTTP_WRITEABLE;
+#if defined(LWS_WITH_HTTP2)
+		if (wsi->h2.client_stream)
+			n = LWS_CALLBACK_CLIENT_HTTP_WRITEABLE;
+#endif
 		break;
 	}
 
+	co = lws_tx_coalesce_begin(wsi);
+
 	m = user_callback_handle_rxflow(wsi->protocol->callback,
 					   wsi, (enum lws_callback_reasons) n,
 					   wsi->user_space, NULL, 0);
 
+	/* whatever the callback wrote goes out now, even if it's closing */
+	if (co && lws_tx_coalesce_end(wsi))
+		m = -1;
+
 	return m;
 }
 
@@ -516,6 +527,36 @@ user_service_go_again:
 			goto next_child;
 		}
 
+#if defined(LWS_H2_CLIENT)
+		if (w->state == LWSS_HTTP2_CLIENT_SEND_HEADERS) {
+			/* client stream gets to send its request headers */
+			if (lws_h2_client_handshake(w)) {
+				lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS,
+						   "h2 client hs");
+				wa = &wsi->h2.child_list;
+			}
+
+			goto next_child;
+		}
+
+		if (w->h2.client_stream && !w->client_http_body_pending &&
+		    !w->h2.send_END_STREAM &&
+		    w->h2.h2_state == LWS_H2_STATE_OPEN) {
+			uint8_t fin[LWS_PRE + 1];
+
+			/*
+			 * The user finished his request body without a final
+			 * write... end our side of the stream with empty DATA
+			 */
+			if (lws_write(w, fin + LWS_PRE, 0,
+				      LWS_WRITE_HTTP_FINAL) < 0)
+				goto bail_die;
+			lws_h2_client_sent_end_stream(w);
+
+			goto next_child;
+		}
+#endif
+
 		if (w->state == LWSS_HTTP_ISSUING_FILE) {
 
 			((volatile struct lws *)w)->leave_pollout_active = 0;
@@ -601,12 +642,25 @@ user_service_go_again:
 			goto next_child;
 		}
 
-		if (lws_calllback_as_writeable(w) || w->h2.send_END_STREAM) {
+		if (lws_calllback_as_writeable(w) ||
+		    (w->h2.send_END_STREAM && !w->h2.client_stream)) {
 			lwsl_debug("Closing POLLOUT child\n");
 			lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS, "h2 pollout handle");
 			wa = &wsi->h2.child_list;
+			goto next_child;
 		}
 
+#if defined(LWS_H2_CLIENT)
+		/* client streams wait for the response after sending the body */
+		if (w->h2.client_stream && w->h2.h2_state == LWS_H2_STATE_OPEN) {
+			if (w->h2.send_END_STREAM)
+				lws_h2_client_sent_end_stream(w);
+			else
+				if (!w->client_http_body_pending)
+					lws_callback_on_writable(w);
+		}
+#endif
+
 next_child:
 		wsi2 = wa;
 	} while (wsi2 && *wsi2 && !lws_send_pipe_choked(wsi));
@@ -1310,6 +1364,11 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd,
 		} lws_end_foreach_ll(v, vhost_next);
 		if (wsi)
 			lws_free(wsi);
+
+#ifdef LWS_OPENSSL_SUPPORT
+		/* rotate the session ticket keys if we manage them, if due */
+		lws_tls_ticket_keys_check(context, now);
+#endif
 	}
 
 	/*
@@ -1447,6 +1506,18 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd,
 		if (n < 0)
 			goto close_and_handled;
 #endif
+#if defined(LWS_ATOMICS)
+		/*
+		 * Only once the pipe is drained: a wake coming between this
+		 * and the read would otherwise have its byte eaten, leaving
+		 * wake_pending set with nothing in the pipe, and every later
+		 * lws_cancel_service() thinking it's already signalled
+		 */
+		lws_atomic_xchg(&pt->wake_pending, 0);
+#endif
+		/* tls offload workers wake us this way when they finish */
+		lws_tls_offload_service_pt(pt);
+
 		/*
 		 * the poll() wait, or the event loop for libuv etc is a
 		 * process-wide resource that we interrupted.  So let every
@@ -1874,6 +1945,13 @@ drain:
 		wsi->socket_is_permanently_unusable = 1;
 		goto close_and_handled;
 
+#ifndef LWS_NO_CLIENT
+	case LWSCM_HTTP_CLIENT_IDLE:
+		if (lws_client_idle_service(wsi, pollfd))
+			goto close_and_handled;
+		goto handled;
+#endif
+
 	default:
 #ifdef LWS_NO_CLIENT
 		break;
@@ -84,6 +84,12 @@ lws_ssl_client_bio_create(struct lws *wsi)
 	return 0;
 }
 
+void
+lws_tls_client_reuse(struct lws *wsi)
+{
+	/* nothing in the tls connection points back to the wsi */
+}
+
 int ERR_get_error(void)
 {
 	return 0;
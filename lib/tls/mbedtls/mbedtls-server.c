@@ -92,6 +92,10 @@ lws_mbedtls_sni_cb(void *arg, mbedtls_ssl_context *mbedtls_ctx,
 	lwsl_info("SNI: Found: %s:%d at vhost '%s'\n", servername,
 					vh->listen_port, vhost->name);
 
+	/* a vhost with a deferred ssl ctx gets it built on first use */
+	if (lws_tls_server_vhost_deferred_init(vhost) || !vhost->ssl_ctx)
+		return 0;
+
 	/* select the ssl ctx from the selected vhost for this conn */
 	SSL_set_SSL_CTX(ssl, vhost->ssl_ctx);
 
@@ -284,13 +288,43 @@ lws_tls_server_abort_connection(struct lws *wsi)
 	return 0;
 }
 
+int
+lws_tls_server_accept_raw(struct lws *wsi, int *err)
+{
+	int n = SSL_accept(wsi->ssl);
+
+	*err = SSL_ERROR_NONE;
+	if (n == 1)
+		return n;
+
+	*err = SSL_get_error(wsi->ssl, n);
+	lwsl_debug("%s: %p: accept SSL_get_error %d errno %d\n", __func__,
+		   wsi, *err, errno);
+
+	// mbedtls wrapper only
+	if (*err == SSL_ERROR_SYSCALL && errno == 11) {
+		*err = SSL_ERROR_WANT_READ;
+		return n;
+	}
+
+	if (*err == SSL_ERROR_SYSCALL || *err == SSL_ERROR_SSL ||
+	    *err == SSL_ERROR_WANT_READ || *err == SSL_ERROR_WANT_WRITE)
+		return n;
+
+	if (SSL_want_read(wsi->ssl))
+		*err = SSL_ERROR_WANT_READ;
+	else
+		if (SSL_want_write(wsi->ssl))
+			*err = SSL_ERROR_WANT_WRITE;
+
+	return n;
+}
+
 enum lws_ssl_capable_status
-lws_tls_server_accept(struct lws *wsi)
+lws_tls_server_accept_complete(struct lws *wsi, int n, int m)
 {
 	union lws_tls_cert_info_results ir;
-	int m, n;
 
-	n = SSL_accept(wsi->ssl);
 	if (n == 1) {
 
 		if (strstr(wsi->vhost->name, ".invalid")) {
@@ -309,18 +343,10 @@ lws_tls_server_accept(struct lws *wsi)
 		return LWS_SSL_CAPABLE_DONE;
 	}
 
-	m = SSL_get_error(wsi->ssl, n);
-	lwsl_debug("%s: %p: accept SSL_get_error %d errno %d\n", __func__,
-		   wsi, m, errno);
-
-	// mbedtls wrapper only
-	if (m == SSL_ERROR_SYSCALL && errno == 11)
-		return LWS_SSL_CAPABLE_MORE_SERVICE_READ;
-
 	if (m == SSL_ERROR_SYSCALL || m == SSL_ERROR_SSL)
 		return LWS_SSL_CAPABLE_ERROR;
 
-	if (m == SSL_ERROR_WANT_READ || SSL_want_read(wsi->ssl)) {
+	if (m == SSL_ERROR_WANT_READ) {
 		if (lws_change_pollfd(wsi, 0, LWS_POLLIN)) {
 			lwsl_info("%s: WANT_READ change_pollfd failed\n", __func__);
 			return LWS_SSL_CAPABLE_ERROR;
@@ -329,7 +355,7 @@ lws_tls_server_accept(struct lws *wsi)
 		lwsl_info("SSL_ERROR_WANT_READ\n");
 		return LWS_SSL_CAPABLE_MORE_SERVICE_READ;
 	}
-	if (m == SSL_ERROR_WANT_WRITE || SSL_want_write(wsi->ssl)) {
+	if (m == SSL_ERROR_WANT_WRITE) {
 		lwsl_debug("%s: WANT_WRITE\n", __func__);
 
 		if (lws_change_pollfd(wsi, 0, LWS_POLLOUT)) {
@@ -342,6 +368,14 @@ lws_tls_server_accept(struct lws *wsi)
 	return LWS_SSL_CAPABLE_ERROR;
 }
 
+enum lws_ssl_capable_status
+lws_tls_server_accept(struct lws *wsi)
+{
+	int m, n = lws_tls_server_accept_raw(wsi, &m);
+
+	return lws_tls_server_accept_complete(wsi, n, m);
+}
+
 #if defined(LWS_WITH_ACME)
 /*
  * mbedtls doesn't support SAN for cert creation.  So we use a known-good
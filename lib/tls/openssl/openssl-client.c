@@ -167,6 +167,12 @@ lws_ssl_client_bio_create(struct lws *wsi)
 #endif
 #endif
 
+#if defined(LWS_H2_CLIENT)
+	if (wsi->h2.client_offer)
+		SSL_set_alpn_protos(wsi->ssl, (unsigned char *)
+				    "\x02h2\x08http/1.1", 12);
+#endif
+
 #ifdef USE_WOLFSSL
 	/*
 	 * wolfSSL/CyaSSL does certificate verification differently
@@ -202,6 +208,17 @@ lws_ssl_client_bio_create(struct lws *wsi)
 	return 0;
 }
 
+/*
+ * wsi took over the tls connection of another client wsi, callbacks from the
+ * tls library should find it now
+ */
+
+void
+lws_tls_client_reuse(struct lws *wsi)
+{
+	SSL_set_ex_data(wsi->ssl, openssl_websocket_private_data_index, wsi);
+}
+
 enum lws_ssl_capable_status
 lws_tls_client_connect(struct lws *wsi)
 {
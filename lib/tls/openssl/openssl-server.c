@@ -21,6 +21,14 @@
 
 #include "private-libwebsockets.h"
 
+#if !defined(USE_WOLFSSL)
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#endif
+
 extern int openssl_websocket_private_data_index,
 	   openssl_SSL_CTX_private_data_index;
 
@@ -72,8 +80,11 @@ lws_tls_server_client_cert_verify_config(struct lws_vhost *vh)
 			   LWS_SERVER_OPTION_PEER_CERT_NOT_REQUIRED))
 		verify_options |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
 
-	SSL_CTX_set_session_id_context(vh->ssl_ctx, (uint8_t *)vh->context,
-				       sizeof(void *));
+	/*
+	 * A fixed id, rather than something process-specific, lets sessions
+	 * from an external session store resume in other processes
+	 */
+	SSL_CTX_set_session_id_context(vh->ssl_ctx, (uint8_t *)"lws", 3);
 
 	/* absolutely require the client cert */
 	SSL_CTX_set_verify(vh->ssl_ctx, verify_options, OpenSSL_verify_callback);
@@ -86,8 +97,9 @@ static int
 lws_ssl_server_name_cb(SSL *ssl, int *ad, void *arg)
 {
 	struct lws_context *context = (struct lws_context *)arg;
-	struct lws_vhost *vhost, *vh;
+	struct lws_vhost *vhost, *vh = NULL;
 	const char *servername;
+	struct lws *wsi;
 
 	if (!ssl)
 		return SSL_TLSEXT_ERR_NOACK;
@@ -95,14 +107,21 @@ lws_ssl_server_name_cb(SSL *ssl, int *ad, void *arg)
 	/*
 	 * We can only get ssl accepted connections by using a vhost's ssl_ctx
 	 * find out which listening one took us and only match vhosts on the
-	 * same port.
+	 * same port.  The ssl_ctx may be shared by vhosts on other ports, so
+	 * prefer the vhost the accepted wsi already belongs to.
 	 */
-	vh = context->vhost_list;
-	while (vh) {
-		if (!vh->being_destroyed &&
-		    vh->ssl_ctx == SSL_get_SSL_CTX(ssl))
-			break;
-		vh = vh->vhost_next;
+	wsi = SSL_get_ex_data(ssl, openssl_websocket_private_data_index);
+	if (wsi && wsi->vhost && wsi->vhost->ssl_ctx == SSL_get_SSL_CTX(ssl))
+		vh = wsi->vhost;
+
+	if (!vh) {
+		vh = context->vhost_list;
+		while (vh) {
+			if (!vh->being_destroyed &&
+			    vh->ssl_ctx == SSL_get_SSL_CTX(ssl))
+				break;
+			vh = vh->vhost_next;
+		}
 	}
 
 	if (!vh) {
@@ -127,8 +146,17 @@ lws_ssl_server_name_cb(SSL *ssl, int *ad, void *arg)
 
 	lwsl_info("SNI: Found: %s:%d\n", servername, vh->listen_port);
 
+	/* a vhost with a deferred ssl ctx gets it built on first use */
+	if (lws_tls_server_vhost_deferred_init(vhost) || !vhost->ssl_ctx) {
+		lwsl_err("SNI: %s: no ssl ctx\n", vhost->name);
+
+		return SSL_TLSEXT_ERR_OK;
+	}
+
 	/* select the ssl ctx from the selected vhost for this conn */
 	SSL_set_SSL_CTX(ssl, vhost->ssl_ctx);
+	if (wsi)
+		wsi->vhost = vhost;
 
 	return SSL_TLSEXT_ERR_OK;
 }
@@ -156,6 +184,7 @@ lws_tls_server_certs_load(struct lws_vhost *vhost, struct lws *wsi,
 #endif
 #endif
 	unsigned long error;
+	char errbuf[160];
 	uint8_t *p;
 	lws_filepos_t flen;
 
@@ -210,9 +239,9 @@ lws_tls_server_certs_load(struct lws_vhost *vhost, struct lws *wsi,
 	m = SSL_CTX_use_certificate_chain_file(vhost->ssl_ctx, cert);
 	if (m != 1) {
 		error = ERR_get_error();
+		ERR_error_string_n(error, errbuf, sizeof(errbuf));
 		lwsl_err("problem getting cert '%s' %lu: %s\n",
-			 cert, error, ERR_error_string(error,
-			       (char *)vhost->context->pt[0].serv_buf));
+			 cert, error, errbuf);
 
 		return 1;
 	}
@@ -222,10 +251,9 @@ lws_tls_server_certs_load(struct lws_vhost *vhost, struct lws *wsi,
 		if (SSL_CTX_use_PrivateKey_file(vhost->ssl_ctx, private_key,
 					        SSL_FILETYPE_PEM) != 1) {
 			error = ERR_get_error();
+			ERR_error_string_n(error, errbuf, sizeof(errbuf));
 			lwsl_err("ssl problem getting key '%s' %lu: %s\n",
-				 private_key, error,
-				 ERR_error_string(error,
-				      (char *)vhost->context->pt[0].serv_buf));
+				 private_key, error, errbuf);
 			return 1;
 		}
 	} else {
@@ -324,27 +352,237 @@ post_ecdh:
 	return 0;
 }
 
+static struct lws_context_per_thread *
+lws_tls_session_pt(SSL *ssl)
+{
+	struct lws *wsi = SSL_get_ex_data(ssl, openssl_websocket_private_data_index);
+
+	if (!wsi)
+		return NULL;
+
+	return &wsi->context->pt[(int)wsi->tsi];
+}
+
+static int
+lws_tls_session_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	struct lws_context *context = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl),
+					openssl_SSL_CTX_private_data_index);
+	const unsigned char *id;
+	unsigned int id_len;
+	uint8_t *der, *p;
+	int len;
+
+	len = i2d_SSL_SESSION(sess, NULL);
+	if (len <= 0)
+		return 0;
+
+	der = lws_malloc(len, "tls sess");
+	if (!der)
+		return 0;
+
+	p = der;
+	i2d_SSL_SESSION(sess, &p);
+	id = SSL_SESSION_get_id(sess, &id_len);
+
+	context->tls_session_ops->store(context, id, id_len, der, len,
+					(int)SSL_SESSION_get_timeout(sess));
+	lws_free(der);
+
+	/* we didn't keep a reference on sess */
+
+	return 0;
+}
+
+#define LWS_TLS_SESSION_MAX_DER 8192
+
+static SSL_SESSION *
+lws_tls_session_get_cb(SSL *ssl,
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		       const unsigned char *id,
+#else
+		       unsigned char *id,
+#endif
+		       int id_len, int *copy)
+{
+	struct lws_context *context = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl),
+					openssl_SSL_CTX_private_data_index);
+	struct lws_context_per_thread *pt;
+	size_t len = LWS_TLS_SESSION_MAX_DER;
+	SSL_SESSION *sess = NULL;
+	const uint8_t *p;
+	uint8_t *der;
+
+	*copy = 0;
+
+	der = lws_malloc(len, "tls sess");
+	if (!der)
+		return NULL;
+
+	if (!context->tls_session_ops->lookup(context, id, id_len, der, &len) &&
+	    len <= LWS_TLS_SESSION_MAX_DER) {
+		p = der;
+		sess = d2i_SSL_SESSION(NULL, &p, (long)len);
+		pt = lws_tls_session_pt(ssl);
+		if (sess && pt)
+			lws_stats_atomic_bump(context, pt,
+					      LWSSTATS_C_SSL_SESSION_EXT_HITS, 1);
+	}
+	lws_free(der);
+
+	return sess;
+}
+
+static void
+lws_tls_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+	struct lws_context *context = SSL_CTX_get_ex_data(ctx,
+					openssl_SSL_CTX_private_data_index);
+	const unsigned char *id;
+	unsigned int id_len;
+
+	id = SSL_SESSION_get_id(sess, &id_len);
+	context->tls_session_ops->remove(context, id, id_len);
+}
+
+#if !defined(OPENSSL_NO_TLSEXT) && !defined(USE_WOLFSSL)
+/*
+ * OpenSSL 3 deprecates the HMAC_CTX flavour of the ticket key callback, the
+ * EVP_MAC one is the same apart from how the mac is keyed
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX lws_ticket_mac_ctx_t;
+
+static int
+lws_tls_ticket_mac_init(EVP_MAC_CTX *mctx, const struct lws_tls_ticket_key *key)
+{
+	OSSL_PARAM params[2];
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     (char *)"SHA256", 0);
+	params[1] = OSSL_PARAM_construct_end();
+
+	return EVP_MAC_init(mctx, key->hmac, sizeof(key->hmac), params) != 1;
+}
+#else
+typedef HMAC_CTX lws_ticket_mac_ctx_t;
+
+static int
+lws_tls_ticket_mac_init(HMAC_CTX *hctx, const struct lws_tls_ticket_key *key)
+{
+	return HMAC_Init_ex(hctx, key->hmac, sizeof(key->hmac), EVP_sha256(),
+			    NULL) != 1;
+}
+#endif
+
+static int
+lws_tls_ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+		      EVP_CIPHER_CTX *ectx, lws_ticket_mac_ctx_t *mctx, int enc)
+{
+	struct lws_context *context = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl),
+					openssl_SSL_CTX_private_data_index);
+	struct lws_tls_ticket_key key;
+	int n;
+
+	if (enc) {
+		/* issue the ticket using the current key */
+		if (lws_tls_ticket_key_find(context, NULL, &key) < 0 ||
+		    RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+			return -1;
+
+		memcpy(name, key.name, sizeof(key.name));
+		n = EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key.aes,
+				       iv) != 1 ||
+		    lws_tls_ticket_mac_init(mctx, &key);
+		memset(&key, 0, sizeof(key));
+
+		return n ? -1 : 1;
+	}
+
+	n = lws_tls_ticket_key_find(context, name, &key);
+	if (n < 0)
+		/* rotated out or never ours: do a full handshake */
+		return 0;
+
+	if (lws_tls_ticket_mac_init(mctx, &key) ||
+	    EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key.aes,
+			       iv) != 1)
+		n = -1;
+	memset(&key, 0, sizeof(key));
+
+	if (n < 0)
+		return -1;
+
+	/* an older key is still good, but ask for a new ticket */
+
+	return n ? 2 : 1;
+}
+#endif
+
+static void
+lws_tls_server_session_config(struct lws_context_creation_info *info,
+			      struct lws_vhost *vhost)
+{
+	const struct lws_tls_session_ops *ops = vhost->context->tls_session_ops;
+	long mode = SSL_SESS_CACHE_SERVER;
+
+	if (info->tls_session_cache_size > 0)
+		SSL_CTX_sess_set_cache_size(vhost->ssl_ctx,
+					    info->tls_session_cache_size);
+	if (info->tls_session_cache_size < 0)
+		mode = ops && ops->lookup ? SSL_SESS_CACHE_SERVER |
+					    SSL_SESS_CACHE_NO_INTERNAL :
+					    SSL_SESS_CACHE_OFF;
+	SSL_CTX_set_session_cache_mode(vhost->ssl_ctx, mode);
+
+	if (info->tls_session_timeout > 0)
+		SSL_CTX_set_timeout(vhost->ssl_ctx, info->tls_session_timeout);
+
+	if (ops && ops->store)
+		SSL_CTX_sess_set_new_cb(vhost->ssl_ctx, lws_tls_session_new_cb);
+	if (ops && ops->lookup)
+		SSL_CTX_sess_set_get_cb(vhost->ssl_ctx, lws_tls_session_get_cb);
+	if (ops && ops->remove)
+		SSL_CTX_sess_set_remove_cb(vhost->ssl_ctx,
+					   lws_tls_session_remove_cb);
+
+	if (vhost->context->tls_ticket_key_rotate_secs < 0)
+		SSL_CTX_set_options(vhost->ssl_ctx, SSL_OP_NO_TICKET);
+#if !defined(OPENSSL_NO_TLSEXT) && !defined(USE_WOLFSSL)
+	else
+		if (vhost->context->tls_ticket_key_rotate_secs > 0)
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(vhost->ssl_ctx,
+							lws_tls_ticket_key_cb);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(vhost->ssl_ctx,
+							 lws_tls_ticket_key_cb);
+#endif
+#endif
+}
+
 int
 lws_tls_server_vhost_backend_init(struct lws_context_creation_info *info,
 				  struct lws_vhost *vhost,
 				  struct lws *wsi)
 {
 	unsigned long error;
+	char errbuf[160];
 	SSL_METHOD *method = (SSL_METHOD *)SSLv23_server_method();
 
 	if (!method) {
 		error = ERR_get_error();
+		ERR_error_string_n(error, errbuf, sizeof(errbuf));
 		lwsl_err("problem creating ssl method %lu: %s\n",
-				error, ERR_error_string(error,
-				      (char *)vhost->context->pt[0].serv_buf));
+			 error, errbuf);
 		return 1;
 	}
 	vhost->ssl_ctx = SSL_CTX_new(method);	/* create context */
 	if (!vhost->ssl_ctx) {
 		error = ERR_get_error();
+		ERR_error_string_n(error, errbuf, sizeof(errbuf));
 		lwsl_err("problem creating ssl context %lu: %s\n",
-				error, ERR_error_string(error,
-				      (char *)vhost->context->pt[0].serv_buf));
+			 error, errbuf);
 		return 1;
 	}
 
@@ -383,6 +621,8 @@ lws_tls_server_vhost_backend_init(struct lws_context_creation_info *info,
 		SSL_CTX_clear_options(vhost->ssl_ctx, info->ssl_options_clear);
 #endif
 
+	lws_tls_server_session_config(info, vhost);
+
 	lwsl_info(" SSL options 0x%lX\n", (unsigned long)SSL_CTX_get_options(vhost->ssl_ctx));
 	if (!vhost->use_ssl || !info->ssl_cert_filepath)
 		return 0;
@@ -452,11 +692,48 @@ lws_tls_server_abort_connection(struct lws *wsi)
 	return 0;
 }
 
+/*
+ * Just the SSL_accept() step, touching nothing but wsi->ssl, so it can run on
+ * a tls offload worker.  *err gets the SSL_get_error() result, with any want
+ * read / write state folded in while we are still the thread owning the SSL.
+ */
+
+int
+lws_tls_server_accept_raw(struct lws *wsi, int *err)
+{
+	int n;
+
+	/*
+	 * workers are shared by many connections, make sure SSL_get_error()
+	 * only sees what this SSL_accept() left in the thread's error queue
+	 */
+	ERR_clear_error();
+
+	n = SSL_accept(wsi->ssl);
+	*err = SSL_ERROR_NONE;
+	if (n == 1)
+		return n;
+
+	*err = lws_ssl_get_error(wsi, n);
+	if (*err == SSL_ERROR_SYSCALL || *err == SSL_ERROR_SSL ||
+	    *err == SSL_ERROR_WANT_READ || *err == SSL_ERROR_WANT_WRITE)
+		return n;
+
+	if (SSL_want_read(wsi->ssl))
+		*err = SSL_ERROR_WANT_READ;
+	else
+		if (SSL_want_write(wsi->ssl))
+			*err = SSL_ERROR_WANT_WRITE;
+
+	return n;
+}
+
+/* the part of accept that must happen on the wsi's service thread */
+
 enum lws_ssl_capable_status
-lws_tls_server_accept(struct lws *wsi)
+lws_tls_server_accept_complete(struct lws *wsi, int n, int m)
 {
 	union lws_tls_cert_info_results ir;
-	int m, n = SSL_accept(wsi->ssl);
 
 	if (n == 1) {
 		n = lws_tls_peer_cert_info(wsi, LWS_TLS_CERT_INFO_COMMON_NAME, &ir,
@@ -469,12 +746,10 @@ lws_tls_server_accept(struct lws *wsi)
 		return LWS_SSL_CAPABLE_DONE;
 	}
 
-	m = lws_ssl_get_error(wsi, n);
-
 	if (m == SSL_ERROR_SYSCALL || m == SSL_ERROR_SSL)
 		return LWS_SSL_CAPABLE_ERROR;
 
-	if (m == SSL_ERROR_WANT_READ || SSL_want_read(wsi->ssl)) {
+	if (m == SSL_ERROR_WANT_READ) {
 		if (lws_change_pollfd(wsi, 0, LWS_POLLIN)) {
 			lwsl_info("%s: WANT_READ change_pollfd failed\n",
 				  __func__);
@@ -484,7 +759,7 @@ lws_tls_server_accept(struct lws *wsi)
 		lwsl_info("SSL_ERROR_WANT_READ\n");
 		return LWS_SSL_CAPABLE_MORE_SERVICE_READ;
 	}
-	if (m == SSL_ERROR_WANT_WRITE || SSL_want_write(wsi->ssl)) {
+	if (m == SSL_ERROR_WANT_WRITE) {
 		lwsl_debug("%s: WANT_WRITE\n", __func__);
 
 		if (lws_change_pollfd(wsi, 0, LWS_POLLOUT)) {
@@ -498,6 +773,14 @@ lws_tls_server_accept(struct lws *wsi)
 	return LWS_SSL_CAPABLE_ERROR;
 }
 
+enum lws_ssl_capable_status
+lws_tls_server_accept(struct lws *wsi)
+{
+	int m, n = lws_tls_server_accept_raw(wsi, &m);
+
+	return lws_tls_server_accept_complete(wsi, n, m);
+}
+
 #if defined(LWS_WITH_ACME)
 static int
 lws_tls_openssl_rsa_new_key(RSA **rsa, int bits)
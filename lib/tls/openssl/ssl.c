@@ -310,21 +310,37 @@ lws_ssl_pending(struct lws *wsi)
 LWS_VISIBLE int
 lws_ssl_capable_write(struct lws *wsi, unsigned char *buf, int len)
 {
-	int n, m;
+	int n, m, r, done = 0;
 
 	if (!wsi->ssl)
 		return lws_ssl_capable_write_no_ssl(wsi, buf, len);
 
-	n = SSL_write(wsi->ssl, buf, len);
-	if (n > 0)
-		return n;
+	/* one SSL_write() per record, so we decide the record sizes */
+	lws_tls_record_begin(wsi);
+	do {
+		r = lws_tls_record_size(wsi, len - done);
+		n = SSL_write(wsi->ssl, buf + done, r);
+		if (n <= 0)
+			break;
+		lws_tls_record_sent(wsi, n);
+		done += n;
+	} while (done < len);
+
+	if (done == len)
+		return done;
 
 	m = lws_ssl_get_error(wsi, n);
 	if (m != SSL_ERROR_SYSCALL) {
+		/*
+		 * Report what did go out as a partial write, the rest comes
+		 * back to us starting with the record that must be retried
+		 */
+		wsi->tls_rec_wpend = r;
+
 		if (m == SSL_ERROR_WANT_READ || SSL_want_read(wsi->ssl)) {
 			lwsl_notice("%s: want read\n", __func__);
 
-			return LWS_SSL_CAPABLE_MORE_SERVICE;
+			return done ? done : LWS_SSL_CAPABLE_MORE_SERVICE;
 		}
 
 		if (m == SSL_ERROR_WANT_WRITE || SSL_want_write(wsi->ssl)) {
@@ -332,8 +348,10 @@ lws_ssl_capable_write(struct lws *wsi, unsigned char *buf, int len)
 
 			lwsl_notice("%s: want write\n", __func__);
 
-			return LWS_SSL_CAPABLE_MORE_SERVICE;
+			return done ? done : LWS_SSL_CAPABLE_MORE_SERVICE;
 		}
+
+		wsi->tls_rec_wpend = 0;
 	}
 
 	lwsl_debug("%s failed: %s\n",__func__, ERR_error_string(m, NULL));
@@ -453,6 +471,22 @@ lws_ssl_context_destroy(struct lws_context *context)
 #endif
 }
 
+int
+lws_tls_ctx_ref(lws_tls_ctx *ctx)
+{
+#if defined(LWS_HAVE_SSL_CTX_up_ref)
+	return SSL_CTX_up_ref(ctx) != 1;
+#else
+	return 1;
+#endif
+}
+
+int
+lws_tls_session_is_reused(struct lws *wsi)
+{
+	return wsi->ssl && SSL_session_reused(wsi->ssl);
+}
+
 lws_tls_ctx *
 lws_tls_ctx_from_wsi(struct lws *wsi)
 {
@@ -79,6 +79,79 @@ lws_ssl_remove_wsi_from_buffered_list(struct lws *wsi)
 	lws_pt_unlock(pt);
 }
 
+/*
+ * Dynamic TLS record sizing.  A record can't be decrypted until all of it
+ * arrived, so at the start of a connection, when the congestion window is
+ * small, a 16KiB record costs the peer several round trips before it can
+ * use the first byte.  So we send small records until the vhost's boost
+ * threshold has gone out, then full size ones for throughput.  After an
+ * idle period the congestion window has likely collapsed again, so we go
+ * back to small records.
+ *
+ * The backends call lws_tls_record_begin() once per write, then issue one
+ * SSL_write() per lws_tls_record_size(), accounting what went out with
+ * lws_tls_record_sent().
+ */
+
+void
+lws_tls_record_begin(struct lws *wsi)
+{
+	unsigned long long now;
+
+	if (!wsi->vhost->tls_rec_small)
+		return;
+
+	now = time_in_microseconds();
+	/* stuck behind a full socket buffer is not idle */
+	if (!wsi->trunc_len && !wsi->tls_rec_wpend &&
+	    now - wsi->tls_rec_last_us > wsi->vhost->tls_rec_idle_us)
+		wsi->tls_rec_sent = 0;
+	wsi->tls_rec_last_us = now;
+}
+
+int
+lws_tls_record_size(struct lws *wsi, int len)
+{
+	struct lws_vhost *vh = wsi->vhost;
+	int n = LWS_TLS_RECORD_MAX;
+
+	if (wsi->tls_rec_wpend) {
+		/* an unfinished write must be retried as it was */
+		n = wsi->tls_rec_wpend;
+		wsi->tls_rec_wpend = 0;
+	} else
+		if (vh->tls_rec_small && wsi->tls_rec_sent < vh->tls_rec_boost)
+			n = vh->tls_rec_small;
+
+	return n < len ? n : len;
+}
+
+void
+lws_tls_record_sent(struct lws *wsi, int n)
+{
+#if defined(LWS_WITH_STATS)
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	int small = wsi->vhost->tls_rec_small;
+
+	if (!small)
+		small = LWS_TLS_RECORD_SMALL;
+
+	if (n >= LWS_TLS_RECORD_MAX)
+		lws_stats_atomic_bump(wsi->context, pt,
+				      LWSSTATS_C_TLS_RECORDS_FULL, 1);
+	else
+		if (n <= small)
+			lws_stats_atomic_bump(wsi->context, pt,
+					      LWSSTATS_C_TLS_RECORDS_SMALL, 1);
+		else
+			lws_stats_atomic_bump(wsi->context, pt,
+					      LWSSTATS_C_TLS_RECORDS_MEDIUM, 1);
+#endif
+
+	if (wsi->tls_rec_sent < wsi->vhost->tls_rec_boost)
+		wsi->tls_rec_sent += n;
+}
+
 #if defined(LWS_WITH_ESP32)
 int alloc_file(struct lws_context *context, const char *filename, uint8_t **buf,
 	       lws_filepos_t *amount)
@@ -274,6 +347,124 @@ lws_tls_check_all_cert_lifetimes(struct lws_context *context)
 
 	return 0;
 }
+
+/*
+ * Session ticket keys are per-context rather than per-vhost: the TLS library
+ * decrypts tickets using the SSL_CTX the connection was accepted on, before
+ * SNI may move it to another vhost's SSL_CTX for issuing the new ticket.
+ */
+
+static void
+lws_tls_ticket_keys_rotate(struct lws_context *context)
+{
+	const struct lws_tls_session_ops *ops = context->tls_session_ops;
+	struct lws_tls_ticket_key key;
+
+	if (!ops || !ops->new_ticket_key ||
+	    ops->new_ticket_key(context, (uint8_t *)&key, sizeof(key)))
+		if (lws_get_random(context, &key, sizeof(key)) !=
+							(int)sizeof(key)) {
+			lwsl_err("%s: unable to get random\n", __func__);
+			return;
+		}
+
+	lws_tls_cb_lock(context);
+	memmove(&context->ticket_keys[1], &context->ticket_keys[0],
+		sizeof(key) * (LWS_TLS_TICKET_KEYS - 1));
+	context->ticket_keys[0] = key;
+	if (context->count_ticket_keys < LWS_TLS_TICKET_KEYS)
+		context->count_ticket_keys++;
+	lws_tls_cb_unlock(context);
+
+	memset(&key, 0, sizeof(key));
+
+	lwsl_info("%s: rotated session ticket key\n", __func__);
+}
+
+void
+lws_tls_ticket_keys_check(struct lws_context *context, time_t now)
+{
+	int due;
+
+	if (context->tls_ticket_key_rotate_secs <= 0)
+		return;
+
+	/* any service thread may come here, only one should rotate */
+
+	lws_tls_cb_lock(context);
+	due = !context->count_ticket_keys ||
+	      lws_compare_time_t(context, now,
+				 context->last_ticket_key_rotation_s) >=
+					context->tls_ticket_key_rotate_secs;
+	if (due)
+		context->last_ticket_key_rotation_s = now;
+	lws_tls_cb_unlock(context);
+
+	if (due)
+		lws_tls_ticket_keys_rotate(context);
+}
+
+/*
+ * Copies the ticket key with the given name (or the current one if name is
+ * NULL) into *key.  Returns the key index, 0 is current, or -1 if none.
+ */
+
+int
+lws_tls_ticket_key_find(struct lws_context *context, const uint8_t *name,
+			struct lws_tls_ticket_key *key)
+{
+	int n;
+
+	lws_tls_cb_lock(context);
+	for (n = 0; n < context->count_ticket_keys; n++)
+		if (!name || !memcmp(name, context->ticket_keys[n].name,
+				     sizeof(key->name))) {
+			*key = context->ticket_keys[n];
+			break;
+		}
+	if (n == context->count_ticket_keys)
+		n = -1;
+	lws_tls_cb_unlock(context);
+
+	return n;
+}
+
+LWS_VISIBLE int
+lws_tls_ticket_keys_get(struct lws_context *context, uint8_t *buf, size_t len)
+{
+	int n;
+
+	lws_tls_cb_lock(context);
+	n = context->count_ticket_keys * (int)sizeof(struct lws_tls_ticket_key);
+	if (!n || (size_t)n > len)
+		n = -1;
+	else
+		memcpy(buf, context->ticket_keys, n);
+	lws_tls_cb_unlock(context);
+
+	return n;
+}
+
+LWS_VISIBLE int
+lws_tls_ticket_keys_set(struct lws_context *context, const uint8_t *buf,
+			size_t len)
+{
+	int n = (int)(len / sizeof(struct lws_tls_ticket_key));
+
+	if (!n || len % sizeof(struct lws_tls_ticket_key))
+		return 1;
+
+	if (n > LWS_TLS_TICKET_KEYS)
+		n = LWS_TLS_TICKET_KEYS;
+
+	lws_tls_cb_lock(context);
+	memcpy(context->ticket_keys, buf, n * sizeof(struct lws_tls_ticket_key));
+	context->count_ticket_keys = n;
+	context->last_ticket_key_rotation_s = lws_now_secs();
+	lws_tls_cb_unlock(context);
+
+	return 0;
+}
 #if !defined(LWS_WITH_ESP32) && !defined(LWS_PLAT_OPTEE)
 static int
 lws_tls_extant(const char *name)
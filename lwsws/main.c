@@ -33,6 +33,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #else
 #include <io.h>
 #include "gettimeofday.h"
@@ -54,6 +55,8 @@ static int opts = 0, do_reload = 1;
 static uv_loop_t loop;
 static uv_signal_t signal_outer;
 static int pids[32];
+/* listen sockets pass from the old to the new child over this */
+static int handoff_fds[2] = { -1, -1 }, handoff_expected;
 void lwsl_emit_stderr(int level, const char *line);
 
 #define LWSWS_CONFIG_STRING_SIZE (32 * 1024)
@@ -83,6 +86,9 @@ static struct option options[] = {
 
 void signal_cb(uv_signal_t *watcher, int signum)
 {
+	uint8_t keys[3 * LWS_TLS_TICKET_KEY_LEN];
+	int n;
+
 	switch (watcher->signum) {
 	case SIGTERM:
 	case SIGINT:
@@ -92,6 +98,12 @@ void signal_cb(uv_signal_t *watcher, int signum)
 		if (lws_context_is_deprecated(context))
 			return;
 		lwsl_notice("Dropping listen sockets\n");
+		if (handoff_fds[0] != -1) {
+			/* session tickets we issued should stay valid too */
+			n = lws_tls_ticket_keys_get(context, keys, sizeof(keys));
+			lws_context_listen_fds_send(context, handoff_fds[0],
+						    keys, n < 0 ? 0 : n);
+		}
 		lws_context_deprecate(context, NULL);
 		return;
 
@@ -110,6 +122,9 @@ context_creation(void)
 	int cs_len = LWSWS_CONFIG_STRING_SIZE - 1;
 	struct lws_context_creation_info info;
 	char *cs, *config_strings;
+	uint8_t keys[3 * LWS_TLS_TICKET_KEY_LEN];
+	size_t keys_len = sizeof(keys);
+	int listen_fds[64], n = 0;
 
 	cs = config_strings = malloc(LWSWS_CONFIG_STRING_SIZE);
 	if (!config_strings) {
@@ -134,12 +149,28 @@ context_creation(void)
 	if (lwsws_get_config_globals(&info, config_dir, &cs, &cs_len))
 		goto init_failed;
 
+	/*
+	 * if we are replacing a running lwsws, it sends us its listen sockets
+	 */
+	if (handoff_expected && handoff_fds[1] != -1) {
+		n = lws_listen_fds_recv(handoff_fds[1], listen_fds,
+					ARRAY_SIZE(listen_fds), keys,
+					&keys_len, 3000);
+		if (n > 0) {
+			info.listen_fds = listen_fds;
+			info.count_listen_fds = n;
+		}
+	}
+
 	context = lws_create_context(&info);
 	if (context == NULL) {
 		lwsl_err("libwebsocket init failed\n");
 		goto init_failed;
 	}
 
+	if (n > 0 && keys_len)
+		lws_tls_ticket_keys_set(context, keys, keys_len);
+
 	lws_uv_sigint_cfg(context, 1, signal_cb);
 	lws_uv_initloop(context, &loop, 0);
 
@@ -179,6 +210,7 @@ reload_handler(int signum)
 		fprintf(stderr, "root process receives reload\n");
 		if (!do_reload) {
 			fprintf(stderr, "passing HUP to child processes\n");
+			handoff_expected = 1;
 			for (m = 0; m < (int)ARRAY_SIZE(pids); m++)
 				if (pids[m])
 					kill(pids[m], SIGHUP);
@@ -240,6 +272,9 @@ int main(int argc, char **argv)
 
 	fprintf(stderr, "Root process is %u\n", getpid());
 
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, handoff_fds))
+		fprintf(stderr, "No listen socket handoff on reload\n");
+
 	while (1) {
 		if (do_reload) {
 			do_reload = 0;
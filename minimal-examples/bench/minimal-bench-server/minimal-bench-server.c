@@ -0,0 +1,392 @@
+/*
+ * lws-minimal-bench-server
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * This is the server side for lws-bench (test-apps/lws-bench.c).
+ *
+ *  - GET or POST /bytes/<n> replies with n bytes of text/plain, after
+ *    discarding any POST body
+ *
+ *  - ws[s] connections with the "lws-bench" protocol get each message echoed
+ *    back to them, permessage-deflate is offered
+ *
+ *  - anything else is served as files from ./mount-origin
+ *
+ * Commandline switches select the scenario:
+ *
+ *  -s         serve over TLS, allowing http/2 if lws was built with it
+ *  -t <n>     use n service threads (up to the LWS_MAX_SMP lws was built with)
+ *  -e         use the libevent event loop, if lws was built with it
+ *  -p <port>  listen port, default 7681
+ *  -f <bytes> keep up to this much of the files from ./mount-origin in memory
+ *  -c <bytes> coalesce writes made in one writeable callback, /bytes/<n> then
+ *             sends its headers and first body chunk from the same callback
+ */
+
+#include <libwebsockets.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define LWS_PLUGIN_STATIC
+#include "protocol_lws_bench.c"
+
+#define MAX_THREADS 32
+#define MAX_BYTES (256 * 1024 * 1024)
+
+/*
+ * Unlike ws, http is a stateless protocol.  This pss only exists for the
+ * duration of a single http transaction.
+ */
+struct pss {
+	lws_filepos_t left;
+	char body;
+	char replied;
+	char reply_pending;
+};
+
+static struct lws_context *context;
+static int interrupted, coalesce;
+
+/* what we send as the http response body, over and over */
+static unsigned char chunk[LWS_PRE + 16384];
+
+static int
+callback_bytes(struct lws *wsi, enum lws_callback_reasons reason,
+	       void *user, void *in, size_t len)
+{
+	struct pss *pss = (struct pss *)user;
+	uint8_t buf[LWS_PRE + 256], *start = &buf[LWS_PRE], *p = start,
+		*end = &buf[sizeof(buf) - 1];
+	int n, m;
+
+	switch (reason) {
+	case LWS_CALLBACK_HTTP:
+
+		/* in contains the url part after our mountpoint /bytes */
+
+		n = 0;
+		if (in && *(const char *)in == '/')
+			n = atoi((const char *)in + 1);
+		if (n < 0 || n > MAX_BYTES)
+			n = 0;
+		pss->left = (lws_filepos_t)n;
+		/* h1 keepalive reuses the pss for the next transaction */
+		pss->replied = 0;
+		pss->reply_pending = 0;
+
+		/* if there's a body coming, reply when we have had it all */
+		pss->body = !!lws_hdr_total_length(wsi,
+					WSI_TOKEN_HTTP_CONTENT_LENGTH);
+		if (pss->body)
+			return 0;
+		goto reply;
+
+	case LWS_CALLBACK_HTTP_BODY:
+		/* we just discard it */
+		return 0;
+
+	case LWS_CALLBACK_HTTP_BODY_COMPLETION:
+		goto reply;
+
+	case LWS_CALLBACK_HTTP_WRITEABLE:
+		if (!pss)
+			break;
+
+		/*
+		 * with coalescing, the headers can be written here along with
+		 * the body and they all go out together.  We can also be made
+		 * writeable when there's no transaction waiting for a reply,
+		 * eg, after a keepalive transaction completed
+		 */
+		if (pss->reply_pending) {
+			pss->reply_pending = 0;
+			if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK,
+					"text/plain", pss->left, &p, end))
+				return 1;
+			if (lws_finalize_write_http_header(wsi, start, &p, end))
+				return 1;
+			pss->replied = 1;
+			if (!pss->left)
+				goto completed;
+		}
+
+		/* h2 may make us writeable before we replied, eg, tx credit */
+		if (!pss->replied || !pss->left)
+			break;
+
+		n = sizeof(chunk) - LWS_PRE;
+		if ((lws_filepos_t)n > pss->left)
+			n = (int)pss->left;
+
+		/*
+		 * on h2, don't send more than the peer gave us credit for...
+		 * we're made writeable again when it gives us more
+		 */
+		m = lws_get_peer_write_allowance(wsi);
+		if (!m)
+			break;
+		if (m > 0 && n > m)
+			n = m;
+		pss->left -= n;
+
+		/*
+		 * Use LWS_WRITE_HTTP for intermediate writes, on http/2
+		 * lws uses this to understand to end the stream with this
+		 * frame
+		 */
+		if (lws_write(wsi, chunk + LWS_PRE, n, pss->left ?
+			      LWS_WRITE_HTTP : LWS_WRITE_HTTP_FINAL) != n)
+			return 1;
+
+		if (pss->left) {
+			lws_callback_on_writable(wsi);
+			return 0;
+		}
+
+completed:
+		if (lws_http_transaction_completed(wsi))
+			return -1;
+
+		return 0;
+
+	default:
+		break;
+	}
+
+	return lws_callback_http_dummy(wsi, reason, user, in, len);
+
+reply:
+	if (coalesce) {
+		pss->reply_pending = 1;
+		lws_callback_on_writable(wsi);
+		return 0;
+	}
+
+	if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, "text/plain",
+					pss->left, &p, end))
+		return 1;
+	if (lws_finalize_write_http_header(wsi, start, &p, end))
+		return 1;
+	pss->replied = 1;
+
+	if (!pss->left) {
+		if (lws_http_transaction_completed(wsi))
+			return -1;
+		return 0;
+	}
+
+	lws_callback_on_writable(wsi);
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "http", callback_bytes, sizeof(struct pss), 0 },
+	LWS_PLUGIN_PROTOCOL_BENCH,
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+static const struct lws_http_mount mount_bytes = {
+	/* .mount_next */		NULL,		/* linked-list "next" */
+	/* .mountpoint */		"/bytes",	/* mountpoint URL */
+	/* .origin */			NULL,	/* protocol */
+	/* .def */			NULL,
+	/* .protocol */			"http",
+	/* .cgienv */			NULL,
+	/* .extra_mimetypes */		NULL,
+	/* .interpret */		NULL,
+	/* .cgi_timeout */		0,
+	/* .cache_max_age */		0,
+	/* .auth_mask */		0,
+	/* .cache_reusable */		0,
+	/* .cache_revalidate */		0,
+	/* .cache_intermediaries */	0,
+	/* .origin_protocol */		LWSMPRO_CALLBACK, /* dynamic */
+	/* .mountpoint_len */		6,		/* char count */
+	/* .basic_auth_login_file */	NULL,
+};
+
+static const struct lws_http_mount mount = {
+	/* .mount_next */		&mount_bytes,	/* linked-list "next" */
+	/* .mountpoint */		"/",		/* mountpoint URL */
+	/* .origin */			"./mount-origin", /* serve from dir */
+	/* .def */			"index.html",	/* default filename */
+	/* .protocol */			NULL,
+	/* .cgienv */			NULL,
+	/* .extra_mimetypes */		NULL,
+	/* .interpret */		NULL,
+	/* .cgi_timeout */		0,
+	/* .cache_max_age */		0,
+	/* .auth_mask */		0,
+	/* .cache_reusable */		0,
+	/* .cache_revalidate */		0,
+	/* .cache_intermediaries */	0,
+	/* .origin_protocol */		LWSMPRO_FILE,	/* files in a dir */
+	/* .mountpoint_len */		1,		/* char count */
+	/* .basic_auth_login_file */	NULL,
+};
+
+static const struct lws_extension extensions[] = {
+	{
+		"permessage-deflate",
+		lws_extension_callback_pm_deflate,
+		"permessage-deflate"
+		 "; client_no_context_takeover"
+		 "; client_max_window_bits"
+	},
+	{ NULL, NULL, NULL /* terminator */ }
+};
+
+void *thread_service(void *threadid)
+{
+	while (lws_service_tsi(context, 1000,
+			       (int)(lws_intptr_t)threadid) >= 0 &&
+	       !interrupted)
+		;
+
+	pthread_exit(NULL);
+}
+
+#if defined(LWS_WITH_LIBEVENT)
+static struct event_base *evbase;
+
+static void
+signal_cb(evutil_socket_t sock_fd, short events, void *ctx)
+{
+	interrupted = 1;
+	event_base_loopbreak(evbase);
+}
+#endif
+
+void sigint_handler(int sig)
+{
+	interrupted = 1;
+	lws_cancel_service(context);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t pthread_service[MAX_THREADS];
+	struct lws_context_creation_info info;
+	int n = 0, threads = 1, use_libevent = 0;
+	void *retval;
+
+	memset(&info, 0, sizeof info); /* otherwise uninitialized garbage */
+	info.port = 7681;
+	info.mounts = &mount;
+	info.protocols = protocols;
+	info.extensions = extensions;
+	/*
+	 * every h2 stream holds an ah until it has its request headers, allow
+	 * for all the streams we advertise on a few h2 connections
+	 */
+	info.max_http_header_pool = 128;
+
+	for (n = 1; n < argc; n++) {
+		if (!strcmp(argv[n], "-s")) {
+			info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+			info.ssl_cert_filepath = "localhost-100y.cert";
+			info.ssl_private_key_filepath = "localhost-100y.key";
+		} else if (!strcmp(argv[n], "-e"))
+			use_libevent = 1;
+		else if (!strcmp(argv[n], "-t") && n + 1 < argc)
+			threads = atoi(argv[++n]);
+		else if (!strcmp(argv[n], "-p") && n + 1 < argc)
+			info.port = atoi(argv[++n]);
+		else if (!strcmp(argv[n], "-f") && n + 1 < argc)
+			info.fcache_size = (unsigned int)atoi(argv[++n]);
+		else if (!strcmp(argv[n], "-c") && n + 1 < argc) {
+			info.tx_coalesce_size = (unsigned int)atoi(argv[++n]);
+			coalesce = !!info.tx_coalesce_size;
+		} else {
+			lwsl_err("Usage: %s [-s] [-e] [-t threads] [-p port] "
+				 "[-f file cache bytes] [-c coalesce bytes]\n",
+				 argv[0]);
+			return 1;
+		}
+	}
+
+	if (threads < 1 || threads > MAX_THREADS)
+		threads = 1;
+	info.count_threads = threads;
+
+#if defined(LWS_WITH_LIBEVENT)
+	if (use_libevent) {
+		if (threads > 1) {
+			lwsl_err("libevent is only used with one thread\n");
+			return 1;
+		}
+		info.options |= LWS_SERVER_OPTION_LIBEVENT;
+	}
+#else
+	if (use_libevent) {
+		lwsl_err("lws was built without LWS_WITH_LIBEVENT\n");
+		return 1;
+	}
+#endif
+
+	memset(chunk + LWS_PRE, 'x', sizeof(chunk) - LWS_PRE);
+
+	signal(SIGINT, sigint_handler);
+
+	lws_set_log_level(LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE
+			/* for LLL_ verbosity above NOTICE to be built into lws,
+			 * lws must have been configured and built with
+			 * -DCMAKE_BUILD_TYPE=DEBUG instead of =RELEASE */
+			/* | LLL_INFO */ /* | LLL_PARSER */ /* | LLL_HEADER */
+			/* | LLL_EXT */ /* | LLL_CLIENT */ /* | LLL_LATENCY */
+			/* | LLL_DEBUG */, NULL);
+
+	lwsl_user("LWS bench server | %s://localhost:%d\n",
+		  info.ssl_cert_filepath ? "https" : "http", info.port);
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+#if defined(LWS_WITH_LIBEVENT)
+	if (use_libevent) {
+		struct event *sig;
+
+		evbase = event_base_new();
+		sig = evsignal_new(evbase, SIGINT, signal_cb, NULL);
+		evsignal_add(sig, NULL);
+
+		lws_event_sigint_cfg(context, 0, NULL);
+		lws_event_initloop(context, evbase, 0);
+		event_base_dispatch(evbase);
+
+		event_free(sig);
+		lws_context_destroy(context);
+		event_base_free(evbase);
+
+		return 0;
+	}
+#endif
+
+	lwsl_notice("  Service threads: %d\n", lws_get_count_threads(context));
+
+	/* start all the service threads */
+
+	for (n = 0; n < lws_get_count_threads(context); n++)
+		if (pthread_create(&pthread_service[n], NULL, thread_service,
+				   (void *)(lws_intptr_t)n))
+			lwsl_err("Failed to start service thread\n");
+
+	/* wait for all the service threads to exit */
+
+	while ((--n) >= 0)
+		pthread_join(pthread_service[n], &retval);
+
+	lws_context_destroy(context);
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * ws protocol handler plugin for "lws-bench"
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * Echoes every message back to the client that sent it, fragment by fragment.
+ * Each connection queues up to 32 fragments in its own lws_ring, and if that
+ * fills, rx flow control stops us reading more from that client until it has
+ * drained.
+ */
+
+#if !defined (LWS_PLUGIN_STATIC)
+#define LWS_DLL
+#define LWS_INTERNAL
+#include <libwebsockets.h>
+#endif
+
+#include <string.h>
+
+#define BENCH_RING_DEPTH 32
+
+/* one of these created for each message fragment */
+
+struct bench_msg {
+	void *payload; /* is malloc'd, with LWS_PRE at the start */
+	size_t len;
+	char binary;
+	char first;
+	char final;
+};
+
+/* one of these is created for each client connecting to us */
+
+struct per_session_data__bench {
+	struct lws_ring *ring; /* fragments waiting to be echoed */
+	char flow_controlled;
+};
+
+static void
+__bench_destroy_message(void *_msg)
+{
+	struct bench_msg *msg = _msg;
+
+	free(msg->payload);
+	msg->payload = NULL;
+	msg->len = 0;
+}
+
+static int
+callback_bench(struct lws *wsi, enum lws_callback_reasons reason,
+	       void *user, void *in, size_t len)
+{
+	struct per_session_data__bench *pss =
+			(struct per_session_data__bench *)user;
+	const struct bench_msg *pmsg;
+	struct bench_msg amsg;
+	int n, m;
+
+	switch (reason) {
+	case LWS_CALLBACK_ESTABLISHED:
+		pss->ring = lws_ring_create(sizeof(struct bench_msg),
+					    BENCH_RING_DEPTH,
+					    __bench_destroy_message);
+		if (!pss->ring)
+			return 1;
+		break;
+
+	case LWS_CALLBACK_CLOSED:
+		if (pss->ring)
+			lws_ring_destroy(pss->ring);
+		pss->ring = NULL;
+		break;
+
+	case LWS_CALLBACK_SERVER_WRITEABLE:
+		pmsg = lws_ring_get_element(pss->ring, NULL);
+		if (!pmsg)
+			break;
+
+		if (pmsg->first)
+			m = pmsg->binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT;
+		else
+			m = LWS_WRITE_CONTINUATION;
+		if (!pmsg->final)
+			m |= LWS_WRITE_NO_FIN;
+
+		n = lws_write(wsi, ((unsigned char *)pmsg->payload) + LWS_PRE,
+			      pmsg->len, m);
+		if (n < (int)pmsg->len) {
+			lwsl_err("ERROR %d writing to ws socket\n", n);
+			return -1;
+		}
+
+		lws_ring_consume(pss->ring, NULL, NULL, 1);
+
+		if (pss->flow_controlled &&
+		    lws_ring_get_count_free_elements(pss->ring) >
+						BENCH_RING_DEPTH / 2) {
+			lws_rx_flow_control(wsi, 1);
+			pss->flow_controlled = 0;
+		}
+
+		if (lws_ring_get_element(pss->ring, NULL))
+			lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_RECEIVE:
+		if (!lws_ring_get_count_free_elements(pss->ring)) {
+			lwsl_err("%s: ring full\n", __func__);
+			return -1;
+		}
+
+		amsg.len = len;
+		amsg.binary = (char)lws_frame_is_binary(wsi);
+		amsg.first = (char)lws_is_first_fragment(wsi);
+		amsg.final = (char)lws_is_final_fragment(wsi);
+		/* notice we over-allocate by LWS_PRE */
+		amsg.payload = malloc(LWS_PRE + len);
+		if (!amsg.payload) {
+			lwsl_user("OOM: dropping\n");
+			break;
+		}
+
+		memcpy((char *)amsg.payload + LWS_PRE, in, len);
+		if (!lws_ring_insert(pss->ring, &amsg, 1)) {
+			__bench_destroy_message(&amsg);
+			lwsl_user("dropping!\n");
+			break;
+		}
+		lws_callback_on_writable(wsi);
+
+		/* stop reading from him while he has a backlog with us */
+		if (!pss->flow_controlled &&
+		    lws_ring_get_count_free_elements(pss->ring) < 2) {
+			lws_rx_flow_control(wsi, 0);
+			pss->flow_controlled = 1;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+#define LWS_PLUGIN_PROTOCOL_BENCH \
+	{ \
+		"lws-bench", \
+		callback_bench, \
+		sizeof(struct per_session_data__bench), \
+		4096, \
+		0, NULL, 0 \
+	}
+
+#if !defined (LWS_PLUGIN_STATIC)
+
+/* boilerplate needed if we are built as a dynamic plugin */
+
+static const struct lws_protocols protocols[] = {
+	LWS_PLUGIN_PROTOCOL_BENCH
+};
+
+LWS_EXTERN LWS_VISIBLE int
+init_protocol_lws_bench(struct lws_context *context,
+			struct lws_plugin_capability *c)
+{
+	if (c->api_magic != LWS_PLUGIN_API_MAGIC) {
+		lwsl_err("Plugin API %d, library API %d", LWS_PLUGIN_API_MAGIC,
+			 c->api_magic);
+		return 1;
+	}
+
+	c->protocols = protocols;
+	c->count_protocols = ARRAY_SIZE(protocols);
+	c->extensions = NULL;
+	c->count_extensions = 0;
+
+	return 0;
+}
+
+LWS_EXTERN LWS_VISIBLE int
+destroy_protocol_lws_bench(struct lws_context *context)
+{
+	return 0;
+}
+#endif
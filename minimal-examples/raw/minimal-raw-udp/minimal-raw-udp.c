@@ -0,0 +1,252 @@
+/*
+ * lws-minimal-raw-udp
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * This demonstrates adopting a UDP socket into the lws event loop as a RAW
+ * wsi in datagram mode.  By default it's a UDP echo server on port 7681:
+ * every datagram that comes in is sent straight back to whoever sent it.
+ *
+ * Run with -b <server> it's instead a packets-per-second benchmark, it
+ * keeps up to -w datagrams in flight to an echo server, sending more as the
+ * echoes come back, and reports the sent and echoed rates every second.
+ */
+
+#include <libwebsockets.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+static struct sockaddr_storage dest;
+static size_t dest_len;
+static unsigned long long sent, rcvd, lost;
+static int interrupted, flood, size = 64, window = 1024;
+static struct lws *udp_wsi;
+
+static int
+callback_raw_udp(struct lws *wsi, enum lws_callback_reasons reason,
+		 void *user, void *in, size_t len)
+{
+	static const uint8_t payload[1472];
+	int n;
+
+	switch (reason) {
+
+	case LWS_CALLBACK_RAW_ADOPT:
+		lwsl_user("LWS_CALLBACK_RAW_ADOPT\n");
+		udp_wsi = wsi;
+		if (flood)
+			lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_RAW_CLOSE:
+		lwsl_user("LWS_CALLBACK_RAW_CLOSE\n");
+		break;
+
+	case LWS_CALLBACK_RAW_RX:
+		/* one datagram per callback */
+		rcvd++;
+		if (flood) {
+			/* an echo came back, there's room for more in flight */
+			lws_callback_on_writable(wsi);
+			break;
+		}
+
+		/* NULL destination means reply to whoever sent this one */
+		if (lws_udp_send(wsi, in, len, NULL, 0) < 0)
+			return -1;
+		sent++;
+		break;
+
+	case LWS_CALLBACK_RAW_WRITEABLE:
+		if (!flood)
+			break;
+
+		/*
+		 * top up what's in flight... lws sends everything we queue
+		 * here with one sendmmsg() per 16 datagrams on the way out
+		 */
+		while (sent - rcvd - lost < (unsigned long long)window) {
+			n = lws_udp_send(wsi, payload, size,
+					 (struct sockaddr *)&dest, dest_len);
+			if (n < 0)
+				return -1;
+			if (n) { /* queue full, come back when it drained */
+				lws_callback_on_writable(wsi);
+				break;
+			}
+			sent++;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "raw-udp", callback_raw_udp, 0, 0 },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+void sigint_handler(int sig)
+{
+	interrupted = 1;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long last_sent = 0, last_rcvd = 0;
+	struct lws_context_creation_info info;
+	const char *server = NULL, *port = "7681";
+	struct lws_context *context;
+	struct sockaddr_in6 sa6;
+	lws_sock_file_fd_type sock;
+	struct addrinfo h, *r;
+	struct lws_vhost *vhost;
+	time_t last, now;
+	int n = 0;
+
+	for (n = 1; n < argc; n++) {
+		if (!strcmp(argv[n], "-b") && n + 1 < argc) {
+			server = argv[++n];
+			flood = 1;
+		} else if (!strcmp(argv[n], "-p") && n + 1 < argc)
+			port = argv[++n];
+		else if (!strcmp(argv[n], "-s") && n + 1 < argc) {
+			size = atoi(argv[++n]);
+			if (size < 1 || size > 1472)
+				size = 64;
+		} else if (!strcmp(argv[n], "-w") && n + 1 < argc) {
+			window = atoi(argv[++n]);
+			if (window < 1)
+				window = 1;
+		} else {
+			lwsl_err("Usage: %s [-b <echo server>] [-p port] "
+				 "[-s datagram size] [-w window]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	lws_set_log_level(LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE
+			/* for LLL_ verbosity above NOTICE to be built into lws,
+			 * lws must have been configured and built with
+			 * -DCMAKE_BUILD_TYPE=DEBUG instead of =RELEASE */
+			/* | LLL_INFO */ /* | LLL_PARSER */ /* | LLL_HEADER */
+			/* | LLL_EXT */ /* | LLL_CLIENT */ /* | LLL_LATENCY */
+			/* | LLL_DEBUG */, NULL);
+
+	memset(&info, 0, sizeof info); /* otherwise uninitialized garbage */
+	info.options = LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
+
+	lwsl_user("LWS minimal raw udp %s\n", flood ? "pps bench" : "echo");
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+	/* we don't want a listen socket, the UDP socket is our own */
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+
+	vhost = lws_create_vhost(context, &info);
+	if (!vhost) {
+		lwsl_err("lws vhost creation failed\n");
+		goto bail;
+	}
+
+	/*
+	 * Create and bind our own UDP socket, dual-stack so it can talk to
+	 * both IPv4 and IPv6 peers.  The echo server binds to the port, the
+	 * benchmark lets the kernel pick one.
+	 */
+
+	sock.sockfd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock.sockfd < 0) {
+		lwsl_err("%s: unable to create UDP socket\n", __func__);
+		goto bail;
+	}
+	n = 0;
+	setsockopt(sock.sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &n, sizeof(n));
+
+	memset(&sa6, 0, sizeof(sa6));
+	sa6.sin6_family = AF_INET6;
+	sa6.sin6_addr = in6addr_any;
+	if (!flood)
+		sa6.sin6_port = htons(atoi(port));
+	if (bind(sock.sockfd, (struct sockaddr *)&sa6, sizeof(sa6)) < 0) {
+		lwsl_err("%s: unable to bind UDP port %s\n", __func__, port);
+		close(sock.sockfd);
+		goto bail;
+	}
+
+	if (flood) {
+		memset(&h, 0, sizeof(h));
+		h.ai_family = AF_INET6;
+		h.ai_flags = AI_V4MAPPED;
+		h.ai_socktype = SOCK_DGRAM;
+
+		n = getaddrinfo(server, port, &h, &r);
+		if (n) {
+			lwsl_err("%s: problem resolving %s: %s\n", __func__,
+				 server, gai_strerror(n));
+			close(sock.sockfd);
+			goto bail;
+		}
+		memcpy(&dest, r->ai_addr, r->ai_addrlen);
+		dest_len = r->ai_addrlen;
+		freeaddrinfo(r);
+	}
+
+	/* adopt it into lws as a datagram-mode raw wsi */
+
+	if (!lws_adopt_descriptor_vhost(vhost, LWS_ADOPT_SOCKET |
+				       LWS_ADOPT_FLAG_UDP, sock,
+				       protocols[0].name, NULL)) {
+		lwsl_err("%s: UDP socket adoption failed\n", __func__);
+		goto bail;
+	}
+
+	signal(SIGINT, sigint_handler);
+	last = time(NULL);
+	n = 0;
+
+	while (n >= 0 && !interrupted) {
+		n = lws_service(context, 1000);
+
+		now = time(NULL);
+		if (now == last)
+			continue;
+		if (sent != last_sent || rcvd != last_rcvd)
+			lwsl_user("tx %llu pps, rx %llu pps\n",
+				  (sent - last_sent) / (now - last),
+				  (rcvd - last_rcvd) / (now - last));
+		if (flood && udp_wsi && rcvd == last_rcvd) {
+			/* nothing came back for a second, write off the rest */
+			lost = sent - rcvd;
+			lws_callback_on_writable(udp_wsi);
+		}
+		last_sent = sent;
+		last_rcvd = rcvd;
+		last = now;
+	}
+
+bail:
+	lws_context_destroy(context);
+
+	return 0;
+}
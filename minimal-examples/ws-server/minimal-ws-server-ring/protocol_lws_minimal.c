@@ -8,6 +8,10 @@
  *
  * This version uses an lws_ring ringbuffer to cache up to 8 messages at a time,
  * so it's not so easy to lose messages.
+ *
+ * Each connection is registered with the ring as a consumer that loses its
+ * oldest messages if the ring is full, so a slow client doesn't stop the
+ * others getting new messages.
  */
 
 #if !defined (LWS_PLUGIN_STATIC)
@@ -30,7 +34,7 @@ struct msg {
 struct per_session_data__minimal {
 	struct per_session_data__minimal *pss_list;
 	struct lws *wsi;
-	uint32_t tail;
+	struct lws_ring_consumer rc;
 };
 
 /* one of these is created for each vhost our protocol is used with */
@@ -69,7 +73,7 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 					lws_get_protocol(wsi));
 	const struct msg *pmsg;
 	struct msg amsg;
-	int n, m;
+	int m;
 
 	switch (reason) {
 	case LWS_CALLBACK_PROTOCOL_INIT:
@@ -93,7 +97,9 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 	case LWS_CALLBACK_ESTABLISHED:
 		/* add ourselves to the list of live pss held in the vhd */
 		lws_ll_fwd_insert(pss, pss_list, vhd->pss_list);
-		pss->tail = lws_ring_get_oldest_tail(vhd->ring);
+		if (lws_ring_consumer_add(vhd->ring, &pss->rc,
+					  LWS_RING_CP_DROP_OLDEST, 0))
+			return -1;
 		pss->wsi = wsi;
 		break;
 
@@ -101,10 +107,14 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 		/* remove our closing pss from the list of live pss */
 		lws_ll_fwd_remove(struct per_session_data__minimal, pss_list,
 				  pss, vhd->pss_list);
+		lws_ring_consumer_remove(vhd->ring, &pss->rc);
+		if (pss->rc.dropped)
+			lwsl_user("%p: dropped %u messages, max lag %u\n", wsi,
+				  pss->rc.dropped, pss->rc.lag_max);
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
-		pmsg = lws_ring_get_element(vhd->ring, &pss->tail);
+		pmsg = lws_ring_consumer_get_element(vhd->ring, &pss->rc);
 		if (!pmsg)
 			break;
 
@@ -116,29 +126,16 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 			return -1;
 		}
 
-		lws_ring_consume_and_update_oldest_tail(
-			vhd->ring,	/* lws_ring object */
-			struct per_session_data__minimal, /* type of objects with tails */
-			&pss->tail,	/* tail of guy doing the consuming */
-			1,		/* number of payload objects being consumed */
-			vhd->pss_list,	/* head of list of objects with tails */
-			tail,		/* member name of tail in objects with tails */
-			pss_list	/* member name of next object in objects with tails */
-		);
+		/* the ring frees it when every consumer has had it */
+		lws_ring_consumer_consume(vhd->ring, &pss->rc, NULL, 1);
 
 		/* more to do for us? */
-		if (lws_ring_get_element(vhd->ring, &pss->tail))
+		if (lws_ring_consumer_get_element(vhd->ring, &pss->rc))
 			/* come back as soon as we can write more */
 			lws_callback_on_writable(pss->wsi);
 		break;
 
 	case LWS_CALLBACK_RECEIVE:
-		n = (int)lws_ring_get_count_free_elements(vhd->ring);
-		if (!n) {
-			lwsl_user("dropping!\n");
-			break;
-		}
-
 		amsg.len = len;
 		/* notice we over-allocate by LWS_PRE */
 		amsg.payload = malloc(LWS_PRE + len);
@@ -148,6 +145,7 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 		}
 
 		memcpy((char *)amsg.payload + LWS_PRE, in, len);
+		/* lagging consumers lose their oldest message if it's full */
 		if (!lws_ring_insert(vhd->ring, &amsg, 1)) {
 			__minimal_destroy_message(&amsg);
 			lwsl_user("dropping!\n");
@@ -44,16 +44,15 @@ struct per_vhost_data__minimal {
 	struct per_session_data__minimal *pss_list; /* linked-list of live pss*/
 	pthread_t pthread_spam[2];
 
-	pthread_mutex_t lock_ring; /* serialize access to the ring buffer */
-	struct lws_ring *ring; /* {lock_ring} ringbuffer holding unsent content */
+	struct lws_ring *ring; /* lockfree MPSC ringbuffer of unsent content */
 
 	const char *config;
 	char finished;
 };
 
 /*
- * This runs under both lws service and "spam threads" contexts.
- * Access is serialized by vhd->lock_ring.
+ * This runs under the lws service thread context when the ring retires a
+ * message, and in the "spam threads" context if they couldn't insert one.
  */
 
 static void
@@ -86,19 +85,22 @@ thread_spam(void *d)
 		if (!vhd->pss_list)
 			goto wait;
 
-		pthread_mutex_lock(&vhd->lock_ring); /* --------- ring lock { */
+		/*
+		 * The ring was created with LWS_RING_MPSC, so both threads
+		 * can insert into it at the same time without any lock
+		 */
 
 		/* only create if space in ringbuffer */
 		n = (int)lws_ring_get_count_free_elements(vhd->ring);
 		if (!n) {
 			lwsl_user("dropping!\n");
-			goto wait_unlock;
+			goto wait;
 		}
 
 		amsg.payload = malloc(LWS_PRE + len);
 		if (!amsg.payload) {
 			lwsl_user("OOM: dropping\n");
-			goto wait_unlock;
+			goto wait;
 		}
 		n = lws_snprintf((char *)amsg.payload + LWS_PRE, len,
 			         "%s: tid: %p, msg: %d", vhd->config,
@@ -111,13 +113,11 @@ thread_spam(void *d)
 		} else
 			/*
 			 * This will cause a LWS_CALLBACK_EVENT_WAIT_CANCELLED
-			 * in the lws service thread context.
+			 * in the lws service thread context.  If one is
+			 * already pending, it is coalesced into that.
 			 */
 			lws_cancel_service(vhd->context);
 
-wait_unlock:
-		pthread_mutex_unlock(&vhd->lock_ring); /* } ring lock ------- */
-
 wait:
 		usleep(100000);
 
@@ -154,8 +154,6 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 		if (!vhd)
 			return 1;
 
-		pthread_mutex_init(&vhd->lock_ring, NULL);
-
 		/* recover the pointer to the globals struct */
 		pvo = lws_pvo_search(
 			(const struct lws_protocol_vhost_options *)in,
@@ -170,8 +168,9 @@ callback_minimal(struct lws *wsi, enum lws_callback_reasons reason,
 		vhd->protocol = lws_get_protocol(wsi);
 		vhd->vhost = lws_get_vhost(wsi);
 
-		vhd->ring = lws_ring_create(sizeof(struct msg), 8,
-					    __minimal_destroy_message);
+		vhd->ring = lws_ring_create_lockfree(sizeof(struct msg), 8,
+					    __minimal_destroy_message,
+					    LWS_RING_MPSC);
 		if (!vhd->ring) {
 			lwsl_err("%s: failed to create ring\n", __func__);
 			return 1;
@@ -197,8 +196,6 @@ init_fail:
 
 		if (vhd->ring)
 			lws_ring_destroy(vhd->ring);
-
-		pthread_mutex_destroy(&vhd->lock_ring);
 		break;
 
 	case LWS_CALLBACK_ESTABLISHED:
@@ -215,19 +212,14 @@ init_fail:
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
-		pthread_mutex_lock(&vhd->lock_ring); /* --------- ring lock { */
-
 		pmsg = lws_ring_get_element(vhd->ring, &pss->tail);
-		if (!pmsg) {
-			pthread_mutex_unlock(&vhd->lock_ring); /* } ring lock ------- */
+		if (!pmsg)
 			break;
-		}
 
 		/* notice we allowed for LWS_PRE in the payload already */
 		m = lws_write(wsi, pmsg->payload + LWS_PRE, pmsg->len,
 			      LWS_WRITE_TEXT);
 		if (m < (int)pmsg->len) {
-			pthread_mutex_unlock(&vhd->lock_ring); /* } ring lock ------- */
 			lwsl_err("ERROR %d writing to ws socket\n", m);
 			return -1;
 		}
@@ -246,8 +238,6 @@ init_fail:
 		if (lws_ring_get_element(vhd->ring, &pss->tail))
 			/* come back as soon as we can write more */
 			lws_callback_on_writable(pss->wsi);
-
-		pthread_mutex_unlock(&vhd->lock_ring); /* } ring lock ------- */
 		break;
 
 	case LWS_CALLBACK_RECEIVE:
@@ -0,0 +1,80 @@
+/*
+ * libwebsockets - lws-plugin-ssh-base - multi-block ChaCha20
+ *
+ * Copyright (C) 2017 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * Included by chacha.c once per vector width, with CHACHA_V (the vector
+ * type), CHACHA_LANES (u32 per vector), CHACHA_VEC_FN (the function name)
+ * and CHACHA_VEC_ATTR (any target attribute) defined.
+ *
+ * En/decrypts groups * CHACHA_LANES whole blocks and advances the counter.
+ */
+
+CHACHA_VEC_ATTR static void
+CHACHA_VEC_FN(chacha_ctx *ctx, const u8 *m, u8 *c, u32 groups)
+{
+	uint64_t ctr = ctx->input[12] | ((uint64_t)ctx->input[13] << 32);
+	CHACHA_V j[16], x[16];
+	u32 ks[16][CHACHA_LANES], ctr_lo[CHACHA_LANES], ctr_hi[CHACHA_LANES], v;
+	int i, b, w;
+
+	for (i = 0; i < 16; i++)
+		j[i] = (CHACHA_V){ 0 } + ctx->input[i];
+
+	while (groups--) {
+		/* each lane is the next block, so it gets the next counter */
+		for (b = 0; b < CHACHA_LANES; b++) {
+			ctr_lo[b] = (u32)(ctr + b);
+			ctr_hi[b] = (u32)((ctr + b) >> 32);
+		}
+		memcpy(&j[12], ctr_lo, sizeof(ctr_lo));
+		memcpy(&j[13], ctr_hi, sizeof(ctr_hi));
+
+		memcpy(x, j, sizeof(x));
+
+		for (i = 20; i > 0; i -= 2) {
+			CHACHA_VQR(x[0], x[4], x[8], x[12])
+			CHACHA_VQR(x[1], x[5], x[9], x[13])
+			CHACHA_VQR(x[2], x[6], x[10], x[14])
+			CHACHA_VQR(x[3], x[7], x[11], x[15])
+			CHACHA_VQR(x[0], x[5], x[10], x[15])
+			CHACHA_VQR(x[1], x[6], x[11], x[12])
+			CHACHA_VQR(x[2], x[7], x[8], x[13])
+			CHACHA_VQR(x[3], x[4], x[9], x[14])
+		}
+
+		for (i = 0; i < 16; i++) {
+			x[i] += j[i];
+			memcpy(ks[i], &x[i], sizeof(x[i]));
+		}
+
+		for (b = 0; b < CHACHA_LANES; b++) {
+			for (w = 0; w < 16; w++) {
+				v = ks[w][b] ^ U8TO32_LITTLE(m + (4 * w));
+				U32TO8_LITTLE(c + (4 * w), v);
+			}
+			m += CHACHA_BLOCKLEN;
+			c += CHACHA_BLOCKLEN;
+		}
+
+		ctr += CHACHA_LANES;
+	}
+
+	ctx->input[12] = (u32)ctr;
+	ctx->input[13] = (u32)(ctr >> 32);
+}
@@ -96,8 +96,8 @@ chacha_ivsetup(chacha_ctx *x, const u8 *iv, const u8 *counter)
   x->input[15] = U8TO32_LITTLE(iv + 4);
 }
 
-void
-chacha_encrypt_bytes(chacha_ctx *x,const u8 *m,u8 *c,u32 bytes)
+static void
+chacha_encrypt_bytes_ref(chacha_ctx *x,const u8 *m,u8 *c,u32 bytes)
 {
   u32 x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
   u32 j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
@@ -227,6 +227,87 @@ chacha_encrypt_bytes(chacha_ctx *x,const u8 *m,u8 *c,u32 bytes)
   }
 }
 
+/*
+ * Multi-block ChaCha20: each vector holds the same state word for 4 (SSE2 /
+ * NEON) or 8 (AVX2) consecutive blocks, so the rounds run on all of them at
+ * once.  The compiler's generic vectors are lowered to whichever of those
+ * the function is built for; AVX2 is chosen at runtime.  Anything left over
+ * that doesn't fill a whole group, and builds without the vector support,
+ * use the reference code above.
+ */
+
+#if defined(__GNUC__) && !defined(LWS_SSH_CHACHA_REF) && \
+    (defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define LWS_SSH_CHACHA_VEC
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ >= 5 || defined(__clang__))
+#define LWS_SSH_CHACHA_AVX2
+#endif
+
+#define CHACHA_VROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA_VQR(a, b, c, d) \
+	a += b; d = CHACHA_VROTL(d ^ a, 16); \
+	c += d; b = CHACHA_VROTL(b ^ c, 12); \
+	a += b; d = CHACHA_VROTL(d ^ a, 8); \
+	c += d; b = CHACHA_VROTL(b ^ c, 7);
+
+typedef u32 chacha_v4 __attribute__((vector_size(16)));
+
+#define CHACHA_V	chacha_v4
+#define CHACHA_LANES	4
+#define CHACHA_VEC_FN	chacha_vec4_blocks
+#define CHACHA_VEC_ATTR
+#include "chacha-vec.h"
+#undef CHACHA_V
+#undef CHACHA_LANES
+#undef CHACHA_VEC_FN
+#undef CHACHA_VEC_ATTR
+
+#if defined(LWS_SSH_CHACHA_AVX2)
+typedef u32 chacha_v8 __attribute__((vector_size(32)));
+
+#define CHACHA_V	chacha_v8
+#define CHACHA_LANES	8
+#define CHACHA_VEC_FN	chacha_vec8_blocks
+#define CHACHA_VEC_ATTR	__attribute__((target("avx2")))
+#include "chacha-vec.h"
+#undef CHACHA_V
+#undef CHACHA_LANES
+#undef CHACHA_VEC_FN
+#undef CHACHA_VEC_ATTR
+#endif
+#endif
+
+void
+chacha_encrypt_bytes(chacha_ctx *x, const u8 *m, u8 *c, u32 bytes)
+{
+#if defined(LWS_SSH_CHACHA_VEC)
+	u32 n;
+
+#if defined(LWS_SSH_CHACHA_AVX2)
+	if (bytes >= 8 * CHACHA_BLOCKLEN && __builtin_cpu_supports("avx2")) {
+		n = bytes / (8 * CHACHA_BLOCKLEN);
+		chacha_vec8_blocks(x, m, c, n);
+		n *= 8 * CHACHA_BLOCKLEN;
+		m += n;
+		c += n;
+		bytes -= n;
+	}
+#endif
+	if (bytes >= 4 * CHACHA_BLOCKLEN) {
+		n = bytes / (4 * CHACHA_BLOCKLEN);
+		chacha_vec4_blocks(x, m, c, n);
+		n *= 4 * CHACHA_BLOCKLEN;
+		m += n;
+		c += n;
+		bytes -= n;
+	}
+#endif
+
+	chacha_encrypt_bytes_ref(x, m, c, bytes);
+}
+
 struct lws_cipher_chacha {
 	struct chacha_ctx ccctx[2];
 };
@@ -13,6 +13,8 @@
 
 #include "fe25519.h"
 
+#if !defined(LWS_SSH_FE51)
+
 static uint32_t fe_equal(uint32_t a,uint32_t b) /* 16-bit inputs */
 {
   uint32_t x = a ^ b; /* 0: yes; 1..65535: no */
@@ -216,6 +218,10 @@ void fe25519_square(fe25519 *r, const fe25519 *x)
   fe25519_mul(r, x, x);
 }
 
+#endif /* !LWS_SSH_FE51 */
+
+/* invert and pow2523 only need mul and square, so serve both representations */
+
 void fe25519_invert(fe25519 *r, const fe25519 *x)
 {
 	fe25519 z2;
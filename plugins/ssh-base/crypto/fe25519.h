@@ -9,6 +9,15 @@
 #ifndef FE25519_H
 #define FE25519_H
 
+/*
+ * Where the compiler gives us a 64x64->128 multiply, use field elements of
+ * five 51-bit limbs (fe25519_51.c, smult_curve25519_51.c).  Otherwise, or if
+ * LWS_SSH_FE25519_REF is defined, use the radix 2^8 reference code.
+ */
+#if defined(__SIZEOF_INT128__) && !defined(LWS_SSH_FE25519_REF)
+#define LWS_SSH_FE51
+#endif
+
 #define fe25519              crypto_sign_ed25519_ref_fe25519
 #define fe25519_freeze       crypto_sign_ed25519_ref_fe25519_freeze
 #define fe25519_unpack       crypto_sign_ed25519_ref_fe25519_unpack
@@ -27,11 +36,19 @@
 #define fe25519_invert       crypto_sign_ed25519_ref_fe25519_invert
 #define fe25519_pow2523      crypto_sign_ed25519_ref_fe25519_pow2523
 
+#if defined(LWS_SSH_FE51)
+typedef struct
+{
+	uint64_t v[5];
+}
+fe25519;
+#else
 typedef struct 
 {
 	uint32_t v[32];
 }
 fe25519;
+#endif
 
 void fe25519_freeze(fe25519 *r);
 
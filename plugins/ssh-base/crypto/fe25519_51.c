@@ -0,0 +1,290 @@
+/*
+ * libwebsockets - lws-plugin-ssh-base - fe25519 in radix 2^51
+ *
+ * Copyright (C) 2017 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * Drop-in replacement for the representation-dependent parts of the
+ * supercop ref fe25519.c, holding elements as five 51-bit limbs and using
+ * 64x64->128 multiplies, as in the public domain curve25519-donna-c64 and
+ * ed25519-donna.  fe25519.c still provides invert and pow2523 on top.
+ *
+ * Every function leaves its result "loosely reduced", with every limb below
+ * 2^52, which keeps every product inside 128 bits and lets sub() bias by 2p
+ * without any caller needing to think about it.
+ */
+
+#include <libwebsockets.h>
+
+#include "fe25519.h"
+
+#if defined(LWS_SSH_FE51)
+
+typedef unsigned __int128 fe51_u128;
+
+#define FE51_MASK ((uint64_t)0x7ffffffffffffULL)
+
+static uint64_t
+fe51_load64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+	       ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+	       ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+	       ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static void
+fe51_store64(unsigned char *p, uint64_t v)
+{
+	int n;
+
+	for (n = 0; n < 8; n++)
+		p[n] = (unsigned char)(v >> (8 * n));
+}
+
+static void
+fe51_carry(uint64_t *v)
+{
+	v[1] += v[0] >> 51;
+	v[0] &= FE51_MASK;
+	v[2] += v[1] >> 51;
+	v[1] &= FE51_MASK;
+	v[3] += v[2] >> 51;
+	v[2] &= FE51_MASK;
+	v[4] += v[3] >> 51;
+	v[3] &= FE51_MASK;
+	v[0] += 19 * (v[4] >> 51);
+	v[4] &= FE51_MASK;
+}
+
+void fe25519_freeze(fe25519 *r)
+{
+	uint64_t q;
+
+	fe51_carry(r->v);
+	fe51_carry(r->v);
+
+	/* r is now below 2^255 + 19... q = 1 if r >= p */
+
+	q = (r->v[0] + 19) >> 51;
+	q = (r->v[1] + q) >> 51;
+	q = (r->v[2] + q) >> 51;
+	q = (r->v[3] + q) >> 51;
+	q = (r->v[4] + q) >> 51;
+
+	r->v[0] += 19 * q;
+
+	r->v[1] += r->v[0] >> 51;
+	r->v[0] &= FE51_MASK;
+	r->v[2] += r->v[1] >> 51;
+	r->v[1] &= FE51_MASK;
+	r->v[3] += r->v[2] >> 51;
+	r->v[2] &= FE51_MASK;
+	r->v[4] += r->v[3] >> 51;
+	r->v[3] &= FE51_MASK;
+	r->v[4] &= FE51_MASK;
+}
+
+void fe25519_unpack(fe25519 *r, const unsigned char x[32])
+{
+	uint64_t x0 = fe51_load64(x), x1 = fe51_load64(x + 8),
+		 x2 = fe51_load64(x + 16), x3 = fe51_load64(x + 24);
+
+	/* like the ref code, bit 255 is ignored */
+
+	r->v[0] = x0 & FE51_MASK;
+	r->v[1] = ((x0 >> 51) | (x1 << 13)) & FE51_MASK;
+	r->v[2] = ((x1 >> 38) | (x2 << 26)) & FE51_MASK;
+	r->v[3] = ((x2 >> 25) | (x3 << 39)) & FE51_MASK;
+	r->v[4] = (x3 >> 12) & FE51_MASK;
+}
+
+void fe25519_pack(unsigned char r[32], const fe25519 *x)
+{
+	fe25519 y = *x;
+
+	fe25519_freeze(&y);
+
+	fe51_store64(r, y.v[0] | (y.v[1] << 51));
+	fe51_store64(r + 8, (y.v[1] >> 13) | (y.v[2] << 38));
+	fe51_store64(r + 16, (y.v[2] >> 26) | (y.v[3] << 25));
+	fe51_store64(r + 24, (y.v[3] >> 39) | (y.v[4] << 12));
+}
+
+int fe25519_iszero(const fe25519 *x)
+{
+	fe25519 t = *x;
+	uint64_t m;
+
+	fe25519_freeze(&t);
+	m = t.v[0] | t.v[1] | t.v[2] | t.v[3] | t.v[4];
+
+	return (int)(((m | (0 - m)) >> 63) ^ 1);
+}
+
+int fe25519_iseq_vartime(const fe25519 *x, const fe25519 *y)
+{
+	fe25519 t1 = *x, t2 = *y;
+	int n;
+
+	fe25519_freeze(&t1);
+	fe25519_freeze(&t2);
+
+	for (n = 0; n < 5; n++)
+		if (t1.v[n] != t2.v[n])
+			return 0;
+
+	return 1;
+}
+
+void fe25519_cmov(fe25519 *r, const fe25519 *x, unsigned char b)
+{
+	uint64_t mask = 0 - (uint64_t)b;
+	int n;
+
+	for (n = 0; n < 5; n++)
+		r->v[n] ^= mask & (x->v[n] ^ r->v[n]);
+}
+
+unsigned char fe25519_getparity(const fe25519 *x)
+{
+	fe25519 t = *x;
+
+	fe25519_freeze(&t);
+
+	return (unsigned char)(t.v[0] & 1);
+}
+
+void fe25519_setone(fe25519 *r)
+{
+	r->v[0] = 1;
+	r->v[1] = r->v[2] = r->v[3] = r->v[4] = 0;
+}
+
+void fe25519_setzero(fe25519 *r)
+{
+	r->v[0] = r->v[1] = r->v[2] = r->v[3] = r->v[4] = 0;
+}
+
+void fe25519_add(fe25519 *r, const fe25519 *x, const fe25519 *y)
+{
+	int n;
+
+	for (n = 0; n < 5; n++)
+		r->v[n] = x->v[n] + y->v[n];
+
+	fe51_carry(r->v);
+}
+
+void fe25519_sub(fe25519 *r, const fe25519 *x, const fe25519 *y)
+{
+	/* add 2p first so the limbs can't go negative */
+
+	r->v[0] = (x->v[0] + 0xfffffffffffdaULL) - y->v[0];
+	r->v[1] = (x->v[1] + 0xffffffffffffeULL) - y->v[1];
+	r->v[2] = (x->v[2] + 0xffffffffffffeULL) - y->v[2];
+	r->v[3] = (x->v[3] + 0xffffffffffffeULL) - y->v[3];
+	r->v[4] = (x->v[4] + 0xffffffffffffeULL) - y->v[4];
+
+	fe51_carry(r->v);
+}
+
+void fe25519_neg(fe25519 *r, const fe25519 *x)
+{
+	fe25519 z;
+
+	fe25519_setzero(&z);
+	fe25519_sub(r, &z, x);
+}
+
+static void
+fe51_reduce(fe25519 *r, fe51_u128 t0, fe51_u128 t1, fe51_u128 t2,
+	    fe51_u128 t3, fe51_u128 t4)
+{
+	uint64_t c;
+
+	t1 += (uint64_t)(t0 >> 51);
+	r->v[0] = (uint64_t)t0 & FE51_MASK;
+	t2 += (uint64_t)(t1 >> 51);
+	r->v[1] = (uint64_t)t1 & FE51_MASK;
+	t3 += (uint64_t)(t2 >> 51);
+	r->v[2] = (uint64_t)t2 & FE51_MASK;
+	t4 += (uint64_t)(t3 >> 51);
+	r->v[3] = (uint64_t)t3 & FE51_MASK;
+	c = (uint64_t)(t4 >> 51);
+	r->v[4] = (uint64_t)t4 & FE51_MASK;
+
+	r->v[0] += c * 19;
+	r->v[1] += r->v[0] >> 51;
+	r->v[0] &= FE51_MASK;
+}
+
+void fe25519_mul(fe25519 *r, const fe25519 *x, const fe25519 *y)
+{
+	uint64_t x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3],
+		 x4 = x->v[4], y0 = y->v[0], y1 = y->v[1], y2 = y->v[2],
+		 y3 = y->v[3], y4 = y->v[4],
+		 y1_19 = 19 * y1, y2_19 = 19 * y2, y3_19 = 19 * y3,
+		 y4_19 = 19 * y4;
+
+	fe51_reduce(r,
+		(fe51_u128)x0 * y0 + (fe51_u128)x1 * y4_19 +
+		(fe51_u128)x2 * y3_19 + (fe51_u128)x3 * y2_19 +
+		(fe51_u128)x4 * y1_19,
+
+		(fe51_u128)x0 * y1 + (fe51_u128)x1 * y0 +
+		(fe51_u128)x2 * y4_19 + (fe51_u128)x3 * y3_19 +
+		(fe51_u128)x4 * y2_19,
+
+		(fe51_u128)x0 * y2 + (fe51_u128)x1 * y1 +
+		(fe51_u128)x2 * y0 + (fe51_u128)x3 * y4_19 +
+		(fe51_u128)x4 * y3_19,
+
+		(fe51_u128)x0 * y3 + (fe51_u128)x1 * y2 +
+		(fe51_u128)x2 * y1 + (fe51_u128)x3 * y0 +
+		(fe51_u128)x4 * y4_19,
+
+		(fe51_u128)x0 * y4 + (fe51_u128)x1 * y3 +
+		(fe51_u128)x2 * y2 + (fe51_u128)x3 * y1 +
+		(fe51_u128)x4 * y0);
+}
+
+void fe25519_square(fe25519 *r, const fe25519 *x)
+{
+	uint64_t x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3],
+		 x4 = x->v[4], d0 = 2 * x0, d1 = 2 * x1,
+		 x3_19 = 19 * x3, x3_38 = 38 * x3, x4_19 = 19 * x4,
+		 x4_38 = 38 * x4;
+
+	fe51_reduce(r,
+		(fe51_u128)x0 * x0 + (fe51_u128)x1 * x4_38 +
+		(fe51_u128)x2 * x3_38,
+
+		(fe51_u128)d0 * x1 + (fe51_u128)x2 * x4_38 +
+		(fe51_u128)x3 * x3_19,
+
+		(fe51_u128)d0 * x2 + (fe51_u128)x1 * x1 +
+		(fe51_u128)x3 * x4_38,
+
+		(fe51_u128)d0 * x3 + (fe51_u128)d1 * x2 +
+		(fe51_u128)x4 * x4_19,
+
+		(fe51_u128)d0 * x4 + (fe51_u128)d1 * x3 +
+		(fe51_u128)x2 * x2);
+}
+
+#endif /* LWS_SSH_FE51 */
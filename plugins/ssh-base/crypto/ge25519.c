@@ -18,6 +18,18 @@
  * Base point: (15112221349535400772501151409588531511454012693041857206046113283949847762202,46316835694926478169428394003475163141307993866256225615783033603165251855960);
  */
 
+#if defined(LWS_SSH_FE51)
+/* d */
+static const fe25519 ge25519_ecd = {{0x34dca135978a3ULL, 0x1a8283b156ebdULL, 0x5e7a26001c029ULL,
+                                     0x739c663a03cbbULL, 0x52036cee2b6ffULL}};
+/* 2*d */
+static const fe25519 ge25519_ec2d = {{0x69b9426b2f159ULL, 0x35050762add7aULL, 0x3cf44c0038052ULL,
+                                      0x6738cc7407977ULL, 0x2406d9dc56dffULL}};
+/* sqrt(-1) */
+static const fe25519 ge25519_sqrtm1 = {{0x61b274a0ea0b0ULL, 0x0d5a5fc8f189dULL, 0x7ef5e9cbd0c60ULL,
+                                        0x78595a6804c9eULL, 0x2b8324804fc1dULL}};
+
+#else
 /* d */
 static const fe25519 ge25519_ecd = {{0xA3, 0x78, 0x59, 0x13, 0xCA, 0x4D, 0xEB, 0x75, 0xAB, 0xD8, 0x41, 0x41, 0x4D, 0x0A, 0x70, 0x00, 
                       0x98, 0xE8, 0x79, 0x77, 0x79, 0x40, 0xC7, 0x8C, 0x73, 0xFE, 0x6F, 0x2B, 0xEE, 0x6C, 0x03, 0x52}};
@@ -27,6 +39,7 @@ static const fe25519 ge25519_ec2d = {{0x59, 0xF1, 0xB2, 0x26, 0x94, 0x9B, 0xD6,
 /* sqrt(-1) */
 static const fe25519 ge25519_sqrtm1 = {{0xB0, 0xA0, 0x0E, 0x4A, 0x27, 0x1B, 0xEE, 0xC4, 0x78, 0xE4, 0x2F, 0xAD, 0x06, 0x18, 0x43, 0x2F, 
                          0xA7, 0xD7, 0xFB, 0x3D, 0x99, 0x00, 0x4D, 0x2B, 0x0B, 0xDF, 0xC1, 0x4F, 0x80, 0x24, 0x83, 0x2B}};
+#endif
 
 #define ge25519_p3 ge25519
 
@@ -52,6 +65,34 @@ typedef struct
 } ge25519_aff;
 
 
+#if defined(LWS_SSH_FE51)
+/* Coordinates of the base point, in radix 2^51 */
+const ge25519 ge25519_base = {{{0x62d608f25d51aULL, 0x412a4b4f6592aULL, 0x75b7171a4b31dULL,
+                                0x1ff60527118feULL, 0x216936d3cd6e5ULL}},
+                              {{0x6666666666658ULL, 0x4ccccccccccccULL, 0x1999999999999ULL,
+                                0x3333333333333ULL, 0x6666666666666ULL}},
+                              {{0x0000000000001ULL, 0x0000000000000ULL, 0x0000000000000ULL,
+                                0x0000000000000ULL, 0x0000000000000ULL}},
+                              {{0x68ab3a5b7dda3ULL, 0x00eea2a5eadbbULL, 0x2af8df483c27eULL,
+                                0x332b375274732ULL, 0x67875f0fd78b7ULL}}};
+
+/*
+ * The table below stays in the ref code's packed form, one byte per uint32,
+ * whatever fe25519 is: choose_t() selects in that form and converts the one
+ * entry it chose.
+ */
+typedef struct
+{
+  uint32_t v[32];
+} fe25519_packed;
+
+typedef struct
+{
+  fe25519_packed x;
+  fe25519_packed y;
+} ge25519_aff_packed;
+
+#else
 /* Packed coordinates of the base point */
 const ge25519 ge25519_base = {{{0x1A, 0xD5, 0x25, 0x8F, 0x60, 0x2D, 0x56, 0xC9, 0xB2, 0xA7, 0x25, 0x95, 0x60, 0xC7, 0x2C, 0x69, 
                                 0x5C, 0xDC, 0xD6, 0xFD, 0x31, 0xE2, 0xA4, 0xC0, 0xFE, 0x53, 0x6E, 0xCD, 0xD3, 0x36, 0x69, 0x21}},
@@ -62,8 +103,11 @@ const ge25519 ge25519_base = {{{0x1A, 0xD5, 0x25, 0x8F, 0x60, 0x2D, 0x56, 0xC9,
                               {{0xA3, 0xDD, 0xB7, 0xA5, 0xB3, 0x8A, 0xDE, 0x6D, 0xF5, 0x52, 0x51, 0x77, 0x80, 0x9F, 0xF0, 0x20, 
                                 0x7D, 0xE3, 0xAB, 0x64, 0x8E, 0x4E, 0xEA, 0x66, 0x65, 0x76, 0x8B, 0xD7, 0x0F, 0x5F, 0x87, 0x67}}};
 
+typedef ge25519_aff ge25519_aff_packed;
+#endif
+
 /* Multiples of the base point in affine representation */
-static const ge25519_aff ge25519_base_multiples_affine[425] = {
+static const ge25519_aff_packed ge25519_base_multiples_affine[425] = {
 #include "ge25519_base.data"
 };
 
@@ -143,10 +187,20 @@ static void dbl_p1p1(ge25519_p1p1 *r, const ge25519_p2 *p)
 }
 
 /* Constant-time version of: if(b) r = p */
-static void cmov_aff(ge25519_aff *r, const ge25519_aff *p, unsigned char b)
+static void cmov_aff(ge25519_aff_packed *r, const ge25519_aff_packed *p, unsigned char b)
 {
+#if defined(LWS_SSH_FE51)
+  uint32_t mask = -(uint32_t)b;
+  int i;
+
+  for(i=0;i<32;i++) {
+    r->x.v[i] ^= mask & (p->x.v[i] ^ r->x.v[i]);
+    r->y.v[i] ^= mask & (p->y.v[i] ^ r->y.v[i]);
+  }
+#else
   fe25519_cmov(&r->x, &p->x, b);
   fe25519_cmov(&r->y, &p->y, b);
+#endif
 }
 
 static unsigned char ge_equal(signed char b,signed char c)
@@ -171,11 +225,24 @@ static void choose_t(ge25519_aff *t, unsigned long long pos, signed char b)
 {
   /* constant time */
   fe25519 v;
-  *t = ge25519_base_multiples_affine[5*pos+0];
-  cmov_aff(t, &ge25519_base_multiples_affine[5*pos+1],ge_equal(b,1) | ge_equal(b,-1));
-  cmov_aff(t, &ge25519_base_multiples_affine[5*pos+2],ge_equal(b,2) | ge_equal(b,-2));
-  cmov_aff(t, &ge25519_base_multiples_affine[5*pos+3],ge_equal(b,3) | ge_equal(b,-3));
-  cmov_aff(t, &ge25519_base_multiples_affine[5*pos+4],ge_equal(b,-4));
+  ge25519_aff_packed pt;
+#if defined(LWS_SSH_FE51)
+  unsigned char b32[32];
+  int i;
+#endif
+  pt = ge25519_base_multiples_affine[5*pos+0];
+  cmov_aff(&pt, &ge25519_base_multiples_affine[5*pos+1],ge_equal(b,1) | ge_equal(b,-1));
+  cmov_aff(&pt, &ge25519_base_multiples_affine[5*pos+2],ge_equal(b,2) | ge_equal(b,-2));
+  cmov_aff(&pt, &ge25519_base_multiples_affine[5*pos+3],ge_equal(b,3) | ge_equal(b,-3));
+  cmov_aff(&pt, &ge25519_base_multiples_affine[5*pos+4],ge_equal(b,-4));
+#if defined(LWS_SSH_FE51)
+  for(i=0;i<32;i++) b32[i] = (unsigned char)pt.x.v[i];
+  fe25519_unpack(&t->x, b32);
+  for(i=0;i<32;i++) b32[i] = (unsigned char)pt.y.v[i];
+  fe25519_unpack(&t->y, b32);
+#else
+  *t = pt;
+#endif
   fe25519_neg(&v, &t->x);
   fe25519_cmov(&t->x, &v, negative(b));
 }
@@ -0,0 +1,137 @@
+/*
+ * libwebsockets - lws-plugin-ssh-base - X25519 on radix 2^51 fe25519
+ *
+ * Copyright (C) 2017 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * The constant-time Montgomery ladder of RFC7748 section 5, using the same
+ * 51-bit limb field arithmetic as ed25519 (fe25519_51.c).  It gives the same
+ * results as smult_curve25519_ref.c, which is still used where there is no
+ * 128-bit multiply.
+ */
+
+#include <libwebsockets.h>
+#include "lws-ssh.h"
+#include "fe25519.h"
+
+#if defined(LWS_SSH_FE51)
+
+static void
+x25519_cswap(fe25519 *a, fe25519 *b, uint64_t swap)
+{
+	uint64_t mask = 0 - swap, t;
+	int n;
+
+	for (n = 0; n < 5; n++) {
+		t = mask & (a->v[n] ^ b->v[n]);
+		a->v[n] ^= t;
+		b->v[n] ^= t;
+	}
+}
+
+/* r = x * 121666, ie, (A + 2) / 4 */
+
+static void
+x25519_mul_a24(fe25519 *r, const fe25519 *x)
+{
+	unsigned __int128 t[5];
+	uint64_t c;
+	int n;
+
+	for (n = 0; n < 5; n++)
+		t[n] = (unsigned __int128)x->v[n] * 121666;
+
+	for (n = 0; n < 4; n++) {
+		t[n + 1] += (uint64_t)(t[n] >> 51);
+		r->v[n] = (uint64_t)t[n] & 0x7ffffffffffffULL;
+	}
+	c = (uint64_t)(t[4] >> 51);
+	r->v[4] = (uint64_t)t[4] & 0x7ffffffffffffULL;
+
+	r->v[0] += c * 19;
+	r->v[1] += r->v[0] >> 51;
+	r->v[0] &= 0x7ffffffffffffULL;
+}
+
+int
+crypto_scalarmult_curve25519(unsigned char *q, const unsigned char *n,
+			     const unsigned char *p)
+{
+	fe25519 x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d, da, cb;
+	uint64_t swap = 0, bit;
+	unsigned char k[32];
+	int t;
+
+	memcpy(k, n, sizeof(k));
+	k[0] &= 248;
+	k[31] &= 127;
+	k[31] |= 64;
+
+	/*
+	 * the ref code takes all 256 bits of the u coordinate, so bit 255
+	 * contributes 2^255 == 19 mod p; stay bit-for-bit compatible with it
+	 */
+	fe25519_unpack(&x1, p);
+	x1.v[0] += 19 * (uint64_t)(p[31] >> 7);
+
+	fe25519_setone(&x2);
+	fe25519_setzero(&z2);
+	x3 = x1;
+	fe25519_setone(&z3);
+
+	for (t = 254; t >= 0; t--) {
+		bit = (k[t >> 3] >> (t & 7)) & 1;
+		swap ^= bit;
+		x25519_cswap(&x2, &x3, swap);
+		x25519_cswap(&z2, &z3, swap);
+		swap = bit;
+
+		fe25519_add(&a, &x2, &z2);
+		fe25519_square(&aa, &a);
+		fe25519_sub(&b, &x2, &z2);
+		fe25519_square(&bb, &b);
+		fe25519_sub(&e, &aa, &bb);
+		fe25519_add(&c, &x3, &z3);
+		fe25519_sub(&d, &x3, &z3);
+		fe25519_mul(&da, &d, &a);
+		fe25519_mul(&cb, &c, &b);
+
+		fe25519_add(&x3, &da, &cb);
+		fe25519_square(&x3, &x3);
+		fe25519_sub(&z3, &da, &cb);
+		fe25519_square(&z3, &z3);
+		fe25519_mul(&z3, &z3, &x1);
+
+		fe25519_mul(&x2, &aa, &bb);
+		x25519_mul_a24(&z2, &e);
+		fe25519_add(&z2, &z2, &bb);
+		fe25519_mul(&z2, &z2, &e);
+	}
+
+	x25519_cswap(&x2, &x3, swap);
+	x25519_cswap(&z2, &z3, swap);
+
+	fe25519_invert(&z2, &z2);
+	fe25519_mul(&x2, &x2, &z2);
+	fe25519_pack(q, &x2);
+
+	explicit_bzero(k, sizeof(k));
+
+	return 0;
+}
+
+#endif /* LWS_SSH_FE51 */
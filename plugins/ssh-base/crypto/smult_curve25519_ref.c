@@ -6,6 +6,12 @@ Public domain.
 Derived from public domain code by D. J. Bernstein.
 */
 
+#include <libwebsockets.h>
+#include "fe25519.h"
+
+/* smult_curve25519_51.c provides it instead when we have 128-bit products */
+#if !defined(LWS_SSH_FE51)
+
 static void add(unsigned int out[32],const unsigned int a[32],const unsigned int b[32])
 {
   unsigned int j;
@@ -263,3 +269,5 @@ int crypto_scalarmult_curve25519(unsigned char *q,
   for (i = 0;i < 32;++i) q[i] = work[64 + i];
   return 0;
 }
+
+#endif /* !LWS_SSH_FE51 */
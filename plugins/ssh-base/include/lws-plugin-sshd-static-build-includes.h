@@ -9,10 +9,12 @@
 #include "../crypto/chacha.c"
 #include "../crypto/ed25519.c"
 #include "../crypto/fe25519.c"
+#include "../crypto/fe25519_51.c"
 #include "../crypto/ge25519.c"
 #include "../crypto/poly1305.c"
 #include "../crypto/sc25519.c"
 #include "../crypto/smult_curve25519_ref.c"
+#include "../crypto/smult_curve25519_51.c"
 #include "../kex-25519.c"
 #include "../sshd.c"
 #include "../telnet.c"
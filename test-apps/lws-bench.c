@@ -0,0 +1,829 @@
+/*
+ * lws-bench - libwebsockets load generator
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * The person who associated a work with this deed has dedicated
+ * the work to the public domain by waiving all of his or her rights
+ * to the work worldwide under copyright law, including all related
+ * and neighboring rights, to the extent allowed by law. You can copy,
+ * modify, distribute and perform the work, even for commercial purposes,
+ * all without asking permission.
+ *
+ * Opens a number of concurrent http or ws client connections spread over
+ * a number of threads, each with its own lws context, drives requests or
+ * messages over them either as fast as the server answers (closed loop) or
+ * at a fixed rate per connection (open loop), and reports the throughput
+ * and the latency distribution as JSON on stdout.
+ *
+ * In open loop mode, latency is measured from when the request was due to
+ * be sent rather than when it actually went out, so a stalled server
+ * doesn't hide its own stalls by slowing the load down.
+ *
+ * In h1 mode, each "connection" keeps reusing the same keep-alive connection
+ * for its requests, while the server allows it.
+ *
+ * In h2 mode, the "connections" are concurrent requests, which lws sends as
+ * streams on as few tls connections as the server's stream limit allows.
+ *
+ * In ws-connect mode, each "connection" opens a ws connection, closes it as
+ * soon as the upgrade completed and goes again, so the rate and latency are
+ * for whole connect + upgrade handshakes.
+ *
+ * It's intended to be run against minimal-examples/bench/minimal-bench-server
+ * which serves GET or POST /bytes/<n> with n bytes of response, and echoes
+ * ws messages on the "lws-bench" protocol.
+ */
+
+#include "lws_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../lib/libwebsockets.h"
+
+#define BENCH_MAX_THREADS	64
+#define BENCH_MAX_INFLIGHT	64
+#define BENCH_GRACE_US		(2 * 1000000ll)
+
+/*
+ * log-linear histogram in the style of HdrHistogram: values below
+ * 2^BENCH_HIST_SUBBITS us are exact, above that each power of two is split
+ * into 2^BENCH_HIST_SUBBITS buckets, so any value is within 1% of its bucket
+ */
+#define BENCH_HIST_SUBBITS	7
+#define BENCH_HIST_BUCKETS	((32 - BENCH_HIST_SUBBITS + 1) << \
+				 BENCH_HIST_SUBBITS)
+
+enum bench_mode {
+	BENCH_H1,
+	BENCH_H2,
+	BENCH_WS,
+	BENCH_WS_CONNECT,
+};
+
+static const char * const mode_names[] = { "h1", "h2", "ws", "ws-connect" };
+
+struct bench_hist {
+	uint64_t b[BENCH_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct bench_thread;
+
+struct bench_conn {
+	struct bench_thread *bt;
+	struct lws *wsi;
+	int64_t due;		/* open loop: when the next send is due */
+	int64_t started;	/* h1: when this request was due / began */
+	int64_t sent[BENCH_MAX_INFLIGHT]; /* ws: fifo of message send times */
+	size_t tx_left;		/* h1: request body still to send */
+	unsigned int status;	/* h1: http response code */
+	int head;
+	int tail;
+	char busy;		/* a connection attempt or request is live */
+	char established;	/* ws: ready for messages */
+};
+
+struct bench_thread {
+	pthread_t thread;
+	struct lws_context *context;
+	struct bench_conn *conn;
+	struct bench_hist hist;
+	unsigned char *txbuf;
+	int64_t start;
+	int64_t end;
+	uint64_t issued;
+	uint64_t limit;
+	uint64_t completed;
+	uint64_t errors;
+	uint64_t rx;
+	uint64_t tx;
+	int count_conn;
+	int finished; /* service loop exited, conns close in ctx destroy */
+};
+
+static struct bench_thread bt[BENCH_MAX_THREADS];
+static enum bench_mode mode = BENCH_H1;
+static const char *address = "127.0.0.1", *path = NULL;
+static int port = 7681, use_ssl, use_pmd, count_conn = 10, count_threads = 1,
+	   rate, duration = 10, count_requests;
+static size_t size;
+static volatile int force_exit;
+
+static int64_t
+bench_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int
+bench_hist_bucket(uint64_t us)
+{
+	int e = 0, n;
+
+	if (us < (1 << BENCH_HIST_SUBBITS))
+		return (int)us;
+	if (us >> 32)
+		return BENCH_HIST_BUCKETS - 1;
+
+	while (us >> (e + 1))
+		e++;
+
+	n = ((e - BENCH_HIST_SUBBITS + 1) << BENCH_HIST_SUBBITS) +
+	    (int)((us >> (e - BENCH_HIST_SUBBITS)) &
+		  ((1 << BENCH_HIST_SUBBITS) - 1));
+
+	return n < BENCH_HIST_BUCKETS ? n : BENCH_HIST_BUCKETS - 1;
+}
+
+static uint64_t
+bench_hist_bucket_floor(int bucket)
+{
+	int e = (bucket >> BENCH_HIST_SUBBITS) + BENCH_HIST_SUBBITS - 1;
+
+	if (bucket < (1 << BENCH_HIST_SUBBITS))
+		return (uint64_t)bucket;
+
+	return ((uint64_t)(1 << BENCH_HIST_SUBBITS) +
+		(bucket & ((1 << BENCH_HIST_SUBBITS) - 1))) <<
+			(e - BENCH_HIST_SUBBITS);
+}
+
+static void
+bench_hist_add(struct bench_hist *h, int64_t us)
+{
+	if (us < 0)
+		us = 0;
+
+	h->b[bench_hist_bucket((uint64_t)us)]++;
+	if (!h->count || (uint64_t)us < h->min)
+		h->min = (uint64_t)us;
+	if ((uint64_t)us > h->max)
+		h->max = (uint64_t)us;
+	h->count++;
+	h->sum += (uint64_t)us;
+}
+
+static void
+bench_hist_merge(struct bench_hist *d, const struct bench_hist *s)
+{
+	int n;
+
+	if (!s->count)
+		return;
+
+	for (n = 0; n < BENCH_HIST_BUCKETS; n++)
+		d->b[n] += s->b[n];
+	if (!d->count || s->min < d->min)
+		d->min = s->min;
+	if (s->max > d->max)
+		d->max = s->max;
+	d->count += s->count;
+	d->sum += s->sum;
+}
+
+/* pc is the percentile wanted, eg, 99.9 */
+
+static uint64_t
+bench_hist_percentile(const struct bench_hist *h, double pc)
+{
+	uint64_t want, acc = 0, v;
+	int n;
+
+	if (!h->count)
+		return 0;
+
+	want = (uint64_t)((h->count * pc) / 100.0);
+	if (want >= h->count)
+		want = h->count - 1;
+
+	for (n = 0; n < BENCH_HIST_BUCKETS; n++) {
+		acc += h->b[n];
+		if (acc > want)
+			break;
+	}
+
+	v = bench_hist_bucket_floor(n);
+	if (v < h->min)
+		v = h->min;
+	if (v > h->max)
+		v = h->max;
+
+	return v;
+}
+
+static void
+bench_next_due(struct bench_conn *c, int64_t now)
+{
+	if (!rate) {
+		c->due = now;
+		return;
+	}
+
+	c->due += 1000000 / rate;
+}
+
+static void
+bench_connect(struct bench_conn *c, int64_t now)
+{
+	struct bench_thread *t = c->bt;
+	struct lws_client_connect_info i;
+
+	memset(&i, 0, sizeof(i));
+	i.context = t->context;
+	i.address = address;
+	i.port = port;
+	i.host = address;
+	i.origin = address;
+	i.path = path;
+	if (use_ssl)
+		i.ssl_connection = LCCSCF_USE_SSL | LCCSCF_ALLOW_SELFSIGNED |
+				   LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK;
+	if (mode == BENCH_H2)
+		/* every request after the first is a stream on one conn */
+		i.ssl_connection |= LCCSCF_OFFER_H2;
+	if (mode == BENCH_H1)
+		/* the next request takes over the last one's idle conn */
+		i.ssl_connection |= LCCSCF_PIPELINE;
+	i.userdata = c;
+	i.pwsi = &c->wsi;
+
+	if (mode == BENCH_WS || mode == BENCH_WS_CONNECT) {
+		i.protocol = "lws-bench";
+		/* bind to our ws handler rather than protocols[0] */
+		i.local_protocol_name = "lws-bench";
+		if (mode == BENCH_WS_CONNECT) {
+			c->started = rate ? c->due : now;
+			bench_next_due(c, now);
+			t->issued++;
+		}
+	} else {
+		i.method = size ? "POST" : "GET";
+		i.protocol = "http";
+		c->tx_left = size;
+		c->status = 0;
+		/* open loop latency counts from when it should have gone */
+		c->started = rate ? c->due : now;
+		bench_next_due(c, now);
+		t->issued++;
+	}
+
+	c->busy = 1;
+	c->established = 0;
+	c->head = c->tail = 0;
+
+	if (!lws_client_connect_via_info(&i)) {
+		t->errors++;
+		c->busy = 0;
+		c->wsi = NULL;
+	}
+}
+
+static void
+bench_conn_gone(struct bench_conn *c, struct lws *wsi, int error)
+{
+	/* ignore the close of a wsi we already finished with */
+	if (!c || !c->busy || (c->wsi && c->wsi != wsi))
+		return;
+
+	if (error && !force_exit)
+		c->bt->errors++;
+
+	c->busy = 0;
+	c->established = 0;
+	c->wsi = NULL;
+
+	/* nothing will start another, and the event pipe may be gone */
+	if (force_exit || c->bt->finished)
+		return;
+
+	/*
+	 * The next request is started from the bench loop.  If we finished in
+	 * forced service, eg, on tls rx that was already buffered,
+	 * lws_service() would still sit in poll() for its timeout before
+	 * returning to it.
+	 */
+	lws_cancel_service_pt(wsi);
+}
+
+static int
+callback_bench_http(struct lws *wsi, enum lws_callback_reasons reason,
+		    void *user, void *in, size_t len)
+{
+	struct bench_conn *c = (struct bench_conn *)user;
+	char buf[LWS_PRE + 4096], *px = buf + LWS_PRE;
+	int lenx = sizeof(buf) - LWS_PRE, n, m;
+
+	switch (reason) {
+	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+		lwsl_info("%s: connection error: %s\n", __func__,
+			  in ? (char *)in : "(null)");
+		bench_conn_gone(c, wsi, 1);
+		break;
+
+	case LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER:
+		/* on h2, this is the stream wsi rather than the one we got */
+		if (c)
+			c->wsi = wsi;
+		if (c && c->tx_left) {
+			unsigned char **p = (unsigned char **)in,
+				      *end = (*p) + len;
+			char cl[24];
+
+			n = lws_snprintf(cl, sizeof(cl), "%llu",
+					 (unsigned long long)c->tx_left);
+			if (lws_add_http_header_by_token(wsi,
+					WSI_TOKEN_HTTP_CONTENT_LENGTH,
+					(unsigned char *)cl, n, p, end))
+				return -1;
+
+			lws_client_http_body_pending(wsi, 1);
+			lws_callback_on_writable(wsi);
+		}
+		break;
+
+	case LWS_CALLBACK_CLIENT_HTTP_WRITEABLE:
+		if (!c || !c->tx_left)
+			break;
+		n = c->tx_left > 4096 ? 4096 : (int)c->tx_left;
+		/* on h2, only send what the server gave us tx credit for */
+		m = lws_get_peer_write_allowance(wsi);
+		if (!m)
+			break;
+		if (m > 0 && n > m)
+			n = m;
+		if (lws_write(wsi, c->bt->txbuf + LWS_PRE, n,
+			      LWS_WRITE_HTTP) != n)
+			return -1;
+		c->tx_left -= n;
+		c->bt->tx += n;
+		if (c->tx_left)
+			lws_callback_on_writable(wsi);
+		else
+			lws_client_http_body_pending(wsi, 0);
+		break;
+
+	case LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP:
+		if (c)
+			c->status = lws_http_client_http_response(wsi);
+		break;
+
+	case LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ:
+		if (c)
+			c->bt->rx += len;
+		return 0;
+
+	case LWS_CALLBACK_RECEIVE_CLIENT_HTTP:
+		if (lws_http_client_read(wsi, &px, &lenx) < 0)
+			return -1;
+		return 0;
+
+	case LWS_CALLBACK_COMPLETED_CLIENT_HTTP:
+		if (!c)
+			break;
+		if (c->status != 200)
+			c->bt->errors++;
+		else {
+			bench_hist_add(&c->bt->hist, bench_us() - c->started);
+			c->bt->completed++;
+		}
+		/* he's done, whatever happens to the connection now */
+		bench_conn_gone(c, wsi, 0);
+		break;
+
+	case LWS_CALLBACK_CLOSED_CLIENT_HTTP:
+		bench_conn_gone(c, wsi, 1);
+		break;
+
+	default:
+		break;
+	}
+
+	return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
+
+static int
+callback_bench_ws(struct lws *wsi, enum lws_callback_reasons reason,
+		  void *user, void *in, size_t len)
+{
+	struct bench_conn *c = (struct bench_conn *)user;
+	int64_t now;
+
+	switch (reason) {
+	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+		lwsl_info("%s: connection error: %s\n", __func__,
+			  in ? (char *)in : "(null)");
+		bench_conn_gone(c, wsi, 1);
+		break;
+
+	case LWS_CALLBACK_CLIENT_ESTABLISHED:
+		if (mode == BENCH_WS_CONNECT) {
+			bench_hist_add(&c->bt->hist, bench_us() - c->started);
+			c->bt->completed++;
+			/* we're done with it, let the conn go again */
+			bench_conn_gone(c, wsi, 0);
+			return -1;
+		}
+		c->established = 1;
+		c->due = bench_us();
+		lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_CLIENT_WRITEABLE:
+		now = bench_us();
+		if (force_exit || now >= c->bt->end ||
+		    (c->bt->limit && c->bt->issued >= c->bt->limit))
+			break;
+		if (c->due > now ||
+		    (c->tail + 1) % BENCH_MAX_INFLIGHT == c->head)
+			break;
+		if (!rate && c->head != c->tail)
+			break;
+
+		c->sent[c->tail] = rate ? c->due : now;
+		c->tail = (c->tail + 1) % BENCH_MAX_INFLIGHT;
+		if (lws_write(wsi, c->bt->txbuf + LWS_PRE, size,
+			      LWS_WRITE_TEXT) < (int)size)
+			return -1;
+		c->bt->tx += size;
+		c->bt->issued++;
+		bench_next_due(c, now);
+		break;
+
+	case LWS_CALLBACK_CLIENT_RECEIVE:
+		c->bt->rx += len;
+		if (!lws_is_final_fragment(wsi) ||
+		    lws_remaining_packet_payload(wsi))
+			break;
+		if (c->head == c->tail) {
+			c->bt->errors++;
+			break;
+		}
+		now = bench_us();
+		bench_hist_add(&c->bt->hist, now - c->sent[c->head]);
+		c->head = (c->head + 1) % BENCH_MAX_INFLIGHT;
+		c->bt->completed++;
+		if (!rate)
+			lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_CLIENT_CLOSED:
+		bench_conn_gone(c, wsi, 1);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static const struct lws_protocols protocols[] = {
+	{ "http", callback_bench_http, 0, 0, },
+	{ "lws-bench", callback_bench_ws, 0, 0, },
+	{ NULL, NULL, 0, 0 }
+};
+
+static const struct lws_extension exts[] = {
+	{
+		"permessage-deflate",
+		lws_extension_callback_pm_deflate,
+		"permessage-deflate; client_max_window_bits"
+	},
+	{ NULL, NULL, NULL }
+};
+
+static int
+bench_idle(struct bench_thread *t)
+{
+	int n;
+
+	for (n = 0; n < t->count_conn; n++)
+		if (t->conn[n].busy && (mode != BENCH_WS ||
+		    t->conn[n].head != t->conn[n].tail))
+			return 0;
+
+	return 1;
+}
+
+static void *
+bench_thread_service(void *d)
+{
+	struct bench_thread *t = (struct bench_thread *)d;
+	struct bench_conn *c;
+	int64_t now;
+	int n;
+
+	t->start = now = bench_us();
+	t->end = t->start + (int64_t)duration * 1000000;
+
+	for (n = 0; n < t->count_conn; n++)
+		t->conn[n].due = now;
+
+	while (!force_exit) {
+		now = bench_us();
+
+		if (now >= t->end || (t->limit && t->issued >= t->limit)) {
+			/* let what's in flight finish, for a while */
+			if (bench_idle(t) || now >= t->end + BENCH_GRACE_US)
+				break;
+		} else
+			for (n = 0; n < t->count_conn; n++) {
+				c = &t->conn[n];
+
+				if (!c->busy) {
+					if (c->due <= now)
+						bench_connect(c, now);
+					continue;
+				}
+
+				if (mode == BENCH_WS && rate &&
+				    c->established && c->due <= now)
+					lws_callback_on_writable(c->wsi);
+			}
+
+		lws_service(t->context, rate ? 1 : 50);
+	}
+
+	t->end = bench_us();
+	t->finished = 1;
+
+	return NULL;
+}
+
+static void
+sighandler(int sig)
+{
+	force_exit = 1;
+}
+
+static struct option options[] = {
+	{ "help",	no_argument,		NULL, 'h' },
+	{ "debug",	required_argument,	NULL, 'd' },
+	{ "mode",	required_argument,	NULL, 'm' },
+	{ "port",	required_argument,	NULL, 'p' },
+	{ "path",	required_argument,	NULL, 'P' },
+	{ "ssl",	no_argument,		NULL, 's' },
+	{ "pmd",	no_argument,		NULL, 'z' },
+	{ "connections", required_argument,	NULL, 'c' },
+	{ "threads",	required_argument,	NULL, 't' },
+	{ "rate",	required_argument,	NULL, 'r' },
+	{ "size",	required_argument,	NULL, 'b' },
+	{ "duration",	required_argument,	NULL, 'D' },
+	{ "requests",	required_argument,	NULL, 'n' },
+	{ NULL, 0, 0, 0 }
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: lws-bench [-m h1|h2|ws|ws-connect] [-s] [-z] "
+		"[-c <connections>] [-t <threads>]\n"
+		"                 [-r <rate/s per conn>] [-b <req body or "
+		"msg size>] [-D <secs>] [-n <requests>]\n"
+		"                 [-p <port>] [-P <path>] [-d <log bitfield>] "
+		"[<server address>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+	struct bench_hist *h;
+	int n = 0, m, debug_level = LLL_ERR | LLL_WARN;
+	uint64_t completed = 0, errors = 0, rx = 0, tx = 0;
+	char default_path[32];
+	double secs = 0;
+
+	while (n >= 0) {
+		n = getopt_long(argc, argv, "hd:m:p:P:szc:t:r:b:D:n:",
+				options, NULL);
+		if (n < 0)
+			continue;
+		switch (n) {
+		case 'd':
+			debug_level = atoi(optarg);
+			break;
+		case 'm':
+			for (m = 0; m < (int)LWS_ARRAY_SIZE(mode_names); m++)
+				if (!strcmp(optarg, mode_names[m]))
+					break;
+			if (m == (int)LWS_ARRAY_SIZE(mode_names)) {
+				usage();
+				return 1;
+			}
+			mode = (enum bench_mode)m;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'P':
+			path = optarg;
+			break;
+		case 's':
+			use_ssl = 1;
+			break;
+		case 'z':
+			use_pmd = 1;
+			break;
+		case 'c':
+			count_conn = atoi(optarg);
+			break;
+		case 't':
+			count_threads = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'b':
+			size = (size_t)atol(optarg);
+			break;
+		case 'D':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			count_requests = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+		address = argv[optind];
+
+	if (mode == BENCH_H2)
+		/* h2 is only negotiated by ALPN on tls */
+		use_ssl = 1;
+	if (mode == BENCH_WS && !size)
+		size = 128;
+	if (mode == BENCH_WS_CONNECT)
+		size = 0;
+	if (count_threads < 1 || count_threads > BENCH_MAX_THREADS ||
+	    count_conn < count_threads || rate < 0 || rate > 1000000 ||
+	    duration < 1) {
+		usage();
+		return 1;
+	}
+
+	if (!path) {
+		if (mode == BENCH_WS || mode == BENCH_WS_CONNECT)
+			path = "/";
+		else {
+			lws_snprintf(default_path, sizeof(default_path),
+				     "/bytes/%u", 1024);
+			path = default_path;
+		}
+	}
+
+	lws_set_log_level(debug_level, NULL);
+	signal(SIGINT, sighandler);
+
+	/*
+	 * Contexts are created here one by one, each thread only services
+	 * its own
+	 */
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.gid = -1;
+	info.uid = -1;
+	info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+	if (use_pmd)
+		info.extensions = exts;
+
+	for (n = 0; n < count_threads; n++) {
+		struct bench_thread *t = &bt[n];
+
+		t->count_conn = count_conn / count_threads +
+				(n < count_conn % count_threads);
+		if (count_requests)
+			t->limit = count_requests / count_threads +
+				   (n < count_requests % count_threads);
+
+		t->conn = calloc(t->count_conn, sizeof(*t->conn));
+		t->txbuf = malloc(LWS_PRE + (size > 4096 ? size : 4096));
+		if (!t->conn || !t->txbuf)
+			return 1;
+		for (m = 0; m < t->count_conn; m++)
+			t->conn[m].bt = t;
+
+		/* something like text, so pmd has some work to do */
+		for (m = 0; m < (int)(size > 4096 ? size : 4096); m++)
+			t->txbuf[LWS_PRE + m] = 'a' + (rand() % 26);
+
+		/* every conn may need its own fd, plus a few for lws */
+		info.fd_limit_per_thread = t->count_conn + 8;
+		/* h2 requests hold an ah until their response headers came */
+		info.max_http_header_pool = t->count_conn + 4;
+		/* h1 requests reuse the conns, but keep count_conn of them */
+		info.client_conns_per_peer = t->count_conn;
+
+		t->context = lws_create_context(&info);
+		if (!t->context) {
+			lwsl_err("lws init failed\n");
+			return 1;
+		}
+	}
+
+	for (n = 0; n < count_threads; n++)
+		if (pthread_create(&bt[n].thread, NULL, bench_thread_service,
+				   &bt[n])) {
+			lwsl_err("Failed to start thread\n");
+			force_exit = 1;
+			count_threads = n;
+			break;
+		}
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return 1;
+
+	for (n = 0; n < count_threads; n++) {
+		pthread_join(bt[n].thread, NULL);
+		bench_hist_merge(h, &bt[n].hist);
+		completed += bt[n].completed;
+		errors += bt[n].errors;
+		rx += bt[n].rx;
+		tx += bt[n].tx;
+		if ((double)(bt[n].end - bt[n].start) / 1000000.0 > secs)
+			secs = (double)(bt[n].end - bt[n].start) / 1000000.0;
+	}
+
+	for (n = 0; n < count_threads; n++) {
+		lws_context_destroy(bt[n].context);
+		free(bt[n].conn);
+		free(bt[n].txbuf);
+	}
+
+	if (secs <= 0)
+		secs = 1;
+
+	printf("{\n"
+	       " \"mode\": \"%s\",\n"
+	       " \"url\": \"%s://%s:%d%s\",\n"
+	       " \"tls\": %d,\n"
+	       " \"pmd\": %d,\n"
+	       " \"threads\": %d,\n"
+	       " \"connections\": %d,\n"
+	       " \"rate_per_conn\": %d,\n"
+	       " \"size\": %llu,\n"
+	       " \"elapsed_s\": %.3f,\n"
+	       " \"completed\": %llu,\n"
+	       " \"errors\": %llu,\n"
+	       " \"rx_bytes\": %llu,\n"
+	       " \"tx_bytes\": %llu,\n"
+	       " \"per_s\": %.1f,\n"
+	       " \"rx_mbit_s\": %.3f,\n"
+	       " \"tx_mbit_s\": %.3f,\n"
+	       " \"latency_us\": {\n"
+	       "  \"min\": %llu,\n"
+	       "  \"mean\": %llu,\n"
+	       "  \"p50\": %llu,\n"
+	       "  \"p90\": %llu,\n"
+	       "  \"p99\": %llu,\n"
+	       "  \"p99.9\": %llu,\n"
+	       "  \"p99.99\": %llu,\n"
+	       "  \"max\": %llu\n"
+	       " }\n"
+	       "}\n",
+	       mode_names[mode],
+	       mode >= BENCH_WS ? (use_ssl ? "wss" : "ws") :
+				  (use_ssl ? "https" : "http"),
+	       address, port, path, use_ssl, use_pmd, count_threads,
+	       count_conn, rate, (unsigned long long)size, secs,
+	       (unsigned long long)completed, (unsigned long long)errors,
+	       (unsigned long long)rx, (unsigned long long)tx,
+	       completed / secs, (rx * 8) / (secs * 1000000.0),
+	       (tx * 8) / (secs * 1000000.0),
+	       (unsigned long long)h->min,
+	       (unsigned long long)(h->count ? h->sum / h->count : 0),
+	       (unsigned long long)bench_hist_percentile(h, 50.0),
+	       (unsigned long long)bench_hist_percentile(h, 90.0),
+	       (unsigned long long)bench_hist_percentile(h, 99.0),
+	       (unsigned long long)bench_hist_percentile(h, 99.9),
+	       (unsigned long long)bench_hist_percentile(h, 99.99),
+	       (unsigned long long)h->max);
+
+	free(h);
+
+	return errors && !completed;
+}
@@ -21,6 +21,8 @@
 
 #include <libwebsockets.h>
 #include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
 
 
 static const char * const reason_names[] = {
@@ -48,6 +50,191 @@ static const char * const tok[] = {
 	"dummy___"
 };
 
+/*
+ * For -b, paths in the style of the lwsws config, so the benchmark also
+ * exercises path matching with wildcards at some depth
+ */
+
+static const char * const bench_tok[] = {
+	"global.uid",
+	"global.gid",
+	"global.count-threads",
+	"global.server-string",
+	"global.plugin-dir",
+	"vhosts[].name",
+	"vhosts[].port",
+	"vhosts[].interface",
+	"vhosts[].host-ssl-key",
+	"vhosts[].host-ssl-cert",
+	"vhosts[].mounts[].mountpoint",
+	"vhosts[].mounts[].origin",
+	"vhosts[].mounts[].default",
+	"vhosts[].mounts[].cache-max-age",
+	"vhosts[].mounts[].extra-mimetypes.*",
+	"vhosts[].mounts[].interpret.*",
+	"vhosts[].ws-protocols[].*.*",
+	"vhosts[].ws-protocols[].*",
+	"vhosts[].headers[].*",
+	"vhosts[].keepalive_timeout",
+};
+
+static uint64_t bench_matches;
+
+static signed char
+cb_bench(struct lejp_ctx *ctx, char reason)
+{
+	if (reason & LEJP_FLAG_CB_IS_VALUE && ctx->path_match)
+		bench_matches++;
+
+	return 0;
+}
+
+static int
+bench(int loops)
+{
+	size_t len = 0, alloc = 0;
+	struct lejp_ctx ctx;
+	struct timeval t0, t1;
+	unsigned char *js = NULL, *p;
+	uint64_t us;
+	int n, m;
+
+	/* collect the whole JSON from stdin first */
+
+	do {
+		if (len == alloc) {
+			alloc = alloc ? alloc * 2 : 65536;
+			p = realloc(js, alloc);
+			if (!p) {
+				free(js);
+				return 1;
+			}
+			js = p;
+		}
+		n = read(0, js + len, alloc - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0);
+
+	gettimeofday(&t0, NULL);
+
+	for (n = 0; n < loops; n++) {
+		lejp_construct(&ctx, cb_bench, NULL, bench_tok,
+			       ARRAY_SIZE(bench_tok));
+		m = lejp_parse(&ctx, js, (int)len);
+		lejp_destruct(&ctx);
+		if (m < 0 && m != LEJP_CONTINUE) {
+			lwsl_err("parse failed %d\n", m);
+			free(js);
+			return 1;
+		}
+	}
+
+	gettimeofday(&t1, NULL);
+	us = ((uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000) +
+	     t1.tv_usec - t0.tv_usec;
+	if (!us)
+		us = 1;
+
+	lwsl_notice("%d x %lu bytes in %lluus: %lluMB/s, %llu matched values\n",
+		    loops, (unsigned long)len, (unsigned long long)us,
+		    (unsigned long long)(((uint64_t)len * loops) / us),
+		    (unsigned long long)bench_matches);
+
+	free(js);
+
+	return 0;
+}
+
+/*
+ * For -t, empty arrays closing back to the top level object and at some
+ * depth.  Each is fed in pieces ending at every ']', so the next
+ * lejp_parse() call sees the state the array close left behind.
+ * A NULL array_end_paths means the JSON must be rejected.
+ */
+
+static const struct {
+	const char *json;
+	const char *array_end_paths; /* path at each LEJPCB_ARRAY_END */
+} empty_arrays[] = {
+	{ "{\"deep\": []}",			"deep[]|" },
+	{ "{\"deep\": [1]}",			"deep[]|" },
+	{ "{\"a\": [[], []], \"b\": {\"c\": []}}",
+						"a[]|a[]|a[]|b|" },
+	{ "{\"a\": ]}",				NULL },
+};
+
+static char selftest_paths[256];
+static int selftest_starts, selftest_failed;
+
+static signed char
+cb_selftest(struct lejp_ctx *ctx, char reason)
+{
+	size_t n = strlen(selftest_paths);
+
+	switch (reason) {
+	case LEJPCB_START:
+		selftest_starts++;
+		break;
+	case LEJPCB_FAILED:
+		selftest_failed = 1;
+		break;
+	case LEJPCB_ARRAY_END:
+		lws_snprintf(selftest_paths + n, sizeof(selftest_paths) - n,
+			     "%s|", ctx->path);
+		break;
+	}
+
+	return 0;
+}
+
+static int
+selftest(void)
+{
+	const char *p, *e;
+	struct lejp_ctx ctx;
+	int n, m, fails = 0;
+
+	for (n = 0; n < (int)ARRAY_SIZE(empty_arrays); n++) {
+		selftest_paths[0] = '\0';
+		selftest_starts = 0;
+		selftest_failed = 0;
+
+		lejp_construct(&ctx, cb_selftest, NULL, tok, ARRAY_SIZE(tok));
+		m = LEJP_CONTINUE;
+		p = empty_arrays[n].json;
+		while (*p && m == LEJP_CONTINUE && !selftest_failed) {
+			e = strchr(p, ']');
+			e = e ? e + 1 : p + strlen(p);
+			m = lejp_parse(&ctx, (const unsigned char *)p,
+				       (int)(e - p));
+			p = e;
+		}
+		lejp_destruct(&ctx);
+
+		if (!empty_arrays[n].array_end_paths) {
+			if (selftest_failed)
+				continue;
+		} else
+			if (!selftest_failed && selftest_starts == 1 &&
+			    !strcmp(selftest_paths,
+				    empty_arrays[n].array_end_paths))
+				continue;
+
+		lwsl_err("FAIL: '%s': %s, %d starts, paths '%s'\n",
+			 empty_arrays[n].json,
+			 selftest_failed ? "rejected" : "accepted",
+			 selftest_starts, selftest_paths);
+		fails++;
+	}
+
+	lwsl_notice("%d / %d selftests passed\n",
+		    (int)ARRAY_SIZE(empty_arrays) - fails,
+		    (int)ARRAY_SIZE(empty_arrays));
+
+	return !!fails;
+}
+
 static signed char
 cb(struct lejp_ctx *ctx, char reason)
 {
@@ -90,7 +277,15 @@ main(int argc, char *argv[])
 	lws_set_log_level(7, NULL);
 
 	lwsl_notice("libwebsockets-test-lejp  (C) 2017 - 2018 andy@warmcat.com\n");
-	lwsl_notice("  usage: cat my.json | libwebsockets-test-lejp\n\n");
+	lwsl_notice("  usage: cat my.json | libwebsockets-test-lejp\n");
+	lwsl_notice("         cat my.json | libwebsockets-test-lejp -b <loops>"
+		    "  (benchmark)\n");
+	lwsl_notice("         libwebsockets-test-lejp -t  (selftest)\n\n");
+
+	if (argc > 2 && !strcmp(argv[1], "-b"))
+		return bench(atoi(argv[2]));
+	if (argc > 1 && !strcmp(argv[1], "-t"))
+		return selftest();
 
 	lejp_construct(&ctx, cb, NULL, tok, ARRAY_SIZE(tok));
 
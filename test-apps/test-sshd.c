@@ -26,10 +26,14 @@
  * Connect to it using the test private key with:
  *
  * $ ssh -p 2200 -i /usr/local/share/libwebsockets-test-server/lws-ssh-test-keys anyuser@127.0.0.1
+ *
+ * "libwebsockets-test-sshd -t" instead just runs known-answer tests on the
+ * ssh crypto, and "-b <loops>" benchmarks it.
  */
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
@@ -636,13 +640,227 @@ static const struct lws_protocol_vhost_options pvo_ssh = {
 	"" /* ignored, just matches the protocol name above */
 };
 
+/*
+ * -t runs known-answer tests on the plugin's crypto, and -b <loops> times it,
+ * using whichever of the optimized or reference implementations this build
+ * picked
+ */
+
+struct kat_vec {
+	const char *name;
+	const char *a, *b, *result;
+};
+
+/* RFC7748 5.2 and 6.1 */
+static const struct kat_vec kat_x25519[] = {
+	{ "x25519 5.2",
+	  "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+	  "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+	  "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552" },
+	{ "x25519 6.1 pub",
+	  "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+	  "0900000000000000000000000000000000000000000000000000000000000000",
+	  "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a" },
+	{ "x25519 6.1 K",
+	  "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+	  "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f",
+	  "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742" },
+};
+
+/* lowercase hex only */
+
+static int
+kat_unhex(const char *h, uint8_t *o)
+{
+	int n = 0;
+
+	while (h[0] && h[1]) {
+		o[n++] = (uint8_t)((((h[0] & 0xf) + (h[0] >> 6) * 9) << 4) |
+				   ((h[1] & 0xf) + (h[1] >> 6) * 9));
+		h += 2;
+	}
+
+	return n;
+}
+
+static int
+kat_result(const char *name, int fail)
+{
+	if (fail)
+		lwsl_err("  %-20s FAILED\n", name);
+	else
+		lwsl_notice("  %-20s ok\n", name);
+
+	return !!fail;
+}
+
+static int
+kat_check(const char *name, const uint8_t *got, const char *hex)
+{
+	uint8_t exp[64];
+	int n = kat_unhex(hex, exp);
+
+	return kat_result(name, memcmp(got, exp, n));
+}
+
+static int
+crypto_kat(void)
+{
+	static uint8_t big[1500], o1[1500], o2[1500];
+	const char *poly_msg = "Cryptographic Forum Research Group";
+	uint8_t a[64], b[64], o[128], m[128], ctr[8];
+	unsigned long long sml, ml;
+	chacha_ctx c1, c2;
+	int n, fails = 0, bad = 0;
+
+	for (n = 0; n < (int)ARRAY_SIZE(kat_x25519); n++) {
+		kat_unhex(kat_x25519[n].a, a);
+		kat_unhex(kat_x25519[n].b, b);
+		crypto_scalarmult_curve25519(o, a, b);
+		fails += kat_check(kat_x25519[n].name, o, kat_x25519[n].result);
+	}
+
+	/* RFC8032 7.1 TEST 2... sk is the seed followed by the public key */
+	kat_unhex("4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb"
+		  "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+		  a);
+	b[0] = 0x72;
+	crypto_sign_ed25519(o, &sml, b, 1, a);
+	fails += kat_check("ed25519 sign", o,
+		"92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+		"085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00");
+	n = crypto_sign_ed25519_open(m, &ml, o, sml, a + 32);
+	o[5] ^= 1;
+	fails += kat_result("ed25519 verify",
+			    n || !crypto_sign_ed25519_open(m, &ml, o, sml,
+							   a + 32));
+
+	/* RFC8439 2.5.2 */
+	kat_unhex("85d6be7857556d337f4452fe42d506a8"
+		  "0103808afb0db2fd4abff6af4149f51b", a);
+	poly1305_auth(o, (const uint8_t *)poly_msg, strlen(poly_msg), a);
+	fails += kat_check("poly1305", o, "a8061dc1305136c6c22b8baf0c0127a9");
+
+	/* all-zero key and 64-bit nonce, as used by ssh */
+	memset(a, 0, 32);
+	memset(m, 0, sizeof(m));
+	chacha_keysetup(&c1, a, 256);
+	chacha_ivsetup(&c1, a, NULL);
+	chacha_encrypt_bytes(&c1, m, o, 64);
+	fails += kat_check("chacha20", o,
+		"76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+		"da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586");
+
+	/*
+	 * The multi-block path must agree with the reference one at every
+	 * length, including when the block counter carries into its high
+	 * word part way through a group
+	 */
+	for (n = 0; n < (int)sizeof(big); n++)
+		big[n] = (uint8_t)(n * 7);
+	memset(ctr, 0xff, sizeof(ctr));
+	ctr[0] = 0xfd;
+	ctr[4] = 0;
+	for (n = 0; n <= (int)sizeof(big); n += 13) {
+		chacha_ivsetup(&c1, a, ctr);
+		c2 = c1;
+		chacha_encrypt_bytes(&c1, big, o1, (u32)n);
+		chacha_encrypt_bytes_ref(&c2, big, o2, (u32)n);
+		if (memcmp(o1, o2, n) || memcmp(&c1, &c2, sizeof(c1)))
+			bad = 1;
+	}
+	fails += kat_result("chacha20 multiblock", bad);
+
+	lwsl_notice("%d failed\n", fails);
+
+	return !!fails;
+}
+
+static uint64_t
+bench_us(struct timeval *t0)
+{
+	struct timeval t1;
+	uint64_t us;
+
+	gettimeofday(&t1, NULL);
+	us = ((uint64_t)(t1.tv_sec - t0->tv_sec) * 1000000) +
+	     t1.tv_usec - t0->tv_usec;
+
+	return us ? us : 1;
+}
+
+static int
+crypto_bench(int loops)
+{
+	static uint8_t buf[32768];
+	uint8_t k[64], o[128];
+	unsigned long long sml, ml;
+	struct timeval t0;
+	chacha_ctx cc;
+	uint64_t us;
+	int n;
+
+	memset(k, 0x5a, sizeof(k));
+	chacha_keysetup(&cc, k, 256);
+	chacha_ivsetup(&cc, k, NULL);
+
+	gettimeofday(&t0, NULL);
+	for (n = 0; n < loops; n++)
+		chacha_encrypt_bytes(&cc, buf, buf, sizeof(buf));
+	us = bench_us(&t0);
+	lwsl_notice("chacha20:       %lluMB/s\n", (unsigned long long)
+		    (((uint64_t)sizeof(buf) * loops) / us));
+
+	gettimeofday(&t0, NULL);
+	for (n = 0; n < loops; n++)
+		chacha_encrypt_bytes_ref(&cc, buf, buf, sizeof(buf));
+	us = bench_us(&t0);
+	lwsl_notice("chacha20 (ref): %lluMB/s\n", (unsigned long long)
+		    (((uint64_t)sizeof(buf) * loops) / us));
+
+	gettimeofday(&t0, NULL);
+	for (n = 0; n < loops; n++)
+		poly1305_auth(o, buf, sizeof(buf), k);
+	us = bench_us(&t0);
+	lwsl_notice("poly1305:       %lluMB/s\n", (unsigned long long)
+		    (((uint64_t)sizeof(buf) * loops) / us));
+
+	gettimeofday(&t0, NULL);
+	for (n = 0; n < loops; n++)
+		crypto_scalarmult_curve25519(o, k, buf);
+	us = bench_us(&t0);
+	lwsl_notice("x25519:         %lluus/op\n",
+		    (unsigned long long)(us / loops));
+
+	/* sign with the RFC8032 key so the signature verifies below */
+	kat_unhex("4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb"
+		  "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+		  k);
+
+	gettimeofday(&t0, NULL);
+	for (n = 0; n < loops; n++)
+		crypto_sign_ed25519(o, &sml, buf, 32, k);
+	us = bench_us(&t0);
+	lwsl_notice("ed25519 sign:   %lluus/op\n",
+		    (unsigned long long)(us / loops));
+
+	gettimeofday(&t0, NULL);
+	for (n = 0; n < loops; n++)
+		crypto_sign_ed25519_open(buf + 64, &ml, o, sml, k + 32);
+	us = bench_us(&t0);
+	lwsl_notice("ed25519 verify: %lluus/op\n",
+		    (unsigned long long)(us / loops));
+
+	return 0;
+}
+
 void sighandler(int sig)
 {
 	force_exit = 1;
 	lws_cancel_service(context);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
 	static struct lws_context_creation_info info;
 	struct lws_vhost *vh_sshd;
@@ -658,6 +876,11 @@ int main()
 
 	lwsl_notice("lws test-sshd -- Copyright (C) 2017 <andy@warmcat.com>\n");
 
+	if (argc > 1 && !strcmp(argv[1], "-t"))
+		return crypto_kat();
+	if (argc > 2 && !strcmp(argv[1], "-b"))
+		return crypto_bench(atoi(argv[2]));
+
 	/* create the lws context */
 
 	info.options = LWS_SERVER_OPTION_EXPLICIT_VHOSTS |